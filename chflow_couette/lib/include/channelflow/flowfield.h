@@ -98,6 +98,17 @@ public:
 
   FlowField operator[](int i) const; // extract ith component, inefficient
 
+  // Unchecked access to the data array, for kernels that sweep whole fields.
+  // In both xz states the array holds Reals in order d, Ny, Nx, Nzpad, where
+  // Nzpad = 2*Mz: Physical rows have Nz valid values, Spectral rows hold Mz
+  // interleaved (re,im) pairs. The array is allocated by fftw_malloc.
+  inline Real*       rawData();
+  inline const Real* rawData() const;
+  inline Real&       rawData(int n);
+  inline const Real& rawData(int n) const;
+  inline int rawDataLength() const; // Nd*Ny*Nx*Nzpad
+  inline int Nzpad() const;         // row stride of rawData, 2*Mz
+
 
   //Real eval(Real x, Real y, Real z, int i) const;
   //Complex eval(int nx, Real y, int nz, int i) const;
@@ -369,9 +380,12 @@ inline const Complex& FlowField::cmplx(int mx, int my, int mz, int i, int j) con
   return cdata_[complex_flatten(mx,my,mz,i,j)];
 }
 
-//inline Real& FlowField::rawData(int n) {return rdata_[n];}
-//inline const Real& FlowField::rawData(int n) const{return rdata_[n];}
-//inline int FlowField::rawDataLength() const {return Nx_*Ny_*Nz_*Nd_;}
+inline Real* FlowField::rawData() {return rdata_;}
+inline const Real* FlowField::rawData() const {return rdata_;}
+inline Real& FlowField::rawData(int n) {return rdata_[n];}
+inline const Real& FlowField::rawData(int n) const{return rdata_[n];}
+inline int FlowField::rawDataLength() const {return Nd_*Ny_*Nx_*Nzpad_;}
+inline int FlowField::Nzpad() const {return Nzpad_;}
 
 inline Real FlowField::Lx() const {return Lx_;}
 inline Real FlowField::Ly() const {return b_ - a_;}
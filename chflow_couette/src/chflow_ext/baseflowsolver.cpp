@@ -0,0 +1,414 @@
+// baseflowsolver.cpp: per-mode Stokes solver with implicit base-flow advection
+
+#include "baseflowsolver.h"
+
+using namespace std;
+
+namespace channelflow {
+
+// Coefficient-space derivative on [a,b]: D[k][p] = 2/(b-a) 2p/c_k, p > k, p+k odd
+static void diffMatrix(int N, Real a, Real b, Real* D) {
+  const Real s = 2.0/(b-a);
+  for (int k=0; k<N; ++k)
+    for (int p=0; p<N; ++p)
+      D[k*N+p] = (p > k && (p+k) % 2 == 1) ? s*(k == 0 ? 1.0 : 2.0)*p : 0.0;
+}
+
+// M[n][k] so that (M f)_n = (U f)_n, from T_m T_k = (T_{m+k} + T_{|m-k|})/2
+static void productMatrix(const ChebyCoeff& U, int N, Real* M) {
+  for (int n=0; n<N*N; ++n)
+    M[n] = 0.0;
+  for (int m=0; m<U.N(); ++m)
+    for (int k=0; k<N; ++k) {
+      const Real c = 0.5*U[m];
+      if (m+k < N)
+	M[(m+k)*N + k] += c;
+      M[abs(m-k)*N + k] += c;
+    }
+}
+
+static void matmul(const Real* A, const Real* B, Real* C, int N) {
+  for (int i=0; i<N; ++i)
+    for (int j=0; j<N; ++j) {
+      Real sum = 0.0;
+      for (int k=0; k<N; ++k)
+	sum += A[i*N+k]*B[k*N+j];
+      C[i*N+j] = sum;
+    }
+}
+
+// LU factorization with partial pivoting, in place
+static void luFactor(Complex* A, int* pivot, int N) {
+  for (int k=0; k<N; ++k) {
+    int p = k;
+    for (int i=k+1; i<N; ++i)
+      if (abs2(A[i*N+k]) > abs2(A[p*N+k]))
+	p = i;
+    if (A[p*N+k] == Complex(0.0, 0.0))
+      cferror("BaseflowTauSolver: singular tau matrix");
+    pivot[k] = p;
+    if (p != k)
+      for (int j=0; j<N; ++j)
+	swap(A[k*N+j], A[p*N+j]);
+    const Complex r = 1.0/A[k*N+k];
+    for (int i=k+1; i<N; ++i) {
+      const Complex l = (A[i*N+k] *= r);
+      for (int j=k+1; j<N; ++j)
+	A[i*N+j] -= l*A[k*N+j];
+    }
+  }
+}
+
+static void luSolve(const Complex* LU, const int* pivot, Complex* x, int N) {
+  for (int k=0; k<N; ++k)
+    if (pivot[k] != k)
+      swap(x[k], x[pivot[k]]);
+  for (int i=1; i<N; ++i) {
+    Complex sum = x[i];
+    for (int j=0; j<i; ++j)
+      sum -= LU[i*N+j]*x[j];
+    x[i] = sum;
+  }
+  for (int i=N-1; i>=0; --i) {
+    Complex sum = x[i];
+    for (int j=i+1; j<N; ++j)
+      sum -= LU[i*N+j]*x[j];
+    x[i] = sum/LU[i*N+i];
+  }
+}
+
+// df = d/dy f by the backward recurrence, s = 2/(b-a)
+static void diff(const Complex* f, Complex* df, int N, Real s) {
+  if (N < 2) {
+    if (N == 1)
+      df[0] = 0.0;
+    return;
+  }
+  df[N-1] = 0.0;
+  df[N-2] = (2.0*(N-1))*f[N-1];
+  for (int k=N-3; k>=0; --k)
+    df[k] = df[k+2] + (2.0*(k+1))*f[k+1];
+  df[0] *= 0.5;
+  for (int k=0; k<N; ++k)
+    df[k] *= s;
+}
+
+// g = U f truncated to N; U is stored with its trailing zeros trimmed
+static void multiply(const ChebyCoeff& U, const Complex* f, Complex* g, int N) {
+  for (int n=0; n<N; ++n)
+    g[n] = 0.0;
+  for (int m=0; m<U.N(); ++m) {
+    const Real c = 0.5*U[m];
+    if (c == 0.0)
+      continue;
+    for (int k=0; k<N; ++k) {
+      const Complex cf = c*f[k];
+      if (m+k < N)
+	g[m+k] += cf;
+      g[abs(m-k)] += cf;
+    }
+  }
+}
+
+// Chebyshev coefficients of U up to its highest nonzero one
+static ChebyCoeff trimmed(const ChebyCoeff& U) {
+  int n = U.N();
+  while (n > 1 && U[n-1] == 0.0)
+    --n;
+  ChebyCoeff T(n, U.a(), U.b(), Spectral);
+  for (int i=0; i<n; ++i)
+    T[i] = U[i];
+  return T;
+}
+
+void multiply(const ChebyCoeff& U, const ComplexChebyCoeff& f, ComplexChebyCoeff& g) {
+  assert(U.state() == Spectral && f.state() == Spectral);
+  assert(&f != &g);
+  const int N = f.N();
+  if (g.N() != N)
+    g.resize(N);
+  g.setBounds(f.a(), f.b());
+  g.setState(Spectral);
+  g.setToZero();
+  for (int m=0; m<U.N(); ++m) {
+    const Real c = 0.5*U[m];
+    if (c == 0.0)
+      continue;
+    for (int k=0; k<N; ++k) {
+      const Real re = c*f.re[k];
+      const Real im = c*f.im[k];
+      if (m+k < N) {
+	g.re[m+k] += re;
+	g.im[m+k] += im;
+      }
+      g.re[abs(m-k)] += re;
+      g.im[abs(m-k)] += im;
+    }
+  }
+}
+
+/**************************************************************************
+ * BaseflowOperators
+ **************************************************************************/
+
+BaseflowOperators::BaseflowOperators()
+  :
+  N_(0)
+{}
+
+BaseflowOperators::BaseflowOperators(const ChebyCoeff& Ubase, int Ny)
+  :
+  N_(Ny),
+  U_(Ny, Ubase.a(), Ubase.b(), Spectral),
+  D2_(Ny*Ny),
+  D4_(Ny*Ny),
+  MU_(Ny*Ny),
+  DMUD_(Ny*Ny),
+  DMUy_(Ny*Ny)
+{
+  ChebyCoeff U(Ubase);
+  U.makeSpectral();
+  for (int n=0; n<Ny && n<U.N(); ++n)
+    U_[n] = U[n];
+  Uy_ = diff(U_);
+
+  const int N = Ny;
+  array<Real> D(N*N);
+  array<Real> T(N*N);
+  diffMatrix(N, a(), b(), D.pointer());
+  matmul(D.pointer(), D.pointer(), D2_.pointer(), N);
+  matmul(D2_.pointer(), D2_.pointer(), D4_.pointer(), N);
+  productMatrix(U_, N, MU_.pointer());
+  matmul(D.pointer(), MU_.pointer(), T.pointer(), N);
+  matmul(T.pointer(), D.pointer(), DMUD_.pointer(), N);
+  productMatrix(Uy_, N, T.pointer());
+  matmul(D.pointer(), T.pointer(), DMUy_.pointer(), N);
+}
+
+int BaseflowOperators::N() const {return N_;}
+Real BaseflowOperators::a() const {return U_.a();}
+Real BaseflowOperators::b() const {return U_.b();}
+const ChebyCoeff& BaseflowOperators::U() const {return U_;}
+const ChebyCoeff& BaseflowOperators::Uy() const {return Uy_;}
+const Real* BaseflowOperators::D2() const {return D2_.pointer();}
+const Real* BaseflowOperators::D4() const {return D4_.pointer();}
+const Real* BaseflowOperators::MU() const {return MU_.pointer();}
+const Real* BaseflowOperators::DMUD() const {return DMUD_.pointer();}
+const Real* BaseflowOperators::DMUy() const {return DMUy_.pointer();}
+
+/**************************************************************************
+ * BaseflowTauSolver
+ **************************************************************************/
+
+BaseflowTauSolver::BaseflowTauSolver()
+  :
+  kx_(0),
+  kz_(0),
+  N_(0),
+  a_(0),
+  b_(0),
+  alpha_(0),
+  gamma_(0),
+  kappa2_(0),
+  lambda_(0),
+  nu_(0),
+  cx_(0),
+  cz_(0),
+  lambdac_(0)
+{}
+
+// With L = lambdac - nu D2 + i alpha MU and r = i alpha Rx + i gamma Rz,
+// i alpha (x eqn) + i gamma (z eqn) and div u = 0 give the pressure
+//   P = (-L D v + i alpha MUy v - r)/kappa2,
+// and substituting it in the y equation the Orr-Sommerfeld equation
+//   [kappa2 L - D L D + i alpha D MUy] v = kappa2 Ry + D r,  v = v' = 0 at a, b.
+// i gamma (x eqn) - i alpha (z eqn) gives the Squire equation
+//   L eta = i gamma Rx - i alpha Rz - i gamma MUy v,  eta = 0 at a, b.
+// Both are solved in the boundary-adapted bases, tested against the basis
+// functions: the N-4 (N-2) Galerkin equations on the basis coefficients.
+BaseflowTauSolver::BaseflowTauSolver(int kx, int kz, Real Lx, Real Lz,
+				     Real lambda, Real nu,
+				     const BaseflowOperators& ops, Real cx, Real cz)
+  :
+  kx_(kx),
+  kz_(kz),
+  N_(ops.N()),
+  a_(ops.a()),
+  b_(ops.b()),
+  alpha_(2*pi*kx/Lx),
+  gamma_(2*pi*kz/Lz),
+  kappa2_(alpha_*alpha_ + gamma_*gamma_),
+  lambda_(lambda),
+  nu_(nu),
+  cx_(cx),
+  cz_(cz),
+  lambdac_(lambda - I*(alpha_*cx + gamma_*cz)),
+  U_(trimmed(ops.U())),
+  Uy_(trimmed(ops.Uy())),
+  os_((ops.N()-4)*(ops.N()-4)),
+  ospivot_(ops.N()-4),
+  sq_((ops.N()-2)*(ops.N()-2)),
+  sqpivot_(ops.N()-2)
+{
+  if (kx == 0 && kz == 0)
+    cferror("BaseflowTauSolver: kx == kz == 0 is TauSolver's case");
+  const int N = N_;
+  if (N < 6)
+    cferror("BaseflowTauSolver: Ny must be at least 6");
+  const int n4 = N-4;
+  const int n2 = N-2;
+
+  const Complex ia = I*alpha_;
+  const Real k2 = kappa2_;
+  const Complex c = lambdac_;
+  const Real* D2 = ops.D2();
+  const Real* D4 = ops.D4();
+  const Real* MU = ops.MU();
+  const Real* DMUD = ops.DMUD();
+  const Real* DMUy = ops.DMUy();
+
+  // Column j of each Galerkin matrix: the operator on basis function j,
+  // tested against all basis functions
+  array<Real> e(N);
+  array<Real> q(N);
+  array<Complex> Aq(N);
+  array<Complex> col(N);
+  for (int sys=0; sys<2; ++sys) {
+    const bool os = (sys == 0);
+    const int n = os ? n4 : n2;
+    Complex* A = os ? os_.pointer() : sq_.pointer();
+    for (int j=0; j<n; ++j) {
+      for (int k=0; k<n; ++k)
+	e[k] = (k == j) ? 1.0 : 0.0;
+      basisToCheby(os, e.pointer(), q.pointer(), n, N);
+      for (int i=0; i<N; ++i) {
+	Complex Lq = c*q[i];
+	Complex DLDq = 0.0;
+	Complex DMUyq = 0.0;
+	for (int k=0; k<N; ++k) {
+	  const int ik = i*N+k;
+	  Lq += (-nu_*D2[ik] + ia*MU[ik])*q[k];
+	  DLDq += (c*D2[ik] - nu_*D4[ik] + ia*DMUD[ik])*q[k];
+	  DMUyq += ia*DMUy[ik]*q[k];
+	}
+	Aq[i] = os ? k2*Lq - DLDq + DMUyq : Lq;
+      }
+      testProject(os, Aq.pointer(), col.pointer(), n);
+      for (int i=0; i<n; ++i)
+	A[i*n+j] = col[i];
+    }
+  }
+  luFactor(os_.pointer(), ospivot_.pointer(), n4);
+  luFactor(sq_.pointer(), sqpivot_.pointer(), n2);
+}
+
+void BaseflowTauSolver::solve(ComplexChebyCoeff& u, ComplexChebyCoeff& v,
+			      ComplexChebyCoeff& w, ComplexChebyCoeff& P,
+			      const ComplexChebyCoeff& Rx,
+			      const ComplexChebyCoeff& Ry,
+			      const ComplexChebyCoeff& Rz) const {
+  assert(Rx.state() == Spectral && Ry.state() == Spectral && Rz.state() == Spectral);
+  assert(Rx.N() == N_ && Ry.N() == N_ && Rz.N() == N_);
+  const int N = N_;
+  const Real s = 2.0/(b_-a_);
+  const Complex ia = I*alpha_;
+  const Complex ig = I*gamma_;
+  const Real k2 = kappa2_;
+  const Complex c = lambdac_;
+
+  // Work arrays of length N
+  array<Complex> work(8*N);
+  Complex* r   = work.pointer();
+  Complex* dr  = r + N;
+  Complex* vc  = dr + N;
+  Complex* dv  = vc + N;
+  Complex* eta = dv + N;
+  Complex* t0  = eta + N;
+  Complex* t1  = t0 + N;
+  Complex* a   = t1 + N;
+
+  // r = i alpha Rx + i gamma Rz
+  for (int n=0; n<N; ++n)
+    r[n] = ia*Rx[n] + ig*Rz[n];
+  diff(r, dr, N, s);
+
+  // Orr-Sommerfeld for v
+  for (int n=0; n<N; ++n)
+    t0[n] = k2*Ry[n] + dr[n];
+  testProject(true, t0, a, N-4);
+  luSolve(os_.pointer(), ospivot_.pointer(), a, N-4);
+  basisToCheby(true, a, vc, N-4, N);
+  diff(vc, dv, N, s);
+
+  // Squire for eta, forced by U' v
+  multiply(Uy_, vc, t0, N);
+  for (int n=0; n<N; ++n)
+    t1[n] = ig*Rx[n] - ia*Rz[n] - ig*t0[n];
+  testProject(false, t1, a, N-2);
+  luSolve(sq_.pointer(), sqpivot_.pointer(), a, N-2);
+  basisToCheby(false, a, eta, N-2, N);
+
+  // P = (-L D v + i alpha U' v - r)/kappa2, with t0 still holding U' v.
+  // dr is free for D^3 v.
+  diff(dv, t1, N, s);
+  diff(t1, dr, N, s);
+  multiply(U_, dv, t1, N);
+  for (int n=0; n<N; ++n)
+    t0[n] = (-(c*dv[n] - nu_*dr[n] + ia*t1[n]) + ia*t0[n] - r[n])/k2;
+
+  if (u.N() != N) u.resize(N);
+  if (v.N() != N) v.resize(N);
+  if (w.N() != N) w.resize(N);
+  if (P.N() != N) P.resize(N);
+  u.setBounds(a_, b_);
+  v.setBounds(a_, b_);
+  w.setBounds(a_, b_);
+  P.setBounds(a_, b_);
+  u.setState(Spectral);
+  v.setState(Spectral);
+  w.setState(Spectral);
+  P.setState(Spectral);
+  for (int n=0; n<N; ++n) {
+    u.set(n, (ia*dv[n] - ig*eta[n])/k2);
+    v.set(n, vc[n]);
+    w.set(n, (ig*dv[n] + ia*eta[n])/k2);
+    P.set(n, t0[n]);
+  }
+}
+
+void BaseflowTauSolver::advection(const ComplexChebyCoeff& u,
+				  const ComplexChebyCoeff& v,
+				  const ComplexChebyCoeff& w,
+				  ComplexChebyCoeff& Bx,
+				  ComplexChebyCoeff& By,
+				  ComplexChebyCoeff& Bz) const {
+  // i alpha U f + s f, s = -i (alpha cx + gamma cz), in place on g = U f
+  const Real a = alpha_;
+  const Real sc = -(alpha_*cx_ + gamma_*cz_);
+  multiply(Uy_, v, By);
+  multiply(U_, u, Bx);
+  for (int n=0; n<N_; ++n) {
+    const Real re = Bx.re[n];
+    Bx.re[n] = -a*Bx.im[n] - sc*u.im[n] + By.re[n];
+    Bx.im[n] =  a*re + sc*u.re[n] + By.im[n];
+  }
+  multiply(U_, v, By);
+  multiply(U_, w, Bz);
+  for (int n=0; n<N_; ++n) {
+    Real re = By.re[n];
+    By.re[n] = -a*By.im[n] - sc*v.im[n];
+    By.im[n] =  a*re + sc*v.re[n];
+    re = Bz.re[n];
+    Bz.re[n] = -a*Bz.im[n] - sc*w.im[n];
+    Bz.im[n] =  a*re + sc*w.re[n];
+  }
+}
+
+int BaseflowTauSolver::kx() const {return kx_;}
+int BaseflowTauSolver::kz() const {return kz_;}
+Real BaseflowTauSolver::lambda() const {return lambda_;}
+Real BaseflowTauSolver::nu() const {return nu_;}
+Real BaseflowTauSolver::cx() const {return cx_;}
+Real BaseflowTauSolver::cz() const {return cz_;}
+
+} //namespace channelflow
@@ -0,0 +1,169 @@
+// baseflowsolver.h: per-mode Stokes solver with implicit base-flow advection
+
+#ifndef CHFLOW_EXT_BASEFLOWSOLVER_H
+#define CHFLOW_EXT_BASEFLOWSOLVER_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "channelflow/chebyshev.h"
+
+namespace channelflow {
+
+// BaseflowTauSolver extends TauSolver by the linearized advection terms of a
+// base profile U(y) ex. For the Fourier mode (kx,kz), alpha = 2 pi kx/Lx,
+// gamma = 2 pi kz/Lz, kappa2 = alpha^2 + gamma^2, it solves
+//
+//   lambda u - nu u'' + i alpha U(y) u + U'(y) v ex + grad P = R
+//   div u = 0,  u(a) = u(b) = 0
+//
+// i.e. TauSolver's problem (lambda includes nu kappa2, as there) with the
+// complex, y-dependent lambda(y) = lambda + i alpha U(y) and the coupling of
+// v into the u equation through U'.
+// With base-flow advection on the left-hand side, a time-stepping scheme
+// need not resolve the advection by U explicitly, which for plane Couette
+// flow sets the CFL limit through the wall velocities.
+//
+// A frame velocity (cx,cz) adds the advection -(cx d/dx + cz d/dz) u of a
+// frame of reference moving with it, i.e. lambda(y) = lambda
+// + i alpha (U(y) - cx) - i gamma cz. U may be zero, for the frame term alone.
+//
+// The system is reduced to Orr-Sommerfeld and Squire equations for v and the
+// wall-normal vorticity eta = i gamma u - i alpha w. These are solved by
+// Galerkin projection onto bases that satisfy the boundary conditions, as
+// ETDDNS's propagators are, and LU-factored on construction. Replacing the
+// highest four Orr-Sommerfeld equations by boundary rows instead (the tau
+// method) gives the solver spurious modes that grow under SBDF stepping.
+// u and w follow from v and eta, so div u = 0 holds exactly, and P from the
+// x and z equations.
+// Not defined for kx == kz == 0, where the advection terms vanish and
+// TauSolver applies.
+
+// Dense Chebyshev-coefficient operators shared by the solvers of all modes
+class BaseflowOperators {
+public:
+  BaseflowOperators();
+  BaseflowOperators(const ChebyCoeff& U, int Ny);  // U on [a,b], any state
+
+  int N() const;
+  Real a() const;
+  Real b() const;
+  const ChebyCoeff& U() const;    // Spectral, length N
+  const ChebyCoeff& Uy() const;   // U'
+
+  // N x N matrices, row-major, acting on Chebyshev coefficients. D is
+  // d/dy, MU and MUy multiplication by U and U' truncated to N terms.
+  const Real* D2() const;    // D D
+  const Real* D4() const;    // D D D D
+  const Real* MU() const;    // MU
+  const Real* DMUD() const;  // D MU D
+  const Real* DMUy() const;  // D MUy
+
+private:
+  int N_;
+  ChebyCoeff U_;
+  ChebyCoeff Uy_;
+  array<Real> D2_;
+  array<Real> D4_;
+  array<Real> MU_;
+  array<Real> DMUD_;
+  array<Real> DMUy_;
+};
+
+class BaseflowTauSolver {
+public:
+  BaseflowTauSolver();
+  BaseflowTauSolver(int kx, int kz, Real Lx, Real Lz, Real lambda, Real nu,
+		    const BaseflowOperators& ops, Real cx=0, Real cz=0);
+
+  // Same arguments as TauSolver::solve. All in Spectral state.
+  void solve(ComplexChebyCoeff& u, ComplexChebyCoeff& v, ComplexChebyCoeff& w,
+	     ComplexChebyCoeff& P, const ComplexChebyCoeff& Rx,
+	     const ComplexChebyCoeff& Ry, const ComplexChebyCoeff& Rz) const;
+
+  // The terms moved to the left-hand side,
+  //   B(u) = i alpha (U - cx) u - i gamma cz u + U' v ex.
+  // u,v,w Spectral; Bx,By,Bz distinct from them.
+  void advection(const ComplexChebyCoeff& u, const ComplexChebyCoeff& v,
+		 const ComplexChebyCoeff& w, ComplexChebyCoeff& Bx,
+		 ComplexChebyCoeff& By, ComplexChebyCoeff& Bz) const;
+
+  int kx() const;
+  int kz() const;
+  Real lambda() const;
+  Real nu() const;
+  Real cx() const;
+  Real cz() const;
+
+private:
+  int kx_;
+  int kz_;
+  int N_;
+  Real a_;
+  Real b_;
+  Real alpha_;
+  Real gamma_;
+  Real kappa2_;
+  Real lambda_;
+  Real nu_;
+  Real cx_;
+  Real cz_;
+  Complex lambdac_;       // lambda - i (alpha cx + gamma cz)
+  ChebyCoeff U_;
+  ChebyCoeff Uy_;
+  array<Complex> os_;     // LU factors of the Orr-Sommerfeld tau matrix
+  array<int> ospivot_;
+  array<Complex> sq_;     // LU factors of the Squire tau matrix
+  array<int> sqpivot_;
+};
+
+// g = U f, the Chebyshev product truncated to the length of f, O(N deg U).
+// U and f Spectral, g distinct from f.
+void multiply(const ChebyCoeff& U, const ComplexChebyCoeff& f, ComplexChebyCoeff& g);
+
+// Boundary-adapted bases for the Galerkin solves here and in etd.cpp, a
+// Chebyshev combination T_k + b_k T_{k+2} + c_k T_{k+4} per basis function.
+// Dirichlet: b_k = -1, c_k = 0; clamped (f = f' = 0 at
+// both ends, Shen 1994): b_k = -2(k+2)/(k+3), c_k = (k+1)/(k+3).
+inline Real basisB(bool clamped, int k) {return clamped ? -2.0*(k+2)/(k+3) : -1.0;}
+inline Real basisC(bool clamped, int k) {return clamped ? Real(k+1)/(k+3) : 0.0;}
+
+// Coefficients f[0..N) of sum_k a_k phi_k, k < n
+template <class T>
+inline void basisToCheby(bool clamped, const T* a, T* f, int n, int N) {
+  for (int i=0; i<N; ++i)
+    f[i] = T(0.0);
+  for (int k=0; k<n; ++k) {
+    f[k] += a[k];
+    f[k+2] += basisB(clamped, k)*a[k];
+    if (clamped)
+      f[k+4] += basisC(clamped, k)*a[k];
+  }
+}
+
+// a[0..n) from the first n coefficients of f, by forward substitution
+template <class T>
+inline void chebyToBasis(bool clamped, const T* f, T* a, int n) {
+  for (int i=0; i<n; ++i) {
+    T s = f[i];
+    if (i >= 2)
+      s -= basisB(clamped, i-2)*a[i-2];
+    if (clamped && i >= 4)
+      s -= basisC(clamped, i-4)*a[i-4];
+    a[i] = s;
+  }
+}
+
+// Galerkin projection gt_i = (phi_i, g) in the Chebyshev-weighted inner
+// product, up to a factor pi/2
+template <class T>
+inline void testProject(bool clamped, const T* g, T* gt, int n) {
+  for (int i=0; i<n; ++i) {
+    T s = (i == 0 ? 2.0 : 1.0)*g[i] + basisB(clamped, i)*g[i+2];
+    if (clamped)
+      s += basisC(clamped, i)*g[i+4];
+    gt[i] = s;
+  }
+}
+
+} //namespace channelflow
+#endif
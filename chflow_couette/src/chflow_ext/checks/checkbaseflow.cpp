@@ -0,0 +1,94 @@
+// checkbaseflow.cpp: BaseflowTauSolver and BaseflowImplicitDNS against the
+// library's TauSolver and explicit base-flow advection
+
+#include <iostream>
+#include "channelflow/flowfield.h"
+#include "channelflow/tausolver.h"
+#include "channelflow/symmetry.h"
+#include "channelflow/diffops.h"
+#include "chflow_ext/baseflowsolver.h"
+#include "chflow_ext/dnsext.h"
+#include "checkutil.h"
+
+using namespace std;
+using namespace channelflow;
+
+int main() {
+  // Without a base flow the Galerkin solver and the library's tau solver
+  // differ by the truncation error of the solution. The forcing decays as
+  // exp(-n), and lambda/nu is small enough for no boundary layers.
+  {
+    const int N = 33;
+    const Real Lx = 2*pi;
+    const Real Lz = pi;
+    const Real nu = 0.1;
+    const BaseflowOperators ops(ChebyCoeff(N, -1, 1, Spectral), N);
+    ComplexChebyCoeff Rx(N, -1, 1, Spectral);
+    ComplexChebyCoeff Ry(N, -1, 1, Spectral);
+    ComplexChebyCoeff Rz(N, -1, 1, Spectral);
+    for (int n=0; n<N; ++n) {
+      Rx.set(n, Complex(sin(n+1.0), cos(2.0*n))*exp(-1.0*n));
+      Ry.set(n, Complex(cos(n+3.0), sin(1.5*n))*exp(-1.0*n));
+      Rz.set(n, Complex(sin(2.0*n+1), 0.3)*exp(-1.0*n));
+    }
+    const int kx[] = {1, 0, -3};
+    const int kz[] = {0, 2, 4};
+    for (int k=0; k<3; ++k) {
+      const Real alpha = 2*pi*kx[k]/Lx;
+      const Real gamma = 2*pi*kz[k]/Lz;
+      const Real lambda = 1 + nu*(alpha*alpha + gamma*gamma);
+      const BaseflowTauSolver s(kx[k], kz[k], Lx, Lz, lambda, nu, ops);
+      TauSolver t(kx[k], kz[k], Lx, Lz, -1, 1, lambda, nu, N, true);
+      ComplexChebyCoeff u, v, w, P;
+      ComplexChebyCoeff ut(N, -1, 1, Spectral);
+      ComplexChebyCoeff vt(N, -1, 1, Spectral);
+      ComplexChebyCoeff wt(N, -1, 1, Spectral);
+      ComplexChebyCoeff Pt(N, -1, 1, Spectral);
+      s.solve(u, v, w, P, Rx, Ry, Rz);
+      t.solve(ut, vt, wt, Pt, Rx, Ry, Rz);
+      const Real err = L2Dist(u, ut) + L2Dist(v, vt) + L2Dist(w, wt);
+      check(err < 1e-10, "BaseflowTauSolver against TauSolver at kx,kz = "
+	    + i2s(kx[k]) + "," + i2s(kz[k]), err);
+    }
+  }
+
+  // Implicit and explicit base-flow advection, and a moving frame against
+  // the lab-frame field shifted by cx t, agree to the time-stepping error
+  FlowField u(16,33,16,3,2*pi,pi,-1,1);
+  u.addPerturbations(3,3,1.0,0.5);
+  u *= 0.2/L2Norm(u);
+  u.makeSpectral();
+
+  DNSExtFlags flags;
+  flags.baseflow = PlaneCouette;
+  flags.timestepping = SBDF3;
+  flags.initstepping = SMRK2;
+  flags.nonlinearity = Rotational;
+  flags.dealiasing = DealiasXZ;
+  flags.constraint = PressureGradient;
+  flags.dPdx = 0.0;
+  flags.verbosity = Silent;
+
+  const Real dt = 0.02;
+  const int Nsteps = 250;
+  FlowField w[3];
+  for (int k=0; k<3; ++k) {
+    flags.implicitBaseflow = (k > 0);
+    flags.cx = (k == 2) ? 0.3 : 0.0;
+    FlowField v(u);
+    FlowField q(16,33,16,1,2*pi,pi,-1,1);
+    DNSExt dns(v, 1.0/400, dt, flags);
+    dns.advance(v, q, Nsteps);
+    w[k] = v;
+  }
+  Real err = L2Dist(w[0], w[1]);
+  check(err < 2e-4*L2Norm(w[0]), "implicit base flow against explicit advection", err);
+
+  FieldSymmetry shift(1, 1, 1, 0.3*dt*Nsteps/u.Lx(), 0.0);
+  FlowField lab(w[0]);
+  lab *= shift;
+  err = L2Dist(lab, w[2]);
+  check(err < 2e-4*L2Norm(w[0]), "moving frame against the shifted lab-frame field", err);
+
+  return failures();
+}
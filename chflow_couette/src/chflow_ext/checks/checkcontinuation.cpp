@@ -0,0 +1,81 @@
+// checkcontinuation.cpp: Continuation around the fold of a synthetic branch
+
+#include <iostream>
+#include <cmath>
+#include "chflow_ext/continuation.h"
+#include "chflow_ext/newton.h"
+#include "checkutil.h"
+
+using namespace std;
+using namespace channelflow;
+
+// x_0^2 + mu - 1 = 0 and x_i = x_{i-1}/2: the branch x_0 = +-sqrt(1 - mu)
+// folds at mu = 1, x = 0
+class FoldProblem : public NewtonProblem {
+public:
+  FoldProblem(int n) : n_(n), mu(0) {}
+  int size() const { return n_; }
+  void residual(const Vector& x, Vector& G) {
+    G[0] = x[0]*x[0] + mu - 1;
+    for (int i=1; i<n_; ++i)
+      G[i] = x[i] - 0.5*x[i-1];
+  }
+private:
+  int n_;
+public:
+  Real mu;
+};
+
+class FoldFamily : public ProblemFamily {
+public:
+  FoldFamily(int n) : p_(n) {}
+  int size() const { return p_.size(); }
+  NewtonProblem& problem(Real mu) {
+    p_.mu = mu;
+    return p_;
+  }
+private:
+  FoldProblem p_;
+};
+
+int main() {
+  const int n = 20;
+  FoldFamily family(n);
+  ContinuationFlags flags;
+  flags.ds = 0.05;
+  flags.dsMax = 0.2;
+  flags.verbose = false;
+  NewtonFlags newton;
+  newton.verbose = false;
+  newton.Nrecycle = 4;
+  Continuation continuation(family, flags, newton);
+
+  // From the lower half, x_0 < 0, at mu = 0.5
+  Vector x(n);
+  for (int i=0; i<n; ++i)
+    x[i] = -0.7/(1 << i);
+  const bool started = continuation.start(x, 0.5);
+  check(started && fabs(continuation.x()[0] + sqrt(0.5)) < 1e-10, "first point");
+
+  // Up to the fold and back down the upper half to mu = 0.5
+  Real muMax = 0;
+  Real err = 0;
+  bool stepped = true;
+  for (int k=0; k<200 && stepped; ++k) {
+    stepped = continuation.step();
+    const Vector& y = continuation.x();
+    const Real mu = continuation.mu();
+    muMax = std::max(muMax, mu);
+    err = std::max(err, fabs(y[0]*y[0] + mu - 1));
+    for (int i=1; i<n; ++i)
+      err = std::max(err, fabs(y[i] - 0.5*y[i-1]));
+    if (y[0] > 0 && mu < 0.5)
+      break;
+  }
+  const Real x0 = continuation.x()[0];
+  check(stepped && x0 > 0 && continuation.mu() < 0.5, "around the fold in "
+	+ i2s(continuation.points()) + " points");
+  check(muMax <= 1 + 1e-10 && muMax > 0.99, "fold at mu == 1", 1 - muMax);
+  check(err < 1e-10, "points on the branch", err);
+  return failures();
+}
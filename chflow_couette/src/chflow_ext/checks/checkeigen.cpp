@@ -0,0 +1,98 @@
+// checkeigen.cpp: BlockArnoldi on an operator of known spectrum
+
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include "chflow_ext/eigen.h"
+#include "chflow_ext/newton.h"
+#include "checkutil.h"
+
+using namespace std;
+using namespace channelflow;
+
+// A = P D P, P = I - 2 p p^T a Householder reflection, D block diagonal:
+// the leading eigenvalues 0.99, 0.95 e^{+-0.3i}, -0.9, 0.85, then real
+// ones spread over (-0.6, 0.6). The reflection hides the structure from
+// the iteration without changing the spectrum.
+class KnownSpectrum : public BlockOperator {
+public:
+  KnownSpectrum(int N) : N_(N), p_(N), d_(N) {
+    for (int i=0; i<N; ++i) {
+      p_[i] = sin(1.3*i + 0.7);
+      d_[i] = 0.6*cos(2.1*i);
+    }
+    p_ *= 1.0/sqrt(dot(p_, p_));
+    d_[0] = 0.99;
+    d_[3] = -0.9;
+    d_[4] = 0.85;
+  }
+  void apply(int n, const Vector* const* x, Vector* const* y) {
+    for (int j=0; j<n; ++j)
+      apply(*x[j], *y[j]);
+  }
+  void apply(const Vector& x, Vector& y) {
+    y = x;
+    axpy(-2*dot(p_, x), p_, y);
+    const Real y1 = y[1];
+    const Real y2 = y[2];
+    for (int i=0; i<N_; ++i)
+      y[i] *= d_[i];
+    y[1] = 0.95*(cos(0.3)*y1 - sin(0.3)*y2);
+    y[2] = 0.95*(sin(0.3)*y1 + cos(0.3)*y2);
+    axpy(-2*dot(p_, y), p_, y);
+  }
+private:
+  int N_;
+  Vector p_;
+  Vector d_;
+};
+
+static Real norm(const Vector& x) {
+  return sqrt(dot(x, x));
+}
+
+static void solve(int blockSize) {
+  const int N = 400;
+  KnownSpectrum A(N);
+  ArnoldiFlags flags;
+  flags.Neig = 4;
+  flags.blockSize = blockSize;
+  flags.Kmax = 24;
+  flags.Nrestarts = 50;
+  flags.verbose = false;
+  BlockArnoldi arnoldi(flags, N);
+  const int converged = arnoldi.solve(A);
+  const string what = "block size " + i2s(blockSize) + ": ";
+  check(converged == 4 && arnoldi.number() == 4, what + "converged in "
+	+ i2s(arnoldi.applications()) + " applications");
+
+  const Complex known[4] = {Complex(0.99, 0), 0.95*exp(Complex(0, 0.3)),
+			    0.95*exp(Complex(0, -0.3)), Complex(-0.9, 0)};
+  Real err = 0;
+  for (int j=0; j<arnoldi.number(); ++j)
+    err = std::max(err, abs(arnoldi.eigenvalue(j) - known[j]));
+  check(err < 1e-8, what + "eigenvalues", err);
+
+  // |A x - lambda x| by applying A, for a complex pair A (xr + i xi) =
+  // lambda (xr + i xi) split into real and imaginary parts
+  Real res = 0;
+  Vector y(N);
+  for (int j=0; j<arnoldi.number(); ++j) {
+    const Complex lambda = arnoldi.eigenvalue(j);
+    const Vector& x = arnoldi.eigenvector(j);
+    A.apply(x, y);
+    axpy(-Re(lambda), x, y);
+    if (Im(lambda) > 0)
+      axpy(Im(lambda), arnoldi.eigenvector(j+1), y);
+    else if (Im(lambda) < 0)
+      axpy(Im(lambda), arnoldi.eigenvector(j-1), y);
+    res = std::max(res, norm(y)/norm(x));
+  }
+  check(res < 1e-7, what + "eigenvectors", res);
+}
+
+int main() {
+  solve(1);
+  solve(4);
+  return failures();
+}
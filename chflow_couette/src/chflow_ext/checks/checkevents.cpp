@@ -0,0 +1,110 @@
+// checkevents.cpp: FlowEvents on known sequences of diagnostics
+
+#include <iostream>
+#include <cmath>
+#include <cstdio>
+#include "chflow_ext/events.h"
+#include "checkutil.h"
+
+using namespace std;
+using namespace channelflow;
+
+// Feed E[n] (and the same as dissipation and maxKE) at t = n, n0 <= n < N,
+// until an event
+static FlowEvents::Kind feed(FlowEvents& e, const Real* E, int N, int n0=0) {
+  for (int n=n0; n<N; ++n) {
+    FlowDiagnostics d;
+    d.t = n;
+    d.energy = E[n];
+    d.dissipation = E[n];
+    d.maxKE = 100*E[n];
+    if (e(d))
+      break;
+  }
+  return e.fired();
+}
+
+int main() {
+  // E(t) = E(t - 3) first at t = 6; E(5) = 4 differs from E(2) = 3
+  {
+    const Real E[] = {1, 2, 3, 4, 4, 4, 4, 4};
+    FlowEvents e;
+    e.stallTol = 1e-6;
+    e.stallWindow = 3;
+    check(feed(e, E, 8) == FlowEvents::EnergyStalled && e.time() == 6,
+	  "energy_stalled over stall_window intervals");
+  }
+  // Never stalled, whatever the ring held before it was written
+  {
+    const Real E[] = {0, 1, 2, 3, 4, 5, 6, 7};
+    for (int W=1; W<=8; ++W) {
+      FlowEvents e;
+      e.stallTol = 1e-6;
+      e.stallWindow = W;
+      if (feed(e, E, 8) != FlowEvents::None) {
+	check(false, "energy_stalled on a growing energy");
+	return 1;
+      }
+    }
+    check(true, "energy_stalled on a growing energy");
+  }
+  // Thresholds on the mean energy and on the maximum pointwise u.u
+  {
+    const Real E[] = {1.0, 0.5, 0.2, 0.05, 0.01};
+    FlowEvents e;
+    e.energyBelow = 0.1;
+    check(feed(e, E, 5) == FlowEvents::EnergyBelow && e.time() == 3, "energy_below");
+    FlowEvents m;
+    m.maxKEBelow = 30;
+    check(feed(m, E, 5) == FlowEvents::MaxKEBelow && m.time() == 2 && m.value() == 20,
+	  "max_ke_below");
+  }
+  // Crossings of 1.5 at interpolated times, upward and downward
+  {
+    const Real D[] = {0, 1, 2, 3, 2, 1, 0};
+    FlowEvents e;
+    e.crossing = true;
+    e.crossingLevel = 1.5;
+    feed(e, D, 7);
+    check(e.fired() == FlowEvents::None && e.crossings() == 2 &&
+	  fabs(e.crossingTimes()[0] - 1.5) < 1e-14 && fabs(e.crossingTimes()[1] - 4.5) < 1e-14,
+	  "crossings in both directions");
+    FlowEvents u;
+    u.crossing = true;
+    u.crossingLevel = 1.5;
+    u.crossingDirection = -1;
+    u.crossingCount = 1;
+    check(feed(u, D, 7) == FlowEvents::Crossing && fabs(u.time() - 4.5) < 1e-14,
+	  "crossing_count of downward crossings");
+  }
+  // Stopped and continued from a checkpoint after t = 3, stall ring,
+  // crossings and the last observable included: the crossing at 3.25
+  // straddles the checkpoint
+  {
+    const Real E[] = {0, 1, 2, 2, 4, 3, 1, 0, 2, 3, 1, 0, 3, 3, 3};
+    const int N = 15;
+    FlowEvents e;
+    e.stallTol = 1e-6;
+    e.stallWindow = 2;
+    e.crossing = true;
+    e.crossingLevel = 2.5;
+    FlowEvents f(e);
+    feed(e, E, N);
+    feed(f, E, 4);
+    f.save("checkevents");
+    FlowEvents g;
+    g.stallTol = 1e-6;
+    g.stallWindow = 2;
+    g.crossing = true;
+    g.crossingLevel = 2.5;
+    g.load("checkevents");
+    feed(g, E, N, 4);
+    bool same = g.fired() == e.fired() && g.time() == e.time() && g.crossings() == e.crossings();
+    for (int i=0; same && i<e.crossings(); ++i)
+      same = fabs(g.crossingTimes()[i] - e.crossingTimes()[i]) < 1e-14;
+    check(e.fired() == FlowEvents::EnergyStalled && e.time() == 14 && e.crossings() == 5 && same,
+	  "save and load mid-sequence");
+    remove("checkevents.events");
+  }
+  return failures();
+}
@@ -0,0 +1,147 @@
+// checkfieldloops.cpp: parallelForPlanes, parallelForSlabs and xzProfilesFast
+// against loops over FlowField::operator()
+
+#include <iostream>
+#include "channelflow/flowfield.h"
+#include "channelflow/diffops.h"
+#include "chflow_ext/fieldloops.h"
+#include "chflow_ext/gridtables.h"
+#include "checkutil.h"
+
+using namespace std;
+using namespace channelflow;
+
+// Value expected at gridpoint (nx,ny,nz,i)
+static Real tag(int nx, int ny, int nz, int i) {
+  return nx + 100*ny + 10000*nz + 1000000*i;
+}
+
+struct TagPlanes {
+  void operator()(const XZPlane<Real>& p) const {
+    for (int nx=0; nx<p.Nx; ++nx)
+      for (int nz=0; nz<p.Nz; ++nz)
+	p.row(nx)[nz] = tag(nx, p.ny, nz, p.i);
+  }
+};
+
+// Running sum in y of every line, v_ny = sum_{n<=ny} u_n
+struct SumSlabs {
+  void operator()(const YSlab<Real>& s) const {
+    for (int ny=1; ny<s.Ny; ++ny) {
+      const Real* prev = s.plane(ny-1);
+      Real* cur = s.plane(ny);
+      for (int l=0; l<s.L; ++l)
+	cur[l] += prev[l];
+    }
+  }
+};
+
+// Sum of all values, one partial per slab
+struct TotalSlabs {
+  Real* partial;
+  int Nslabs;
+  int Nlines;
+  void operator()(const YSlab<const Real>& s) const {
+    Real sum = 0.0;
+    for (int ny=0; ny<s.Ny; ++ny)
+      for (int l=0; l<s.L; ++l)
+	sum += s.plane(ny)[l];
+    partial[s.i*Nslabs + s.l0/Nlines] = sum;
+  }
+};
+
+int main() {
+  const int Nx = 12;
+  const int Ny = 9;
+  const int Nz = 10;
+  FlowField u(Nx,Ny,Nz,3,2*pi,pi,-1,1);
+  u.setState(Physical, Physical);
+
+  // Every gridpoint written once, at its own place
+  parallelForPlanes(u, TagPlanes());
+  Real err = 0.0;
+  for (int i=0; i<3; ++i)
+    for (int ny=0; ny<Ny; ++ny)
+      for (int nx=0; nx<Nx; ++nx)
+	for (int nz=0; nz<Nz; ++nz)
+	  err = Greater(err, abs(u(nx,ny,nz,i) - tag(nx,ny,nz,i)));
+  check(err == 0.0, "parallelForPlanes covers the physical gridpoints", err);
+
+  // Slabs of 7 lines, the last one partial, including the padding
+  FlowField v(u);
+  parallelForSlabs(v, SumSlabs(), 7);
+  err = 0.0;
+  for (int i=0; i<3; ++i)
+    for (int nx=0; nx<Nx; ++nx)
+      for (int nz=0; nz<Nz; ++nz) {
+	Real sum = 0.0;
+	for (int ny=0; ny<Ny; ++ny) {
+	  sum += u(nx,ny,nz,i);
+	  err = Greater(err, abs(v(nx,ny,nz,i) - sum));
+	}
+      }
+  check(err == 0.0, "parallelForSlabs recurrence in y", err);
+
+  const FlowField& cu = u;
+  const int Nslabs = (Nx*u.Nzpad() + 6)/7;
+  Vector partial(3*Nslabs);
+  TotalSlabs total;
+  total.partial = partial.pointer();
+  total.Nslabs = Nslabs;
+  total.Nlines = 7;
+  parallelForSlabs(cu, total, 7);
+  Real sum = 0.0;
+  Real expected = 0.0;
+  for (int k=0; k<3*Nslabs; ++k)
+    sum += partial[k];
+  for (int n=0; n<u.rawDataLength(); ++n)
+    expected += u.rawData()[n];
+  check(abs(sum - expected) < 1e-12*abs(expected), "parallelForSlabs on a const field",
+	abs(sum - expected));
+
+  // Profiles of a spectral field, which comes back unchanged
+  FlowField w(Nx,Ny,Nz,3,2*pi,pi,-1,1);
+  w.addPerturbations(4,4,1.0,0.5);
+  w.makeSpectral();
+  const FlowField w0(w);
+  Vector mean(3*Ny);
+  Vector meanSquare(3*Ny);
+  xzProfilesFast(w, mean.pointer(), meanSquare.pointer());
+  check(w.xzstate() == Spectral && w.ystate() == Spectral && L2Dist(w, w0) < 1e-13*L2Norm(w0),
+	"xzProfilesFast leaves its input as it was", L2Dist(w, w0));
+
+  FlowField wp(w);
+  wp.makePhysical();
+  Real errMean = 0.0;
+  Real errSquare = 0.0;
+  Real maxSquare = 0.0;
+  for (int i=0; i<3; ++i)
+    for (int ny=0; ny<Ny; ++ny) {
+      Real s = 0.0;
+      Real s2 = 0.0;
+      for (int nx=0; nx<Nx; ++nx)
+	for (int nz=0; nz<Nz; ++nz) {
+	  s += wp(nx,ny,nz,i);
+	  s2 += square(wp(nx,ny,nz,i));
+	}
+      errMean = Greater(errMean, abs(mean[ny + Ny*i] - s/(Nx*Nz)));
+      errSquare = Greater(errSquare, abs(meanSquare[ny + Ny*i] - s2/(Nx*Nz)));
+      maxSquare = Greater(maxSquare, s2/(Nx*Nz));
+    }
+  check(errMean < 1e-13, "xzProfilesFast mean profiles", errMean);
+  check(errSquare < 1e-13*maxSquare, "xzProfilesFast mean-square profiles", errSquare);
+
+  // <u_i>_xz is the kx = kz = 0 mode
+  errMean = 0.0;
+  for (int i=0; i<3; ++i) {
+    ChebyCoeff U(Ny, w.a(), w.b(), Spectral);
+    for (int ny=0; ny<Ny; ++ny)
+      U[ny] = Re(w.cmplx(0,ny,0,i));
+    U.makePhysical();
+    for (int ny=0; ny<Ny; ++ny)
+      errMean = Greater(errMean, abs(mean[ny + Ny*i] - U[ny]));
+  }
+  check(errMean < 1e-13, "xzProfilesFast means are the mean modes", errMean);
+
+  return failures();
+}
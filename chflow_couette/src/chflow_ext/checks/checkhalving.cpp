@@ -0,0 +1,93 @@
+// checkhalving.cpp: SpectralSymmetry and the halved solve of
+// FusedMultistepDNS against the channelflow library
+
+#include <iostream>
+#include "channelflow/flowfield.h"
+#include "channelflow/symmetry.h"
+#include "channelflow/diffops.h"
+#include "channelflow/dns.h"
+#include "chflow_ext/symmetry.h"
+#include "chflow_ext/dnsext.h"
+#include "checkutil.h"
+
+using namespace std;
+using namespace channelflow;
+
+// s(u), mode by mode
+static FlowField symmetric(const SpectralSymmetry& s, const FlowField& u) {
+  FlowField v(u);
+  for (int m=0; m<u.Mx()*u.Mz(); ++m)
+    s.apply(m, u.rawData(), v.rawData(), u.Nd(), u.Ny());
+  return v;
+}
+
+int main() {
+  const int Nx = 16;
+  const int Ny = 17;
+  const int Nz = 16;
+  FlowField u(Nx,Ny,Nz,3,2*pi,pi,-1,1);
+  u.addPerturbations(5,5,1.0,0.5);
+  u.makeSpectral();
+  zeroNyquist(u);
+  FlowField p(Nx,Ny,Nz,1,2*pi,pi,-1,1);
+  p.setState(Spectral,Spectral);
+  for (int mx=0; mx<u.Mx(); ++mx)
+    for (int mz=0; mz<u.Mz(); ++mz)
+      for (int ny=0; ny<Ny; ++ny)
+	p.cmplx(mx,ny,mz,0) = u.cmplx(mx,ny,mz,1);
+
+  // Phases, y reflections and conjugated sources, vector and scalar
+  const FieldSymmetry symmetries[] = {
+    FieldSymmetry(1,1,-1,0.5,0.0), FieldSymmetry(-1,-1,1,0.5,0.5),
+    FieldSymmetry(-1,-1,-1,0.25,0.3,-1), FieldSymmetry(1,-1,1,0.1,0.2),
+    FieldSymmetry(-1,1,1,0.3,0.7)};
+  for (int k=0; k<5; ++k) {
+    const FieldSymmetry& s = symmetries[k];
+    FlowField v = s(u);
+    v.makeSpectral();
+    zeroNyquist(v);
+    FlowField w = symmetric(SpectralSymmetry(s,Nx,Nz), u);
+    zeroNyquist(w);
+    // The library flips a scalar by s, where SpectralSymmetry leaves a
+    // pressure, quadratic in u, unchanged
+    const FieldSymmetry sp(s.sx(), s.sy(), s.sz(), s.ax(), s.az());
+    FlowField vp = sp(p);
+    vp.makeSpectral();
+    zeroNyquist(vp);
+    FlowField wp = symmetric(SpectralSymmetry(s,Nx,Nz), p);
+    zeroNyquist(wp);
+    const Real err = L2Dist(v,w) + L2Dist(vp,wp);
+    check(err < 1e-13*L2Norm(u), "SpectralSymmetry " + i2s(k), err);
+  }
+
+  // A shift-reflect subspace, solved for kx >= 0 only by FusedMultistepDNS,
+  // against the library's full solve
+  array<FieldSymmetry> sym(2);
+  sym[0] = FieldSymmetry(1,1,-1,0.5,0.0);
+  sym[1] = FieldSymmetry(-1,-1,1,0.5,0.5);
+  check(halvingSymmetry(sym) != 0, "halving symmetry found", 0.0);
+  FlowField u0(Nx,Ny,Nz,3,2*pi,pi,-1,1);
+  u0.addPerturbations(4,4,1.0,0.5);
+  u0 *= 0.2/L2Norm(u0);
+  u0.project(sym);
+  u0.makeSpectral();
+
+  DNSFlags flags;
+  flags.baseflow = PlaneCouette;
+  flags.verbosity = Silent;
+  flags.timestepping = SBDF3;
+  flags.initstepping = SMRK2;
+  flags.dealiasing = DealiasXZ;
+  flags.symmetries = sym;
+  FlowField q;
+  FlowField a(u0);
+  DNSExt ext(a, 1.0/400, 0.02, DNSExtFlags(flags));
+  ext.advance(a, q, 50);
+  FlowField b(u0);
+  DNS lib(b, 1.0/400, 0.02, flags);
+  lib.advance(b, q, 50);
+  const Real err = L2Dist(a,b);
+  check(err < 1e-10*L2Norm(b), "halved SBDF3 steps against the library", err);
+
+  return failures();
+}
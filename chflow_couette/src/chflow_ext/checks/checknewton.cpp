@@ -0,0 +1,146 @@
+// checknewton.cpp: NewtonKrylov and GMRES on small systems of known solution
+
+#include <iostream>
+#include <cmath>
+#include "chflow_ext/newton.h"
+#include "checkutil.h"
+
+using namespace std;
+using namespace channelflow;
+
+// Broyden's tridiagonal system, (3 - 2 x_i) x_i - x_{i-1} - 2 x_{i+1} + 1 = 0
+// with x_0 = x_{n+1} = 0, Jacobian-vector products by finite differences
+class Broyden : public NewtonProblem {
+public:
+  Broyden(int n) : n_(n) {}
+  int size() const { return n_; }
+  void residual(const Vector& x, Vector& G) {
+    for (int i=0; i<n_; ++i)
+      G[i] = (3 - 2*x[i])*x[i] + 1 - (i > 0 ? x[i-1] : 0) - 2*(i < n_-1 ? x[i+1] : 0);
+  }
+private:
+  int n_;
+};
+
+// Rosenbrock's function as the system 10 (x1 - x0^2) = 0, 1 - x0 = 0, with
+// the exact Jacobian; its root (1,1) lies at the end of a curved valley
+class Rosenbrock : public NewtonProblem {
+public:
+  int size() const { return 2; }
+  void residual(const Vector& x, Vector& G) {
+    G[0] = 10*(x[1] - x[0]*x[0]);
+    G[1] = 1 - x[0];
+  }
+  void jacobian(const Vector& x, const Vector& Gx, const Vector& dx, Vector& dG) {
+    dG[0] = -20*x[0]*dx[0] + 10*dx[1];
+    dG[1] = -dx[0];
+  }
+};
+
+// A = tridiag(-1, 2 + s, -1) plus a skew part c (e_{i+1} e_i^T - e_i e_{i+1}^T),
+// nonsymmetric with real eigenvalues within [s, s+4]
+class Tridiagonal : public LinearOperator {
+public:
+  Tridiagonal(int n, Real s, Real c) : s_(s), n_(n), c_(c) {}
+  void apply(const Vector& x, Vector& y) {
+    for (int i=0; i<n_; ++i) {
+      const Real xm = i > 0 ? x[i-1] : 0;
+      const Real xp = i < n_-1 ? x[i+1] : 0;
+      y[i] = (2 + s_)*x[i] - xm - xp + c_*(xm - xp);
+    }
+  }
+  Real s_;
+private:
+  int n_;
+  Real c_;
+};
+
+static Real norm(const Vector& x) {
+  return sqrt(dot(x, x));
+}
+
+int main() {
+  NewtonFlags flags;
+  flags.verbose = false;
+
+  // Broyden from x = -1, converging to the solution with all x_i < 0
+  {
+    const int n = 100;
+    Broyden p(n);
+    NewtonKrylov newton(flags, n);
+    Vector x(n);
+    for (int i=0; i<n; ++i)
+      x[i] = -1;
+    const bool converged = newton.solve(p, x);
+    Vector G(n);
+    p.residual(x, G);
+    bool negative = true;
+    for (int i=0; i<n; ++i)
+      negative = negative && x[i] < 0;
+    check(converged && norm(G) < 1e-10 && negative, "Broyden tridiagonal, finite differences", norm(G));
+  }
+
+  // Rosenbrock from (-1.2, 1), where the Newton steps of length 5 exceed the
+  // trust region
+  {
+    Rosenbrock p;
+    NewtonFlags rflags(flags);
+    rflags.delta = 0.5;
+    NewtonKrylov newton(rflags, 2);
+    Vector x(2);
+    x[0] = -1.2;
+    x[1] = 1;
+    const bool converged = newton.solve(p, x);
+    const Real err = sqrt(square(x[0] - 1) + square(x[1] - 1));
+    check(converged && err < 1e-10, "Rosenbrock, exact Jacobian, hooksteps in "
+	  + i2s(newton.iterations()) + " iterations", err);
+  }
+
+  // GMRES to its tolerance on a nonsymmetric system, the model's residual
+  // that of x
+  {
+    const int n = 200;
+    Tridiagonal A(n, 0.05, 0.3);
+    Vector b(n);
+    for (int i=0; i<n; ++i)
+      b[i] = sin(0.1*i) + 1;
+    Vector x(n);
+    Vector r(n);
+    GMRES gmres(n, n, 1e-8);
+    gmres.solve(A, b, x);
+    A.apply(x, r);
+    axpy(-1, b, r);
+    const Real err = norm(r)/norm(b);
+    check(err < 2e-8 && fabs(err - gmres.residual()) < 1e-10, "GMRES, |A x - b|/|b|", err);
+  }
+  // With recycling, on a sequence of nearby systems as along a branch, fewer
+  // applications of A, and the model's residual still that of x
+  {
+    const int n = 200;
+    Tridiagonal A(n, 0.05, 0.3);
+    Vector b(n);
+    for (int i=0; i<n; ++i)
+      b[i] = sin(0.1*i) + 1;
+    Vector x(n);
+    Vector r(n);
+    GMRES plain(n, n, 1e-8);
+    GMRES recycling(n, n, 1e-8, 20);
+    int plainApplications = 0;
+    int recycledApplications = 0;
+    Real err = 0;
+    for (int k=0; k<4; ++k) {
+      A.s_ = 0.05*(1 + 0.05*k);
+      plain.solve(A, b, x);
+      plainApplications += plain.applications();
+      recycling.solve(A, b, x);
+      recycledApplications += recycling.applications();
+      A.apply(x, r);
+      axpy(-1, b, r);
+      err = std::max(err, fabs(norm(r)/norm(b) - recycling.residual()));
+    }
+    check(err < 1e-9, "GMRES with recycling, model residual as |A x - b|/|b|", err);
+    check(recycledApplications < plainApplications, "GMRES recycling saves applications, "
+	  + i2s(recycledApplications) + " vs " + i2s(plainApplications));
+  }
+  return failures();
+}
@@ -0,0 +1,115 @@
+// checkorbit.cpp: PeriodicOrbitProblem against single shooting, and its
+// exact Jacobian against finite differences
+
+#include <iostream>
+#include <cmath>
+#include "channelflow/flowfield.h"
+#include "channelflow/diffops.h"
+#include "chflow_ext/dnsext.h"
+#include "chflow_ext/solutions.h"
+#include "chflow_ext/newton.h"
+#include "checkutil.h"
+
+using namespace std;
+using namespace channelflow;
+
+static const Real nu = 1.0/400;
+static const Real T = 1.2;
+static const Real dt = 0.02;
+
+static Real norm(const Vector& x, int begin, int end) {
+  Real s = 0;
+  for (int n=begin; n<end; ++n)
+    s += square(x[n]);
+  return sqrt(s);
+}
+
+static FlowField randomField(Real magnitude) {
+  FlowField u(16, 17, 16, 3, 2*pi, pi, -1, 1);
+  u.addPerturbations(3, 3, 1.0, 0.5);
+  u *= magnitude/L2Norm(u);
+  u.makeSpectral();
+  return u;
+}
+
+// The segments, integrated on concurrent threads, continue each other as
+// the serial integration of toVector. With a self-starting method the last
+// residual block is that of single shooting; SBDF3 restarts its history
+// at each segment.
+static void chain(const DNSExtFlags& flags, const string& what) {
+  const FlowField u = randomField(0.3);
+  PeriodicOrbitProblem p3(u, nu, T, dt, 3, flags);
+  PeriodicOrbitProblem p1(u, nu, T, dt, 1, flags);
+  Vector x3, x1, G3, G1;
+  p3.toVector(u, T, 0, 0, x3);
+  p1.toVector(u, T, 0, 0, x1);
+  p3.residual(x3, G3);
+  p1.residual(x1, G1);
+  const int Nu = p3.packing().size();
+  const Real unorm = norm(x1, 0, Nu);
+  check(norm(G3, 0, 2*Nu)/unorm < 1e-13, what + ": concurrent segments continue each other",
+	norm(G3, 0, 2*Nu)/unorm);
+  if (!flags.lowStorageRK)
+    return;
+  Real d = 0;
+  for (int n=0; n<Nu; ++n)
+    d += square(G3[2*Nu + n] - G1[n]);
+  check(sqrt(d)/norm(G1, 0, Nu) < 1e-12, what + ": last segment as single shooting",
+	sqrt(d)/norm(G1, 0, Nu));
+}
+
+int main() {
+  DNSExtFlags flags;
+  flags.baseflow = PlaneCouette;
+  flags.timestepping = SBDF3;
+  flags.initstepping = SMRK2;
+  flags.nonlinearity = Rotational;
+  flags.dealiasing = DealiasXZ;
+  flags.constraint = PressureGradient;
+  flags.dPdx = 0;
+  flags.verbosity = Silent;
+  chain(flags, "DNSExt");
+  flags.lowStorageRK = true;
+  chain(flags, "TangentDNS");
+
+  // The Jacobian against central differences of G: exact in the u_m, the
+  // forward difference of epsDx in T
+  {
+    const FlowField u = randomField(0.3);
+    PeriodicOrbitProblem p(u, nu, T, dt, 3, flags);
+    Vector x, G;
+    p.toVector(u, T, 0, 0, x);
+    p.residual(x, G);
+    const int Nu = p.packing().size();
+    for (int column=0; column<2; ++column) {
+      Vector dx(p.size());
+      dx.setToZero();
+      Vector dG;
+      Real eps = 1e-4;
+      if (column == 0) {
+	for (int m=0; m<3; ++m)
+	  p.packing().pack(randomField(1.0), dx, m*Nu);
+      }
+      else {
+	dx[3*Nu] = 1;
+	eps = 1e-3;
+      }
+      p.jacobian(x, G, dx, dG);
+
+      Vector xp(x), xm(x), Gp, Gm;
+      axpy(eps, dx, xp);
+      axpy(-eps, dx, xm);
+      p.residual(xp, Gp);
+      p.residual(xm, Gm);
+      Real d = 0;
+      for (int n=0; n<3*Nu; ++n)
+	d += square((Gp[n] - Gm[n])/(2*eps) - dG[n]);
+      const Real err = sqrt(d)/norm(dG, 0, 3*Nu);
+      if (column == 0)
+	check(err < 1e-6, "Jacobian in the u_m as central differences", err);
+      else
+	check(err < 1e-5, "Jacobian in T as central differences", err);
+    }
+  }
+  return failures();
+}
@@ -0,0 +1,55 @@
+// checkprojector.cpp: SymmetryProjector against FlowField::project
+
+#include <iostream>
+#include "channelflow/flowfield.h"
+#include "channelflow/symmetry.h"
+#include "channelflow/diffops.h"
+#include "chflow_ext/symmetry.h"
+#include "checkutil.h"
+
+using namespace std;
+using namespace channelflow;
+
+int main() {
+  const int Nx = 16;
+  const int Ny = 17;
+  const int Nz = 12;
+  FlowField u(Nx,Ny,Nz,3,2*pi,pi,-1,1);
+  u.addPerturbations(5,5,1.0,0.5);
+  u.makeSpectral();
+  zeroNyquist(u);
+
+  // Shift-reflect and shift-rotate, with an inversion as a third generator,
+  // and a pair of generic symmetries whose products have 4-mode orbits.
+  // The last pair generates no finite group, so its product of (1 + s)/2
+  // is not a projection, in the library either.
+  array<FieldSymmetry> groups[3];
+  groups[0].resize(2);
+  groups[0][0] = FieldSymmetry(1,1,-1,0.5,0.0);
+  groups[0][1] = FieldSymmetry(-1,-1,1,0.5,0.5);
+  groups[1].resize(3);
+  groups[1][0] = groups[0][0];
+  groups[1][1] = groups[0][1];
+  groups[1][2] = FieldSymmetry(-1,-1,-1,0.0,0.0);
+  groups[2].resize(2);
+  groups[2][0] = FieldSymmetry(1,-1,1,0.1,0.2);
+  groups[2][1] = FieldSymmetry(-1,1,1,0.3,0.7);
+
+  for (int k=0; k<3; ++k) {
+    const SymmetryProjector P(groups[k], Nx, Nz);
+    FlowField a(u);
+    a.project(groups[k]);
+    a.makeSpectral();
+    zeroNyquist(a);
+    FlowField b(u);
+    P(b);
+    zeroNyquist(b);
+    FlowField c(b);
+    P(c);
+    const Real err = L2Dist(a,b);
+    check(err < 1e-13*L2Norm(u), "projection onto group " + i2s(k), err);
+    if (k < 2)
+      check(L2Dist(b,c) < 1e-13*L2Norm(u), "idempotence on group " + i2s(k), L2Dist(b,c));
+  }
+  return failures();
+}
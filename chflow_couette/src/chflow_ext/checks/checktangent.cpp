@@ -0,0 +1,86 @@
+// checktangent.cpp: TangentDNS against IMEXRK3DNS and finite differences
+
+#include <iostream>
+#include <cmath>
+#include "channelflow/flowfield.h"
+#include "channelflow/diffops.h"
+#include "chflow_ext/dnsext.h"
+#include "chflow_ext/imexrk.h"
+#include "chflow_ext/tangent.h"
+#include "checkutil.h"
+
+using namespace std;
+using namespace channelflow;
+
+static const Real nu = 1.0/400;
+static const Real dt = 0.02;
+static const int nSteps = 50;
+
+// u advanced nSteps by IMEXRK3DNS
+static FlowField advanced(const FlowField& u, const ChebyCoeff& Ubase, const DNSExtFlags& flags) {
+  FlowField v(u);
+  FlowField q;
+  IMEXRK3DNS dns(v, Ubase, nu, dt, flags);
+  dns.advance(v, q, nSteps);
+  return v;
+}
+
+int main() {
+  DNSExtFlags flags;
+  flags.baseflow = PlaneCouette;
+  flags.timestepping = SBDF3;
+  flags.nonlinearity = Rotational;
+  flags.dealiasing = DealiasXZ;
+  flags.constraint = PressureGradient;
+  flags.dPdx = 0;
+  flags.lowStorageRK = true;
+  flags.verbosity = Silent;
+  const ChebyCoeff Ubase = baseflowProfile(flags.baseflow, 17, -1, 1);
+
+  FlowField u(16, 17, 16, 3, 2*pi, pi, -1, 1);
+  u.addPerturbations(3, 3, 1.0, 0.5);
+  u *= 0.3/L2Norm(u);
+  u.makeSpectral();
+  FlowField du(u);
+  du.addPerturbations(4, 4, 1.0, 0.5);
+  du *= 1.0/L2Norm(du);
+  du.makeSpectral();
+
+  // u with tangents steps as u alone; the tangent of 2 du is twice that
+  // of du
+  FlowField v(u);
+  FlowField q;
+  array<FlowField> dv(2);
+  dv[0] = du;
+  dv[1] = du;
+  dv[1] *= 2.0;
+  TangentDNS tangent(v, Ubase, nu, dt, flags);
+  tangent.advance(v, q, dv, nSteps);
+  const FlowField uT = advanced(u, Ubase, flags);
+  check(L2Dist(v, uT) < 1e-13*L2Norm(uT), "u as by IMEXRK3DNS", L2Dist(v, uT)/L2Norm(uT));
+  FlowField twice(dv[0]);
+  twice *= 2.0;
+  check(L2Dist(dv[1], twice) < 1e-13*L2Norm(twice), "linear in du",
+	L2Dist(dv[1], twice)/L2Norm(twice));
+
+  // Central differences (f(u + eps du) - f(u - eps du))/(2 eps) converge to
+  // the tangent as eps^2, down to rounding
+  Real err[2];
+  for (int k=0; k<2; ++k) {
+    const Real eps = 1e-3/(1 << k);
+    FlowField up(du);
+    up *= eps;
+    up += u;
+    FlowField um(du);
+    um *= -eps;
+    um += u;
+    FlowField fd = advanced(up, Ubase, flags);
+    fd -= advanced(um, Ubase, flags);
+    fd *= 0.5/eps;
+    err[k] = L2Dist(fd, dv[0])/L2Norm(dv[0]);
+  }
+  check(err[1] < 1e-6, "tangent as central differences", err[1]);
+  check(err[0]/err[1] > 3.5 && err[0]/err[1] < 4.5, "central differences converge to it as eps^2, ratio "
+	+ r2s(err[0]/err[1]));
+  return failures();
+}
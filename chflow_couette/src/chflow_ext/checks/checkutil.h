@@ -0,0 +1,43 @@
+// checkutil.h: reporting and field helpers shared by the checks
+
+#ifndef CHFLOW_EXT_CHECKUTIL_H
+#define CHFLOW_EXT_CHECKUTIL_H
+
+#include <iostream>
+#include <string>
+#include "channelflow/mathdefs.h"
+#include "channelflow/flowfield.h"
+
+namespace channelflow {
+
+// Number of failed checks so far, the exit status of a check program
+inline int& failures() {
+  static int n = 0;
+  return n;
+}
+
+// Print one line "ok" or "FAILED" for what, with err if given
+inline void check(bool ok, const std::string& what) {
+  std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl;
+  if (!ok)
+    ++failures();
+}
+
+inline void check(bool ok, const std::string& what, Real err) {
+  std::cout << (ok ? "ok      " : "FAILED  ") << what << ", error " << err << std::endl;
+  if (!ok)
+    ++failures();
+}
+
+// The library leaves the Nyquist modes out of its symmetries. u Spectral.
+inline void zeroNyquist(FlowField& u) {
+  for (int mx=0; mx<u.Mx(); ++mx)
+    for (int mz=0; mz<u.Mz(); ++mz)
+      if (abs(u.kx(mx)) == u.Nx()/2 || mz == u.Nz()/2)
+	for (int i=0; i<u.Nd(); ++i)
+	  for (int ny=0; ny<u.Ny(); ++ny)
+	    u.cmplx(mx,ny,mz,i) = 0.0;
+}
+
+} //namespace channelflow
+#endif
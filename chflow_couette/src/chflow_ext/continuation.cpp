@@ -0,0 +1,395 @@
+// continuation.cpp: pseudo-arclength continuation of solution branches
+
+#include <iostream>
+#include <cstring>
+#include "continuation.h"
+
+using namespace std;
+
+namespace channelflow {
+
+/**************************************************************************
+ * SolutionFamily
+ **************************************************************************/
+
+ProblemFamily::~ProblemFamily() {}
+
+SolutionFamily::Parameter SolutionFamily::parseParameter(const string& s) {
+  if (s == "Re") return Reynolds;
+  if (s == "Lx") return LengthX;
+  if (s == "Lz") return LengthZ;
+  cferror("SolutionFamily::parseParameter : unknown parameter " + s);
+  return Reynolds;
+}
+
+SolutionFamily::SolutionFamily(const FlowField& u, Real Re, Real T, Real dt,
+			       const DNSExtFlags& flags, Parameter p, bool xrel, bool zrel,
+			       int segments)
+  :
+  u_(u),
+  Re_(Re),
+  T_(T),
+  dt_(dt),
+  flags_(flags),
+  p_(p),
+  xrel_(xrel),
+  zrel_(zrel),
+  segments_(segments),
+  mu_(0.0),
+  equilibrium_(0),
+  orbit_(0)
+{
+  u_.makeSpectral();
+  problem(parameter());
+}
+
+SolutionFamily::~SolutionFamily() {
+  delete equilibrium_;
+  delete orbit_;
+}
+
+int SolutionFamily::size() const {
+  return equilibrium_ ? equilibrium_->size() : orbit_->size();
+}
+
+Real SolutionFamily::parameter() const {
+  switch (p_) {
+  case LengthX: return u_.Lx();
+  case LengthZ: return u_.Lz();
+  default:      return Re_;
+  }
+}
+
+// Only the grid and box of the template field matter to the problems
+NewtonProblem& SolutionFamily::problem(Real mu) {
+  if (equilibrium_ && mu == mu_)
+    return *equilibrium_;
+  if (orbit_ && mu == mu_)
+    return *orbit_;
+  delete equilibrium_;
+  delete orbit_;
+  equilibrium_ = 0;
+  orbit_ = 0;
+
+  const Real Lx = (p_ == LengthX) ? mu : u_.Lx();
+  const Real Lz = (p_ == LengthZ) ? mu : u_.Lz();
+  const Real nu = 1.0/((p_ == Reynolds) ? mu : Re_);
+  FlowField v(u_.Nx(), u_.Ny(), u_.Nz(), 3, Lx, Lz, u_.a(), u_.b());
+  mu_ = mu;
+  if (segments_ > 0) {
+    orbit_ = new PeriodicOrbitProblem(v, nu, T_, dt_, segments_, flags_, xrel_, zrel_);
+    return *orbit_;
+  }
+  equilibrium_ = new EquilibriumProblem(v, nu, T_, dt_, flags_, xrel_, zrel_);
+  return *equilibrium_;
+}
+
+void SolutionFamily::toField(const Vector& x, Real mu, FlowField& u) {
+  problem(mu);
+  Real ax, az;
+  if (equilibrium_)
+    equilibrium_->toField(x, u, ax, az);
+  else
+    orbit_->toField(x, 0, u);
+}
+
+void SolutionFamily::parameters(const Vector& x, Real& T, Real& ax, Real& az) const {
+  if (orbit_) {
+    orbit_->parameters(x, T, ax, az);
+    return;
+  }
+  int n = equilibrium_->packing().size();
+  T = T_;
+  ax = xrel_ ? x[n++] : 0.0;
+  az = zrel_ ? x[n++] : 0.0;
+}
+
+/**************************************************************************
+ * ArclengthProblem
+ **************************************************************************/
+
+// G(x; mu) and the arclength condition <t, X - Xp> = 0 on X = (x, mu). The
+// column dG/dmu of the Jacobian is a forward difference in mu, kept for the
+// X it was taken at, so that the JVPs of a Newton step share it.
+class ArclengthProblem : public NewtonProblem {
+public:
+  ArclengthProblem(ProblemFamily& family, const Vector& Xp, const Vector& t);
+
+  int size() const;
+  void residual(const Vector& X, Vector& G);
+  void jacobian(const Vector& X, const Vector& GX, const Vector& dX, Vector& dG);
+
+private:
+  ProblemFamily& family_;
+  int n_;
+  const Vector& Xp_;
+  const Vector& t_;
+  Vector x_;
+  Vector g_;
+  Vector dx_;
+  Vector dg_;
+  Vector Xmu_;   // X of the mu column
+  Vector Gmu_;   // dG/dmu at Xmu_
+
+  void head(const Vector& X, Vector& x) const;  // x of X = (x, mu)
+};
+
+ArclengthProblem::ArclengthProblem(ProblemFamily& family, const Vector& Xp, const Vector& t)
+  :
+  family_(family),
+  n_(family.size()),
+  Xp_(Xp),
+  t_(t),
+  x_(n_),
+  g_(n_),
+  dx_(n_),
+  dg_(n_),
+  Gmu_(n_)
+{}
+
+int ArclengthProblem::size() const {
+  return n_ + 1;
+}
+
+void ArclengthProblem::head(const Vector& X, Vector& x) const {
+  memcpy(x.pointer(), X.pointer(), n_*sizeof(Real));
+}
+
+void ArclengthProblem::residual(const Vector& X, Vector& G) {
+  head(X, x_);
+  family_.problem(X[n_]).residual(x_, g_);
+  if (G.length() != n_ + 1)
+    G.resize(n_ + 1);
+  memcpy(G.pointer(), g_.pointer(), n_*sizeof(Real));
+  Real N = 0.0;
+  for (int i=0; i<=n_; ++i)
+    N += t_[i]*(X[i] - Xp_[i]);
+  G[n_] = N;
+}
+
+void ArclengthProblem::jacobian(const Vector& X, const Vector& GX, const Vector& dX,
+				Vector& dG) {
+  const Real mu = X[n_];
+  head(X, x_);
+  if (Xmu_.length() != n_ + 1 || memcmp(Xmu_.pointer(), X.pointer(), (n_+1)*sizeof(Real))) {
+    const Real h = epsDx*(fabs(mu) > 1.0 ? fabs(mu) : 1.0);
+    family_.problem(mu + h).residual(x_, Gmu_);
+    for (int i=0; i<n_; ++i)
+      Gmu_[i] = (Gmu_[i] - GX[i])/h;
+    Xmu_ = X;
+  }
+
+  head(GX, g_);
+  head(dX, dx_);
+  family_.problem(mu).jacobian(x_, g_, dx_, dg_);
+  if (dG.length() != n_ + 1)
+    dG.resize(n_ + 1);
+  axpy(dX[n_], Gmu_, dg_);
+  memcpy(dG.pointer(), dg_.pointer(), n_*sizeof(Real));
+  dG[n_] = dot(t_, dX);
+}
+
+/**************************************************************************
+ * Continuation
+ **************************************************************************/
+
+ContinuationFlags::ContinuationFlags()
+  :
+  history(4),
+  order(2),
+  ds(0.01),
+  dsMin(1e-5),
+  dsMax(0.1),
+  Ntarget(4),
+  verbose(true)
+{}
+
+Continuation::Continuation(ProblemFamily& family, const ContinuationFlags& flags,
+			   const NewtonFlags& newton)
+  :
+  family_(family),
+  flags_(flags),
+  newtonFlags_(newton),
+  newton_(newton, family.size() + 1),
+  n_(family.size()),
+  points_(0),
+  kept_(0),
+  xScale_(1.0),
+  muScale_(1.0),
+  ds_(flags.ds),
+  residual_(0.0),
+  iterations_(0),
+  applications_(0),
+  X_(flags.history > 1 ? flags.history : 1),
+  s_(X_.length()),
+  Xp_(n_ + 1),
+  t_(n_ + 1)
+{
+  if (flags_.order < 1 || flags_.order >= X_.length())
+    flags_.order = X_.length() - 1;
+}
+
+// The first point is converged on its own, by a NewtonKrylov of the family
+bool Continuation::start(Vector& x, Real mu) {
+  NewtonKrylov newton(newtonFlags_, n_);
+  const bool converged = newton.solve(family_.problem(mu), x);
+  residual_ = newton.residual();
+  iterations_ = newton.iterations();
+  applications_ = newton.applications();
+  if (!converged)
+    return false;
+
+  const Real xnorm = sqrt(dot(x, x));
+  xScale_ = (xnorm > 0.0) ? 1.0/xnorm : 1.0;
+  muScale_ = (mu != 0.0) ? 1.0/fabs(mu) : 1.0;
+  Vector& X = X_[0];
+  X.resize(n_ + 1);
+  memcpy(X.pointer(), x.pointer(), n_*sizeof(Real));
+  X[n_] = mu;
+  s_[0] = 0.0;
+  X0_ = x;
+  kept_ = 1;
+  points_ = 1;
+  return true;
+}
+
+// The Lagrange polynomial through the newest order+1 points, and its
+// derivative, at s. From one point, a step ds in mu alone.
+void Continuation::predict(Real s) {
+  if (kept_ == 1) {
+    Xp_ = X_[0];
+    Xp_[n_] += ds_/muScale_;
+    t_.setToZero();
+    t_[n_] = muScale_;
+    return;
+  }
+
+  const int d = (flags_.order < kept_ - 1) ? flags_.order : kept_ - 1;
+  Xp_.setToZero();
+  t_.setToZero();
+  for (int i=0; i<=d; ++i) {
+    Real L = 1.0;
+    Real dL = 0.0;
+    for (int j=0; j<=d; ++j) {
+      if (j == i)
+	continue;
+      Real p = 1.0/(s_[i] - s_[j]);
+      for (int k=0; k<=d; ++k)
+	if (k != i && k != j)
+	  p *= (s - s_[k])/(s_[i] - s_[k]);
+      dL += p;
+      L *= (s - s_[j])/(s_[i] - s_[j]);
+    }
+    axpy(L, X_[i], Xp_);
+    axpy(dL, X_[i], t_);
+  }
+
+  // t in the arclength inner product, W^2 t/|t|_W
+  Real tnorm = 0.0;
+  for (int i=0; i<n_; ++i) {
+    t_[i] *= xScale_;
+    tnorm += t_[i]*t_[i];
+  }
+  t_[n_] *= muScale_;
+  tnorm = sqrt(tnorm + t_[n_]*t_[n_]);
+  for (int i=0; i<n_; ++i)
+    t_[i] *= xScale_/tnorm;
+  t_[n_] *= muScale_/tnorm;
+}
+
+Real Continuation::distance(const Vector& X, const Vector& Y) const {
+  Real dx2 = 0.0;
+  for (int i=0; i<n_; ++i)
+    dx2 += (X[i] - Y[i])*(X[i] - Y[i]);
+  const Real dmu = (X[n_] - Y[n_])*muScale_;
+  return sqrt(dx2*xScale_*xScale_ + dmu*dmu);
+}
+
+// The first step may have ds < 0, to go down in mu; after it the branch is
+// parametrized by increasing s.
+bool Continuation::step() {
+  if (points_ == 0)
+    cferror("Continuation::step : no first point, call start()");
+
+  Vector X;
+  for (;;) {
+    predict(s_[0] + fabs(ds_));
+    ArclengthProblem p(family_, Xp_, t_);
+    X = Xp_;
+    const bool converged = newton_.solve(p, X);
+    residual_ = newton_.residual();
+    iterations_ = newton_.iterations();
+    applications_ = newton_.applications();
+    if (converged)
+      break;
+    if (0.5*fabs(ds_) < flags_.dsMin) {
+      if (flags_.verbose)
+	cout << "continuation: no convergence at ds == " << ds_ << ", stopping" << endl;
+      return false;
+    }
+    ds_ *= 0.5;
+    if (flags_.verbose)
+      cout << "continuation: no convergence, retrying with ds == " << ds_ << endl;
+  }
+
+  const Real s = s_[0] + distance(X, X_[0]);
+  const int kept = (kept_ < X_.length()) ? kept_ + 1 : kept_;
+  for (int i=kept-1; i>0; --i) {
+    X_[i] = X_[i-1];
+    s_[i] = s_[i-1];
+  }
+  X_[0] = X;
+  s_[0] = s;
+  kept_ = kept;
+  ++points_;
+  memcpy(X0_.pointer(), X.pointer(), n_*sizeof(Real));
+
+  ds_ = fabs(ds_);
+  if (iterations_ < flags_.Ntarget)
+    ds_ = (1.5*ds_ < flags_.dsMax) ? 1.5*ds_ : flags_.dsMax;
+  else if (iterations_ > flags_.Ntarget)
+    ds_ = (0.5*ds_ > flags_.dsMin) ? 0.5*ds_ : flags_.dsMin;
+  if (flags_.verbose)
+    cout << "continuation point " << points_ - 1 << ": mu == " << X[n_]
+	 << ", s == " << s << ", " << iterations_ << " newton steps, "
+	 << applications_ << " jacobian applications, next ds == " << ds_ << endl;
+  return true;
+}
+
+int Continuation::points() const {
+  return points_;
+}
+
+const Vector& Continuation::x() const {
+  return X0_;
+}
+
+Real Continuation::mu() const {
+  return X_[0][n_];
+}
+
+Real Continuation::arclength() const {
+  return s_[0];
+}
+
+Real Continuation::ds() const {
+  return ds_;
+}
+
+Real Continuation::residual() const {
+  return residual_;
+}
+
+int Continuation::iterations() const {
+  return iterations_;
+}
+
+int Continuation::applications() const {
+  return applications_;
+}
+
+const ContinuationFlags& Continuation::flags() const {
+  return flags_;
+}
+
+} //namespace channelflow
@@ -0,0 +1,144 @@
+// continuation.h: pseudo-arclength continuation of solution branches
+
+#ifndef CHFLOW_EXT_CONTINUATION_H
+#define CHFLOW_EXT_CONTINUATION_H
+
+#include <string>
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "channelflow/vector.h"
+#include "channelflow/flowfield.h"
+#include "dnsext.h"
+#include "newton.h"
+#include "solutions.h"
+
+namespace channelflow {
+
+// A NewtonProblem G(x; mu) for each value of a parameter mu, on unknowns x
+// of the same length for all mu
+class ProblemFamily {
+public:
+  virtual ~ProblemFamily();
+  virtual int size() const = 0;
+  virtual NewtonProblem& problem(Real mu) = 0;  // valid until the next call
+};
+
+// SolutionFamily is the EquilibriumProblems, or with segments > 0 the
+// PeriodicOrbitProblems, of a fixed grid in Re or in the box length Lx or
+// Lz, rebuilt whenever mu changes. The packed spectral coefficients mean
+// the same field for every box, stretched.
+
+class SolutionFamily : public ProblemFamily {
+public:
+  enum Parameter {Reynolds, LengthX, LengthZ};
+  static Parameter parseParameter(const std::string& s);  // "Re", "Lx", "Lz"
+
+  // u's grid and box at Reynolds number Re; T is the time-T map of
+  // equilibria, or the initial period of orbits
+  SolutionFamily(const FlowField& u, Real Re, Real T, Real dt, const DNSExtFlags& flags,
+		 Parameter p, bool xrel=false, bool zrel=false, int segments=0);
+  ~SolutionFamily();
+
+  int size() const;
+  NewtonProblem& problem(Real mu);
+
+  Real parameter() const;  // mu of u, Re, Lx or Lz
+  // The field of x at mu (u_0 of an orbit), and its T, ax and az
+  void toField(const Vector& x, Real mu, FlowField& u);
+  void parameters(const Vector& x, Real& T, Real& ax, Real& az) const;
+
+private:
+  SolutionFamily(const SolutionFamily& f);             // unimplemented
+  SolutionFamily& operator=(const SolutionFamily& f);  // unimplemented
+
+  FlowField u_;
+  Real Re_;
+  Real T_;
+  Real dt_;
+  DNSExtFlags flags_;
+  Parameter p_;
+  bool xrel_;
+  bool zrel_;
+  int segments_;
+  Real mu_;
+  EquilibriumProblem* equilibrium_;
+  PeriodicOrbitProblem* orbit_;
+};
+
+// ContinuationFlags configures Continuation. Arclength is measured in the
+// relative norm |dx|^2/|x0|^2 + dmu^2/mu0^2 of the first point.
+class ContinuationFlags {
+public:
+  ContinuationFlags();
+
+  int history;       // solutions kept for the predictor
+  int order;         // degree of the polynomial predictor, < history
+  Real ds;           // initial arclength step
+  Real dsMin;        // a step that fails below this ends the branch
+  Real dsMax;
+  int Ntarget;       // Newton steps per point: fewer grow ds, more shrink it
+  bool verbose;
+};
+
+// Continuation follows a branch of solutions of G(x; mu) = 0 by
+// pseudo-arclength continuation. The last few points stay in memory, and
+// the next is predicted by extrapolating the polynomial in arclength s
+// through them (a natural-parameter step from the first point alone). The
+// corrector is NewtonKrylov on (x, mu) with G and the arclength condition
+// <t, (x, mu) - prediction> = 0, for t the polynomial's tangent, so it can
+// turn around folds. The derivative dG/dmu is a forward difference, once
+// per Newton step. One NewtonKrylov serves the whole branch, so with
+// NewtonFlags::Nrecycle its GMRES recycles the Krylov subspace of each
+// point's last solve into the next.
+
+class Continuation {
+public:
+  Continuation(ProblemFamily& family, const ContinuationFlags& flags,
+	       const NewtonFlags& newton);
+
+  // Converge x at mu, as the first point of the branch; true on success
+  bool start(Vector& x, Real mu);
+
+  // The next point along the branch; false if the Newton search failed
+  // down to ds = dsMin
+  bool step();
+
+  int points() const;           // on the branch so far
+  const Vector& x() const;      // of the last point
+  Real mu() const;
+  Real arclength() const;       // from the first point
+  Real ds() const;              // of the next step
+  Real residual() const;        // |G| of the last point
+  int iterations() const;       // Newton steps for the last point
+  int applications() const;     // Jacobian-vector products for the last point
+  const ContinuationFlags& flags() const;
+
+private:
+  Continuation(const Continuation& c);             // unimplemented
+  Continuation& operator=(const Continuation& c);  // unimplemented
+
+  ProblemFamily& family_;
+  ContinuationFlags flags_;
+  NewtonFlags newtonFlags_;
+  NewtonKrylov newton_;       // on (x, mu), for the whole branch
+  int n_;
+  int points_;
+  int kept_;
+  Real xScale_;
+  Real muScale_;
+  Real ds_;
+  Real residual_;
+  int iterations_;
+  int applications_;
+  array<Vector> X_;     // the last kept points (x, mu), newest first
+  array<Real> s_;       // and their arclengths
+  Vector X0_;           // the newest point, for x()
+  Vector Xp_;           // prediction
+  Vector t_;            // weighted unit tangent at the prediction
+
+  void predict(Real s);
+  Real distance(const Vector& X, const Vector& Y) const;  // in the arclength norm
+};
+
+} //namespace channelflow
+#endif
@@ -0,0 +1,899 @@
+// dnsext.cpp: DNS wrapper and algorithms with fused per-step diagnostics
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include "channelflow/utilfuncs.h"
+#include "dnsext.h"
+#include "etd.h"
+#include "imexrk.h"
+#include "gridtables.h"
+
+using namespace std;
+
+namespace channelflow {
+
+ChebyCoeff baseflowProfile(BaseFlow baseflow, int Ny, Real a, Real b) {
+  ChebyCoeff U(Ny, a, b, Spectral);
+  switch (baseflow) {
+  case PlaneCouette:
+    U[1] = 1.0;
+    break;
+  case Parabolic:
+    U[0] =  0.5;
+    U[2] = -0.5;
+    break;
+  default:
+    break;
+  }
+  return U;
+}
+
+Real cflNumber(Real cflfactor, Real dt, const DNSFlags& flags) {
+  return cflfactor*dt*(flags.dealias_xz() ? 2.0*pi/3.0 : pi);
+}
+
+DNSExtFlags::DNSExtFlags(const DNSFlags& flags)
+  :
+  DNSFlags(flags),
+  implicitBaseflow(false),
+  cx(0.0),
+  cz(0.0),
+  etdOrder(0),
+  lowStorageRK(false)
+{}
+
+bool DNSExtFlags::movingFrame() const {
+  return cx != 0.0 || cz != 0.0;
+}
+
+DNSGuard::DNSGuard()
+  :
+  snapshots(0),
+  CFLmax(0.0),
+  divNormMax(0.0),
+  energyMax(0.0),
+  dtFactor(0.5),
+  dtmin(0.0)
+{}
+
+bool DNSGuard::violated(const FlowDiagnostics& d, Real CFL) const {
+  const Real divNorm = sqrt(d.divNorm2);
+  if (!isfinite(CFL) || !isfinite(divNorm) || !isfinite(d.energy))
+    return true;
+  return (CFLmax > 0 && CFL > CFLmax)
+    || (divNormMax > 0 && divNorm > divNormMax)
+    || (energyMax > 0 && d.energy > energyMax);
+}
+
+/**************************************************************************
+ * FusedMultistepDNS
+ **************************************************************************/
+
+FusedMultistepDNS::FusedMultistepDNS()
+  :
+  MultistepDNS(),
+  f0valid_(false),
+  halved_(false)
+{}
+
+FusedMultistepDNS::FusedMultistepDNS(const FusedMultistepDNS& dns)
+  :
+  MultistepDNS(dns),
+  nl_(dns.nl_),
+  diag_(dns.diag_),
+  f0valid_(dns.f0valid_),
+  halved_(dns.halved_),
+  halving_(dns.halving_),
+  projector_(dns.projector_)
+{}
+
+FusedMultistepDNS::FusedMultistepDNS(const FlowField& u, const ChebyCoeff& Ubase,
+				     Real nu, Real dt, const DNSFlags& flags, Real t)
+  :
+  MultistepDNS(u, Ubase, nu, dt, flags, t),
+  nl_(u),
+  f0valid_(false),
+  halved_(false),
+  projector_(flags.symmetries, u.Nx(), u.Nz())
+{
+  const FieldSymmetry* s = halvingSymmetry(flags.symmetries);
+  if (s) {
+    halved_ = true;
+    halving_ = SpectralSymmetry(*s, Nx_, Nz_);
+  }
+}
+
+FusedMultistepDNS::~FusedMultistepDNS() {}
+
+FusedMultistepDNS& FusedMultistepDNS::operator=(const FusedMultistepDNS& dns) {
+  MultistepDNS::operator=(dns);
+  nl_ = dns.nl_;
+  diag_ = dns.diag_;
+  f0valid_ = dns.f0valid_;
+  halved_ = dns.halved_;
+  halving_ = dns.halving_;
+  projector_ = dns.projector_;
+  return *this;
+}
+
+DNSAlgorithm* FusedMultistepDNS::clone() const {
+  return new FusedMultistepDNS(*this);
+}
+
+bool FusedMultistepDNS::fused() {
+  return flags_.nonlinearity == Rotational && ubase_.isNull() && !flags_.dealias_y();
+}
+
+const FlowDiagnostics& FusedMultistepDNS::diagnostics() const {
+  return diag_;
+}
+
+int FusedMultistepDNS::countdown() const {
+  return countdown_;
+}
+
+void FusedMultistepDNS::saveHistory(const std::string& filebase) const {
+  for (int j=0; j<u_.length(); ++j) {
+    u_[j].binarySave(filebase + "_u" + i2s(j));
+    f_[j].binarySave(filebase + "_f" + i2s(j));
+  }
+}
+
+void FusedMultistepDNS::loadHistory(const std::string& filebase, int countdown,
+				    Real dPdxAct, Real UbulkAct) {
+  for (int j=0; j<u_.length(); ++j) {
+    FlowField uj(filebase + "_u" + i2s(j) + ".ff");
+    FlowField fj(filebase + "_f" + i2s(j) + ".ff");
+    if (!uj.congruent(u_[j]) || !fj.congruent(f_[j]))
+      cferror("FusedMultistepDNS::loadHistory : history fields do not match the grid");
+    u_[j] = uj;
+    f_[j] = fj;
+  }
+  countdown_ = countdown;
+  dPdxAct_ = dPdxAct;
+  UbulkAct_ = UbulkAct;
+  f0valid_ = false;
+}
+
+void FusedMultistepDNS::project() {
+  if (projector_.length() == 0)
+    return;
+  for (int j=0; j<u_.length(); ++j) {
+    u_[j].makeSpectral();
+    f_[j].makeSpectral();
+    projector_(u_[j]);
+    projector_(f_[j]);
+  }
+  f0valid_ = false;
+}
+
+void FusedMultistepDNS::operator *= (const FieldSymmetry& symm) {
+  MultistepDNS::operator*=(symm);
+  f0valid_ = false;
+}
+
+void FusedMultistepDNS::reset_dt(Real dt) {
+  MultistepDNS::reset_dt(dt);
+  f0valid_ = false;
+}
+
+bool FusedMultistepDNS::push(const FlowField& u) {
+  f0valid_ = false;
+  return MultistepDNS::push(u);
+}
+
+bool FusedMultistepDNS::current(const FlowField& u) const {
+  const FlowField& u0 = u_[0];
+  return f0valid_
+    && sameGeometry(u, u0)
+    && u.xzstate() == u0.xzstate() && u.ystate() == u0.ystate()
+    && memcmp(u.rawData(), u0.rawData(), u.rawDataLength()*sizeof(Real)) == 0;
+}
+
+void FusedMultistepDNS::advance(FlowField& u, FlowField& q, int Nsteps) {
+  if (!fused()) {
+    MultistepDNS::advance(u, q, Nsteps);
+    f0valid_ = false;
+    nl_.diagnose(u, Ubase_, diag_);
+    diag_.t = t_;
+    cfl_ = cflNumber(diag_.cflfactor, dt_, flags_);
+    return;
+  }
+
+  u.makeSpectral();
+  q.makeSpectral();
+  const int J = u_.length();
+
+  for (int n=0; n<Nsteps; ++n) {
+    // f_[0] was computed along with the previous step's diagnostics,
+    // unless u has been changed since.
+    if (!current(u)) {
+      u_[0] = u;
+      nonlinear(u_[0], f_[0]);
+    }
+    solve(u, q);
+
+    for (int j=J-1; j>0; --j) {
+      swap(u_[j], u_[j-1]);
+      swap(f_[j], f_[j-1]);
+    }
+    t_ += dt_;
+
+    // Nonlinear term for the next step and diagnostics of u(t) in one pass
+    u_[0] = u;
+    nonlinear(u_[0], f_[0], &diag_);
+    diag_.t = t_;
+    f0valid_ = true;
+  }
+  if (flags_.dealias_xz())
+    u.setPadded(true);
+  cfl_ = cflNumber(diag_.cflfactor, dt_, flags_);
+}
+
+// One SBDF step: for each mode solve
+//   nu u'' - lambda u - grad P = -R,  R = -sum_j (alpha_j/dt u_j + beta_j f_j)
+// as MultistepDNS does, writing u(t+dt) into u and P into q.
+void FusedMultistepDNS::solve(FlowField& u, FlowField& q) {
+  const int J = alpha_.length();
+  const int Ny = Ny_;
+  const int Mx = Mx_;
+  const int Mz = Mz_;
+  const int ystride = 2*Mx*Mz;   // Reals between successive ny
+  const int istride = Ny*ystride; // Reals between components
+
+  ChebyCoeff Uyy(Ubaseyy_);
+  if (Uyy.N() == Ny)
+    Uyy.makeSpectral();
+
+  array<const Real*> up(J);
+  array<const Real*> fp(J);
+  for (int j=0; j<J; ++j) {
+    up[j] = u_[j].rawData();
+    fp[j] = f_[j].rawData();
+  }
+  Real* ud = u.rawData();
+  Real* qd = q.rawData();
+
+#pragma omp parallel
+  {
+    ComplexChebyCoeff uk(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff vk(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff wk(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff Pk(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff Rx(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff Ry(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff Rz(Ny, a_, b_, Spectral);
+
+#pragma omp for schedule(dynamic)
+    for (int m=0; m<Mx*Mz; ++m) {
+      const int mx = m / Mz;
+      const int mz = m % Mz;
+      const int kx = u.kx(mx);
+      const int kz = u.kz(mz);
+      const int o = 2*m;
+
+      // Aliased and Nyquist modes are zeroed (no tausolvers for the latter)
+      if (isAliasedMode(kx, kz) || kx == Nx_/2 || kz == Nz_/2) {
+	for (int ny=0; ny<Ny; ++ny) {
+	  const int r = o + ny*ystride;
+	  for (int i=0; i<3; ++i)
+	    ud[r + i*istride] = ud[r + i*istride + 1] = 0.0;
+	  qd[r] = qd[r+1] = 0.0;
+	}
+	continue;
+      }
+      if (halved_ && kx < 0)
+	continue;
+
+      for (int ny=0; ny<Ny; ++ny) {
+	const int r = o + ny*ystride;
+	Real rx[2] = {0.0, 0.0};
+	Real ry[2] = {0.0, 0.0};
+	Real rz[2] = {0.0, 0.0};
+	for (int j=0; j<J; ++j) {
+	  const Real a = -alpha_[j]/dt_;
+	  const Real b = -beta_[j];
+	  const Real* uj = up[j] + r;
+	  const Real* fj = fp[j] + r;
+	  for (int c=0; c<2; ++c) {
+	    rx[c] += a*uj[c]           + b*fj[c];
+	    ry[c] += a*uj[c+istride]   + b*fj[c+istride];
+	    rz[c] += a*uj[c+2*istride] + b*fj[c+2*istride];
+	  }
+	}
+	Rx.re[ny] = rx[0]; Rx.im[ny] = rx[1];
+	Ry.re[ny] = ry[0]; Ry.im[ny] = ry[1];
+	Rz.re[ny] = rz[0]; Rz.im[ny] = rz[1];
+      }
+
+      if (kx == 0 && kz == 0) {
+	if (Uyy.N() == Ny)
+	  for (int ny=0; ny<Ny; ++ny)
+	    Rx.re[ny] += nu_*Uyy[ny];
+
+	if (flags_.constraint == PressureGradient) {
+	  Rx.re[0] -= dPdxRef_;
+	  tausolver_[mx][mz].solve(uk, vk, wk, Pk, Rx, Ry, Rz);
+	  dPdxAct_ = dPdxRef_;
+	}
+	else
+	  tausolver_[mx][mz].solve(uk, vk, wk, Pk, dPdxAct_, Rx, Ry, Rz,
+				   UbulkRef_ - UbulkBase_);
+	UbulkAct_ = UbulkBase_ + uk.re.mean();
+      }
+      else
+	solveMode(mx, mz, uk, vk, wk, Pk, Rx, Ry, Rz);
+
+      for (int ny=0; ny<Ny; ++ny) {
+	const int r = o + ny*ystride;
+	ud[r]   = uk.re[ny]; ud[r+1] = uk.im[ny];
+	ud[r+istride]   = vk.re[ny]; ud[r+istride+1]   = vk.im[ny];
+	ud[r+2*istride] = wk.re[ny]; ud[r+2*istride+1] = wk.im[ny];
+	qd[r]   = Pk.re[ny]; qd[r+1] = Pk.im[ny];
+      }
+    }
+  }
+  if (halved_)
+    fillHalved(u, q);
+}
+
+// The kx < 0 modes of u and q from their kx > 0 partners: by the halving
+// symmetry, or at kz == 0 as complex conjugates
+void FusedMultistepDNS::fillHalved(FlowField& u, FlowField& q) const {
+  const int Ny = Ny_;
+  const int Mx = Mx_;
+  const int Mz = Mz_;
+  const int ystride = 2*Mx*Mz;
+  const int istride = Ny*ystride;
+  Real* ud = u.rawData();
+  Real* qd = q.rawData();
+
+#pragma omp parallel for schedule(dynamic)
+  for (int m=0; m<Mx*Mz; ++m) {
+    const int mx = m / Mz;
+    const int mz = m % Mz;
+    const int kx = u.kx(mx);
+    const int kz = u.kz(mz);
+    if (kx >= 0 || isAliasedMode(kx, kz) || kz == Nz_/2)
+      continue;
+    if (kz != 0) {
+      halving_.apply(m, ud, ud, 3, Ny);
+      halving_.apply(m, qd, qd, 1, Ny);
+      continue;
+    }
+    const int o = 2*m;
+    const int os = 2*(u.mx(-kx)*Mz);
+    for (int ny=0; ny<Ny; ++ny) {
+      const int r = ny*ystride;
+      for (int i=0; i<3; ++i) {
+	ud[o + r + i*istride]     =  ud[os + r + i*istride];
+	ud[o + r + i*istride + 1] = -ud[os + r + i*istride + 1];
+      }
+      qd[o + r]     =  qd[os + r];
+      qd[o + r + 1] = -qd[os + r + 1];
+    }
+  }
+}
+
+void FusedMultistepDNS::nonlinear(const FlowField& u, FlowField& f,
+				  FlowDiagnostics* diag) {
+  nl_(u, Ubase_, f, diag);
+}
+
+void FusedMultistepDNS::solveMode(int mx, int mz, ComplexChebyCoeff& u,
+				  ComplexChebyCoeff& v, ComplexChebyCoeff& w,
+				  ComplexChebyCoeff& P, const ComplexChebyCoeff& Rx,
+				  const ComplexChebyCoeff& Ry,
+				  const ComplexChebyCoeff& Rz) const {
+  tausolver_[mx][mz].solve(u, v, w, P, Rx, Ry, Rz);
+}
+
+/**************************************************************************
+ * BaseflowImplicitDNS
+ **************************************************************************/
+
+BaseflowImplicitDNS::BaseflowImplicitDNS()
+  :
+  FusedMultistepDNS(),
+  implicitBaseflow_(false),
+  cx_(0.0),
+  cz_(0.0)
+{}
+
+BaseflowImplicitDNS::BaseflowImplicitDNS(const BaseflowImplicitDNS& dns)
+  :
+  FusedMultistepDNS(dns),
+  implicitBaseflow_(dns.implicitBaseflow_),
+  cx_(dns.cx_),
+  cz_(dns.cz_),
+  ops_(dns.ops_),
+  solver_(dns.solver_),
+  implicit_(dns.implicit_)
+{}
+
+BaseflowImplicitDNS::BaseflowImplicitDNS(const FlowField& u, const ChebyCoeff& Ubase,
+					 Real nu, Real dt, const DNSExtFlags& flags,
+					 Real t)
+  :
+  FusedMultistepDNS(u, Ubase, nu, dt, flags, t),
+  implicitBaseflow_(flags.implicitBaseflow),
+  cx_(flags.cx),
+  cz_(flags.cz),
+  ops_(flags.implicitBaseflow ? Ubase : ChebyCoeff(u.Ny(), u.a(), u.b(), Spectral), u.Ny())
+{
+  if (!fused())
+    cferror("BaseflowImplicitDNS: needs Rotational nonlinearity about Ubase, without y dealiasing");
+  factor();
+}
+
+BaseflowImplicitDNS::~BaseflowImplicitDNS() {}
+
+BaseflowImplicitDNS& BaseflowImplicitDNS::operator=(const BaseflowImplicitDNS& dns) {
+  FusedMultistepDNS::operator=(dns);
+  implicitBaseflow_ = dns.implicitBaseflow_;
+  cx_ = dns.cx_;
+  cz_ = dns.cz_;
+  ops_ = dns.ops_;
+  solver_ = dns.solver_;
+  implicit_ = dns.implicit_;
+  return *this;
+}
+
+DNSAlgorithm* BaseflowImplicitDNS::clone() const {
+  return new BaseflowImplicitDNS(*this);
+}
+
+bool BaseflowImplicitDNS::implicitBaseflow() const {
+  return implicitBaseflow_;
+}
+
+// A solver for each mode that solve() passes to solveMode
+void BaseflowImplicitDNS::factor() {
+  const int Mxz = Mx_*Mz_;
+  solver_.resize(Mxz);
+  implicit_.resize(Mxz);
+
+#pragma omp parallel for schedule(dynamic)
+  for (int m=0; m<Mxz; ++m) {
+    const int mx = m / Mz_;
+    const int mz = m % Mz_;
+    const int kx = (mx <= Nx_/2) ? mx : mx - Nx_;
+    const int kz = mz;
+    implicit_[m] = !(isAliasedMode(kx, kz) || kx == Nx_/2 || kz == Nz_/2
+		     || (kx == 0 && kz == 0));
+    if (implicit_[m]) {
+      const Real alpha = 2*pi*kx/Lx_;
+      const Real gamma = 2*pi*kz/Lz_;
+      const Real lambda = eta_/dt_ + nu_*(alpha*alpha + gamma*gamma);
+      solver_[m] = BaseflowTauSolver(kx, kz, Lx_, Lz_, lambda, nu_, ops_, cx_, cz_);
+    }
+  }
+}
+
+void BaseflowImplicitDNS::reset_dt(Real dt) {
+  FusedMultistepDNS::reset_dt(dt);
+  factor();
+}
+
+// The library pushes f = N(u) including the base-flow advection
+bool BaseflowImplicitDNS::push(const FlowField& u) {
+  const bool full = FusedMultistepDNS::push(u);
+  if (!implicitBaseflow_)
+    return full;
+  u_[0].makeSpectral();
+  f_[0].makeSpectral();
+  subtractAdvection(u_[0], f_[0]);
+  return full;
+}
+
+void BaseflowImplicitDNS::nonlinear(const FlowField& u, FlowField& f,
+				    FlowDiagnostics* diag) {
+  FusedMultistepDNS::nonlinear(u, f, diag);
+  if (implicitBaseflow_)
+    subtractAdvection(u, f);
+}
+
+void BaseflowImplicitDNS::subtractAdvection(const FlowField& u, FlowField& f) const {
+  assert(u.xzstate() == Spectral && u.ystate() == Spectral);
+  assert(f.xzstate() == Spectral && f.ystate() == Spectral);
+  const int Ny = Ny_;
+  const int Mxz = Mx_*Mz_;
+  const int ystride = 2*Mxz;
+  const int istride = Ny*ystride;
+  const Real* ud = u.rawData();
+  Real* fd = f.rawData();
+
+#pragma omp parallel
+  {
+    ComplexChebyCoeff uk(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff vk(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff wk(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff Bx(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff By(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff Bz(Ny, a_, b_, Spectral);
+
+#pragma omp for schedule(dynamic)
+    for (int m=0; m<Mxz; ++m) {
+      if (!implicit_[m])
+	continue;
+      const int o = 2*m;
+      for (int ny=0; ny<Ny; ++ny) {
+	const int r = o + ny*ystride;
+	uk.re[ny] = ud[r];           uk.im[ny] = ud[r+1];
+	vk.re[ny] = ud[r+istride];   vk.im[ny] = ud[r+istride+1];
+	wk.re[ny] = ud[r+2*istride]; wk.im[ny] = ud[r+2*istride+1];
+      }
+      // B(u) less the frame advection -i sc u, which f never contained
+      solver_[m].advection(uk, vk, wk, Bx, By, Bz);
+      const BaseflowTauSolver& s = solver_[m];
+      const Real sc = -(2*pi*s.kx()/Lx_*cx_ + 2*pi*s.kz()/Lz_*cz_);
+      for (int ny=0; ny<Ny; ++ny) {
+	const int r = o + ny*ystride;
+	fd[r]   -= Bx.re[ny] + sc*uk.im[ny];
+	fd[r+1] -= Bx.im[ny] - sc*uk.re[ny];
+	fd[r+istride]   -= By.re[ny] + sc*vk.im[ny];
+	fd[r+istride+1] -= By.im[ny] - sc*vk.re[ny];
+	fd[r+2*istride]   -= Bz.re[ny] + sc*wk.im[ny];
+	fd[r+2*istride+1] -= Bz.im[ny] - sc*wk.re[ny];
+      }
+    }
+  }
+}
+
+void BaseflowImplicitDNS::solveMode(int mx, int mz, ComplexChebyCoeff& u,
+				    ComplexChebyCoeff& v, ComplexChebyCoeff& w,
+				    ComplexChebyCoeff& P, const ComplexChebyCoeff& Rx,
+				    const ComplexChebyCoeff& Ry,
+				    const ComplexChebyCoeff& Rz) const {
+  solver_[mx*Mz_ + mz].solve(u, v, w, P, Rx, Ry, Rz);
+}
+
+/**************************************************************************
+ * DNSExt
+ **************************************************************************/
+
+DNSExt::DNSExt(const FlowField& u, Real nu, Real dt, const DNSExtFlags& flags, Real t)
+  :
+  main_algorithm_(0),
+  init_algorithm_(0),
+  flags_(flags),
+  Ubase_(baseflowProfile(flags.baseflow, u.Ny(), u.a(), u.b())),
+  nl_(u),
+  projector_(flags.symmetries, u.Nx(), u.Nz()),
+  ringHead_(0),
+  ringCount_(0),
+  rollbacks_(0),
+  restartTime_(t)
+{
+  init(u, nu, dt, t);
+}
+
+DNSExt::DNSExt(const FlowField& u, const ChebyCoeff& Ubase,
+	       Real nu, Real dt, const DNSExtFlags& flags, Real t)
+  :
+  main_algorithm_(0),
+  init_algorithm_(0),
+  flags_(flags),
+  Ubase_(Ubase),
+  nl_(u),
+  projector_(flags.symmetries, u.Nx(), u.Nz()),
+  ringHead_(0),
+  ringCount_(0),
+  rollbacks_(0),
+  restartTime_(t)
+{
+  init(u, nu, dt, t);
+}
+
+DNSExt::~DNSExt() {
+  delete main_algorithm_;
+  delete init_algorithm_;
+  main_algorithm_ = 0;
+  init_algorithm_ = 0;
+}
+
+void DNSExt::init(const FlowField& u, Real nu, Real dt, Real t) {
+  const DNSExtFlags& flags = flags_;
+  main_algorithm_ = newAlgorithm(u, Ubase_, nu, dt, flags, t);
+
+  initStepping();
+  diagnose(u);
+}
+
+void DNSExt::initStepping() {
+  const DNSAlgorithm& m = *main_algorithm_;
+  const DNSExtFlags& flags = flags_;
+  if (m.full() || init_algorithm_ || flags.initstepping == flags.timestepping)
+    return;
+  DNSExtFlags initflags = flags;
+  initflags.timestepping = flags.initstepping;
+  FlowField u(m.Nx(), m.Ny(), m.Nz(), 3, m.Lx(), m.Lz(), m.a(), m.b());
+  init_algorithm_ = newAlgorithm(u, Ubase_, m.nu(), m.dt(), initflags, m.time());
+  if (init_algorithm_->Ninitsteps() != 0)
+    cferror("DNSExt: initstepping algorithm must be self-starting");
+}
+
+DNSAlgorithm* DNSExt::newAlgorithm(const FlowField& u, const ChebyCoeff& Ubase,
+				   Real nu, Real dt, const DNSExtFlags& flags, Real t) {
+  if (flags.etdOrder != 0)
+    return new ETDDNS(u, Ubase, nu, dt, flags, t);
+  if (flags.lowStorageRK)
+    return new IMEXRK3DNS(u, Ubase, nu, dt, flags, t);
+
+  DNSAlgorithm* alg = 0;
+  switch (flags.timestepping) {
+  case CNFE1:
+  case SBDF1:
+  case SBDF2:
+  case SBDF3:
+  case SBDF4:
+    if (flags.implicitBaseflow || flags.movingFrame())
+      alg = new BaseflowImplicitDNS(u, Ubase, nu, dt, flags, t);
+    else
+      alg = new FusedMultistepDNS(u, Ubase, nu, dt, flags, t);
+    break;
+  case CNRK2:
+    alg = new RungeKuttaDNS(u, Ubase, nu, dt, flags, t);
+    break;
+  case CNAB2:
+  case SMRK2:
+    alg = new CNABstyleDNS(u, Ubase, nu, dt, flags, t);
+    break;
+  default:
+    cferror("DNSExt::newAlgorithm : unknown timestepping method");
+  }
+  return alg;
+}
+
+void DNSExt::diagnose(const FlowField& u) {
+  nl_.diagnose(u, Ubase_, diag_);
+  diag_.t = time();
+}
+
+void DNSExt::setGuard(const DNSGuard& guard) {
+  if (guard.snapshots > 0 && (guard.dtFactor <= 0 || guard.dtFactor >= 1))
+    cferror("DNSExt::setGuard : dtFactor must be in (0,1)");
+  guard_ = guard;
+  ring_.resize(guard.snapshots > 0 ? guard.snapshots : 0);
+  ringTime_.resize(ring_.length());
+
+  // Snapshots of the DNS's geometry, so that advance builds no FFTW plans
+  const DNSAlgorithm& m = *main_algorithm_;
+  for (int k=0; k<ring_.length(); ++k)
+    if (ring_[k].Nx() != m.Nx() || ring_[k].Ny() != m.Ny() || ring_[k].Nz() != m.Nz())
+      ring_[k] = FlowField(m.Nx(), m.Ny(), m.Nz(), 3, m.Lx(), m.Lz(), m.a(), m.b());
+  ringHead_ = 0;
+  ringCount_ = 0;
+}
+
+const DNSGuard& DNSExt::guard() const {
+  return guard_;
+}
+
+int DNSExt::rollbacks() const {
+  return rollbacks_;
+}
+
+Real DNSExt::restartTime() const {
+  return restartTime_;
+}
+
+void DNSExt::advance(FlowField& u, FlowField& q, int nSteps) {
+  const int K = ring_.length();
+  restartTime_ = time();
+  if (K == 0 || nSteps == 0) {
+    step(u, q, nSteps);
+    return;
+  }
+
+  ringHead_ = (ringHead_ + 1) % K;
+  copyFast(u, ring_[ringHead_]);
+  ringTime_[ringHead_] = time();
+  if (ringCount_ < K)
+    ++ringCount_;
+
+  const Real tend = time() + nSteps*dt();
+  step(u, q, nSteps);
+  for (int k=0; guard_.violated(diag_, CFL()); ++k) {
+    const Real dtnew = guard_.dtFactor*dt();
+    if (dtnew < guard_.dtmin)
+      cferror("DNSExt::advance : blow-up guard violated, dt would fall below dtmin");
+
+    // The first retry starts from the latest snapshot; each further one
+    // drops it and starts one further back, while there is one
+    if (k > 0 && ringCount_ > 1) {
+      ringHead_ = (ringHead_ + K - 1) % K;
+      --ringCount_;
+    }
+    const Real t0 = ringTime_[ringHead_];
+    copyFast(ring_[ringHead_], u);
+    restartTime_ = t0;
+    ++rollbacks_;
+
+    const int n = iround((tend - t0)/dtnew) > 0 ? iround((tend - t0)/dtnew) : 1;
+    reset_dt((tend - t0)/n);
+    reset_time(t0);
+    step(u, q, n);
+  }
+}
+
+void DNSExt::step(FlowField& u, FlowField& q, int nSteps) {
+  assert(main_algorithm_);
+  if (!main_algorithm_->full() && !init_algorithm_)
+    cferror("DNSExt::advance : main algorithm is not initialized and there is no init algorithm");
+
+  if (!q.geomCongruent(u) || q.Nd() != 1)
+    q.resize(u.Nx(), u.Ny(), u.Nz(), 1, u.Lx(), u.Lz(), u.a(), u.b());
+
+  // Initialization steps by a library algorithm are in the lab frame, which
+  // then moves by c dt
+  const FieldSymmetry frameshift(flags_.cx*dt()/u.Lx(), flags_.cz*dt()/u.Lz());
+
+  int n = 0;
+  for (; n<nSteps && !main_algorithm_->full(); ++n) {
+    init_algorithm_->advance(u, q, 1);
+    if (flags_.movingFrame()) {
+      u *= frameshift;
+      q *= frameshift;
+    }
+    main_algorithm_->push(u);
+    if (main_algorithm_->full()) {
+      delete init_algorithm_;
+      init_algorithm_ = 0;
+    }
+  }
+  if (n < nSteps)
+    main_algorithm_->advance(u, q, nSteps-n);
+
+  const array<FieldSymmetry>& symm = main_algorithm_->flags().symmetries;
+  main_algorithm_->project();
+  if (projector_.length() > 0) {
+    u.makeSpectral();
+    q.makeSpectral();
+    projector_(u);
+    projector_(q);
+  }
+
+  // Use the diagnostics from the last fused step if it produced this u
+  FusedMultistepDNS* fused = dynamic_cast<FusedMultistepDNS*>(main_algorithm_);
+  ETDDNS* etd = dynamic_cast<ETDDNS*>(main_algorithm_);
+  IMEXRK3DNS* rk = dynamic_cast<IMEXRK3DNS*>(main_algorithm_);
+  if (fused && n < nSteps && symm.length() == 0)
+    diag_ = fused->diagnostics();
+  else if (etd && n < nSteps && symm.length() == 0)
+    diag_ = etd->diagnostics();
+  else if (rk && n < nSteps && symm.length() == 0)
+    diag_ = rk->diagnostics();
+  else
+    diagnose(u);
+}
+
+void DNSExt::project() {
+  main_algorithm_->project();
+  if (init_algorithm_)
+    init_algorithm_->project();
+}
+
+void DNSExt::operator *= (const FieldSymmetry& symm) {
+  *main_algorithm_ *= symm;
+  if (init_algorithm_)
+    *init_algorithm_ *= symm;
+}
+
+void DNSExt::reset_dt(Real dt) {
+  main_algorithm_->reset_dt(dt);
+  if (init_algorithm_)
+    init_algorithm_->reset_dt(dt);
+
+  // A reset multistep algorithm needs initialization steps again
+  initStepping();
+}
+
+void DNSExt::saveState(const string& filebase, const FlowField& u) const {
+  const FusedMultistepDNS* fused = dynamic_cast<const FusedMultistepDNS*>(main_algorithm_);
+  ofstream os((filebase + ".state").c_str());
+  os << setprecision(17);
+  os << "timestepping " << int(main_algorithm_->timestepping()) << '\n'
+     << "t " << time() << '\n'
+     << "dt " << dt() << '\n'
+     << "dPdx " << dPdx() << '\n'
+     << "Ubulk " << Ubulk() << '\n'
+     << "countdown " << (fused ? fused->countdown() : 0) << '\n'
+     << "history " << (fused ? 1 : 0) << '\n';
+  if (!os.good())
+    cferror("DNSExt::saveState : can't write " + filebase + ".state");
+  FlowField us(u);
+  us.makeSpectral();
+  us.binarySave(filebase + "_u");
+  if (fused)
+    fused->saveHistory(filebase);
+}
+
+void DNSExt::loadState(const string& filebase, FlowField& u) {
+  ifstream is((filebase + ".state").c_str());
+  if (!is.good())
+    cferror("DNSExt::loadState : can't open " + filebase + ".state");
+  map<string, Real> state;
+  string key;
+  Real value;
+  while (is >> key >> value)
+    state[key] = value;
+  const char* keys[] = {"timestepping", "t", "dt", "dPdx", "Ubulk", "countdown", "history"};
+  for (int k=0; k<7; ++k)
+    if (state.find(keys[k]) == state.end())
+      cferror("DNSExt::loadState : " + filebase + ".state lacks " + keys[k]);
+  if (int(state["timestepping"]) != int(main_algorithm_->timestepping()))
+    cferror("DNSExt::loadState : state was written by a different time-stepping method");
+
+  FusedMultistepDNS* fused = dynamic_cast<FusedMultistepDNS*>(main_algorithm_);
+  if (bool(state["history"] != 0) != bool(fused))
+    cferror("DNSExt::loadState : state was written by a different algorithm");
+
+  u = FlowField(filebase + "_u.ff");
+  if (dt() != state["dt"])
+    reset_dt(state["dt"]);
+  reset_time(state["t"]);
+  if (fused) {
+    fused->loadHistory(filebase, int(state["countdown"]), state["dPdx"], state["Ubulk"]);
+    if (fused->full()) {
+      delete init_algorithm_;
+      init_algorithm_ = 0;
+    }
+    else
+      initStepping();
+  }
+  diagnose(u);
+}
+
+void DNSExt::reset_time(Real t) {
+  main_algorithm_->reset_time(t);
+  if (init_algorithm_)
+    init_algorithm_->reset_time(t);
+  diag_.t = t;
+}
+
+void DNSExt::reset_dPdx(Real dPdx) {
+  main_algorithm_->reset_dPdx(dPdx);
+  if (init_algorithm_)
+    init_algorithm_->reset_dPdx(dPdx);
+}
+
+void DNSExt::reset_Ubulk(Real Ubulk) {
+  main_algorithm_->reset_Ubulk(Ubulk);
+  if (init_algorithm_)
+    init_algorithm_->reset_Ubulk(Ubulk);
+}
+
+bool DNSExt::push(const FlowField& u) {
+  if (init_algorithm_)
+    init_algorithm_->push(u);
+  return main_algorithm_->push(u);
+}
+
+bool DNSExt::full() const {return main_algorithm_->full();}
+int DNSExt::order() const {return main_algorithm_->order();}
+int DNSExt::Ninitsteps() const {return main_algorithm_->Ninitsteps();}
+Real DNSExt::nu() const {return main_algorithm_->nu();}
+Real DNSExt::dt() const {return main_algorithm_->dt();}
+Real DNSExt::time() const {return main_algorithm_->time();}
+Real DNSExt::dPdx() const {return main_algorithm_->dPdx();}
+Real DNSExt::Ubulk() const {return main_algorithm_->Ubulk();}
+Real DNSExt::dPdxRef() const {return main_algorithm_->dPdxRef();}
+Real DNSExt::UbulkRef() const {return main_algorithm_->UbulkRef();}
+const DNSExtFlags& DNSExt::flags() const {return flags_;}
+const ChebyCoeff& DNSExt::Ubase() const {return Ubase_;}
+TimeStepMethod DNSExt::timestepping() const {return main_algorithm_->timestepping();}
+const FlowDiagnostics& DNSExt::diagnostics() const {return diag_;}
+
+// With implicit base-flow advection only the fluctuation is advected
+// explicitly. That depends on the algorithm in use, not on the flags alone.
+Real DNSExt::CFL() const {
+  const BaseflowImplicitDNS* implicit = dynamic_cast<const BaseflowImplicitDNS*>(main_algorithm_);
+  const bool fluct = implicit && implicit->implicitBaseflow();
+  const Real c = fluct ? diag_.cflfactorFluct : diag_.cflfactor;
+  return cflNumber(c, dt(), flags_);
+}
+
+} //namespace channelflow
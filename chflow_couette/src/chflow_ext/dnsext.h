@@ -0,0 +1,290 @@
+// dnsext.h: DNS wrapper and algorithms with fused per-step diagnostics
+
+#ifndef CHFLOW_EXT_DNSEXT_H
+#define CHFLOW_EXT_DNSEXT_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/chebyshev.h"
+#include "channelflow/flowfield.h"
+#include "channelflow/dns.h"
+#include "nonlinear.h"
+#include "baseflowsolver.h"
+#include "symmetry.h"
+
+namespace channelflow {
+
+// DNSExtFlags adds the options of the chflow_ext algorithms to DNSFlags.
+// It converts from DNSFlags with the options off, so DNSExt accepts either.
+class DNSExtFlags : public DNSFlags {
+public:
+  DNSExtFlags(const DNSFlags& flags = DNSFlags());
+
+  // Base-flow advection U du/dx + v U' ex implicit, in BaseflowImplicitDNS.
+  // The advective CFL number is then that of the fluctuation alone.
+  bool implicitBaseflow;
+
+  // Velocity of the frame of reference, in which u(x,y,z,t) is the lab-frame
+  // field at (x + cx t, y, z + cz t). The frame advection is implicit, in
+  // BaseflowImplicitDNS. A travelling wave of phase speed (cx,cz) is steady.
+  Real cx;
+  Real cz;
+
+  // 2 or 4: integrate with ETDRK2 or ETDRK4 (ETDDNS) in place of
+  // timestepping; 0: off
+  int etdOrder;
+
+  // Integrate with IMEXRK3DNS in place of timestepping
+  bool lowStorageRK;
+
+  bool movingFrame() const;  // cx or cz nonzero
+};
+
+// FusedMultistepDNS is MultistepDNS (SBDFn) with the nonlinear term of
+// each new velocity field evaluated by RotationalNL at the end of the step
+// that produced it. The same pass yields the FlowDiagnostics of that field,
+// and f_[0] is reused at the start of the next step if u is unchanged, so
+// diagnostics come at no extra transforms. CFL() is computed from them.
+//
+// Fusion applies to Rotational nonlinearity about a profile Ubase without
+// y dealiasing. Other configurations step with MultistepDNS::advance and
+// compute the diagnostics in a separate RotationalNL::diagnose pass.
+//
+// If flags.symmetries contains one that maps (kx,kz) to (-kx,kz), such as
+// shift-reflect or shift-rotate (see halvingSymmetry), u lies in a subspace
+// in which the kx < 0 modes are determined by the kx > 0 ones. The fused
+// step then solves only kx >= 0 and fills in the rest by that symmetry, or
+// at kz == 0 by conjugation, halving the implicit solve. FlowField's layout
+// is the library's, so the storage remains that of the full field.
+// project() applies the symmetries to the history by a SymmetryProjector,
+// in place.
+
+class FusedMultistepDNS : public MultistepDNS {
+public:
+  FusedMultistepDNS();
+  FusedMultistepDNS(const FusedMultistepDNS& dns);
+  FusedMultistepDNS(const FlowField& u, const ChebyCoeff& Ubase, Real nu,
+		    Real dt, const DNSFlags& flags, Real t=0);
+  ~FusedMultistepDNS();
+
+  FusedMultistepDNS& operator=(const FusedMultistepDNS& dns);
+
+  virtual void advance(FlowField& u, FlowField& q, int nSteps=1);
+  virtual void project();
+  virtual void operator *= (const FieldSymmetry& symm);
+  virtual void reset_dt(Real dt);
+  virtual bool push(const FlowField& u);
+
+  virtual DNSAlgorithm* clone() const;
+
+  bool fused();                                 // fused stepping applies
+  const FlowDiagnostics& diagnostics() const;  // of u after last advance
+
+  // The step history u_[j], f_[j] as binary filebase_u<j>.ff and
+  // filebase_f<j>.ff. loadHistory restores it with the scalar state.
+  void saveHistory(const std::string& filebase) const;
+  void loadHistory(const std::string& filebase, int countdown, Real dPdxAct,
+		   Real UbulkAct);
+  int countdown() const;  // pushes still needed, 0 if full()
+
+protected:
+  RotationalNL nl_;
+  FlowDiagnostics diag_;
+  bool f0valid_;  // f_[0] == N(u_[0]), with diag_ for u_[0]
+  bool halved_;   // solve kx >= 0 only, by halving_
+  SpectralSymmetry halving_;
+  SymmetryProjector projector_;  // of flags.symmetries
+
+  bool current(const FlowField& u) const;  // u bitwise equal to u_[0]
+  void solve(FlowField& u, FlowField& q);  // implicit solve, one step
+  void fillHalved(FlowField& u, FlowField& q) const;  // kx < 0 modes if halved_
+
+  // Explicit term f of the step for u, diagnostics on the way if diag != 0
+  virtual void nonlinear(const FlowField& u, FlowField& f, FlowDiagnostics* diag=0);
+
+  // Solve for mode (mx,mz), other than kx == kz == 0, as tausolver_[mx][mz]
+  virtual void solveMode(int mx, int mz, ComplexChebyCoeff& u, ComplexChebyCoeff& v,
+			 ComplexChebyCoeff& w, ComplexChebyCoeff& P,
+			 const ComplexChebyCoeff& Rx, const ComplexChebyCoeff& Ry,
+			 const ComplexChebyCoeff& Rz) const;
+};
+
+// BaseflowImplicitDNS is FusedMultistepDNS with the linear advection terms
+// of the base flow, U du/dx + v U' ex, moved from the explicit nonlinear term
+// into the per-mode implicit solve, via a BaseflowTauSolver for each mode.
+// The advective CFL limit then comes from the fluctuation u alone rather
+// than from the wall speeds of U, so that for plane Couette flow dt can be
+// several times larger. The solvers are LU-factored again on reset_dt.
+//
+// The same solvers carry the advection -(cx d/dx + cz d/dz) u of a moving
+// frame, a phase shift of each mode folded into its operator, so that the
+// frame costs no transforms. Either option may be used alone.
+// Requires fused stepping (Rotational nonlinearity, no y dealiasing).
+
+class BaseflowImplicitDNS : public FusedMultistepDNS {
+public:
+  BaseflowImplicitDNS();
+  BaseflowImplicitDNS(const BaseflowImplicitDNS& dns);
+  BaseflowImplicitDNS(const FlowField& u, const ChebyCoeff& Ubase, Real nu,
+		      Real dt, const DNSExtFlags& flags, Real t=0);
+  ~BaseflowImplicitDNS();
+
+  BaseflowImplicitDNS& operator=(const BaseflowImplicitDNS& dns);
+
+  virtual void reset_dt(Real dt);
+  virtual bool push(const FlowField& u);
+
+  virtual DNSAlgorithm* clone() const;
+
+  bool implicitBaseflow() const;  // U d/dx + v U' ex in the implicit solve
+
+protected:
+  bool implicitBaseflow_;
+  Real cx_;
+  Real cz_;
+  BaseflowOperators ops_;            // of Ubase, or of zero for the frame alone
+  array<BaseflowTauSolver> solver_;  // indexed by mx*Mz + mz
+  array<char> implicit_;             // solver_[m] in use
+
+  void factor();  // build solver_ for the current dt
+  void subtractAdvection(const FlowField& u, FlowField& f) const;  // f -= B(u)
+
+  virtual void nonlinear(const FlowField& u, FlowField& f, FlowDiagnostics* diag=0);
+  virtual void solveMode(int mx, int mz, ComplexChebyCoeff& u, ComplexChebyCoeff& v,
+			 ComplexChebyCoeff& w, ComplexChebyCoeff& P,
+			 const ComplexChebyCoeff& Rx, const ComplexChebyCoeff& Ry,
+			 const ComplexChebyCoeff& Rz) const;
+};
+
+// DNSGuard configures the blow-up guard of DNSExt: after each advance the
+// CFL number, divNorm and energy of the new field are checked against the
+// bounds, and non-finite values always count as a violation. A bound <= 0
+// is not checked; snapshots == 0 turns the guard off.
+class DNSGuard {
+public:
+  DNSGuard();
+
+  int snapshots;    // depth of the ring of saved fields
+  Real CFLmax;
+  Real divNormMax;
+  Real energyMax;
+  Real dtFactor;    // dt is multiplied by this on each rollback
+  Real dtmin;       // a rollback that would go below it is an error
+
+  bool violated(const FlowDiagnostics& d, Real CFL) const;
+};
+
+// DNSExt is a drop-in replacement for DNS (same constructors, flags and
+// advance semantics) that uses FusedMultistepDNS for the SBDFn and CNFE1
+// methods, or ETDDNS if etdOrder is set, or IMEXRK3DNS if lowStorageRK is,
+// and keeps the FlowDiagnostics of the current velocity field.
+// The library's RungeKuttaDNS and CNABstyleDNS serve the other methods and
+// initialization; after steps taken by those, diagnostics are computed
+// with a separate pass. With implicitBaseflow or a moving frame,
+// BaseflowImplicitDNS serves the SBDFn and CNFE1 methods. CFL() is then that
+// of the fluctuation if implicitBaseflow; the other algorithms advect with U
+// explicitly, and ETDDNS and IMEXRK3DNS reject both options. The few
+// initialization steps remain explicit in U; in a moving frame their
+// results are translated into it.
+
+class DNSExt {
+public:
+  DNSExt(const FlowField& u, Real nu, Real dt, const DNSExtFlags& flags, Real t=0.0);
+  DNSExt(const FlowField& u, const ChebyCoeff& Ubase,
+	 Real nu, Real dt, const DNSExtFlags& flags, Real t=0.0);
+  ~DNSExt();
+
+  void advance(FlowField& u, FlowField& q, int nSteps=1);
+
+  void project();
+  void operator *= (const FieldSymmetry& symm);
+
+  void reset_dt(Real dt);
+  void reset_time(Real t);
+  void reset_dPdx(Real dPdx);
+  void reset_Ubulk(Real Ubulk);
+
+  bool push(const FlowField& u);
+  bool full() const;
+
+  int order() const;
+  int Ninitsteps() const;
+
+  Real nu() const;
+  Real dt() const;
+  Real CFL() const;       // cflNumber of the current u
+  Real time() const;
+  Real dPdx() const;
+  Real Ubulk() const;
+  Real dPdxRef() const;
+  Real UbulkRef() const;
+
+  const DNSExtFlags& flags() const;
+  const ChebyCoeff& Ubase() const;
+  TimeStepMethod timestepping() const;
+
+  // Diagnostics of the field most recently passed to or returned by
+  // advance, or passed to the constructor.
+  const FlowDiagnostics& diagnostics() const;
+
+  // Checkpoint of u and the integrator state: the scalar state in the text
+  // file filebase.state, u as binary filebase_u.ff and, for the SBDFn and
+  // CNFE1 algorithms, their u and f histories. loadState into a DNSExt
+  // constructed with the same flags restores u, t, dt, dPdx, Ubulk and the
+  // history, so that the run continues bitwise as if never stopped, without
+  // initialization steps. The one-step algorithms restore exactly from u and
+  // t alone, except CNAB2, which restarts from u.
+  void saveState(const std::string& filebase, const FlowField& u) const;
+  void loadState(const std::string& filebase, FlowField& u);
+
+  // With a guard set, each advance first saves u and t in a ring of
+  // guard.snapshots fields. If the result violates the guard, u and t are
+  // restored from the latest snapshot and the interval is integrated again
+  // with dt reduced by dtFactor, rounded so that the advance ends at the
+  // same time. Each further violation reduces dt again and starts one
+  // snapshot further back, down to the oldest. reset_dt restarts the
+  // multistep history, so u and t are all a snapshot needs. Fails with
+  // cferror when dt would fall below dtmin. A rollback past the start of
+  // the advance discards earlier intervals, whose outputs the caller has
+  // written from the old trajectory: restartTime() is then below the start.
+  void setGuard(const DNSGuard& guard);
+  const DNSGuard& guard() const;
+  int rollbacks() const;     // total number of rollbacks so far
+  Real restartTime() const;  // earliest t the last advance integrated from
+
+private:
+  DNSExt(const DNSExt& dns);             // unimplemented
+  DNSExt& operator=(const DNSExt& dns);  // unimplemented
+
+  DNSAlgorithm* main_algorithm_;
+  DNSAlgorithm* init_algorithm_;
+  DNSExtFlags flags_;
+  ChebyCoeff Ubase_;
+  RotationalNL nl_;
+  FlowDiagnostics diag_;
+  SymmetryProjector projector_;  // of flags.symmetries, applied after each advance
+  DNSGuard guard_;
+  array<FlowField> ring_;    // snapshots of u, latest at ringHead_
+  array<Real> ringTime_;
+  int ringHead_;
+  int ringCount_;
+  int rollbacks_;
+  Real restartTime_;
+
+  void init(const FlowField& u, Real nu, Real dt, Real t);
+  void step(FlowField& u, FlowField& q, int nSteps);  // advance, unguarded
+  void initStepping();  // init_algorithm_ if the main one is not full
+  DNSAlgorithm* newAlgorithm(const FlowField& u, const ChebyCoeff& Ubase, Real nu,
+			     Real dt, const DNSExtFlags& flags, Real t);
+  void diagnose(const FlowField& u);
+};
+
+// The CFL number as DNS::CFL() reports it: dt times the CFL factor times
+// pi, or times 2pi/3 with xz dealiasing. cflfactor is a FlowDiagnostics
+// cflfactor, i.e. from |u_i| rather than the library's signed u_i.
+Real cflNumber(Real cflfactor, Real dt, const DNSFlags& flags);
+
+// Ubase(y) for flags.baseflow on [a,b], as DNS constructs it
+ChebyCoeff baseflowProfile(BaseFlow baseflow, int Ny, Real a, Real b);
+
+} //namespace channelflow
+#endif
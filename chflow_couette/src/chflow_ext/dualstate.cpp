@@ -0,0 +1,74 @@
+// dualstate.cpp: FlowField with a cached physical-space copy
+
+#include "dualstate.h"
+#include "gridtables.h"
+
+using namespace std;
+
+namespace channelflow {
+
+DualStateField::DualStateField(FlowField& u)
+  :
+  u_(u),
+  trans_(0),
+  version_(0),
+  physversion_(0),
+  physvalid_(false)
+{}
+
+DualStateField::~DualStateField() {
+  delete trans_;
+  trans_ = 0;
+}
+
+FlowField& DualStateField::modify() {
+  ++version_;
+  return u_;
+}
+
+void DualStateField::touch() {
+  ++version_;
+}
+
+const FlowField& DualStateField::field() const {
+  return u_;
+}
+
+unsigned long DualStateField::version() const {
+  return version_;
+}
+
+bool DualStateField::cached() const {
+  return physvalid_ && physversion_ == version_ && sameGeometry(phys_, u_);
+}
+
+const FlowField& DualStateField::physical() {
+  if (cached())
+    return phys_;
+
+  if (!sameGeometry(phys_, u_)) {
+    phys_.resize(u_.Nx(), u_.Ny(), u_.Nz(), u_.Nd(), u_.Lx(), u_.Lz(),
+		 u_.a(), u_.b());
+    delete trans_;
+    trans_ = new BatchedChebyTransform(u_);
+  }
+  else if (trans_ == 0)
+    trans_ = new BatchedChebyTransform(u_);
+
+  // Copy the data array as is and transform the copy
+  const int N = u_.rawDataLength();
+  const Real* src = u_.rawData();
+  Real* dst = phys_.rawData();
+#pragma omp parallel for
+  for (int n=0; n<N; ++n)
+    dst[n] = src[n];
+  phys_.setState(u_.xzstate(), u_.ystate());
+  phys_.setPadded(u_.padded());
+  trans_->makePhysical(phys_);
+
+  physversion_ = version_;
+  physvalid_ = true;
+  return phys_;
+}
+
+} //namespace channelflow
@@ -0,0 +1,51 @@
+// dualstate.h: FlowField with a cached physical-space copy
+
+#ifndef CHFLOW_EXT_DUALSTATE_H
+#define CHFLOW_EXT_DUALSTATE_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/flowfield.h"
+#include "ytransform.h"
+
+namespace channelflow {
+
+// DualStateField keeps a physical-space copy of a FlowField u alongside u
+// itself, so that code which needs u in Physical,Physical (saving to disk,
+// pointwise diagnostics) doesn't flip u's state back and forth with a pair
+// of full transforms each time.
+//
+// A version counter tracks modifications of u. Write access goes through
+// modify(), or else touch() must be called after u was changed through some
+// other reference. physical() transforms a fresh copy only if the version
+// has changed since the copy was made. u's own state is never altered.
+//
+// The class doesn't change FlowField (its layout is fixed by the channelflow
+// library) and costs one extra field of storage, so it is opt-in.
+
+class DualStateField {
+public:
+  DualStateField(FlowField& u);
+  ~DualStateField();
+
+  FlowField& modify();              // write access to u, invalidates the copy
+  void touch();                     // u was modified elsewhere
+  const FlowField& field() const;   // u in whatever state it is in
+  const FlowField& physical();      // u in Physical,Physical, cached
+
+  unsigned long version() const;
+  bool cached() const;              // physical() would not transform
+
+private:
+  DualStateField(const DualStateField& d);            // unimplemented
+  DualStateField& operator=(const DualStateField& d); // unimplemented
+
+  FlowField& u_;
+  FlowField phys_;
+  BatchedChebyTransform* trans_;
+  unsigned long version_;       // bumped on every (possible) change of u
+  unsigned long physversion_;   // version phys_ was made from
+  bool physvalid_;
+};
+
+} //namespace channelflow
+#endif
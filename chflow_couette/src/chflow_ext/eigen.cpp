@@ -0,0 +1,871 @@
+// eigen.cpp: block Arnoldi eigensolver over flat vectors
+
+#include <iostream>
+#include <iomanip>
+#include <omp.h>
+#include "eigen.h"
+
+using namespace std;
+
+namespace channelflow {
+
+// Elements per block of the multi-vector loops, as in newton.cpp
+static const int Nblock = 512;
+
+/**************************************************************************
+ * Multi-vector operations
+ **************************************************************************/
+
+// h[j*k + i] = <v[i], w[j]> for i < k, j < m, with the partial sums of each
+// thread's fixed range of elements added in thread order
+static void blockGram(const Real* const* v, int k, const Real* const* w, int m,
+		      int N, Real* h) {
+  const int Nthreads = omp_get_max_threads();
+  array<Real> partial(Nthreads*k*m);
+  partial.fill(0.0);
+#pragma omp parallel num_threads(Nthreads)
+  {
+    Real* p = partial.pointer() + omp_get_thread_num()*k*m;
+#pragma omp for schedule(static)
+    for (int n0=0; n0<N; n0+=Nblock) {
+      const int n1 = (n0 + Nblock < N) ? n0 + Nblock : N;
+      for (int j=0; j<m; ++j) {
+	const Real* wj = w[j];
+	for (int i=0; i<k; ++i) {
+	  const Real* vi = v[i];
+	  Real s = 0.0;
+	  for (int n=n0; n<n1; ++n)
+	    s += vi[n]*wj[n];
+	  p[j*k + i] += s;
+	}
+      }
+    }
+  }
+  for (int l=0; l<k*m; ++l) {
+    h[l] = 0.0;
+    for (int t=0; t<Nthreads; ++t)
+      h[l] += partial[t*k*m + l];
+  }
+}
+
+// w[j] += sum_i c[j*k + i] v[i]
+static void blockUpdate(const Real* const* v, int k, const Real* c, Real* const* w,
+			int m, int N) {
+#pragma omp parallel for schedule(static)
+  for (int n0=0; n0<N; n0+=Nblock) {
+    const int n1 = (n0 + Nblock < N) ? n0 + Nblock : N;
+    for (int j=0; j<m; ++j) {
+      Real* wj = w[j];
+      for (int i=0; i<k; ++i) {
+	const Real* vi = v[i];
+	const Real cij = c[j*k + i];
+	for (int n=n0; n<n1; ++n)
+	  wj[n] += cij*vi[n];
+      }
+    }
+  }
+}
+
+// v[j] = sum_i v[i] Y[j*k + i] for j < m <= k, in place: each block of
+// elements is combined in a buffer and then written back
+static void blockRotate(Real* const* v, int k, const Real* Y, int m, int N) {
+#pragma omp parallel
+  {
+    array<Real> buf(m*Nblock);
+#pragma omp for schedule(static)
+    for (int n0=0; n0<N; n0+=Nblock) {
+      const int n1 = (n0 + Nblock < N) ? n0 + Nblock : N;
+      const int len = n1 - n0;
+      buf.fill(0.0);
+      for (int j=0; j<m; ++j) {
+	Real* b = buf.pointer() + j*Nblock;
+	for (int i=0; i<k; ++i) {
+	  const Real* vi = v[i] + n0;
+	  const Real y = Y[j*k + i];
+	  for (int n=0; n<len; ++n)
+	    b[n] += y*vi[n];
+	}
+      }
+      for (int j=0; j<m; ++j) {
+	const Real* b = buf.pointer() + j*Nblock;
+	Real* vj = v[j] + n0;
+	for (int n=0; n<len; ++n)
+	  vj[n] = b[n];
+      }
+    }
+  }
+}
+
+/**************************************************************************
+ * Dense eigenvalues
+ **************************************************************************/
+
+// (cr + i ci) = (xr + i xi)/(yr + i yi)
+static void cdiv(Real xr, Real xi, Real yr, Real yi, Real& cr, Real& ci) {
+  if (fabs(yr) > fabs(yi)) {
+    const Real r = yi/yr;
+    const Real d = yr + r*yi;
+    cr = (xr + r*xi)/d;
+    ci = (xi - r*xr)/d;
+  }
+  else {
+    const Real r = yr/yi;
+    const Real d = yi + r*yr;
+    cr = (r*xr + xi)/d;
+    ci = (r*xi - xr)/d;
+  }
+}
+
+// Reduction of H to upper Hessenberg form by Householder similarity
+// transformations, accumulated in V (orthes)
+static void hessenberg(int nn, Real* Hd, Real* Vd) {
+#define H(i,j) Hd[(i) + (j)*nn]
+#define V(i,j) Vd[(i) + (j)*nn]
+  const int low = 0;
+  const int high = nn-1;
+  array<Real> ort(nn);
+  ort.fill(0.0);
+
+  for (int m=low+1; m<=high-1; ++m) {
+    Real scale = 0.0;
+    for (int i=m; i<=high; ++i)
+      scale += fabs(H(i,m-1));
+    if (scale == 0.0)
+      continue;
+
+    Real h = 0.0;
+    for (int i=high; i>=m; --i) {
+      ort[i] = H(i,m-1)/scale;
+      h += ort[i]*ort[i];
+    }
+    Real g = sqrt(h);
+    if (ort[m] > 0)
+      g = -g;
+    h = h - ort[m]*g;
+    ort[m] = ort[m] - g;
+
+    // H = (I - u u^T/h) H (I - u u^T/h)
+    for (int j=m; j<nn; ++j) {
+      Real f = 0.0;
+      for (int i=high; i>=m; --i)
+	f += ort[i]*H(i,j);
+      f /= h;
+      for (int i=m; i<=high; ++i)
+	H(i,j) -= f*ort[i];
+    }
+    for (int i=0; i<=high; ++i) {
+      Real f = 0.0;
+      for (int j=high; j>=m; --j)
+	f += ort[j]*H(i,j);
+      f /= h;
+      for (int j=m; j<=high; ++j)
+	H(i,j) -= f*ort[j];
+    }
+    ort[m] = scale*ort[m];
+    H(m,m-1) = scale*g;
+  }
+
+  for (int j=0; j<nn; ++j)
+    for (int i=0; i<nn; ++i)
+      V(i,j) = (i == j) ? 1.0 : 0.0;
+  for (int m=high-1; m>=low+1; --m) {
+    if (H(m,m-1) == 0.0)
+      continue;
+    for (int i=m+1; i<=high; ++i)
+      ort[i] = H(i,m-1);
+    for (int j=m; j<=high; ++j) {
+      Real g = 0.0;
+      for (int i=m; i<=high; ++i)
+	g += ort[i]*V(i,j);
+      g = (g/ort[m])/H(m,m-1);
+      for (int i=m; i<=high; ++i)
+	V(i,j) += g*ort[i];
+    }
+  }
+#undef H
+#undef V
+}
+
+// Real Schur form of Hessenberg H by the Francis double-shift QR algorithm,
+// eigenvalues into d + i e, then eigenvectors by back substitution,
+// transformed by V (hqr2)
+static void schur(int nn, Real* Hd, Real* Vd, Real* d, Real* e) {
+#define H(i,j) Hd[(i) + (j)*nn]
+#define V(i,j) Vd[(i) + (j)*nn]
+  int n = nn-1;
+  const int low = 0;
+  const int high = nn-1;
+  const Real eps = pow(2.0, -52.0);
+  Real exshift = 0.0;
+  Real p = 0, q = 0, r = 0, s = 0, z = 0, t, w, x, y;
+
+  Real norm = 0.0;
+  for (int i=0; i<nn; ++i)
+    for (int j=(i > 0 ? i-1 : 0); j<nn; ++j)
+      norm += fabs(H(i,j));
+
+  int iter = 0;
+  while (n >= low) {
+    // A single small subdiagonal element splits off a block
+    int l = n;
+    while (l > low) {
+      s = fabs(H(l-1,l-1)) + fabs(H(l,l));
+      if (s == 0.0)
+	s = norm;
+      if (fabs(H(l,l-1)) < eps*s)
+	break;
+      --l;
+    }
+
+    if (l == n) {
+      // One root
+      H(n,n) = H(n,n) + exshift;
+      d[n] = H(n,n);
+      e[n] = 0.0;
+      --n;
+      iter = 0;
+    }
+    else if (l == n-1) {
+      // Two roots
+      w = H(n,n-1)*H(n-1,n);
+      p = (H(n-1,n-1) - H(n,n))/2.0;
+      q = p*p + w;
+      z = sqrt(fabs(q));
+      H(n,n) = H(n,n) + exshift;
+      H(n-1,n-1) = H(n-1,n-1) + exshift;
+      x = H(n,n);
+
+      if (q >= 0) {
+	// Real pair, split off by a rotation
+	z = (p >= 0) ? p + z : p - z;
+	d[n-1] = x + z;
+	d[n] = d[n-1];
+	if (z != 0.0)
+	  d[n] = x - w/z;
+	e[n-1] = 0.0;
+	e[n] = 0.0;
+	x = H(n,n-1);
+	s = fabs(x) + fabs(z);
+	p = x/s;
+	q = z/s;
+	r = sqrt(p*p + q*q);
+	p /= r;
+	q /= r;
+	for (int j=n-1; j<nn; ++j) {
+	  z = H(n-1,j);
+	  H(n-1,j) = q*z + p*H(n,j);
+	  H(n,j) = q*H(n,j) - p*z;
+	}
+	for (int i=0; i<=n; ++i) {
+	  z = H(i,n-1);
+	  H(i,n-1) = q*z + p*H(i,n);
+	  H(i,n) = q*H(i,n) - p*z;
+	}
+	for (int i=low; i<=high; ++i) {
+	  z = V(i,n-1);
+	  V(i,n-1) = q*z + p*V(i,n);
+	  V(i,n) = q*V(i,n) - p*z;
+	}
+      }
+      else {
+	// Complex pair
+	d[n-1] = x + p;
+	d[n] = x + p;
+	e[n-1] = z;
+	e[n] = -z;
+      }
+      n -= 2;
+      iter = 0;
+    }
+    else {
+      // No convergence yet: shifts, with exceptional ones at 10 and 30
+      x = H(n,n);
+      y = 0.0;
+      w = 0.0;
+      if (l < n) {
+	y = H(n-1,n-1);
+	w = H(n,n-1)*H(n-1,n);
+      }
+      if (iter == 10) {
+	exshift += x;
+	for (int i=low; i<=n; ++i)
+	  H(i,i) -= x;
+	s = fabs(H(n,n-1)) + fabs(H(n-1,n-2));
+	x = y = 0.75*s;
+	w = -0.4375*s*s;
+      }
+      if (iter == 30) {
+	s = (y - x)/2.0;
+	s = s*s + w;
+	if (s > 0) {
+	  s = sqrt(s);
+	  if (y < x)
+	    s = -s;
+	  s = x - w/((y - x)/2.0 + s);
+	  for (int i=low; i<=n; ++i)
+	    H(i,i) -= s;
+	  exshift += s;
+	  x = y = w = 0.964;
+	}
+      }
+      if (++iter > 30*nn)
+	cferror("eigenvalues : QR iteration did not converge");
+
+      // Two consecutive small subdiagonal elements
+      int m = n-2;
+      while (m >= l) {
+	z = H(m,m);
+	r = x - z;
+	s = y - z;
+	p = (r*s - w)/H(m+1,m) + H(m,m+1);
+	q = H(m+1,m+1) - z - r - s;
+	r = H(m+2,m+1);
+	s = fabs(p) + fabs(q) + fabs(r);
+	p /= s;
+	q /= s;
+	r /= s;
+	if (m == l)
+	  break;
+	if (fabs(H(m,m-1))*(fabs(q) + fabs(r)) <
+	    eps*(fabs(p)*(fabs(H(m-1,m-1)) + fabs(z) + fabs(H(m+1,m+1)))))
+	  break;
+	--m;
+      }
+      for (int i=m+2; i<=n; ++i) {
+	H(i,i-2) = 0.0;
+	if (i > m+2)
+	  H(i,i-3) = 0.0;
+      }
+
+      // Double QR step on rows l..n and columns m..n
+      for (int k=m; k<=n-1; ++k) {
+	const bool notlast = (k != n-1);
+	if (k != m) {
+	  p = H(k,k-1);
+	  q = H(k+1,k-1);
+	  r = notlast ? H(k+2,k-1) : 0.0;
+	  x = fabs(p) + fabs(q) + fabs(r);
+	  if (x == 0.0)
+	    continue;
+	  p /= x;
+	  q /= x;
+	  r /= x;
+	}
+	s = sqrt(p*p + q*q + r*r);
+	if (p < 0)
+	  s = -s;
+	if (s == 0.0)
+	  continue;
+	if (k != m)
+	  H(k,k-1) = -s*x;
+	else if (l != m)
+	  H(k,k-1) = -H(k,k-1);
+	p = p + s;
+	x = p/s;
+	y = q/s;
+	z = r/s;
+	q = q/p;
+	r = r/p;
+
+	for (int j=k; j<nn; ++j) {
+	  p = H(k,j) + q*H(k+1,j);
+	  if (notlast) {
+	    p = p + r*H(k+2,j);
+	    H(k+2,j) = H(k+2,j) - p*z;
+	  }
+	  H(k,j) = H(k,j) - p*x;
+	  H(k+1,j) = H(k+1,j) - p*y;
+	}
+	const int imax = (n < k+3) ? n : k+3;
+	for (int i=0; i<=imax; ++i) {
+	  p = x*H(i,k) + y*H(i,k+1);
+	  if (notlast) {
+	    p = p + z*H(i,k+2);
+	    H(i,k+2) = H(i,k+2) - p*r;
+	  }
+	  H(i,k) = H(i,k) - p;
+	  H(i,k+1) = H(i,k+1) - p*q;
+	}
+	for (int i=low; i<=high; ++i) {
+	  p = x*V(i,k) + y*V(i,k+1);
+	  if (notlast) {
+	    p = p + z*V(i,k+2);
+	    V(i,k+2) = V(i,k+2) - p*r;
+	  }
+	  V(i,k) = V(i,k) - p;
+	  V(i,k+1) = V(i,k+1) - p*q;
+	}
+      }
+    }
+  }
+
+  // Eigenvectors of the quasi-triangular form by back substitution
+  if (norm == 0.0)
+    return;
+  for (n=nn-1; n>=0; --n) {
+    p = d[n];
+    q = e[n];
+
+    if (q == 0) {
+      // Real vector
+      int l = n;
+      H(n,n) = 1.0;
+      for (int i=n-1; i>=0; --i) {
+	w = H(i,i) - p;
+	r = 0.0;
+	for (int j=l; j<=n; ++j)
+	  r = r + H(i,j)*H(j,n);
+	if (e[i] < 0.0) {
+	  z = w;
+	  s = r;
+	}
+	else {
+	  l = i;
+	  if (e[i] == 0.0)
+	    H(i,n) = (w != 0.0) ? -r/w : -r/(eps*norm);
+	  else {
+	    x = H(i,i+1);
+	    y = H(i+1,i);
+	    q = (d[i] - p)*(d[i] - p) + e[i]*e[i];
+	    t = (x*s - z*r)/q;
+	    H(i,n) = t;
+	    H(i+1,n) = (fabs(x) > fabs(z)) ? (-r - w*t)/x : (-s - y*t)/z;
+	  }
+	  // Overflow control
+	  t = fabs(H(i,n));
+	  if ((eps*t)*t > 1)
+	    for (int j=i; j<=n; ++j)
+	      H(j,n) = H(j,n)/t;
+	}
+      }
+    }
+    else if (q < 0) {
+      // Complex vector, of the pair at n-1, n
+      int l = n-1;
+      if (fabs(H(n,n-1)) > fabs(H(n-1,n))) {
+	H(n-1,n-1) = q/H(n,n-1);
+	H(n-1,n) = -(H(n,n) - p)/H(n,n-1);
+      }
+      else
+	cdiv(0.0, -H(n-1,n), H(n-1,n-1) - p, q, H(n-1,n-1), H(n-1,n));
+      H(n,n-1) = 0.0;
+      H(n,n) = 1.0;
+      for (int i=n-2; i>=0; --i) {
+	Real ra = 0.0;
+	Real sa = 0.0;
+	for (int j=l; j<=n; ++j) {
+	  ra = ra + H(i,j)*H(j,n-1);
+	  sa = sa + H(i,j)*H(j,n);
+	}
+	w = H(i,i) - p;
+
+	if (e[i] < 0.0) {
+	  z = w;
+	  r = ra;
+	  s = sa;
+	}
+	else {
+	  l = i;
+	  if (e[i] == 0)
+	    cdiv(-ra, -sa, w, q, H(i,n-1), H(i,n));
+	  else {
+	    x = H(i,i+1);
+	    y = H(i+1,i);
+	    Real vr = (d[i] - p)*(d[i] - p) + e[i]*e[i] - q*q;
+	    const Real vi = (d[i] - p)*2.0*q;
+	    if (vr == 0.0 && vi == 0.0)
+	      vr = eps*norm*(fabs(w) + fabs(q) + fabs(x) + fabs(y) + fabs(z));
+	    cdiv(x*r - z*ra + q*sa, x*s - z*sa - q*ra, vr, vi, H(i,n-1), H(i,n));
+	    if (fabs(x) > (fabs(z) + fabs(q))) {
+	      H(i+1,n-1) = (-ra - w*H(i,n-1) + q*H(i,n))/x;
+	      H(i+1,n) = (-sa - w*H(i,n) - q*H(i,n-1))/x;
+	    }
+	    else
+	      cdiv(-r - y*H(i,n-1), -s - y*H(i,n), z, q, H(i+1,n-1), H(i+1,n));
+	  }
+	  // Overflow control
+	  t = fabs(H(i,n-1)) > fabs(H(i,n)) ? fabs(H(i,n-1)) : fabs(H(i,n));
+	  if ((eps*t)*t > 1)
+	    for (int j=i; j<=n; ++j) {
+	      H(j,n-1) = H(j,n-1)/t;
+	      H(j,n) = H(j,n)/t;
+	    }
+	}
+      }
+    }
+  }
+
+  // Back to eigenvectors of the original matrix
+  for (int j=nn-1; j>=low; --j)
+    for (int i=low; i<=high; ++i) {
+      z = 0.0;
+      for (int k=low; k<=(j < high ? j : high); ++k)
+	z = z + V(i,k)*H(k,j);
+      V(i,j) = z;
+    }
+#undef H
+#undef V
+}
+
+void eigenvalues(int n, Real* A, Real* wr, Real* wi, Real* Z) {
+  if (n == 0)
+    return;
+  hessenberg(n, A, Z);
+  schur(n, A, Z, wr, wi);
+}
+
+/**************************************************************************
+ * BlockArnoldi
+ **************************************************************************/
+
+BlockOperator::~BlockOperator() {}
+
+ArnoldiFlags::ArnoldiFlags()
+  :
+  Neig(10),
+  blockSize(4),
+  Kmax(60),
+  Nrestarts(20),
+  tol(1e-8),
+  verbose(true)
+{}
+
+BlockArnoldi::BlockArnoldi(const ArnoldiFlags& flags, int N)
+  :
+  flags_(flags),
+  N_(N),
+  b_(flags.blockSize),
+  Kmax_(flags.Kmax - flags.Kmax % flags.blockSize),
+  applications_(0)
+{
+  if (b_ < 1 || Kmax_ < flags.Neig + 2*b_)
+    cferror("BlockArnoldi: Kmax must exceed Neig by two blocks");
+  V_.resize(Kmax_ + b_);
+  for (int j=0; j<Kmax_ + b_; ++j)
+    V_[j].resize(N_);
+  H_.resize((Kmax_ + b_)*Kmax_);
+}
+
+const ArnoldiFlags& BlockArnoldi::flags() const {
+  return flags_;
+}
+
+int BlockArnoldi::number() const {
+  return lambda_.length();
+}
+
+Complex BlockArnoldi::eigenvalue(int j) const {
+  return lambda_[j];
+}
+
+Real BlockArnoldi::residual(int j) const {
+  return residual_[j];
+}
+
+const Vector& BlockArnoldi::eigenvector(int j) const {
+  return x_[j];
+}
+
+int BlockArnoldi::applications() const {
+  return applications_;
+}
+
+// Block CGS2 against v, then CGS2 within the block, column by column
+void BlockArnoldi::orthonormalize(const Real* const* v, int k, Real* const* w, int m,
+				  Real* C, Real* R) {
+  array<Real> C2(k*m > 0 ? k*m : 1);
+  for (int l=0; l<k*m; ++l)
+    C[l] = 0.0;
+  for (int pass=0; pass<2 && k>0; ++pass) {
+    blockGram(v, k, w, m, N_, C2.pointer());
+    for (int l=0; l<k*m; ++l) {
+      C[l] += C2[l];
+      C2[l] = -C2[l];
+    }
+    blockUpdate(v, k, C2.pointer(), w, m, N_);
+  }
+
+  for (int l=0; l<m*m; ++l)
+    R[l] = 0.0;
+  array<Real> r(m), r2(m);
+  for (int j=0; j<m; ++j) {
+    Real* wj = w[j];
+    const Real* wjc = wj;
+    Real n0;
+    blockGram(&wjc, 1, &wjc, 1, N_, &n0);
+    for (int pass=0; pass<2 && j>0; ++pass) {
+      blockGram(w, j, &wjc, 1, N_, r2.pointer());
+      for (int i=0; i<j; ++i) {
+	R[j*m + i] += r2[i];
+	r2[i] = -r2[i];
+      }
+      blockUpdate(w, j, r2.pointer(), &wj, 1, N_);
+    }
+    Real nj;
+    blockGram(&wjc, 1, &wjc, 1, N_, &nj);
+    nj = sqrt(nj);
+
+    // A dependent column: continue the basis with a random direction
+    if (!(nj > 1e-12*sqrt(n0))) {
+      for (int i=0; i<j; ++i)
+	R[j*m + i] = 0.0;
+      for (int n=0; n<N_; ++n)
+	wj[n] = randomReal(-1.0, 1.0);
+      for (int pass=0; pass<2; ++pass) {
+	if (k > 0) {
+	  blockGram(v, k, &wjc, 1, N_, C2.pointer());
+	  for (int i=0; i<k; ++i)
+	    C2[i] = -C2[i];
+	  blockUpdate(v, k, C2.pointer(), &wj, 1, N_);
+	}
+	if (j > 0) {
+	  blockGram(w, j, &wjc, 1, N_, r2.pointer());
+	  for (int i=0; i<j; ++i)
+	    r2[i] = -r2[i];
+	  blockUpdate(w, j, r2.pointer(), &wj, 1, N_);
+	}
+      }
+      blockGram(&wjc, 1, &wjc, 1, N_, &nj);
+      nj = sqrt(nj);
+      const Real c = 1.0/nj;
+#pragma omp parallel for schedule(static)
+      for (int n=0; n<N_; ++n)
+	wj[n] *= c;
+      continue;
+    }
+    R[j*m + j] = nj;
+    const Real c = 1.0/nj;
+#pragma omp parallel for schedule(static)
+    for (int n=0; n<N_; ++n)
+      wj[n] *= c;
+  }
+}
+
+void BlockArnoldi::expand(BlockOperator& A, int s) {
+  const int b = b_;
+  const int ld = Kmax_ + b_;
+  array<const Vector*> x(b);
+  array<Vector*> y(b);
+  for (int j=0; j<b; ++j) {
+    x[j] = &V_[s + j];
+    y[j] = &V_[s + b + j];
+  }
+  A.apply(b, x.pointer(), y.pointer());
+  applications_ += b;
+
+  const int k = s + b;
+  array<const Real*> v(k);
+  array<Real*> w(b);
+  for (int i=0; i<k; ++i)
+    v[i] = V_[i].pointer();
+  for (int j=0; j<b; ++j)
+    w[j] = V_[k + j].pointer();
+  array<Real> C(k*b), R(b*b);
+  orthonormalize(v.pointer(), k, w.pointer(), b, C.pointer(), R.pointer());
+  for (int j=0; j<b; ++j) {
+    Real* Hj = H_.pointer() + (s + j)*ld;
+    for (int i=0; i<k; ++i)
+      Hj[i] = C[j*k + i];
+    for (int i=0; i<b; ++i)
+      Hj[k + i] = R[j*b + i];
+  }
+}
+
+// Order of eigenvalues: decreasing modulus, then decreasing imaginary part,
+// which puts the Im > 0 member of a pair first
+static bool precedes(Real ar, Real ai, Real br, Real bi) {
+  const Real ma = ar*ar + ai*ai;
+  const Real mb = br*br + bi*bi;
+  return ma > mb || (ma == mb && ai > bi);
+}
+
+int BlockArnoldi::solve(BlockOperator& A, const Vector* start) {
+  const int b = b_;
+  const int ld = Kmax_ + b_;
+  const int Neig = flags_.Neig;
+  applications_ = 0;
+  H_.fill(0.0);
+
+  for (int j=0; j<b; ++j)
+    for (int n=0; n<N_; ++n)
+      V_[j][n] = randomReal(-1.0, 1.0);
+  if (start)
+    V_[0] = *start;
+  {
+    array<Real*> w(b);
+    for (int j=0; j<b; ++j)
+      w[j] = V_[j].pointer();
+    array<Real> R(b*b);
+    orthonormalize(0, 0, w.pointer(), b, 0, R.pointer());
+  }
+
+  int s = 0;
+  int converged = 0;
+  array<Real> Hs, Z, wr, wi, Y;
+  array<int> order;
+  for (int restart=0; ; ++restart) {
+    while (s + b <= Kmax_) {
+      expand(A, s);
+      s += b;
+    }
+
+    // Ritz values of the Rayleigh quotient, leading first
+    Hs.resize(s*s);
+    Z.resize(s*s);
+    wr.resize(s);
+    wi.resize(s);
+    for (int j=0; j<s; ++j)
+      for (int i=0; i<s; ++i)
+	Hs[j*s + i] = H_[j*ld + i];
+    eigenvalues(s, Hs.pointer(), wr.pointer(), wi.pointer(), Z.pointer());
+    order.resize(s);
+    for (int j=0; j<s; ++j)
+      order[j] = j;
+    for (int j=1; j<s; ++j)
+      for (int i=j; i>0 && precedes(wr[order[i]], wi[order[i]],
+				   wr[order[i-1]], wi[order[i-1]]); --i)
+	swap(order[i], order[i-1]);
+
+    // Real basis Y of the Ritz vectors in that order, a pair's real and
+    // imaginary parts in its two columns; residuals |B y|/(|lambda| |y|)
+    Y.resize(s*s);
+    array<Real> res(s);
+    for (int j=0; j<s; ) {
+      const int c = order[j];
+      const bool pair = wi[c] != 0.0;
+      const int c0 = (pair && wi[c] < 0.0) ? c-1 : c;
+      const int cols = pair ? 2 : 1;
+      Real norm2 = 0.0;
+      for (int l=0; l<cols; ++l)
+	for (int i=0; i<s; ++i) {
+	  Y[(j+l)*s + i] = Z[(c0+l)*s + i];
+	  norm2 += Z[(c0+l)*s + i]*Z[(c0+l)*s + i];
+	}
+      Real r2 = 0.0;
+      for (int l=0; l<cols; ++l)
+	for (int i=s; i<s+b; ++i) {
+	  Real bi = 0.0;
+	  for (int q=0; q<s; ++q)
+	    bi += H_[q*ld + i]*Y[(j+l)*s + q];
+	  r2 += bi*bi;
+	}
+      const Real lam = sqrt(wr[c]*wr[c] + wi[c]*wi[c]);
+      for (int l=0; l<cols && j+l<s; ++l)
+	res[j+l] = sqrt(r2/norm2)/lam;
+      j += cols;
+    }
+
+    int Nwant = Neig;
+    if (Nwant < s && wi[order[Nwant-1]] > 0.0)
+      ++Nwant;
+    converged = 0;
+    for (int j=0; j<Neig; ++j)
+      if (res[j] < flags_.tol)
+	++converged;
+    if (flags_.verbose) {
+      Real rmax = 0.0;
+      for (int j=0; j<Nwant; ++j)
+	rmax = res[j] > rmax ? res[j] : rmax;
+      cout << "arnoldi restart " << restart << ": " << applications_ << " applications, "
+	   << converged << " of " << Neig << " converged, max residual " << rmax << endl;
+    }
+
+    if (converged == Neig || restart == flags_.Nrestarts) {
+      lambda_.resize(Nwant);
+      residual_.resize(Nwant);
+      x_.resize(Nwant);
+      for (int j=0; j<Nwant; ++j) {
+	const int c = order[j];
+	lambda_[j] = Complex(wr[c], wi[c]);
+	residual_[j] = res[j];
+      }
+
+      // x = V Y, the pair's parts scaled to unit length together
+      array<const Real*> v(s);
+      for (int i=0; i<s; ++i)
+	v[i] = V_[i].pointer();
+      array<Real*> xp(Nwant);
+      for (int j=0; j<Nwant; ++j) {
+	x_[j].resize(N_);
+	x_[j].setToZero();
+	xp[j] = x_[j].pointer();
+      }
+      blockUpdate(v.pointer(), s, Y.pointer(), xp.pointer(), Nwant, N_);
+      for (int j=0; j<Nwant; ) {
+	const int cols = (wi[order[j]] != 0.0 && j+1 < Nwant) ? 2 : 1;
+	Real n2 = 0.0;
+	for (int l=0; l<cols; ++l) {
+	  const Real* xl = xp[j+l];
+	  Real d;
+	  blockGram(&xl, 1, &xl, 1, N_, &d);
+	  n2 += d;
+	}
+	for (int l=0; l<cols; ++l)
+	  x_[j+l] *= 1.0/sqrt(n2);
+	j += cols;
+      }
+      return converged;
+    }
+
+    // Krylov-Schur restart: keep p leading Ritz vectors, without splitting
+    // a pair, and leave room for one block
+    int p = (s + Nwant)/2;
+    if (p > s - b)
+      p = s - b;
+    if (p < Nwant)
+      p = Nwant;
+    if (wi[order[p-1]] > 0.0)
+      p = (p + 1 <= s - b) ? p + 1 : p - 1;
+
+    // Orthonormalize the first p columns of Y (MGS, twice)
+    for (int j=0; j<p; ++j) {
+      Real* yj = Y.pointer() + j*s;
+      for (int pass=0; pass<2; ++pass)
+	for (int i=0; i<j; ++i) {
+	  const Real* yi = Y.pointer() + i*s;
+	  Real d = 0.0;
+	  for (int q=0; q<s; ++q)
+	    d += yi[q]*yj[q];
+	  for (int q=0; q<s; ++q)
+	    yj[q] -= d*yi[q];
+	}
+      Real d = 0.0;
+      for (int q=0; q<s; ++q)
+	d += yj[q]*yj[q];
+      d = 1.0/sqrt(d);
+      for (int q=0; q<s; ++q)
+	yj[q] *= d;
+    }
+
+    // Rayleigh quotient T = Y^T H Y and coupling B Y of the new basis
+    array<Real> HY((s + b)*p);
+    for (int j=0; j<p; ++j)
+      for (int i=0; i<s+b; ++i) {
+	Real d = 0.0;
+	for (int q=0; q<s; ++q)
+	  d += H_[q*ld + i]*Y[j*s + q];
+	HY[j*(s + b) + i] = d;
+      }
+    H_.fill(0.0);
+    for (int j=0; j<p; ++j) {
+      for (int i=0; i<p; ++i) {
+	Real d = 0.0;
+	for (int q=0; q<s; ++q)
+	  d += Y[i*s + q]*HY[j*(s + b) + q];
+	H_[j*ld + i] = d;
+      }
+      for (int i=0; i<b; ++i)
+	H_[j*ld + p + i] = HY[j*(s + b) + s + i];
+    }
+
+    array<Real*> v(s);
+    for (int i=0; i<s; ++i)
+      v[i] = V_[i].pointer();
+    blockRotate(v.pointer(), s, Y.pointer(), p, N_);
+    for (int j=0; j<b; ++j)
+      swap(V_[p + j], V_[s + j]);
+    s = p;
+  }
+}
+
+} //namespace channelflow
@@ -0,0 +1,104 @@
+// eigen.h: block Arnoldi eigensolver over flat vectors
+
+#ifndef CHFLOW_EXT_EIGEN_H
+#define CHFLOW_EXT_EIGEN_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "channelflow/vector.h"
+
+namespace channelflow {
+
+// y[j] = A x[j] for j < n, for an operator that is cheaper applied to a
+// block of vectors at once than to each in turn
+class BlockOperator {
+public:
+  virtual ~BlockOperator();
+  virtual void apply(int n, const Vector* const* x, Vector* const* y) = 0;
+};
+
+// Eigenvalues lambda_j = wr[j] + i wi[j] and eigenvectors of a dense real
+// n x n matrix A, column-major, by reduction to Hessenberg form and the
+// shifted QR algorithm (orthes and hqr2 of EISPACK). A is overwritten.
+// Column j of Z (n x n, column-major) is the eigenvector of a real lambda_j;
+// for a complex pair, wi[j] > 0 and wi[j+1] = -wi[j], the eigenvector of
+// lambda_j is Z_j + i Z_{j+1}.
+void eigenvalues(int n, Real* A, Real* wr, Real* wi, Real* Z);
+
+// ArnoldiFlags configures BlockArnoldi.
+class ArnoldiFlags {
+public:
+  ArnoldiFlags();
+
+  int Neig;        // wanted eigenvalues, largest in modulus
+  int blockSize;   // vectors per application of the operator
+  int Kmax;        // maximum basis size, rounded down to whole blocks
+  int Nrestarts;
+  Real tol;        // converged when |A x - lambda x| < tol |lambda| |x|
+  bool verbose;
+};
+
+// BlockArnoldi finds the Neig eigenvalues of largest modulus of a linear
+// operator, e.g. the linearized time-T map of an equilibrium or orbit
+// (Floquet multipliers), by block Arnoldi iteration with Krylov-Schur
+// restarts. Each step applies A to a block of blockSize vectors, then
+// orthogonalizes the new block against the basis by block classical
+// Gram-Schmidt with reorthogonalization: the Gram matrix V^T W comes from
+// one parallel pass over the basis, and W -= V H from another, so the
+// basis is streamed through cache twice per block rather than twice per
+// vector. When the basis is full, it is contracted in place to an
+// orthonormal basis of the invariant subspace of the wanted Ritz values,
+// with the Rayleigh quotient and residual block carried over, and the
+// iteration continues from the residual block.
+//
+// A Ritz pair (lambda, x = V y) has residual |A x - lambda x| = |B y| for the
+// rows B of the Rayleigh quotient that couple V to the residual block, so
+// convergence is tested without applying A. All vectors are allocated on
+// construction.
+
+class BlockArnoldi {
+public:
+  BlockArnoldi(const ArnoldiFlags& flags, int N);
+
+  // Iterate from start (else random vectors); returns the number of the
+  // Neig leading eigenvalues converged
+  int solve(BlockOperator& A, const Vector* start=0);
+
+  // Eigenvalues in order of decreasing modulus, for j < number()
+  int number() const;            // Neig, or Neig+1 to complete a pair
+  Complex eigenvalue(int j) const;
+  Real residual(int j) const;    // |A x - lambda x|/|lambda x|
+  int applications() const;      // of A to a vector, in the last solve
+
+  // Eigenvector of a real eigenvalue j; for a pair j, j+1 with Im > 0 at
+  // j, the real and imaginary parts of the eigenvector of lambda_j. Unit
+  // length, or the pair unit length together.
+  const Vector& eigenvector(int j) const;
+
+  const ArnoldiFlags& flags() const;
+
+private:
+  ArnoldiFlags flags_;
+  int N_;
+  int b_;
+  int Kmax_;
+  int applications_;
+  array<Vector> V_;          // Kmax + b basis vectors
+  array<Real> H_;            // Rayleigh quotient, column-major, Kmax + b rows
+  array<Complex> lambda_;
+  array<Real> residual_;
+  array<Vector> x_;
+
+  // A on the block at s, orthogonalized into the block at s+b
+  void expand(BlockOperator& A, int s);
+
+  // Orthonormalize w[j], j < m, against v[i], i < k, and then each other:
+  // w_in = v C + w_out R for C k x m and R m x m upper triangular, both
+  // column-major. A w[j] within the span is replaced by a random vector,
+  // with a zero column in R.
+  void orthonormalize(const Real* const* v, int k, Real* const* w, int m,
+		      Real* C, Real* R);
+};
+
+} //namespace channelflow
+#endif
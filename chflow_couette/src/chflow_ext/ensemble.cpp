@@ -0,0 +1,383 @@
+// ensemble.cpp: SBDF integration of an ensemble of fields with shared solvers
+
+#include <cstring>
+#include "ensemble.h"
+#include "dnsext.h"
+#include "gridtables.h"
+
+using namespace std;
+
+namespace channelflow {
+
+EnsembleDNS::EnsembleDNS()
+  :
+  MultistepDNS(),
+  N_(0),
+  J_(0),
+  pushed_(0),
+  init_(0)
+{}
+
+EnsembleDNS::EnsembleDNS(const EnsembleDNS& dns)
+  :
+  MultistepDNS(dns),
+  N_(dns.N_),
+  J_(dns.J_),
+  pushed_(dns.pushed_),
+  nl_(dns.nl_),
+  init_(dns.init_ ? dns.init_->clone() : 0),
+  uh_(dns.uh_),
+  fh_(dns.fh_),
+  diag_(dns.diag_),
+  f0valid_(dns.f0valid_),
+  dPdxm_(dns.dPdxm_),
+  Ubulkm_(dns.Ubulkm_),
+  projector_(dns.projector_)
+{}
+
+EnsembleDNS::EnsembleDNS(const array<FlowField>& u, const ChebyCoeff& Ubase,
+			 Real nu, Real dt, const DNSFlags& flags, Real t)
+  :
+  MultistepDNS(u[0], Ubase, nu, dt, flags, t),
+  N_(u.length()),
+  J_(alpha_.length()),
+  pushed_(0),
+  nl_(u[0]),
+  init_(0),
+  uh_(N_*J_),
+  fh_(N_*J_),
+  diag_(N_),
+  f0valid_(N_),
+  dPdxm_(N_),
+  Ubulkm_(N_),
+  projector_(flags.symmetries, u[0].Nx(), u[0].Nz())
+{
+  if (flags.nonlinearity != Rotational || !ubase_.isNull() || flags.dealias_y())
+    cferror("EnsembleDNS: needs Rotational nonlinearity about Ubase, without y dealiasing");
+  if (flags.initstepping != SMRK2 && flags.initstepping != CNRK2)
+    cferror("EnsembleDNS: initstepping must be SMRK2 or CNRK2");
+
+  // The base class history is not used
+  u_.resize(0);
+  f_.resize(0);
+
+  DNSFlags initflags = flags;
+  initflags.timestepping = flags.initstepping;
+  if (J_ > 1) {
+    if (flags.initstepping == CNRK2)
+      init_ = new RungeKuttaDNS(u[0], Ubase, nu, dt, initflags, t);
+    else
+      init_ = new CNABstyleDNS(u[0], Ubase, nu, dt, initflags, t);
+  }
+
+  const FlowField zero(u[0].Nx(), u[0].Ny(), u[0].Nz(), 3, u[0].Lx(), u[0].Lz(),
+		       u[0].a(), u[0].b(), Spectral, Spectral);
+  for (int m=0; m<N_; ++m) {
+    if (!sameGeometry(u[m], u[0]))
+      cferror("EnsembleDNS: members must share the grid");
+    for (int j=0; j<J_; ++j) {
+      uh_[m*J_ + j] = zero;
+      fh_[m*J_ + j] = zero;
+    }
+    f0valid_[m] = false;
+    dPdxm_[m] = dPdxAct_;
+    Ubulkm_[m] = UbulkAct_;
+    nl_.diagnose(u[m], Ubase_, diag_[m]);
+    diag_[m].t = t_;
+  }
+}
+
+EnsembleDNS::~EnsembleDNS() {
+  delete init_;
+  init_ = 0;
+}
+
+EnsembleDNS& EnsembleDNS::operator=(const EnsembleDNS& dns) {
+  if (this == &dns)
+    return *this;
+  MultistepDNS::operator=(dns);
+  N_ = dns.N_;
+  J_ = dns.J_;
+  pushed_ = dns.pushed_;
+  nl_ = dns.nl_;
+  delete init_;
+  init_ = dns.init_ ? dns.init_->clone() : 0;
+  uh_ = dns.uh_;
+  fh_ = dns.fh_;
+  diag_ = dns.diag_;
+  f0valid_ = dns.f0valid_;
+  dPdxm_ = dns.dPdxm_;
+  Ubulkm_ = dns.Ubulkm_;
+  projector_ = dns.projector_;
+  return *this;
+}
+
+DNSAlgorithm* EnsembleDNS::clone() const {
+  return new EnsembleDNS(*this);
+}
+
+int EnsembleDNS::members() const {
+  return N_;
+}
+
+const FlowDiagnostics& EnsembleDNS::diagnostics(int m) const {
+  return diag_[m];
+}
+
+Real EnsembleDNS::CFL(int m) const {
+  return cflNumber(diag_[m].cflfactor, dt_, flags_);
+}
+
+Real EnsembleDNS::CFL() const {
+  Real cfl = 0.0;
+  for (int m=0; m<N_; ++m)
+    cfl = std::max(cfl, CFL(m));
+  return cfl;
+}
+
+Real EnsembleDNS::dPdx(int m) const {
+  return dPdxm_[m];
+}
+
+Real EnsembleDNS::Ubulk(int m) const {
+  return Ubulkm_[m];
+}
+
+// As MultistepDNS, after Ninitsteps_ initialization steps
+bool EnsembleDNS::full() const {
+  return pushed_ > Ninitsteps_;
+}
+
+void EnsembleDNS::advance(FlowField& u, FlowField& q, int nSteps) {
+  cferror("EnsembleDNS::advance : advance the ensemble as a whole");
+}
+
+// The histories no longer fit the new dt; they are refilled by
+// initialization steps from the current fields
+void EnsembleDNS::reset_dt(Real dt) {
+  MultistepDNS::reset_dt(dt);
+  u_.resize(0);
+  f_.resize(0);
+  if (init_)
+    init_->reset_dt(dt);
+  pushed_ = 0;
+  for (int m=0; m<N_; ++m)
+    f0valid_[m] = false;
+}
+
+// The members' histories, as FusedMultistepDNS::project
+void EnsembleDNS::project() {
+  if (projector_.length() == 0)
+    return;
+  for (int k=0; k<uh_.length(); ++k) {
+    projector_(uh_[k]);
+    projector_(fh_[k]);
+  }
+}
+
+bool EnsembleDNS::current(int m, const FlowField& u) const {
+  const FlowField& u0 = uh_[m*J_];
+  return f0valid_[m]
+    && pushed_ > 0
+    && sameGeometry(u, u0)
+    && u.xzstate() == u0.xzstate() && u.ystate() == u0.ystate()
+    && memcmp(u.rawData(), u0.rawData(), u.rawDataLength()*sizeof(Real)) == 0;
+}
+
+// Shift member m's history and put u and N(u) in front, with diagnostics
+void EnsembleDNS::push(int m, const FlowField& u) {
+  FlowField* uh = &uh_[m*J_];
+  FlowField* fh = &fh_[m*J_];
+  for (int j=J_-1; j>0; --j) {
+    swap(uh[j], uh[j-1]);
+    swap(fh[j], fh[j-1]);
+  }
+  uh[0] = u;
+  uh[0].makeSpectral();
+  nl_(uh[0], Ubase_, fh[0], &diag_[m]);
+  diag_[m].t = t_;
+  f0valid_[m] = true;
+}
+
+void EnsembleDNS::advance(array<FlowField>& u, array<FlowField>& q, int nSteps) {
+  if (u.length() != N_)
+    cferror("EnsembleDNS::advance : number of fields differs from the ensemble's");
+  if (q.length() != N_)
+    q.resize(N_);
+  for (int m=0; m<N_; ++m) {
+    if (!q[m].geomCongruent(u[m]) || q[m].Nd() != 1)
+      q[m].resize(u[m].Nx(), u[m].Ny(), u[m].Nz(), 1, u[m].Lx(), u[m].Lz(), u[m].a(), u[m].b());
+    u[m].makeSpectral();
+    q[m].makeSpectral();
+  }
+
+  for (int n=0; n<nSteps; ++n) {
+    // The current fields head the histories, unless changed since
+    const int pushed = pushed_;
+    for (int m=0; m<N_; ++m)
+      if (!current(m, u[m])) {
+	if (pushed == 0)
+	  push(m, u[m]);
+	else {
+	  uh_[m*J_] = u[m];
+	  nl_(uh_[m*J_], Ubase_, fh_[m*J_]);
+	}
+      }
+    if (pushed_ == 0)
+      pushed_ = 1;
+
+    if (!full()) {
+      // Initialization step by the shared one-step algorithm
+      const Real t = t_;
+      for (int m=0; m<N_; ++m) {
+	init_->reset_time(t);
+	init_->advance(u[m], q[m], 1);
+	u[m].makeSpectral();
+	q[m].makeSpectral();
+	dPdxm_[m] = init_->dPdx();
+	Ubulkm_[m] = init_->Ubulk();
+      }
+      t_ = t + dt_;
+      for (int m=0; m<N_; ++m)
+	push(m, u[m]);
+      ++pushed_;
+      continue;
+    }
+
+    solve(u, q);
+    t_ += dt_;
+    for (int m=0; m<N_; ++m)
+      push(m, u[m]);
+  }
+
+  // The projected u[m] stays bitwise equal to its projected history head,
+  // so that the next advance reuses the projected f
+  if (projector_.length() > 0) {
+    project();
+    for (int m=0; m<N_; ++m) {
+      projector_(u[m]);
+      projector_(q[m]);
+      nl_.diagnose(u[m], Ubase_, diag_[m]);
+      diag_[m].t = t_;
+    }
+  }
+  if (flags_.dealias_xz())
+    for (int m=0; m<N_; ++m)
+      u[m].setPadded(true);
+}
+
+// One SBDF step for all members: per mode, the history sums of each member
+// are the right-hand sides of the mode's TauSolver, as in
+// FusedMultistepDNS::solve
+void EnsembleDNS::solve(array<FlowField>& u, array<FlowField>& q) {
+  const int J = J_;
+  const int N = N_;
+  const int Ny = Ny_;
+  const int Mx = Mx_;
+  const int Mz = Mz_;
+  const int ystride = 2*Mx*Mz;   // Reals between successive ny
+  const int istride = Ny*ystride; // Reals between components
+
+  ChebyCoeff Uyy(Ubaseyy_);
+  if (Uyy.N() == Ny)
+    Uyy.makeSpectral();
+
+  array<const Real*> up(N*J);
+  array<const Real*> fp(N*J);
+  array<Real*> ud(N);
+  array<Real*> qd(N);
+  for (int m=0; m<N; ++m) {
+    for (int j=0; j<J; ++j) {
+      up[m*J + j] = uh_[m*J + j].rawData();
+      fp[m*J + j] = fh_[m*J + j].rawData();
+    }
+    ud[m] = u[m].rawData();
+    qd[m] = q[m].rawData();
+  }
+
+#pragma omp parallel
+  {
+    ComplexChebyCoeff uk(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff vk(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff wk(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff Pk(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff Rx(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff Ry(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff Rz(Ny, a_, b_, Spectral);
+
+#pragma omp for schedule(dynamic)
+    for (int k=0; k<Mx*Mz; ++k) {
+      const int mx = k / Mz;
+      const int mz = k % Mz;
+      const int kx = u[0].kx(mx);
+      const int kz = u[0].kz(mz);
+      const int o = 2*k;
+      const bool zeroed = isAliasedMode(kx, kz) || kx == Nx_/2 || kz == Nz_/2;
+
+      for (int m=0; m<N; ++m) {
+	Real* um = ud[m];
+	Real* qm = qd[m];
+
+	// Aliased and Nyquist modes are zeroed (no tausolvers for the latter)
+	if (zeroed) {
+	  for (int ny=0; ny<Ny; ++ny) {
+	    const int r = o + ny*ystride;
+	    for (int i=0; i<3; ++i)
+	      um[r + i*istride] = um[r + i*istride + 1] = 0.0;
+	    qm[r] = qm[r+1] = 0.0;
+	  }
+	  continue;
+	}
+
+	for (int ny=0; ny<Ny; ++ny) {
+	  const int r = o + ny*ystride;
+	  Real rx[2] = {0.0, 0.0};
+	  Real ry[2] = {0.0, 0.0};
+	  Real rz[2] = {0.0, 0.0};
+	  for (int j=0; j<J; ++j) {
+	    const Real a = -alpha_[j]/dt_;
+	    const Real b = -beta_[j];
+	    const Real* uj = up[m*J + j] + r;
+	    const Real* fj = fp[m*J + j] + r;
+	    for (int c=0; c<2; ++c) {
+	      rx[c] += a*uj[c]           + b*fj[c];
+	      ry[c] += a*uj[c+istride]   + b*fj[c+istride];
+	      rz[c] += a*uj[c+2*istride] + b*fj[c+2*istride];
+	    }
+	  }
+	  Rx.re[ny] = rx[0]; Rx.im[ny] = rx[1];
+	  Ry.re[ny] = ry[0]; Ry.im[ny] = ry[1];
+	  Rz.re[ny] = rz[0]; Rz.im[ny] = rz[1];
+	}
+
+	if (kx == 0 && kz == 0) {
+	  if (Uyy.N() == Ny)
+	    for (int ny=0; ny<Ny; ++ny)
+	      Rx.re[ny] += nu_*Uyy[ny];
+
+	  if (flags_.constraint == PressureGradient) {
+	    Rx.re[0] -= dPdxRef_;
+	    tausolver_[mx][mz].solve(uk, vk, wk, Pk, Rx, Ry, Rz);
+	    dPdxm_[m] = dPdxRef_;
+	  }
+	  else
+	    tausolver_[mx][mz].solve(uk, vk, wk, Pk, dPdxm_[m], Rx, Ry, Rz,
+				     UbulkRef_ - UbulkBase_);
+	  Ubulkm_[m] = UbulkBase_ + uk.re.mean();
+	}
+	else
+	  tausolver_[mx][mz].solve(uk, vk, wk, Pk, Rx, Ry, Rz);
+
+	for (int ny=0; ny<Ny; ++ny) {
+	  const int r = o + ny*ystride;
+	  um[r]   = uk.re[ny]; um[r+1] = uk.im[ny];
+	  um[r+istride]   = vk.re[ny]; um[r+istride+1]   = vk.im[ny];
+	  um[r+2*istride] = wk.re[ny]; um[r+2*istride+1] = wk.im[ny];
+	  qm[r]   = Pk.re[ny]; qm[r+1] = Pk.im[ny];
+	}
+      }
+    }
+  }
+}
+
+} //namespace channelflow
@@ -0,0 +1,83 @@
+// ensemble.h: SBDF integration of an ensemble of fields with shared solvers
+
+#ifndef CHFLOW_EXT_ENSEMBLE_H
+#define CHFLOW_EXT_ENSEMBLE_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "channelflow/chebyshev.h"
+#include "channelflow/flowfield.h"
+#include "channelflow/dns.h"
+#include "nonlinear.h"
+#include "symmetry.h"
+
+namespace channelflow {
+
+// EnsembleDNS advances N member fields of the same grid, Re and dt together
+// with the SBDFn or CNFE1 method of FusedMultistepDNS. The members share
+// one set of TauSolvers, one RotationalNL with its transform plans and one
+// initialization algorithm (flags.initstepping, which must be self-starting
+// and hold no state between steps: SMRK2 or CNRK2). Per member there are
+// only the J fields of u and of the explicit term f.
+//
+// The implicit solve loops over Fourier modes outermost and members inside,
+// so each mode's solver is loaded once per step for all members, which act
+// as multiple right-hand sides. The nonlinear terms are evaluated member by
+// member, with the diagnostics of each new field as in FusedMultistepDNS.
+// Requires Rotational nonlinearity about Ubase without y dealiasing. Time,
+// dt and the initialization count are common; dPdx and Ubulk are per
+// member.
+//
+// flags.symmetries are imposed as by DNSExt: at the end of each advance the
+// members' u, q and histories are projected by a SymmetryProjector and
+// their diagnostics recomputed.
+
+class EnsembleDNS : public MultistepDNS {
+public:
+  EnsembleDNS();
+  EnsembleDNS(const EnsembleDNS& dns);
+  EnsembleDNS(const array<FlowField>& u, const ChebyCoeff& Ubase, Real nu,
+	      Real dt, const DNSFlags& flags, Real t=0);
+  ~EnsembleDNS();
+
+  EnsembleDNS& operator=(const EnsembleDNS& dns);
+
+  // Advance all members nSteps; q[m] receives the pressure of member m
+  void advance(array<FlowField>& u, array<FlowField>& q, int nSteps=1);
+
+  // Single-field advance is meaningless for an ensemble; cferror
+  virtual void advance(FlowField& u, FlowField& q, int nSteps=1);
+  virtual void reset_dt(Real dt);
+  virtual void project();
+  virtual bool full() const;
+
+  virtual DNSAlgorithm* clone() const;
+
+  int members() const;
+  const FlowDiagnostics& diagnostics(int m) const;  // of member m's u
+  Real CFL(int m) const;
+  Real CFL() const;  // the largest of the members'
+  Real dPdx(int m) const;
+  Real Ubulk(int m) const;
+
+protected:
+  int N_;                       // members
+  int J_;                       // history length of the method
+  int pushed_;                  // fields pushed, Ninitsteps_+1 when full
+  RotationalNL nl_;
+  DNSAlgorithm* init_;          // shared initialization algorithm
+  array<FlowField> uh_;         // member m's u_j at m*J_ + j, newest j = 0
+  array<FlowField> fh_;         // and its explicit term
+  array<FlowDiagnostics> diag_;
+  array<char> f0valid_;         // fh_[m*J_] == N(uh_[m*J_]), with diag_[m]
+  array<Real> dPdxm_;
+  array<Real> Ubulkm_;
+  SymmetryProjector projector_;  // of flags.symmetries
+
+  bool current(int m, const FlowField& u) const;  // u bitwise uh_[m*J_]
+  void push(int m, const FlowField& u);            // shift in a new u
+  void solve(array<FlowField>& u, array<FlowField>& q);  // one SBDF step
+};
+
+} //namespace channelflow
+#endif
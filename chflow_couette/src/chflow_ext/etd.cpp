@@ -0,0 +1,779 @@
+// etd.cpp: exponential time differencing with per-mode Stokes propagators
+
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include "etd.h"
+#include "gridtables.h"
+
+using namespace std;
+
+namespace channelflow {
+
+// df = d/dy f by the backward recurrence, s = 2/(b-a)
+static void diff(const Complex* f, Complex* df, int N, Real s) {
+  df[N-1] = 0.0;
+  df[N-2] = (2.0*(N-1))*f[N-1];
+  for (int k=N-3; k>=0; --k)
+    df[k] = df[k+2] + (2.0*(k+1))*f[k+1];
+  df[0] *= 0.5;
+  for (int k=0; k<N; ++k)
+    df[k] *= s;
+}
+
+// fx,fy,fz = sum_i w[i] N_i of mode offset o, for N_i = -f[i]
+static void sumForcing(int n, const FlowField* const* f, const Real* w, int o,
+		       int Ny, int ystride, int istride,
+		       Complex* fx, Complex* fy, Complex* fz) {
+  for (int ny=0; ny<Ny; ++ny) {
+    fx[ny] = fy[ny] = fz[ny] = 0.0;
+    for (int i=0; i<n; ++i) {
+      const Real* fd = f[i]->rawData() + o + ny*ystride;
+      const Real c = -w[i];
+      fx[ny] += c*Complex(fd[0], fd[1]);
+      fy[ny] += c*Complex(fd[istride], fd[istride+1]);
+      fz[ny] += c*Complex(fd[2*istride], fd[2*istride+1]);
+    }
+  }
+}
+
+// F' = f with F_0 = 0, s = 2/(b-a)
+static void integrate(const Complex* f, Complex* F, int N, Real s) {
+  F[0] = 0.0;
+  for (int k=1; k<N; ++k) {
+    const Complex fm = (k == 1) ? 2.0*f[0] : f[k-1];
+    const Complex fp = (k+1 < N) ? f[k+1] : Complex(0.0, 0.0);
+    F[k] = (fm - fp)/(2.0*k*s);
+  }
+}
+
+// C = A B, n x n row-major
+static void matmul(const Real* A, const Real* B, Real* C, int n) {
+  for (int i=0; i<n*n; ++i)
+    C[i] = 0.0;
+  for (int i=0; i<n; ++i)
+    for (int k=0; k<n; ++k) {
+      const Real a = A[i*n+k];
+      if (a == 0.0)
+	continue;
+      const Real* b = B + k*n;
+      Real* c = C + i*n;
+      for (int j=0; j<n; ++j)
+	c[j] += a*b[j];
+    }
+}
+
+// X = A^-1 B for n x n A (overwritten) and B (overwritten by X), by Gaussian
+// elimination with partial pivoting
+static void solveMatrix(Real* A, Real* B, int n) {
+  for (int k=0; k<n; ++k) {
+    int p = k;
+    for (int i=k+1; i<n; ++i)
+      if (abs(A[i*n+k]) > abs(A[p*n+k]))
+	p = i;
+    if (A[p*n+k] == 0.0)
+      cferror("StokesPropagator: singular tau matrix");
+    if (p != k)
+      for (int j=0; j<n; ++j) {
+	swap(A[k*n+j], A[p*n+j]);
+	swap(B[k*n+j], B[p*n+j]);
+      }
+    for (int i=k+1; i<n; ++i) {
+      const Real l = A[i*n+k]/A[k*n+k];
+      if (l == 0.0)
+	continue;
+      for (int j=k; j<n; ++j)
+	A[i*n+j] -= l*A[k*n+j];
+      for (int j=0; j<n; ++j)
+	B[i*n+j] -= l*B[k*n+j];
+    }
+  }
+  for (int i=n-1; i>=0; --i)
+    for (int j=0; j<n; ++j) {
+      Real sum = B[i*n+j];
+      for (int k=i+1; k<n; ++k)
+	sum -= A[i*n+k]*B[k*n+j];
+      B[i*n+j] = sum/A[i*n+i];
+    }
+}
+
+// phi[k] = phi_k(A), k = 0..3, and if half != 0, half[k] = phi_k(A/2),
+// k = 0,1. Taylor series at B = A/2^s, |B|_1 <= 1/2, then s steps of
+//   phi_k(2z) = 2^-k (phi_0(z) phi_k(z) + sum_{j=1..k} phi_j(z)/(k-j)!)
+// (Skaflestad & Wright 2009).
+static void phiFunctions(const Real* A, int n, array<Real>* phi, array<Real>* half) {
+  const int nn = n*n;
+  Real norm = 0.0;
+  for (int j=0; j<n; ++j) {
+    Real sum = 0.0;
+    for (int i=0; i<n; ++i)
+      sum += abs(A[i*n+j]);
+    norm = Greater(norm, sum);
+  }
+  int s = 1;
+  Real scale = 0.5;
+  while (norm*scale > 0.5) {
+    ++s;
+    scale *= 0.5;
+  }
+
+  const int M = 14;  // Taylor terms, error below 0.5^(M+1)/(M+1)!
+  Real invfact[M+4];
+  invfact[0] = 1.0;
+  for (int m=1; m<M+4; ++m)
+    invfact[m] = invfact[m-1]/m;
+
+  array<Real> B(nn);
+  array<Real> P(nn);
+  array<Real> Q(nn);
+  for (int i=0; i<nn; ++i) {
+    B[i] = scale*A[i];
+    P[i] = 0.0;
+  }
+  for (int i=0; i<n; ++i)
+    P[i*n+i] = 1.0;
+  for (int k=0; k<4; ++k) {
+    phi[k].resize(nn);
+    for (int i=0; i<nn; ++i)
+      phi[k][i] = 0.0;
+  }
+  for (int m=0; m<=M; ++m) {
+    for (int k=0; k<4; ++k)
+      for (int i=0; i<nn; ++i)
+	phi[k][i] += invfact[m+k]*P[i];
+    if (m < M) {
+      matmul(P.pointer(), B.pointer(), Q.pointer(), n);
+      P = Q;
+    }
+  }
+
+  array<Real> prod[4];
+  for (int k=0; k<4; ++k)
+    prod[k].resize(nn);
+  for (int step=1; step<=s; ++step) {
+    if (half && step == s) {
+      half[0] = phi[0];
+      half[1] = phi[1];
+    }
+    for (int k=0; k<4; ++k)
+      matmul(phi[0].pointer(), phi[k].pointer(), prod[k].pointer(), n);
+    for (int k=3; k>=0; --k) {
+      const Real c = 1.0/(1 << k);
+      for (int i=0; i<nn; ++i) {
+	Real sum = prod[k][i];
+	for (int j=1; j<=k; ++j)
+	  sum += invfact[k-j]*phi[j][i];
+	phi[k][i] = c*sum;
+      }
+    }
+  }
+}
+
+/**************************************************************************
+ * StokesPropagator
+ **************************************************************************/
+
+StokesPropagator::StokesPropagator()
+  :
+  kappa2_(0.0),
+  order_(0),
+  N_(0),
+  n4_(0),
+  n2_(0)
+{}
+
+StokesPropagator::StokesPropagator(Real kappa2, Real nu, Real h, int order,
+				   const BaseflowOperators& ops)
+  :
+  kappa2_(kappa2),
+  order_(order),
+  N_(ops.N()),
+  n4_(kappa2 == 0.0 ? 0 : ops.N()-4),
+  n2_(ops.N()-2)
+{
+  if (order != 2 && order != 4)
+    cferror("StokesPropagator: order must be 2 or 4");
+  if (N_ < 6)
+    cferror("StokesPropagator: needs Ny >= 6");
+  const int N = N_;
+  const Real* D2 = ops.D2();
+  const Real* D4 = ops.D4();
+
+  for (int sys=0; sys<2; ++sys) {
+    const bool os = (sys == OrrSommerfeld);
+    const int n = os ? n4_ : n2_;
+    if (n == 0)
+      continue;
+    array<Real>* mat = os ? os_ : sq_;
+
+    // Galerkin mass and stiffness matrices on the basis
+    array<Real> Mt(n*n);
+    array<Real> At(n*n);
+    array<Real> e(n);
+    array<Real> q(N);
+    array<Real> Mq(N);
+    array<Real> Aq(N);
+    array<Real> col(n);
+    for (int j=0; j<n; ++j) {
+      for (int k=0; k<n; ++k)
+	e[k] = (k == j) ? 1.0 : 0.0;
+      basisToCheby(os, e.pointer(), q.pointer(), n, N);
+      for (int i=0; i<N; ++i) {
+	Real d2 = 0.0;
+	Real d4 = 0.0;
+	for (int k=0; k<N; ++k) {
+	  d2 += D2[i*N+k]*q[k];
+	  d4 += D4[i*N+k]*q[k];
+	}
+	if (os) {
+	  Mq[i] = d2 - kappa2*q[i];
+	  Aq[i] = nu*(d4 - 2*kappa2*d2 + kappa2*kappa2*q[i]);
+	}
+	else {
+	  Mq[i] = q[i];
+	  Aq[i] = nu*(d2 - kappa2*q[i]);
+	}
+      }
+      testProject(os, Mq.pointer(), col.pointer(), n);
+      for (int i=0; i<n; ++i)
+	Mt[i*n+j] = col[i];
+      testProject(os, Aq.pointer(), col.pointer(), n);
+      for (int i=0; i<n; ++i)
+	At[i*n+j] = col[i];
+    }
+
+    // Minv = M^-1, L = M^-1 A
+    array<Real> Minv(n*n);
+    for (int i=0; i<n*n; ++i)
+      Minv[i] = 0.0;
+    for (int i=0; i<n; ++i)
+      Minv[i*n+i] = 1.0;
+    array<Real> L(At);
+    {
+      array<Real> Mt2(Mt);
+      solveMatrix(Mt.pointer(), L.pointer(), n);
+      solveMatrix(Mt2.pointer(), Minv.pointer(), n);
+    }
+
+    array<Real> hL(n*n);
+    for (int i=0; i<n*n; ++i)
+      hL[i] = h*L[i];
+    array<Real> phi[4];
+    array<Real> half[2];
+    phiFunctions(hL.pointer(), n, phi, order == 4 ? half : 0);
+
+    // h phi_k M^-1 for the combinations the scheme uses
+    array<Real> tmp(n*n);
+    array<Real> hphiM[4];
+    for (int k=1; k<4; ++k) {
+      matmul(phi[k].pointer(), Minv.pointer(), tmp.pointer(), n);
+      hphiM[k].resize(n*n);
+      for (int i=0; i<n*n; ++i)
+	hphiM[k][i] = h*tmp[i];
+    }
+    mat[Exp] = phi[0];
+    if (order == 2) {
+      mat[Phi1] = hphiM[1];
+      mat[Phi2] = hphiM[2];
+    }
+    else {
+      mat[HalfExp] = half[0];
+      matmul(half[1].pointer(), Minv.pointer(), tmp.pointer(), n);
+      mat[HalfPhi1].resize(n*n);
+      mat[RK4a].resize(n*n);
+      mat[RK4b].resize(n*n);
+      mat[RK4c].resize(n*n);
+      for (int i=0; i<n*n; ++i) {
+	const Real p1 = hphiM[1][i];
+	const Real p2 = hphiM[2][i];
+	const Real p3 = hphiM[3][i];
+	mat[HalfPhi1][i] = 0.5*h*tmp[i];
+	mat[RK4a][i] = p1 - 3*p2 + 4*p3;
+	mat[RK4b][i] = 2*p2 - 4*p3;
+	mat[RK4c][i] = 4*p3 - p2;
+      }
+    }
+    if (os) {
+      mat[Generator] = L;
+      mat[Mass] = Minv;
+    }
+  }
+}
+
+void StokesPropagator::toBasis(System s, const Complex* f, Complex* a) const {
+  chebyToBasis(s == OrrSommerfeld, f, a, size(s));
+}
+
+void StokesPropagator::fromBasis(System s, const Complex* a, Complex* f) const {
+  basisToCheby(s == OrrSommerfeld, a, f, size(s), N_);
+}
+
+void StokesPropagator::galerkin(System s, const Complex* g, Complex* gt) const {
+  testProject(s == OrrSommerfeld, g, gt, size(s));
+}
+
+void StokesPropagator::apply(Op op, System s, const Complex* x, Complex* y) const {
+  const int n = size(s);
+  const array<Real>& M = (s == OrrSommerfeld) ? os_[op] : sq_[op];
+  assert(M.length() == n*n);
+  for (int i=0; i<n; ++i) {
+    const Real* Mi = M.pointer() + i*n;
+    Real re = 0.0;
+    Real im = 0.0;
+    for (int j=0; j<n; ++j) {
+      re += Mi[j]*x[j].real();
+      im += Mi[j]*x[j].imag();
+    }
+    y[i] += Complex(re, im);
+  }
+}
+
+int StokesPropagator::size(System s) const {return s == OrrSommerfeld ? n4_ : n2_;}
+Real StokesPropagator::kappa2() const {return kappa2_;}
+int StokesPropagator::order() const {return order_;}
+
+/**************************************************************************
+ * ETDDNS
+ **************************************************************************/
+
+ETDDNS::ETDDNS()
+  :
+  DNSAlgorithm(),
+  f0valid_(false)
+{}
+
+ETDDNS::ETDDNS(const ETDDNS& dns)
+  :
+  DNSAlgorithm(dns),
+  nl_(dns.nl_),
+  diag_(dns.diag_),
+  f0valid_(dns.f0valid_),
+  u0_(dns.u0_),
+  ustage_(dns.ustage_),
+  f_(dns.f_),
+  ops_(dns.ops_),
+  prop_(dns.prop_),
+  propIndex_(dns.propIndex_),
+  active_(dns.active_),
+  forcing00_(dns.forcing00_)
+{}
+
+ETDDNS::ETDDNS(const FlowField& u, const ChebyCoeff& Ubase, Real nu, Real dt,
+	       const DNSExtFlags& flags, Real t)
+  :
+  DNSAlgorithm(u, Ubase, nu, dt, flags, t),
+  nl_(u),
+  f0valid_(false),
+  u0_(u.Nx(), u.Ny(), u.Nz(), 3, u.Lx(), u.Lz(), u.a(), u.b()),
+  ustage_(flags.etdOrder == 4 ? 2 : 1),
+  f_(flags.etdOrder == 4 ? 4 : 2),
+  ops_(ChebyCoeff(u.Ny(), u.a(), u.b(), Spectral), u.Ny())
+{
+  if (flags.etdOrder != 2 && flags.etdOrder != 4)
+    cferror("ETDDNS: etdOrder must be 2 or 4");
+  if (flags.nonlinearity != Rotational || !ubase_.isNull() || flags.dealias_y())
+    cferror("ETDDNS: needs Rotational nonlinearity about Ubase, without y dealiasing");
+  if (flags.constraint != PressureGradient)
+    cferror("ETDDNS: supports the PressureGradient constraint only");
+  if (flags.implicitBaseflow || flags.movingFrame())
+    cferror("ETDDNS: implicit base flow and moving frames are not supported");
+
+  order_ = flags.etdOrder;
+  Ninitsteps_ = 0;
+  for (int i=0; i<ustage_.length(); ++i)
+    ustage_[i] = u0_;
+  for (int i=0; i<f_.length(); ++i)
+    f_[i] = u0_;
+  factor();
+}
+
+ETDDNS::~ETDDNS() {}
+
+ETDDNS& ETDDNS::operator=(const ETDDNS& dns) {
+  DNSAlgorithm::operator=(dns);
+  nl_ = dns.nl_;
+  diag_ = dns.diag_;
+  f0valid_ = dns.f0valid_;
+  u0_ = dns.u0_;
+  ustage_ = dns.ustage_;
+  f_ = dns.f_;
+  ops_ = dns.ops_;
+  prop_ = dns.prop_;
+  propIndex_ = dns.propIndex_;
+  active_ = dns.active_;
+  forcing00_ = dns.forcing00_;
+  return *this;
+}
+
+DNSAlgorithm* ETDDNS::clone() const {
+  return new ETDDNS(*this);
+}
+
+const FlowDiagnostics& ETDDNS::diagnostics() const {
+  return diag_;
+}
+
+bool ETDDNS::full() const {
+  return true;
+}
+
+bool ETDDNS::push(const FlowField& u) {
+  f0valid_ = false;
+  return true;
+}
+
+void ETDDNS::project() {
+  if (flags_.symmetries.length() > 0)
+    f0valid_ = false;
+}
+
+void ETDDNS::operator *= (const FieldSymmetry& symm) {
+  f0valid_ = false;
+}
+
+void ETDDNS::reset_dt(Real dt) {
+  cfl_ *= dt/dt_;
+  dt_ = dt;
+  factor();
+}
+
+bool ETDDNS::current(const FlowField& u) const {
+  return f0valid_
+    && sameGeometry(u, u0_)
+    && u.xzstate() == u0_.xzstate() && u.ystate() == u0_.ystate()
+    && memcmp(u.rawData(), u0_.rawData(), u.rawDataLength()*sizeof(Real)) == 0;
+}
+
+// One propagator per distinct kappa2 of the integrated modes. Modes whose
+// kappa2 agree to rounding error, e.g. (kx,kz) = (1,0) and (0,4) for
+// Lz = 4 Lx, share one; with the default box that saves about 1/4 of them.
+void ETDDNS::factor() {
+  const int Kx = Nx_/2;
+  const int Mxz = Mx_*Mz_;
+  active_.resize(Mxz);
+  for (int m=0; m<Mxz; ++m) {
+    const int mx = m / Mz_;
+    const int kx = (mx <= Nx_/2) ? mx : mx - Nx_;
+    const int kz = m % Mz_;
+    active_[m] = !(isAliasedMode(kx, kz) || kx == Nx_/2 || kz == Nz_/2);
+  }
+
+  vector<pair<Real,int> > modes;
+  for (int p=0; p<Kx*Mz_; ++p) {
+    const int kx = p / Mz_;
+    const int kz = p % Mz_;
+    if (isAliasedMode(kx, kz) || kz == Nz_/2)
+      continue;
+    const Real alpha = 2*pi*kx/Lx_;
+    const Real gamma = 2*pi*kz/Lz_;
+    modes.push_back(make_pair(alpha*alpha + gamma*gamma, p));
+  }
+  sort(modes.begin(), modes.end());
+
+  propIndex_.resize(Kx*Mz_);
+  for (int p=0; p<Kx*Mz_; ++p)
+    propIndex_[p] = -1;
+  vector<Real> kappa2;
+  for (size_t k=0; k<modes.size(); ++k) {
+    if (kappa2.empty() || modes[k].first > kappa2.back()*(1 + 1e-13))
+      kappa2.push_back(modes[k].first);
+    propIndex_[modes[k].second] = kappa2.size() - 1;
+  }
+
+  const int Nprop = kappa2.size();
+  prop_.resize(Nprop);
+  const int order = order_;
+#pragma omp parallel for schedule(dynamic)
+  for (int k=0; k<Nprop; ++k)
+    prop_[k] = StokesPropagator(kappa2[k], nu_, dt_, order, ops_);
+
+  // Mean-flow forcing -dPdx + nu Ubase''
+  forcing00_ = ChebyCoeff(Ny_, a_, b_, Spectral);
+  if (Ubaseyy_.N() == Ny_) {
+    ChebyCoeff Uyy(Ubaseyy_);
+    Uyy.makeSpectral();
+    for (int ny=0; ny<Ny_; ++ny)
+      forcing00_[ny] = nu_*Uyy[ny];
+  }
+  forcing00_[0] -= dPdxRef_;
+}
+
+void ETDDNS::advance(FlowField& u, FlowField& q, int Nsteps) {
+  typedef StokesPropagator SP;
+  u.makeSpectral();
+  q.makeSpectral();
+  for (int i=0; i<ustage_.length(); ++i)
+    ustage_[i].setState(Spectral, Spectral);
+
+  // dPdxRef_ may have been reset since factor()
+  forcing00_[0] = 0.0;
+  if (Ubaseyy_.N() == Ny_) {
+    ChebyCoeff Uyy(Ubaseyy_);
+    Uyy.makeSpectral();
+    forcing00_[0] = nu_*Uyy[0];
+  }
+  forcing00_[0] -= dPdxRef_;
+
+  for (int n=0; n<Nsteps; ++n) {
+    if (!current(u)) {
+      u0_ = u;
+      nl_(u0_, Ubase_, f_[0]);
+    }
+    const FlowField* f0 = &f_[0];
+    if (order_ == 2) {
+      // a = E u + Phi1 N(u),  u+ = E u + Phi1 N(u) + Phi2 (N(a) - N(u))
+      FlowField& ua = ustage_[0];
+      const Term sa[] = {{SP::Phi1, 1, {f0, 0}, {1.0, 0.0}}};
+      stage(u0_, SP::Exp, sa, 1, ua);
+      nl_(ua, Ubase_, f_[1]);
+      const Term s[] = {{SP::Phi1, 1, {f0, 0}, {1.0, 0.0}},
+			{SP::Phi2, 2, {&f_[1], f0}, {1.0, -1.0}}};
+      stage(u0_, SP::Exp, s, 2, u);
+    }
+    else {
+      // Cox & Matthews ETDRK4, stages a, b, c at t + h/2, h/2, h
+      FlowField& ua = ustage_[0];
+      FlowField& ub = ustage_[1];
+      const Term sa[] = {{SP::HalfPhi1, 1, {f0, 0}, {1.0, 0.0}}};
+      stage(u0_, SP::HalfExp, sa, 1, ua);
+      nl_(ua, Ubase_, f_[1]);
+      const Term sb[] = {{SP::HalfPhi1, 1, {&f_[1], 0}, {1.0, 0.0}}};
+      stage(u0_, SP::HalfExp, sb, 1, ub);
+      nl_(ub, Ubase_, f_[2]);
+      const Term sc[] = {{SP::HalfPhi1, 2, {&f_[2], f0}, {2.0, -1.0}}};
+      stage(ua, SP::HalfExp, sc, 1, ub);
+      nl_(ub, Ubase_, f_[3]);
+      const Term s[] = {{SP::RK4a, 1, {f0, 0}, {1.0, 0.0}},
+			{SP::RK4b, 2, {&f_[1], &f_[2]}, {1.0, 1.0}},
+			{SP::RK4c, 1, {&f_[3], 0}, {1.0, 0.0}}};
+      stage(u0_, SP::Exp, s, 3, u);
+    }
+    t_ += dt_;
+
+    // Explicit term for the next step and diagnostics of u(t) in one pass
+    u0_ = u;
+    nl_(u0_, Ubase_, f_[0], &diag_);
+    diag_.t = t_;
+    f0valid_ = true;
+  }
+  pressure(u, f_[0], q);
+  dPdxAct_ = dPdxRef_;
+  UbulkAct_ = UbulkBase_ + Re(u.profile(0, 0, 0)).mean();
+
+  if (flags_.dealias_xz())
+    u.setPadded(true);
+  cfl_ = cflNumber(diag_.cflfactor, dt_, flags_);
+}
+
+void ETDDNS::stage(const FlowField& x, StokesPropagator::Op E, const Term* terms,
+		   int Nterms, FlowField& uout) const {
+  typedef StokesPropagator SP;
+  const int Ny = Ny_;
+  const int Mx = Mx_;
+  const int Mz = Mz_;
+  const int ystride = 2*Mx*Mz;
+  const int istride = Ny*ystride;
+  const Real s = 2.0/(b_-a_);
+
+  assert(x.xzstate() == Spectral && x.ystate() == Spectral);
+  uout.setState(Spectral, Spectral);
+  const Real* xd = x.rawData();
+  Real* ud = uout.rawData();
+
+#pragma omp parallel
+  {
+    array<Complex> uk(Ny), vk(Ny), wk(Ny);
+    array<Complex> fx(Ny), fy(Ny), fz(Ny);
+    array<Complex> g(Ny), geta(Ny), tmp(Ny);
+    array<Complex> ya(Ny), yb(Ny), za(Ny), zb(Ny);
+
+#pragma omp for schedule(dynamic)
+    for (int m=0; m<Mx*Mz; ++m) {
+      const int o = 2*m;
+      if (!active_[m]) {
+	for (int ny=0; ny<Ny; ++ny)
+	  for (int i=0; i<3; ++i)
+	    ud[o + ny*ystride + i*istride] = ud[o + ny*ystride + i*istride + 1] = 0.0;
+	continue;
+      }
+      const int mx = m / Mz;
+      const int mz = m % Mz;
+      const int kx = (mx <= Nx_/2) ? mx : mx - Nx_;
+      const SP& p = prop_[propIndex_[abs(kx)*Mz + mz]];
+
+      for (int ny=0; ny<Ny; ++ny) {
+	const int r = o + ny*ystride;
+	uk[ny] = Complex(xd[r], xd[r+1]);
+	vk[ny] = Complex(xd[r+istride], xd[r+istride+1]);
+	wk[ny] = Complex(xd[r+2*istride], xd[r+2*istride+1]);
+      }
+
+      if (kx == 0 && mz == 0) {
+	// Heat equations for u00 and w00, with the mean-flow forcing in u00
+	p.toBasis(SP::Squire, uk.pointer(), ya.pointer());
+	p.toBasis(SP::Squire, wk.pointer(), yb.pointer());
+	for (int ny=0; ny<Ny; ++ny)
+	  za[ny] = zb[ny] = 0.0;
+	p.apply(E, SP::Squire, ya.pointer(), za.pointer());
+	p.apply(E, SP::Squire, yb.pointer(), zb.pointer());
+	for (int t=0; t<Nterms; ++t) {
+	  const Term& term = terms[t];
+	  sumForcing(term.n, term.f, term.w, o, Ny, ystride, istride,
+		     fx.pointer(), fy.pointer(), fz.pointer());
+	  Real wsum = 0.0;
+	  for (int i=0; i<term.n; ++i)
+	    wsum += term.w[i];
+	  for (int ny=0; ny<Ny; ++ny)
+	    fx[ny] += wsum*forcing00_[ny];
+	  p.galerkin(SP::Squire, fx.pointer(), g.pointer());
+	  p.apply(term.op, SP::Squire, g.pointer(), za.pointer());
+	  p.galerkin(SP::Squire, fz.pointer(), g.pointer());
+	  p.apply(term.op, SP::Squire, g.pointer(), zb.pointer());
+	}
+	p.fromBasis(SP::Squire, za.pointer(), uk.pointer());
+	p.fromBasis(SP::Squire, zb.pointer(), wk.pointer());
+	for (int ny=0; ny<Ny; ++ny)
+	  vk[ny] = 0.0;
+      }
+      else {
+	const Real alpha = 2*pi*kx/Lx_;
+	const Real gamma = 2*pi*mz/Lz_;
+	const Real kappa2 = p.kappa2();
+	const Complex ia(0.0, alpha);
+	const Complex ig(0.0, gamma);
+
+	// v and eta in the bases, propagated by E
+	for (int ny=0; ny<Ny; ++ny)
+	  tmp[ny] = ig*uk[ny] - ia*wk[ny];
+	p.toBasis(SP::OrrSommerfeld, vk.pointer(), ya.pointer());
+	p.toBasis(SP::Squire, tmp.pointer(), yb.pointer());
+	for (int ny=0; ny<Ny; ++ny)
+	  za[ny] = zb[ny] = 0.0;
+	p.apply(E, SP::OrrSommerfeld, ya.pointer(), za.pointer());
+	p.apply(E, SP::Squire, yb.pointer(), zb.pointer());
+
+	// g = -(D r + kappa2 Ny), geta = i gamma Nx - i alpha Nz
+	for (int t=0; t<Nterms; ++t) {
+	  const Term& term = terms[t];
+	  sumForcing(term.n, term.f, term.w, o, Ny, ystride, istride,
+		     fx.pointer(), fy.pointer(), fz.pointer());
+	  for (int ny=0; ny<Ny; ++ny)
+	    tmp[ny] = ia*fx[ny] + ig*fz[ny];
+	  diff(tmp.pointer(), g.pointer(), Ny, s);
+	  for (int ny=0; ny<Ny; ++ny) {
+	    g[ny] = -(g[ny] + kappa2*fy[ny]);
+	    geta[ny] = ig*fx[ny] - ia*fz[ny];
+	  }
+	  p.galerkin(SP::OrrSommerfeld, g.pointer(), tmp.pointer());
+	  p.apply(term.op, SP::OrrSommerfeld, tmp.pointer(), za.pointer());
+	  p.galerkin(SP::Squire, geta.pointer(), tmp.pointer());
+	  p.apply(term.op, SP::Squire, tmp.pointer(), zb.pointer());
+	}
+
+	// u = (i alpha v' - i gamma eta)/kappa2, w = (i gamma v' + i alpha eta)/kappa2
+	p.fromBasis(SP::OrrSommerfeld, za.pointer(), vk.pointer());
+	p.fromBasis(SP::Squire, zb.pointer(), tmp.pointer());
+	diff(vk.pointer(), g.pointer(), Ny, s);
+	for (int ny=0; ny<Ny; ++ny) {
+	  uk[ny] = (ia*g[ny] - ig*tmp[ny])/kappa2;
+	  wk[ny] = (ig*g[ny] + ia*tmp[ny])/kappa2;
+	}
+      }
+      for (int ny=0; ny<Ny; ++ny) {
+	const int r = o + ny*ystride;
+	ud[r]   = uk[ny].real(); ud[r+1] = uk[ny].imag();
+	ud[r+istride]   = vk[ny].real(); ud[r+istride+1]   = vk[ny].imag();
+	ud[r+2*istride] = wk[ny].real(); ud[r+2*istride+1] = wk[ny].imag();
+      }
+    }
+  }
+}
+
+// From the x and z equations, kappa2 P = -v_t' + nu lapl v' - r, with v_t
+// from the Orr-Sommerfeld system; for kx == kz == 0, P' = Ny.
+void ETDDNS::pressure(const FlowField& u, const FlowField& f, FlowField& q) const {
+  typedef StokesPropagator SP;
+  const int Ny = Ny_;
+  const int Mx = Mx_;
+  const int Mz = Mz_;
+  const int ystride = 2*Mx*Mz;
+  const int istride = Ny*ystride;
+  const Real s = 2.0/(b_-a_);
+
+  q.setState(Spectral, Spectral);
+  const Real* ud = u.rawData();
+  const Real* fd = f.rawData();
+  Real* qd = q.rawData();
+
+#pragma omp parallel
+  {
+    array<Complex> vk(Ny), fx(Ny), fy(Ny), fz(Ny);
+    array<Complex> g(Ny), tmp(Ny), Dv(Ny), Pk(Ny);
+    array<Complex> a(Ny), at(Ny);
+
+#pragma omp for schedule(dynamic)
+    for (int m=0; m<Mx*Mz; ++m) {
+      const int o = 2*m;
+      const int mx = m / Mz;
+      const int mz = m % Mz;
+      const int kx = (mx <= Nx_/2) ? mx : mx - Nx_;
+      for (int ny=0; ny<Ny; ++ny) {
+	const int r = o + ny*ystride;
+	vk[ny] = Complex(ud[r+istride], ud[r+istride+1]);
+	fx[ny] = -Complex(fd[r], fd[r+1]);
+	fy[ny] = -Complex(fd[r+istride], fd[r+istride+1]);
+	fz[ny] = -Complex(fd[r+2*istride], fd[r+2*istride+1]);
+	Pk[ny] = 0.0;
+      }
+
+      if (!active_[m])
+	;
+      else if (kx == 0 && mz == 0) {
+	// P(b) = 0, as TauSolver leaves it
+	integrate(fy.pointer(), Pk.pointer(), Ny, s);
+	for (int ny=1; ny<Ny; ++ny)
+	  Pk[0] -= Pk[ny];
+      }
+      else {
+	const SP& p = prop_[propIndex_[abs(kx)*Mz + mz]];
+	const Real alpha = 2*pi*kx/Lx_;
+	const Real gamma = 2*pi*mz/Lz_;
+	const Real kappa2 = p.kappa2();
+	const Complex ia(0.0, alpha);
+	const Complex ig(0.0, gamma);
+
+	// r = i alpha Nx + i gamma Nz, g = -(D r + kappa2 Ny)
+	for (int ny=0; ny<Ny; ++ny)
+	  tmp[ny] = ia*fx[ny] + ig*fz[ny];
+	diff(tmp.pointer(), g.pointer(), Ny, s);
+	for (int ny=0; ny<Ny; ++ny)
+	  g[ny] = -(g[ny] + kappa2*fy[ny]);
+
+	// v_t = L v + M^-1 g on the basis
+	p.toBasis(SP::OrrSommerfeld, vk.pointer(), a.pointer());
+	for (int ny=0; ny<Ny; ++ny)
+	  at[ny] = 0.0;
+	p.apply(SP::Generator, SP::OrrSommerfeld, a.pointer(), at.pointer());
+	p.galerkin(SP::OrrSommerfeld, g.pointer(), a.pointer());
+	p.apply(SP::Mass, SP::OrrSommerfeld, a.pointer(), at.pointer());
+	p.fromBasis(SP::OrrSommerfeld, at.pointer(), g.pointer());
+
+	// Pk = (-v_t' + nu (D^2 - kappa2) v' - r)/kappa2
+	diff(vk.pointer(), Dv.pointer(), Ny, s);
+	diff(Dv.pointer(), a.pointer(), Ny, s);
+	diff(a.pointer(), at.pointer(), Ny, s);
+	diff(g.pointer(), a.pointer(), Ny, s);
+	for (int ny=0; ny<Ny; ++ny)
+	  Pk[ny] = (-a[ny] + nu_*(at[ny] - kappa2*Dv[ny]) - tmp[ny])/kappa2;
+      }
+
+      for (int ny=0; ny<Ny; ++ny) {
+	const int r = o + ny*ystride;
+	qd[r] = Pk[ny].real();
+	qd[r+1] = Pk[ny].imag();
+      }
+    }
+  }
+}
+
+} //namespace channelflow
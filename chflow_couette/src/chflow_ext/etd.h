@@ -0,0 +1,157 @@
+// etd.h: exponential time differencing with per-mode Stokes propagators
+
+#ifndef CHFLOW_EXT_ETD_H
+#define CHFLOW_EXT_ETD_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "channelflow/chebyshev.h"
+#include "channelflow/flowfield.h"
+#include "channelflow/dns.h"
+#include "nonlinear.h"
+#include "baseflowsolver.h"
+#include "dnsext.h"
+
+namespace channelflow {
+
+// StokesPropagator holds the exponential integrator of the unsteady Stokes
+// problem u_t = nu lapl u - grad P + N, div u = 0, u(a) = u(b) = 0 for the
+// Fourier modes of wavenumber magnitude kappa2 = alpha^2 + gamma^2, over a
+// step h. The problem splits into
+//
+//   lapl v_t = nu lapl^2 v + g,   g   = -(D r + kappa2 Ny),  r = i alpha Nx + i gamma Nz
+//   eta_t    = nu lapl eta + geta, geta = i gamma Nx - i alpha Nz
+//
+// for v and the wall-normal vorticity eta = i gamma u - i alpha w, which are
+// expanded in Chebyshev combinations that satisfy the boundary conditions
+// (v = v' = 0 and eta = 0 at the walls, N-4 and N-2 functions). Their
+// Chebyshev-Galerkin equations M a_t = A a + G g give the generator
+// L = M^-1 A on these bases, and the propagator matrices exp(hL) and
+// h phi_k(hL) M^-1, the latter acting on the projected forcing G g. Unlike
+// the tau equations of the leading coefficients, which give L spurious
+// growing eigenvalues in the fourth-order Orr-Sommerfeld system, the
+// Galerkin L is stable. With kappa2 == 0 only the eta system is set up; it
+// then serves the heat equations of the mean flow components u00 and w00.
+//
+// The phi functions phi_0(z) = e^z, phi_k(z) = (phi_{k-1}(z) - 1/(k-1)!)/z
+// are computed by a Taylor series at hL/2^s and s modified squarings, which
+// is accurate also where the spectrum of hL is close to zero. The cost is
+// O(N^3) per distinct kappa2, and one of each kind of matrix is N^2 Reals.
+
+class StokesPropagator {
+public:
+  enum System {OrrSommerfeld, Squire};
+
+  // y += Op x for the matrices of an ETDRK scheme. Exp = exp(hL) acts on
+  // basis coefficients, Phi_k = h phi_k(hL) M^-1 on projected forcings.
+  // ETDRK4 stages at h/2 use HalfExp and HalfPhi1, and its final
+  // combination RK4a = Phi1 - 3 Phi2 + 4 Phi3, RK4b = 2 Phi2 - 4 Phi3,
+  // RK4c = 4 Phi3 - Phi2. Generator L and Mass M^-1 give a_t, OS only.
+  enum Op {Exp, Phi1, Phi2, HalfExp, HalfPhi1, RK4a, RK4b, RK4c,
+	   Generator, Mass, Nops};
+
+  StokesPropagator();
+  StokesPropagator(Real kappa2, Real nu, Real h, int order,
+		   const BaseflowOperators& ops);
+
+  // Basis coefficients of v (OrrSommerfeld) or eta (Squire) from Chebyshev
+  // coefficients f, which satisfy the system's boundary conditions, and back
+  void toBasis(System s, const Complex* f, Complex* a) const;
+  void fromBasis(System s, const Complex* a, Complex* f) const;
+
+  // gt = G g, the Galerkin projection of forcing coefficients g
+  void galerkin(System s, const Complex* g, Complex* gt) const;
+
+  void apply(Op op, System s, const Complex* x, Complex* y) const;
+
+  int size(System s) const;  // number of basis functions
+  Real kappa2() const;
+  int order() const;
+
+private:
+  Real kappa2_;
+  int order_;
+  int N_;
+  int n4_;  // size of the OS basis
+  int n2_;  // size of the Squire basis
+  array<Real> os_[Nops];
+  array<Real> sq_[Nops];
+};
+
+// ETDDNS integrates with the exponential Runge-Kutta schemes ETDRK2 and
+// ETDRK4 of Cox & Matthews (2002): the Stokes operator is propagated exactly
+// by the per-mode StokesPropagators, and the explicit term N = -f, including
+// the base-flow advection, enters through the phi functions. Self-starting
+// (no initialization steps), with order 2 or 4 for any dt, but the
+// propagators are recomputed on reset_dt, O(N^3) per distinct kappa2.
+// Modes kx and -kx share them, as do other modes of equal kappa2, but most
+// (|kx|,kz) of a box have a kappa2 of their own.
+//
+// Memory per distinct kappa2: 3 (ETDRK2) or 6 (ETDRK4) N x N matrices for
+// each of the two systems, plus 2 for the pressure; of order 100 kB at
+// Ny = 33 with ETDRK4, and 8x that at Ny = 65. That is 270 MB for the
+// 2712 distinct kappa2 of a 64 x 33 x 512 grid in a 4pi x 16pi box, all
+// rebuilt whenever the CFL control changes dt. Fields: u at the start of
+// the step and N of each stage, plus one (ETDRK2) or two stage fields.
+//
+// The nonlinear term of each new field is evaluated by RotationalNL at the
+// end of the step, with the FlowDiagnostics, and reused by the next step as
+// in FusedMultistepDNS. The pressure q is recovered at the end of advance.
+// Requires Rotational nonlinearity about Ubase without y dealiasing, and a
+// PressureGradient constraint.
+
+class ETDDNS : public DNSAlgorithm {
+public:
+  ETDDNS();
+  ETDDNS(const ETDDNS& dns);
+  ETDDNS(const FlowField& u, const ChebyCoeff& Ubase, Real nu, Real dt,
+	 const DNSExtFlags& flags, Real t=0);
+  ~ETDDNS();
+
+  ETDDNS& operator=(const ETDDNS& dns);
+
+  virtual void advance(FlowField& u, FlowField& q, int nSteps=1);
+  virtual void project();
+  virtual void operator *= (const FieldSymmetry& symm);
+  virtual void reset_dt(Real dt);
+  virtual bool push(const FlowField& u);
+  virtual bool full() const;
+
+  virtual DNSAlgorithm* clone() const;
+
+  const FlowDiagnostics& diagnostics() const;  // of u after last advance
+
+protected:
+  RotationalNL nl_;
+  FlowDiagnostics diag_;
+  bool f0valid_;                   // f_[0] == N(u0_), with diag_ for u0_
+  FlowField u0_;                   // u at the start of the step
+  array<FlowField> ustage_;        // stage values
+  array<FlowField> f_;             // explicit terms of u0_ and the stages
+  BaseflowOperators ops_;          // of a zero profile, for D2 and D4
+  array<StokesPropagator> prop_;   // one per distinct kappa2
+  array<int> propIndex_;           // prop_ of mode |kx|*Mz + mz, or -1
+  array<char> active_;             // mode mx*Mz + mz is integrated
+  ChebyCoeff forcing00_;           // -dPdx + nu Ubase'', Spectral
+
+  // A term Op (sum_i w[i] g(f[i])) of an ETDRK stage
+  struct Term {
+    StokesPropagator::Op op;
+    int n;
+    const FlowField* f[2];
+    Real w[2];
+  };
+
+  bool current(const FlowField& u) const;  // u bitwise equal to u0_
+  void factor();                           // build prop_ for the current dt
+
+  // uout = E x + sum of the terms, for E = Exp or HalfExp
+  void stage(const FlowField& x, StokesPropagator::Op E, const Term* terms,
+	     int Nterms, FlowField& uout) const;
+
+  // Pressure of u, whose explicit term is f
+  void pressure(const FlowField& u, const FlowField& f, FlowField& q) const;
+};
+
+} //namespace channelflow
+#endif
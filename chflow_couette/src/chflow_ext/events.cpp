@@ -0,0 +1,190 @@
+// events.cpp: early-termination events evaluated on flow diagnostics
+
+#include <fstream>
+#include <iomanip>
+#include "events.h"
+
+using namespace std;
+
+namespace channelflow {
+
+FlowEvents::FlowEvents()
+  :
+  energyBelow(0.0),
+  energyAbove(0.0),
+  maxKEBelow(0.0),
+  stallTol(0.0),
+  stallWindow(10),
+  crossingObservable(Dissipation),
+  crossingLevel(0.0),
+  crossingDirection(0),
+  crossingCount(0),
+  crossing(false),
+  fired_(None),
+  time_(0.0),
+  value_(0.0),
+  count_(0),
+  lastt_(0.0),
+  lastObs_(0.0)
+{}
+
+Real FlowEvents::observable(Observable o, const FlowDiagnostics& d) {
+  switch (o) {
+  case Energy:      return d.energy;
+  case Dissipation: return d.dissipation;
+  case L2NormU:     return sqrt(d.L2Norm2[0]);
+  case L2NormV:     return sqrt(d.L2Norm2[1]);
+  default:          return sqrt(d.L2Norm2[2]);
+  }
+}
+
+FlowEvents::Observable FlowEvents::parseObservable(const string& s) {
+  if (s == "energy")      return Energy;
+  if (s == "dissipation") return Dissipation;
+  if (s == "L2Norm(u)")   return L2NormU;
+  if (s == "L2Norm(v)")   return L2NormV;
+  if (s == "L2Norm(w)")   return L2NormW;
+  cferror("FlowEvents::parseObservable : unknown observable " + s);
+  return Energy;
+}
+
+string FlowEvents::name(Kind k) {
+  switch (k) {
+  case EnergyBelow:   return "energy_below";
+  case EnergyAbove:   return "energy_above";
+  case MaxKEBelow:    return "max_ke_below";
+  case EnergyStalled: return "energy_stalled";
+  case Crossing:      return "crossing";
+  default:            return "none";
+  }
+}
+
+bool FlowEvents::operator()(const FlowDiagnostics& d) {
+  const Real E = d.energy;
+  const Real obs = observable(crossingObservable, d);
+
+  // Poincare section between the previous diagnostics and these
+  if (crossing && count_ > 0) {
+    const Real s0 = lastObs_ - crossingLevel;
+    const Real s1 = obs - crossingLevel;
+    const bool up = s0 < 0 && s1 >= 0;
+    const bool down = s0 > 0 && s1 <= 0;
+    if ((up && crossingDirection >= 0) || (down && crossingDirection <= 0)) {
+      const Real tc = lastt_ + (d.t - lastt_)*s0/(s0 - s1);
+      crossingTimes_.resize(crossingTimes_.length() + 1);
+      crossingTimes_[crossingTimes_.length() - 1] = tc;
+      if (crossingCount > 0 && crossingTimes_.length() >= crossingCount && fired_ == None) {
+	fired_ = Crossing;
+	time_ = tc;
+	value_ = crossingLevel;
+      }
+    }
+  }
+
+  // Energy ring: slot count_ % stallWindow holds E(t - stallWindow
+  // intervals) once count_ >= stallWindow
+  if (stallTol > 0 && stallWindow > 0) {
+    if (energy_.length() != stallWindow) {
+      energy_.resize(stallWindow);
+      energy_.fill(0.0);
+    }
+    const int i = count_ % stallWindow;
+    const Real Eold = energy_[i];
+    energy_[i] = E;
+    if (count_ >= stallWindow && fabs(E - Eold) < stallTol*fabs(E) && fired_ == None) {
+      fired_ = EnergyStalled;
+      time_ = d.t;
+      value_ = E;
+    }
+  }
+
+  if (energyBelow > 0 && E < energyBelow && fired_ == None) {
+    fired_ = EnergyBelow;
+    time_ = d.t;
+    value_ = E;
+  }
+  if (energyAbove > 0 && E > energyAbove && fired_ == None) {
+    fired_ = EnergyAbove;
+    time_ = d.t;
+    value_ = E;
+  }
+  if (maxKEBelow > 0 && d.maxKE < maxKEBelow && fired_ == None) {
+    fired_ = MaxKEBelow;
+    time_ = d.t;
+    value_ = d.maxKE;
+  }
+
+  ++count_;
+  lastt_ = d.t;
+  lastObs_ = obs;
+  return fired_ != None;
+}
+
+void FlowEvents::save(const string& filebase) const {
+  ofstream os((filebase + ".events").c_str());
+  os << setprecision(17);
+  os << "fired " << int(fired_) << '\n'
+     << "time " << time_ << '\n'
+     << "value " << value_ << '\n'
+     << "count " << count_ << '\n'
+     << "lastt " << lastt_ << '\n'
+     << "lastObs " << lastObs_ << '\n'
+     << "energy " << energy_.length();
+  for (int i=0; i<energy_.length(); ++i)
+    os << ' ' << energy_[i];
+  os << '\n' << "crossings " << crossingTimes_.length();
+  for (int i=0; i<crossingTimes_.length(); ++i)
+    os << ' ' << crossingTimes_[i];
+  os << '\n';
+  if (!os.good())
+    cferror("FlowEvents::save : can't write " + filebase + ".events");
+}
+
+// Each line is a key and its value, or for the arrays a key, a length and
+// that many values
+void FlowEvents::load(const string& filebase) {
+  ifstream is((filebase + ".events").c_str());
+  if (!is.good())
+    cferror("FlowEvents::load : can't open " + filebase + ".events");
+  int fired = 0;
+  int N = 0;
+  string key;
+  is >> key >> fired >> key >> time_ >> key >> value_ >> key >> count_
+     >> key >> lastt_ >> key >> lastObs_ >> key >> N;
+  energy_.resize(N);
+  for (int i=0; i<N; ++i)
+    is >> energy_[i];
+  is >> key >> N;
+  crossingTimes_.resize(N);
+  for (int i=0; i<N; ++i)
+    is >> crossingTimes_[i];
+  if (is.fail() || key != "crossings")
+    cferror("FlowEvents::load : can't read " + filebase + ".events");
+  fired_ = Kind(fired);
+
+  // The ring's slots are in the order of count_ modulo its length
+  if (stallTol > 0 && stallWindow > 0 && energy_.length() != stallWindow && count_ > 0)
+    cferror("FlowEvents::load : " + filebase + ".events was written with a different stall_window");
+}
+
+FlowEvents::Kind FlowEvents::fired() const {
+  return fired_;
+}
+
+Real FlowEvents::time() const {
+  return time_;
+}
+
+Real FlowEvents::value() const {
+  return value_;
+}
+
+int FlowEvents::crossings() const {
+  return crossingTimes_.length();
+}
+
+const array<Real>& FlowEvents::crossingTimes() const {
+  return crossingTimes_;
+}
+
+} //namespace channelflow
@@ -0,0 +1,79 @@
+// events.h: early-termination events evaluated on flow diagnostics
+
+#ifndef CHFLOW_EXT_EVENTS_H
+#define CHFLOW_EXT_EVENTS_H
+
+#include <string>
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "nonlinear.h"
+
+namespace channelflow {
+
+// FlowEvents checks a sequence of FlowDiagnostics, one per output interval,
+// against the conditions on which a run should stop early:
+//   * energy below energyBelow, e.g. relaminarization
+//   * energy above energyAbove
+//   * the maximum of u.u over gridpoints below maxKEBelow, as postproc's
+//     max_pointwise_ke and timeintegration.py's max_ke_threshold
+//   * energy stalled: |E(t) - E(t - stallWindow intervals)| below
+//     stallTol*E(t), e.g. convergence to an equilibrium
+//   * the crossingCount-th crossing of crossingLevel by an observable in
+//     crossingDirection (+1 upward, -1 downward, 0 either), a Poincare
+//     section. Every crossing is recorded, and with crossingCount == 0 none
+//     stops the run.
+// A threshold <= 0 turns its condition off. The time of a crossing is
+// interpolated linearly between the two diagnostics that bracket it.
+
+class FlowEvents {
+public:
+  enum Observable {Energy, Dissipation, L2NormU, L2NormV, L2NormW};
+  enum Kind {None, EnergyBelow, EnergyAbove, MaxKEBelow, EnergyStalled, Crossing};
+
+  FlowEvents();
+
+  Real energyBelow;
+  Real energyAbove;
+  Real maxKEBelow;
+  Real stallTol;
+  int stallWindow;
+  Observable crossingObservable;
+  Real crossingLevel;
+  int crossingDirection;
+  int crossingCount;
+  bool crossing;          // crossings are checked
+
+  // Check the diagnostics of the next interval; true if an event fires
+  bool operator()(const FlowDiagnostics& d);
+
+  Kind fired() const;                 // the event that fired, or None
+  Real time() const;                  // at which it fired
+  Real value() const;                 // of its energy or observable
+  int crossings() const;              // so far, recorded in crossingTimes
+  const array<Real>& crossingTimes() const;
+
+  // Checkpoint of the state built up from the diagnostics seen so far (the
+  // event fired, the energy ring, the last observable and its time, the
+  // crossing times) in the text file filebase.events, to go with
+  // DNSExt::saveState. load into FlowEvents with the same settings continues
+  // the sequence as if never stopped.
+  void save(const std::string& filebase) const;
+  void load(const std::string& filebase);
+
+  static Real observable(Observable o, const FlowDiagnostics& d);
+  static std::string name(Kind k);
+  static Observable parseObservable(const std::string& s);
+
+private:
+  Kind fired_;
+  Real time_;
+  Real value_;
+  array<Real> energy_;     // ring of the last stallWindow energies
+  int count_;              // diagnostics seen
+  Real lastt_;
+  Real lastObs_;
+  array<Real> crossingTimes_;
+};
+
+} //namespace channelflow
+#endif
@@ -0,0 +1,122 @@
+// fieldloops.h: threaded loops over contiguous pieces of FlowField data
+
+#ifndef CHFLOW_EXT_FIELDLOOPS_H
+#define CHFLOW_EXT_FIELDLOOPS_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/flowfield.h"
+
+namespace channelflow {
+
+// Kernels get raw pointers and strides to pieces of FlowField::rawData()
+// instead of going through operator() or cmplx(), which recompute and
+// assert the flattened index on every access. T is Real or const Real,
+// depending on whether the field passed to the loop is const. One kernel
+// object is shared by all threads, so kernels should write results per
+// plane or slab rather than accumulate into shared variables.
+//
+// XZPlane: all Nx rows of component i at y index ny. Row nx starts at
+// data + nx*Nzpad. In Physical xz state a row holds Nz gridpoint values, in
+// Spectral state Mz = Nzpad/2 interleaved (re,im) coefficients. A plane is
+// Nx*Nzpad contiguous Reals.
+template <class T> struct XZPlane {
+  T* data;
+  int i;
+  int ny;
+  int Nx;
+  int Nz;
+  int Nzpad;
+  inline T* row(int nx) const {return data + nx*Nzpad;}
+};
+
+// YSlab: a block of L adjacent y-lines of component i, starting at offset
+// l0 within each xz plane. Element ny of line l is data[ny*stride + l], so
+// for fixed ny the L values are contiguous and a Chebyshev recurrence in ny
+// vectorizes across lines.
+template <class T> struct YSlab {
+  T* data;
+  int i;
+  int l0;
+  int L;
+  int Ny;
+  int stride;  // Nx*Nzpad
+  inline T* plane(int ny) const {return data + ny*stride;}
+};
+
+// Call kernel(XZPlane) for every (i,ny), in parallel.
+template <class Kernel>
+void parallelForPlanes(FlowField& u, Kernel kernel);
+template <class Kernel>
+void parallelForPlanes(const FlowField& u, Kernel kernel);
+
+// Call kernel(YSlab) on blocks of Nlines y-lines covering u, in parallel.
+// Nlines = 512 keeps a 33-point slab within L2 cache.
+template <class Kernel>
+void parallelForSlabs(FlowField& u, Kernel kernel, int Nlines=512);
+template <class Kernel>
+void parallelForSlabs(const FlowField& u, Kernel kernel, int Nlines=512);
+
+
+template <class T, class Field, class Kernel>
+inline void parallelForPlanes_(Field& u, Kernel& kernel) {
+  const int Nd = u.Nd();
+  const int Ny = u.Ny();
+  const int Nx = u.Nx();
+  const int Nz = u.Nz();
+  const int Nzpad = u.Nzpad();
+  T* data = u.rawData();
+
+#pragma omp parallel for
+  for (int r=0; r<Nd*Ny; ++r) {
+    XZPlane<T> p;
+    p.data = data + r*Nx*Nzpad;
+    p.i = r / Ny;
+    p.ny = r % Ny;
+    p.Nx = Nx;
+    p.Nz = Nz;
+    p.Nzpad = Nzpad;
+    kernel(p);
+  }
+}
+
+template <class T, class Field, class Kernel>
+inline void parallelForSlabs_(Field& u, Kernel& kernel, int Nlines) {
+  assert(Nlines > 0);
+  const int Nd = u.Nd();
+  const int Ny = u.Ny();
+  const int N = u.Nx()*u.Nzpad();
+  const int Nslabs = (N + Nlines - 1)/Nlines;
+  T* data = u.rawData();
+
+#pragma omp parallel for
+  for (int r=0; r<Nd*Nslabs; ++r) {
+    YSlab<T> s;
+    s.i = r / Nslabs;
+    s.l0 = (r % Nslabs)*Nlines;
+    s.L = lesser(Nlines, N - s.l0);
+    s.Ny = Ny;
+    s.stride = N;
+    s.data = data + s.i*Ny*N + s.l0;
+    kernel(s);
+  }
+}
+
+template <class Kernel>
+inline void parallelForPlanes(FlowField& u, Kernel kernel) {
+  parallelForPlanes_<Real>(u, kernel);
+}
+template <class Kernel>
+inline void parallelForPlanes(const FlowField& u, Kernel kernel) {
+  parallelForPlanes_<const Real>(u, kernel);
+}
+template <class Kernel>
+inline void parallelForSlabs(FlowField& u, Kernel kernel, int Nlines) {
+  parallelForSlabs_<Real>(u, kernel, Nlines);
+}
+template <class Kernel>
+inline void parallelForSlabs(const FlowField& u, Kernel kernel, int Nlines) {
+  parallelForSlabs_<const Real>(u, kernel, Nlines);
+}
+
+} //namespace channelflow
+#endif
@@ -0,0 +1,316 @@
+// gridtables.cpp: cached gridpoint, wavenumber and dealiasing tables
+
+#include "gridtables.h"
+#include "shapedispatch.h"
+#include "fieldloops.h"
+
+#include <list>
+
+using namespace std;
+
+namespace channelflow {
+
+GridTables::GridTables()
+  :
+  Nx_(0),
+  Ny_(0),
+  Nz_(0),
+  Mz_(0),
+  Lx_(0),
+  Lz_(0),
+  a_(0),
+  b_(0)
+{}
+
+GridTables::GridTables(const FlowField& u)
+  :
+  GridTables(u.Nx(), u.Ny(), u.Nz(), u.Lx(), u.Lz(), u.a(), u.b())
+{}
+
+GridTables::GridTables(int Nx, int Ny, int Nz, Real Lx, Real Lz, Real a,
+		       Real b)
+  :
+  Nx_(Nx),
+  Ny_(Ny),
+  Nz_(Nz),
+  Mz_(Nz/2+1),
+  Lx_(Lx),
+  Lz_(Lz),
+  a_(a),
+  b_(b),
+  x_(Nx),
+  y_(Ny),
+  z_(Nz),
+  kx_(Nx),
+  alpha_(Nx),
+  gamma_(Nz/2+1),
+  mask_(Nx*(Nz/2+1)),
+  dy_(Ny),
+  chebyIP_(Ny*Ny)
+{
+  assert(Nx_ >= 0 && Ny_ >= 0 && Nz_ >= 0);
+
+  for (int nx=0; nx<Nx_; ++nx)
+    x_[nx] = nx*Lx_/Nx_;
+  for (int nz=0; nz<Nz_; ++nz)
+    z_[nz] = nz*Lz_/Nz_;
+  for (int ny=0; ny<Ny_; ++ny)
+    y_[ny] = 0.5*((b_+a_) + (b_-a_)*cos(pi*ny/(Ny_-1)));
+
+  for (int mx=0; mx<Nx_; ++mx) {
+    kx_[mx] = (mx <= Nx_/2) ? mx : mx - Nx_;
+    alpha_[mx] = 2*pi*kx_[mx]/Lx_;
+  }
+  for (int mz=0; mz<Mz_; ++mz)
+    gamma_[mz] = 2*pi*mz/Lz_;
+
+  // Same criterion as FlowField::isAliased(kx,kz)
+  const int kxmax = Nx_/3-1;
+  const int kzmax = Nz_/3-1;
+  for (int mx=0; mx<Nx_; ++mx)
+    for (int mz=0; mz<Mz_; ++mz)
+      mask_[mz + Mz_*mx] = (abs(kx_[mx]) > kxmax || mz > kzmax) ? 0.0 : 1.0;
+
+  // Same spacings as FlowField::CFLfactor: one-sided at the walls
+  for (int ny=0; ny<Ny_; ++ny) {
+    if (Ny_ < 2)
+      dy_[ny] = b_ - a_;
+    else if (ny == 0 || ny == Ny_-1)
+      dy_[ny] = y_[0] - y_[1];
+    else
+      dy_[ny] = 0.5*(y_[ny-1] - y_[ny+1]);
+  }
+
+  for (int m=0; m<Ny_; ++m)
+    for (int n=0; n<Ny_; ++n)
+      chebyIP_[n + Ny_*m] = channelflow::chebyIP(m,n);
+}
+
+bool GridTables::congruent(const FlowField& u) const {
+  return (u.Nx() == Nx_ && u.Ny() == Ny_ && u.Nz() == Nz_ &&
+	  u.Lx() == Lx_ && u.Lz() == Lz_ && u.a() == a_ && u.b() == b_);
+}
+
+const GridTables& gridTables(const FlowField& u) {
+  // std::list so that references handed out stay valid as the cache grows.
+  // Production runs use one or two geometries, so a linear search will do.
+  static list<GridTables> cache;
+  const GridTables* t = 0;
+
+#pragma omp critical(chflow_ext_gridtables)
+  {
+    for (list<GridTables>::const_iterator it=cache.begin(); it!=cache.end(); ++it)
+      if (it->congruent(u)) {
+	t = &*it;
+	break;
+      }
+    if (t == 0) {
+      cache.push_back(GridTables(u));
+      t = &cache.back();
+    }
+  }
+  return *t;
+}
+
+void copyFast(const FlowField& u, FlowField& v) {
+  if (&u == &v)
+    return;
+  if (!sameGeometry(u, v)) {
+    v = u;
+    return;
+  }
+  const int N = u.rawDataLength();
+  const Real* ud = u.rawData();
+  Real* vd = v.rawData();
+#pragma omp parallel for
+  for (int n=0; n<N; ++n)
+    vd[n] = ud[n];
+  v.setState(u.xzstate(), u.ystate());
+  v.setPadded(u.padded());
+}
+
+// max over the grid of |u_i + U_i|/dx_i, U = (Ubase,0,0) if given
+static Real cflmax(const FlowField& u, const Vector* U) {
+  const GridTables& t = gridTables(u);
+  const int Nd = u.Nd();
+  const int Nx = u.Nx();
+  const int Ny = u.Ny();
+  const int Nz = u.Nz();
+  const int Nzpad = u.Nzpad();
+  const Real* data = u.rawData();
+
+  Real cfl = 0.0;
+  for (int i=0; i<Nd; ++i) {
+    const Real rdxz = (i == 0) ? 1.0/t.dx() : 1.0/t.dz();
+#pragma omp parallel for reduction(max:cfl)
+    for (int ny=0; ny<Ny; ++ny) {
+      const Real rd = (i == 1) ? 1.0/t.dy(ny) : rdxz;
+      const Real Uy = (i == 0 && U) ? (*U)[ny] : 0.0;
+      Real c = 0.0;
+      for (int nx=0; nx<Nx; ++nx) {
+	const Real* row = data + Nzpad*(nx + Nx*(ny + Ny*i));
+#pragma omp simd reduction(max:c)
+	for (int nz=0; nz<Nz; ++nz)
+	  c = Greater(c, abs(row[nz] + Uy));
+      }
+      cfl = Greater(cfl, c*rd);
+    }
+  }
+  return cfl;
+}
+
+Real CFLfactorFast(const FlowField& u_) {
+  FlowField& u = const_cast<FlowField&>(u_);
+  const fieldstate xzstate = u.xzstate();
+  const fieldstate ystate = u.ystate();
+  u.makePhysical();
+  Real cfl = cflmax(u, 0);
+  u.makeState(xzstate, ystate);
+  return cfl;
+}
+
+Real CFLfactorFast(const FlowField& u_, const ChebyCoeff& Ubase) {
+  FlowField& u = const_cast<FlowField&>(u_);
+  const fieldstate xzstate = u.xzstate();
+  const fieldstate ystate = u.ystate();
+  u.makePhysical();
+
+  ChebyCoeff U(Ubase);
+  U.makePhysical();
+  Vector Uy(u.Ny());
+  for (int ny=0; ny<u.Ny(); ++ny)
+    Uy[ny] = U[ny];
+
+  Real cfl = cflmax(u, &Uy);
+  u.makeState(xzstate, ystate);
+  return cfl;
+}
+
+struct L2Args {
+  const Complex* data;
+  const GridTables* t;
+  int Nd;
+  int Ny;
+  int Mx;
+  int Mz;
+  int kxmax;
+  int kzmax;
+  Real* partial;  // Nd*Mx partial sums, one per (i,mx)
+};
+
+// 1/(b-a) Int_a^b |sum_m u_m T_m|^2 dy = sum_mn Re(u_m u_n*) chebyIP(m,n),
+// where chebyIP(m,n) vanishes for m+n odd and is symmetric in m,n.
+template <int ND, int NY> struct L2Kernel {
+  static void run(L2Args& a) {
+    const int Nd = ND ? ND : a.Nd;
+    const int Ny = NY ? NY : a.Ny;
+    const int Mx = a.Mx;
+    const int Mz = a.Mz;
+    const GridTables& t = *a.t;
+    const Real* ip = t.chebyIP();
+
+#pragma omp parallel for
+    for (int mx=0; mx<Mx; ++mx)
+      for (int i=0; i<Nd; ++i) {
+	Real sum = 0.0;
+	if (abs(t.kx(mx)) <= a.kxmax)
+	  for (int mz=0; mz<=a.kzmax; ++mz) {
+	    const Complex* line = a.data + mz + Mz*(mx + Mx*Ny*i);
+	    Real s = 0.0;
+	    for (int m=0; m<Ny; ++m) {
+	      const Complex um = line[Mz*Mx*m];
+	      Real sm = 0.0;
+	      for (int n=m%2; n<m; n += 2) {
+		const Complex un = line[Mz*Mx*n];
+		sm += ip[n + Ny*m]*(Re(um)*Re(un) + Im(um)*Im(un));
+	      }
+	      s += ip[m + Ny*m]*norm(um) + 2*sm;
+	    }
+	    sum += (mz == 0 ? 1.0 : 2.0) * s;
+	  }
+	a.partial[mx + Mx*i] = sum;
+      }
+  }
+};
+
+void L2Norm2Fast(const FlowField& u_, Real* n2, bool normalize) {
+  FlowField& u = const_cast<FlowField&>(u_);
+  const fieldstate xzstate = u.xzstate();
+  const fieldstate ystate = u.ystate();
+  u.makeSpectral();
+
+  Vector partial(u.Nd()*u.Mx());
+  L2Args args;
+  args.data = reinterpret_cast<const Complex*>(u.rawData());
+  args.t = &gridTables(u);
+  args.Nd = u.Nd();
+  args.Ny = u.Ny();
+  args.Mx = u.Mx();
+  args.Mz = u.Mz();
+  args.partial = partial.pointer();
+
+  // Padded fields have zero upper-1/3 modes, as in diffops.cpp
+  args.kxmax = u.padded() ? u.kxmaxDealiased() : u.kxmax();
+  args.kzmax = u.padded() ? u.kzmaxDealiased() : u.kzmax();
+
+  dispatchShape<L2Kernel>(args.Nd, args.Ny, args);
+
+  // Sum partials in a fixed order, so results don't depend on thread count
+  const Real c = normalize ? 1.0 : (u.b()-u.a())*u.Lx()*u.Lz();
+  for (int i=0; i<u.Nd(); ++i) {
+    Real sum = 0.0;
+    for (int mx=0; mx<u.Mx(); ++mx)
+      sum += partial[mx + u.Mx()*i];
+    n2[i] = c*sum;
+  }
+  u.makeState(xzstate, ystate);
+}
+
+Real L2Norm2Fast(const FlowField& u, bool normalize) {
+  Vector n2(u.Nd());
+  L2Norm2Fast(u, n2.pointer(), normalize);
+  Real sum = 0.0;
+  for (int i=0; i<u.Nd(); ++i)
+    sum += n2[i];
+  return sum;
+}
+
+// Sums of u_i and u_i^2 over one physical xz plane
+struct XZProfileKernel {
+  Real* mean;
+  Real* meanSquare;
+  Real scale;  // 1/(Nx Nz)
+  int Ny;
+  void operator()(const XZPlane<const Real>& p) const {
+    Real s = 0.0;
+    Real s2 = 0.0;
+    for (int nx=0; nx<p.Nx; ++nx) {
+      const Real* row = p.row(nx);
+#pragma omp simd reduction(+:s,s2)
+      for (int nz=0; nz<p.Nz; ++nz) {
+	s += row[nz];
+	s2 += row[nz]*row[nz];
+      }
+    }
+    mean[p.ny + Ny*p.i] = scale*s;
+    meanSquare[p.ny + Ny*p.i] = scale*s2;
+  }
+};
+
+void xzProfilesFast(const FlowField& u_, Real* mean, Real* meanSquare) {
+  FlowField& u = const_cast<FlowField&>(u_);
+  const fieldstate xzstate = u.xzstate();
+  const fieldstate ystate = u.ystate();
+  u.makePhysical();
+
+  XZProfileKernel kernel;
+  kernel.mean = mean;
+  kernel.meanSquare = meanSquare;
+  kernel.scale = 1.0/(u.Nx()*u.Nz());
+  kernel.Ny = u.Ny();
+  parallelForPlanes(u_, kernel);
+
+  u.makeState(xzstate, ystate);
+}
+
+} //namespace channelflow
@@ -0,0 +1,181 @@
+// gridtables.h: cached gridpoint, wavenumber and dealiasing tables
+
+#ifndef CHFLOW_EXT_GRIDTABLES_H
+#define CHFLOW_EXT_GRIDTABLES_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "channelflow/vector.h"
+#include "channelflow/chebyshev.h"
+#include "channelflow/flowfield.h"
+
+namespace channelflow {
+
+// GridTables holds the quantities FlowField recomputes on every call of
+// y(ny), kx(mx), Dx(mx), Dz(mz), isAliased(kx,kz) etc. Inner loops index the
+// tables directly instead. The Real tables are Vectors, which are allocated
+// by FFTW and therefore SIMD-aligned.
+//
+// FlowField's data layout is fixed by the channelflow library, so the tables
+// can't be members of FlowField. gridTables(u) returns a shared instance for
+// u's geometry, built on first use, so callers needn't manage them.
+
+class GridTables {
+public:
+  GridTables();
+  GridTables(int Nx, int Ny, int Nz, Real Lx, Real Lz, Real a, Real b);
+  GridTables(const FlowField& u);
+
+  bool congruent(const FlowField& u) const;
+
+  inline int Nx() const;
+  inline int Ny() const;
+  inline int Nz() const;
+  inline int Mx() const;
+  inline int Mz() const;
+  inline Real Lx() const;
+  inline Real Lz() const;
+  inline Real a() const;
+  inline Real b() const;
+
+  // Gridpoints: same values as FlowField::x(nx), y(ny), z(nz)
+  inline Real x(int nx) const;
+  inline Real y(int ny) const;
+  inline Real z(int nz) const;
+  inline const Real* xpts() const;
+  inline const Real* ypts() const;
+  inline const Real* zpts() const;
+
+  // Wavenumbers and derivative factors alpha(mx) = 2 pi kx/Lx and
+  // gamma(mz) = 2 pi kz/Lz. Dx(mx) == I alpha(mx) and Dz(mz) == I gamma(mz)
+  // except at the highest modes, which are zeroed as in FlowField::Dx, Dz.
+  inline int kx(int mx) const;
+  inline int kz(int mz) const;
+  inline Real alpha(int mx) const;
+  inline Real gamma(int mz) const;
+  inline Complex Dx(int mx) const;
+  inline Complex Dz(int mz) const;
+  inline const Real* alphas() const;
+  inline const Real* gammas() const;
+
+  // Dealiasing: mask(mx,mz) is 0.0 for aliased modes, 1.0 otherwise.
+  // Stored by rows of Mz for each mx, matching FlowField data order.
+  inline bool isAliased(int mx, int mz) const;
+  inline Real mask(int mx, int mz) const;
+  inline const Real* mask() const;
+
+  // Grid spacings used in CFL computations: dx, dz uniform, dy(ny) the
+  // local Chebyshev spacing (same as FlowField::CFLfactor).
+  inline Real dx() const;
+  inline Real dz() const;
+  inline Real dy(int ny) const;
+
+  // chebyIP(m,n) of chebyshev.h == 1/(b-a) Int_a^b T_m T_n dy, for m,n < Ny
+  inline Real chebyIP(int m, int n) const;
+  inline const Real* chebyIP() const;  // Ny x Ny, row-major
+
+private:
+  int Nx_;
+  int Ny_;
+  int Nz_;
+  int Mz_;
+  Real Lx_;
+  Real Lz_;
+  Real a_;
+  Real b_;
+
+  Vector x_;
+  Vector y_;
+  Vector z_;
+  array<int> kx_;
+  Vector alpha_;
+  Vector gamma_;
+  Vector mask_;
+  Vector dy_;
+  Vector chebyIP_;
+};
+
+// True if f and g have the same grid, domain and Nd, whatever their states.
+// FlowField::congruent also requires equal states.
+inline bool sameGeometry(const FlowField& f, const FlowField& g) {
+  return f.geomCongruent(g) && f.Nd() == g.Nd();
+}
+
+// v = u. For fields of the same geometry this copies data, states and the
+// padded flag in place; FlowField::operator= would rebuild v's FFTW plans,
+// which is slow and not thread-safe.
+void copyFast(const FlowField& u, FlowField& v);
+
+// Shared tables for u's geometry (thread-safe, built on first use).
+const GridTables& gridTables(const FlowField& u);
+
+// Max over the grid of |u_i|/dx_i, taken over the components i of u (plus
+// Ubase for i=0). FlowField::CFLfactor() of libchflow takes the max of the
+// signed u_i instead, so it can miss a large negative velocity; the two
+// agree whenever the maximum of |u_i| is attained by a positive value.
+// Input in any state.
+Real CFLfactorFast(const FlowField& u);
+Real CFLfactorFast(const FlowField& u, const ChebyCoeff& Ubase);
+
+// Same as L2Norm2(u, normalize) of diffops.h, computed from spectral
+// coefficients with the tabulated Chebyshev inner products. The second form
+// sets n2[i] to the L2Norm2 of component i, for 0 <= i < u.Nd().
+Real L2Norm2Fast(const FlowField& u, bool normalize=true);
+void L2Norm2Fast(const FlowField& u, Real* n2, bool normalize=true);
+inline Real L2NormFast(const FlowField& u, bool normalize=true) {
+  return sqrt(L2Norm2Fast(u, normalize));
+}
+
+// xz averages of u_i and u_i^2 at the gridpoints y_ny, from which the mean
+// velocity and rms fluctuation profiles follow:
+//   mean[ny + Ny*i] = <u_i>_xz,  meanSquare[ny + Ny*i] = <u_i^2>_xz.
+// Each Nd*Ny array is filled a plane at a time. Input in any state; the sums
+// are taken over the physical gridpoints of u.
+void xzProfilesFast(const FlowField& u, Real* mean, Real* meanSquare);
+
+
+inline int GridTables::Nx() const {return Nx_;}
+inline int GridTables::Ny() const {return Ny_;}
+inline int GridTables::Nz() const {return Nz_;}
+inline int GridTables::Mx() const {return Nx_;}
+inline int GridTables::Mz() const {return Mz_;}
+inline Real GridTables::Lx() const {return Lx_;}
+inline Real GridTables::Lz() const {return Lz_;}
+inline Real GridTables::a() const {return a_;}
+inline Real GridTables::b() const {return b_;}
+
+inline Real GridTables::x(int nx) const {return x_[nx];}
+inline Real GridTables::y(int ny) const {return y_[ny];}
+inline Real GridTables::z(int nz) const {return z_[nz];}
+inline const Real* GridTables::xpts() const {return x_.pointer();}
+inline const Real* GridTables::ypts() const {return y_.pointer();}
+inline const Real* GridTables::zpts() const {return z_.pointer();}
+
+inline int GridTables::kx(int mx) const {return kx_[mx];}
+inline int GridTables::kz(int mz) const {return mz;}
+inline Real GridTables::alpha(int mx) const {return alpha_[mx];}
+inline Real GridTables::gamma(int mz) const {return gamma_[mz];}
+inline Complex GridTables::Dx(int mx) const {
+  return Complex(0.0, alpha_[mx]*zero_last_mode(kx_[mx], Nx_/2, 1));
+}
+inline Complex GridTables::Dz(int mz) const {
+  return Complex(0.0, gamma_[mz]*zero_last_mode(mz, Nz_/2, 1));
+}
+inline const Real* GridTables::alphas() const {return alpha_.pointer();}
+inline const Real* GridTables::gammas() const {return gamma_.pointer();}
+
+inline bool GridTables::isAliased(int mx, int mz) const {
+  return mask_[mz + Mz_*mx] == 0.0;
+}
+inline Real GridTables::mask(int mx, int mz) const {return mask_[mz + Mz_*mx];}
+inline const Real* GridTables::mask() const {return mask_.pointer();}
+
+inline Real GridTables::dx() const {return Lx_/Nx_;}
+inline Real GridTables::dz() const {return Lz_/Nz_;}
+inline Real GridTables::dy(int ny) const {return dy_[ny];}
+
+inline Real GridTables::chebyIP(int m, int n) const {return chebyIP_[n + Ny_*m];}
+inline const Real* GridTables::chebyIP() const {return chebyIP_.pointer();}
+
+} //namespace channelflow
+#endif
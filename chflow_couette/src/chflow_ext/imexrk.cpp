@@ -0,0 +1,325 @@
+// imexrk.cpp: low-storage IMEX Runge-Kutta DNS algorithm
+
+#include <cstring>
+#include "imexrk.h"
+#include "gridtables.h"
+
+using namespace std;
+
+namespace channelflow {
+
+// Spalart, Moser & Rogers explicit coefficients, equalized implicit beta
+static const Real rkGamma[3] = {8.0/15.0, 5.0/12.0, 3.0/4.0};
+static const Real rkZeta[3]  = {0.0, -17.0/60.0, -5.0/12.0};
+static const Real rkBeta = 31.0/150.0;
+
+// df = d/dy f by the backward recurrence, s = 2/(b-a)
+static void diff(const ComplexChebyCoeff& f, ComplexChebyCoeff& df, Real s) {
+  const int N = f.N();
+  df.re[N-1] = df.im[N-1] = 0.0;
+  df.re[N-2] = (2.0*(N-1))*f.re[N-1];
+  df.im[N-2] = (2.0*(N-1))*f.im[N-1];
+  for (int k=N-3; k>=0; --k) {
+    df.re[k] = df.re[k+2] + (2.0*(k+1))*f.re[k+1];
+    df.im[k] = df.im[k+2] + (2.0*(k+1))*f.im[k+1];
+  }
+  df.re[0] *= 0.5;
+  df.im[0] *= 0.5;
+  for (int k=0; k<N; ++k) {
+    df.re[k] *= s;
+    df.im[k] *= s;
+  }
+}
+
+IMEXRK3DNS::IMEXRK3DNS()
+  :
+  DNSAlgorithm(),
+  f0valid_(false)
+{}
+
+IMEXRK3DNS::IMEXRK3DNS(const IMEXRK3DNS& dns)
+  :
+  DNSAlgorithm(dns),
+  nl_(dns.nl_),
+  diag_(dns.diag_),
+  f0valid_(dns.f0valid_),
+  u0_(dns.u0_),
+  Uyy_(dns.Uyy_),
+  tausolver_(dns.tausolver_),
+  active_(dns.active_)
+{
+  f_[0] = dns.f_[0];
+  f_[1] = dns.f_[1];
+}
+
+IMEXRK3DNS::IMEXRK3DNS(const FlowField& u, const ChebyCoeff& Ubase, Real nu,
+		       Real dt, const DNSExtFlags& flags, Real t)
+  :
+  DNSAlgorithm(u, Ubase, nu, dt, flags, t),
+  nl_(u),
+  f0valid_(false),
+  u0_(u.Nx(), u.Ny(), u.Nz(), 3, u.Lx(), u.Lz(), u.a(), u.b())
+{
+  if (flags.nonlinearity != Rotational || !ubase_.isNull() || flags.dealias_y())
+    cferror("IMEXRK3DNS: needs Rotational nonlinearity about Ubase, without y dealiasing");
+  if (flags.implicitBaseflow || flags.movingFrame())
+    cferror("IMEXRK3DNS: implicit base flow and moving frames are not supported");
+  order_ = 3;
+  Ninitsteps_ = 0;
+  f_[0] = u0_;
+  f_[1] = u0_;
+  Uyy_ = Ubaseyy_;
+  if (Uyy_.N() == Ny_)
+    Uyy_.makeSpectral();
+  nl_.profile(Ubase_);
+  factor();
+}
+
+IMEXRK3DNS::~IMEXRK3DNS() {}
+
+IMEXRK3DNS& IMEXRK3DNS::operator=(const IMEXRK3DNS& dns) {
+  DNSAlgorithm::operator=(dns);
+  nl_ = dns.nl_;
+  diag_ = dns.diag_;
+  f0valid_ = dns.f0valid_;
+  u0_ = dns.u0_;
+  f_[0] = dns.f_[0];
+  f_[1] = dns.f_[1];
+  Uyy_ = dns.Uyy_;
+  tausolver_ = dns.tausolver_;
+  active_ = dns.active_;
+  return *this;
+}
+
+DNSAlgorithm* IMEXRK3DNS::clone() const {
+  return new IMEXRK3DNS(*this);
+}
+
+const FlowDiagnostics& IMEXRK3DNS::diagnostics() const {
+  return diag_;
+}
+
+bool IMEXRK3DNS::full() const {
+  return true;
+}
+
+bool IMEXRK3DNS::push(const FlowField& u) {
+  f0valid_ = false;
+  return true;
+}
+
+void IMEXRK3DNS::project() {
+  if (flags_.symmetries.length() > 0)
+    f0valid_ = false;
+}
+
+void IMEXRK3DNS::operator *= (const FieldSymmetry& symm) {
+  f0valid_ = false;
+}
+
+void IMEXRK3DNS::reset_dt(Real dt) {
+  cfl_ *= dt/dt_;
+  dt_ = dt;
+  factor();
+}
+
+bool IMEXRK3DNS::current(const FlowField& u) const {
+  return f0valid_
+    && sameGeometry(u, u0_)
+    && u.xzstate() == u0_.xzstate() && u.ystate() == u0_.ystate()
+    && memcmp(u.rawData(), u0_.rawData(), u.rawDataLength()*sizeof(Real)) == 0;
+}
+
+// One solver per mode for all substeps, lambda = 1/(beta dt) + nu kappa2
+void IMEXRK3DNS::factor() {
+  const int Mxz = Mx_*Mz_;
+  tausolver_.resize(Mxz);
+  active_.resize(Mxz);
+  for (int m=0; m<Mxz; ++m) {
+    const int mx = m / Mz_;
+    const int mz = m % Mz_;
+    const int kx = (mx <= Nx_/2) ? mx : mx - Nx_;
+    const int kz = mz;
+    active_[m] = !(isAliasedMode(kx, kz) || kx == Nx_/2 || kz == Nz_/2);
+    if (active_[m]) {
+      const Real alpha = 2*pi*kx/Lx_;
+      const Real gamma = 2*pi*kz/Lz_;
+      const Real lambda = 1.0/(rkBeta*dt_) + nu_*(alpha*alpha + gamma*gamma);
+      tausolver_[m] = TauSolver(kx, kz, Lx_, Lz_, a_, b_, lambda, nu_, Nyd_,
+				flags_.taucorrection);
+    }
+  }
+}
+
+void IMEXRK3DNS::advance(FlowField& u, FlowField& q, int Nsteps) {
+  u.makeSpectral();
+  q.makeSpectral();
+
+  for (int n=0; n<Nsteps; ++n) {
+    // f_[0] was computed along with the previous step's diagnostics,
+    // unless u has been changed since.
+    if (!current(u)) {
+      copyFast(u, u0_);
+      nl_(u0_, Ubase_, f_[0]);
+    }
+    for (int i=0; i<3; ++i) {
+      substep(i, u, i == 2 ? &q : 0);
+      swap(f_[0], f_[1]);
+      if (i < 2)
+	nl_(u, Ubase_, f_[0]);
+    }
+    t_ += dt_;
+
+    // Nonlinear term for the next step and diagnostics of u(t) in one pass
+    copyFast(u, u0_);
+    nl_(u0_, Ubase_, f_[0], &diag_);
+    diag_.t = t_;
+    f0valid_ = true;
+  }
+  if (flags_.dealias_xz())
+    u.setPadded(true);
+  cfl_ = cflNumber(diag_.cflfactor, dt_, flags_);
+}
+
+// Divided by beta h, substep i is the Helmholtz problem
+//   lambda u_i - nu u_i'' + grad P = u_{i-1}/(beta h) + alpha_i/beta nu lapl u_{i-1}
+//                                    + (gamma_i N_{i-1} + zeta_i N_{i-2})/beta
+// with the mean-flow forcing nu Ubase'' - dPdx at weight gamma_i + zeta_i.
+// P is (gamma_i + zeta_i)/beta times the pressure.
+void IMEXRK3DNS::substep(int i, FlowField& u, FlowField* q) {
+  FlowField* up = &u;
+  const FlowField* fa = &f_[0];
+  const FlowField* fb = &f_[1];
+  substep(i, 1, &up, &fa, &fb, q);
+}
+
+// Per mode, the solver serves u[0] and then each tangent u[j], j > 0. The
+// tangents' equations are those of u less the forcing, and under a bulk
+// velocity constraint their own bulk velocity is held at zero.
+void IMEXRK3DNS::substep(int i, int n, FlowField* const* u, const FlowField* const* fa,
+			 const FlowField* const* fb, FlowField* q) {
+  const int Ny = Ny_;
+  const int Mx = Mx_;
+  const int Mz = Mz_;
+  const int ystride = 2*Mx*Mz;
+  const int istride = Ny*ystride;
+  const Real s = 2.0/(b_-a_);
+  const Real c = rkGamma[i] + rkZeta[i];
+  const Real rh = 1.0/(rkBeta*dt_);
+  const Real ga = -rkGamma[i]/rkBeta;  // N = -f
+  const Real ze = -rkZeta[i]/rkBeta;
+  const Real al = (c - rkBeta)/rkBeta*nu_;
+  const Real pscale = rkBeta/c;
+
+  const ChebyCoeff& Uyy = Uyy_;
+
+  array<Real*> ud(n);
+  array<const Real*> fad(n);
+  array<const Real*> fbd(n);
+  for (int j=0; j<n; ++j) {
+    ud[j] = u[j]->rawData();
+    fad[j] = fa[j]->rawData();
+    fbd[j] = fb[j]->rawData();
+  }
+  Real* qd = q ? q->rawData() : 0;
+  Real dPdx = dPdxAct_;
+  Real Ubulk = UbulkAct_;
+
+#pragma omp parallel
+  {
+    ComplexChebyCoeff uk[3];
+    ComplexChebyCoeff Rk[3];
+    for (int j=0; j<3; ++j) {
+      uk[j] = ComplexChebyCoeff(Ny, a_, b_, Spectral);
+      Rk[j] = ComplexChebyCoeff(Ny, a_, b_, Spectral);
+    }
+    ComplexChebyCoeff Pk(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff d1(Ny, a_, b_, Spectral);
+    ComplexChebyCoeff d2(Ny, a_, b_, Spectral);
+
+#pragma omp for schedule(dynamic)
+    for (int m=0; m<Mx*Mz; ++m) {
+      const int o = 2*m;
+      if (!active_[m]) {
+	for (int e=0; e<n; ++e)
+	  for (int ny=0; ny<Ny; ++ny) {
+	    const int r = o + ny*ystride;
+	    for (int j=0; j<3; ++j)
+	      ud[e][r + j*istride] = ud[e][r + j*istride + 1] = 0.0;
+	  }
+	if (qd)
+	  for (int ny=0; ny<Ny; ++ny)
+	    qd[o + ny*ystride] = qd[o + ny*ystride + 1] = 0.0;
+	continue;
+      }
+      const TauSolver& solver = tausolver_[m];
+      const Real alpha = 2*pi*solver.kx()/Lx_;
+      const Real gamma = 2*pi*solver.kz()/Lz_;
+      const Real kappa2 = alpha*alpha + gamma*gamma;
+
+      for (int e=0; e<n; ++e) {
+	Real* ue = ud[e];
+	const Real* fae = fad[e];
+	const Real* fbe = fbd[e];
+	for (int j=0; j<3; ++j) {
+	  ComplexChebyCoeff& uj = uk[j];
+	  ComplexChebyCoeff& Rj = Rk[j];
+	  for (int ny=0; ny<Ny; ++ny) {
+	    const int r = o + ny*ystride + j*istride;
+	    uj.re[ny] = ue[r];
+	    uj.im[ny] = ue[r+1];
+	    Rj.re[ny] = rh*ue[r] + ga*fae[r] + ze*fbe[r];
+	    Rj.im[ny] = rh*ue[r+1] + ga*fae[r+1] + ze*fbe[r+1];
+	  }
+	  // alpha_i/beta nu (D^2 - kappa2) u_{i-1}
+	  diff(uj, d1, s);
+	  diff(d1, d2, s);
+	  for (int ny=0; ny<Ny; ++ny) {
+	    Rj.re[ny] += al*(d2.re[ny] - kappa2*uj.re[ny]);
+	    Rj.im[ny] += al*(d2.im[ny] - kappa2*uj.im[ny]);
+	  }
+	}
+
+	if (m == 0 && e == 0) {
+	  const Real w = c/rkBeta;
+	  if (Uyy.N() == Ny)
+	    for (int ny=0; ny<Ny; ++ny)
+	      Rk[0].re[ny] += w*nu_*Uyy[ny];
+	  if (flags_.constraint == PressureGradient) {
+	    Rk[0].re[0] -= w*dPdxRef_;
+	    solver.solve(uk[0], uk[1], uk[2], Pk, Rk[0], Rk[1], Rk[2]);
+	    dPdx = dPdxRef_;
+	  }
+	  else {
+	    solver.solve(uk[0], uk[1], uk[2], Pk, dPdx, Rk[0], Rk[1], Rk[2],
+			 UbulkRef_ - UbulkBase_);
+	    dPdx /= w;
+	  }
+	  Ubulk = UbulkBase_ + uk[0].re.mean();
+	}
+	else if (m == 0 && flags_.constraint != PressureGradient) {
+	  Real dPdxe;
+	  solver.solve(uk[0], uk[1], uk[2], Pk, dPdxe, Rk[0], Rk[1], Rk[2], 0.0);
+	}
+	else
+	  solver.solve(uk[0], uk[1], uk[2], Pk, Rk[0], Rk[1], Rk[2]);
+
+	for (int ny=0; ny<Ny; ++ny) {
+	  const int r = o + ny*ystride;
+	  for (int j=0; j<3; ++j) {
+	    ue[r + j*istride] = uk[j].re[ny];
+	    ue[r + j*istride + 1] = uk[j].im[ny];
+	  }
+	  if (qd && e == 0) {
+	    qd[r] = pscale*Pk.re[ny];
+	    qd[r+1] = pscale*Pk.im[ny];
+	  }
+	}
+      }
+    }
+  }
+  dPdxAct_ = dPdx;
+  UbulkAct_ = Ubulk;
+}
+
+} //namespace channelflow
@@ -0,0 +1,86 @@
+// imexrk.h: low-storage IMEX Runge-Kutta DNS algorithm
+
+#ifndef CHFLOW_EXT_IMEXRK_H
+#define CHFLOW_EXT_IMEXRK_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "channelflow/chebyshev.h"
+#include "channelflow/flowfield.h"
+#include "channelflow/tausolver.h"
+#include "channelflow/dns.h"
+#include "nonlinear.h"
+#include "dnsext.h"
+
+namespace channelflow {
+
+// IMEXRK3DNS steps with the three-substep, two-register IMEX Runge-Kutta
+// scheme of Spalart, Moser & Rogers (1991),
+//
+//   u_i = u_{i-1} + h (alpha_i L u_{i-1} + beta_i L u_i
+//                      + gamma_i N(u_{i-1}) + zeta_i N(u_{i-2})),  i = 1,2,3
+//
+// with its explicit coefficients gamma = (8/15, 5/12, 3/4), zeta = (0,
+// -17/60, -5/12), third order in N, and the implicit ones equalized to
+// beta_i = 31/150, alpha_i = gamma_i + zeta_i - beta_i. That keeps the
+// scheme second order in L and in the coupling, as with the original
+// (alpha,beta), and gives every substep the same Helmholtz operator, so one
+// TauSolver per mode, with lambda = 1/(beta h) + nu kappa2, serves all three
+// substeps. The right-hand side is scaled by 1/(beta h) instead.
+//
+// State is u (updated in place, mode by mode), N of the last two substeps
+// and a copy of u for the reuse test: four fields against SBDF3's seven.
+// Self-starting, so no initialization steps. The nonlinear term of each new
+// field is evaluated at the end of the step with its FlowDiagnostics and
+// reused by the next step, as in FusedMultistepDNS; a step costs three
+// nonlinear evaluations. q is the pressure of the last substep, which is
+// first-order accurate at t + dt.
+// Requires Rotational nonlinearity about Ubase without y dealiasing. Like
+// ETDDNS it advects with U explicitly in the lab frame, so implicitBaseflow
+// and moving frames are rejected rather than ignored.
+
+class IMEXRK3DNS : public DNSAlgorithm {
+public:
+  IMEXRK3DNS();
+  IMEXRK3DNS(const IMEXRK3DNS& dns);
+  IMEXRK3DNS(const FlowField& u, const ChebyCoeff& Ubase, Real nu, Real dt,
+	     const DNSExtFlags& flags, Real t=0);
+  ~IMEXRK3DNS();
+
+  IMEXRK3DNS& operator=(const IMEXRK3DNS& dns);
+
+  virtual void advance(FlowField& u, FlowField& q, int nSteps=1);
+  virtual void project();
+  virtual void operator *= (const FieldSymmetry& symm);
+  virtual void reset_dt(Real dt);
+  virtual bool push(const FlowField& u);
+  virtual bool full() const;
+
+  virtual DNSAlgorithm* clone() const;
+
+  const FlowDiagnostics& diagnostics() const;  // of u after last advance
+
+protected:
+  RotationalNL nl_;
+  FlowDiagnostics diag_;
+  bool f0valid_;                // f_[0] == N(u0_), with diag_ for u0_
+  FlowField u0_;                // u at the start of the step
+  FlowField f_[2];              // N of the previous and next-to-previous substep
+  ChebyCoeff Uyy_;              // spectral Ubaseyy_, if it has Ny modes
+  array<TauSolver> tausolver_;  // indexed by mx*Mz + mz
+  array<char> active_;          // mode mx*Mz + mz is integrated
+
+  bool current(const FlowField& u) const;  // u bitwise equal to u0_
+  void factor();                           // build tausolver_ for the current dt
+
+  // Substep i, u_{i-1} -> u_i in place; P into q if q != 0
+  void substep(int i, FlowField& u, FlowField* q);
+
+  // The same for u[0] and n-1 tangents u[j] about it, whose explicit terms
+  // for the last two substeps are fa[j] and fb[j], in one pass over the modes
+  void substep(int i, int n, FlowField* const* u, const FlowField* const* fa,
+	       const FlowField* const* fb, FlowField* q);
+};
+
+} //namespace channelflow
+#endif
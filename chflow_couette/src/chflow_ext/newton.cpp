@@ -0,0 +1,860 @@
+// newton.cpp: Newton-Krylov-hookstep solver over flat vectors
+
+#include <iostream>
+#include <omp.h>
+#include "newton.h"
+#include "eigen.h"
+
+using namespace std;
+
+namespace channelflow {
+
+// Elements per block of the multi-vector loops, so that a block of each of
+// up to a few dozen vectors stays in L1/L2 cache
+static const int Nblock = 512;
+
+/**************************************************************************
+ * Vector operations
+ **************************************************************************/
+
+// h[j] = <v[j], w> for j < k. Each thread sums a fixed range of elements and
+// the partial sums are added in thread order, so results do not depend on
+// timing.
+static void blockDots(const Real* const* v, int k, const Real* w, int N, Real* h) {
+  const int Nthreads = omp_get_max_threads();
+  array<Real> partial(Nthreads*k);
+  partial.fill(0.0);
+#pragma omp parallel num_threads(Nthreads)
+  {
+    Real* p = partial.pointer() + omp_get_thread_num()*k;
+#pragma omp for schedule(static)
+    for (int n0=0; n0<N; n0+=Nblock) {
+      const int n1 = (n0 + Nblock < N) ? n0 + Nblock : N;
+      for (int j=0; j<k; ++j) {
+	const Real* vj = v[j];
+	Real s = 0.0;
+	for (int n=n0; n<n1; ++n)
+	  s += vj[n]*w[n];
+	p[j] += s;
+      }
+    }
+  }
+  for (int j=0; j<k; ++j) {
+    h[j] = 0.0;
+    for (int t=0; t<Nthreads; ++t)
+      h[j] += partial[t*k + j];
+  }
+}
+
+// w += sum_j c[j] v[j]
+static void blockCombine(const Real* const* v, int k, const Real* c, Real* w, int N) {
+#pragma omp parallel for schedule(static)
+  for (int n0=0; n0<N; n0+=Nblock) {
+    const int n1 = (n0 + Nblock < N) ? n0 + Nblock : N;
+    for (int j=0; j<k; ++j) {
+      const Real* vj = v[j];
+      const Real cj = c[j];
+      for (int n=n0; n<n1; ++n)
+	w[n] += cj*vj[n];
+    }
+  }
+}
+
+Real dot(const Vector& x, const Vector& y) {
+  assert(x.length() == y.length());
+  const Real* v = x.pointer();
+  Real h;
+  blockDots(&v, 1, y.pointer(), x.length(), &h);
+  return h;
+}
+
+void axpy(Real a, const Vector& x, Vector& y) {
+  assert(x.length() == y.length());
+  const Real* v = x.pointer();
+  blockCombine(&v, 1, &a, y.pointer(), x.length());
+}
+
+void multiDot(const array<Vector>& V, int k, const Vector& w, Real* h) {
+  array<const Real*> v(k);
+  for (int j=0; j<k; ++j) {
+    assert(V[j].length() == w.length());
+    v[j] = V[j].pointer();
+  }
+  blockDots(v.pointer(), k, w.pointer(), w.length(), h);
+}
+
+Real leastSquares(Real* A, int m, int n, Real* b, Real* y) {
+  assert(m >= n);
+  // Householder reflections I - 2 u u^T/|u|^2 zero column j below row j
+  for (int j=0; j<n; ++j) {
+    Real* a = A + j*m;
+    Real s = 0.0;
+    for (int i=j; i<m; ++i)
+      s += a[i]*a[i];
+    const Real norm = sqrt(s);
+    if (norm == 0.0)
+      continue;
+    const Real alpha = (a[j] > 0.0) ? -norm : norm;
+    a[j] -= alpha;
+    Real uu = 0.0;  // |u|^2
+    for (int i=j; i<m; ++i)
+      uu += a[i]*a[i];
+    for (int l=j+1; l<n; ++l) {
+      Real* c = A + l*m;
+      Real d = 0.0;
+      for (int i=j; i<m; ++i)
+	d += a[i]*c[i];
+      d *= 2.0/uu;
+      for (int i=j; i<m; ++i)
+	c[i] -= d*a[i];
+    }
+    Real d = 0.0;
+    for (int i=j; i<m; ++i)
+      d += a[i]*b[i];
+    d *= 2.0/uu;
+    for (int i=j; i<m; ++i)
+      b[i] -= d*a[i];
+    // R's diagonal; the reflector below it is no longer needed
+    a[j] = alpha;
+  }
+  // Back substitution with R, zero rows of a rank-deficient R skipped
+  for (int j=n-1; j>=0; --j) {
+    Real s = b[j];
+    for (int l=j+1; l<n; ++l)
+      s -= A[l*m + j]*y[l];
+    y[j] = (A[j*m + j] != 0.0) ? s/A[j*m + j] : 0.0;
+  }
+  Real r = 0.0;
+  for (int i=n; i<m; ++i)
+    r += b[i]*b[i];
+  return sqrt(r);
+}
+
+/**************************************************************************
+ * NewtonProblem
+ **************************************************************************/
+
+LinearOperator::~LinearOperator() {}
+
+NewtonProblem::NewtonProblem()
+  :
+  epsDx(1e-7)
+{}
+
+NewtonProblem::~NewtonProblem() {}
+
+void NewtonProblem::jacobian(const Vector& x, const Vector& Gx, const Vector& dx,
+			     Vector& dG) {
+  const Real norm = sqrt(dot(dx, dx));
+  if (norm == 0.0) {
+    dG.resize(size());
+    dG.setToZero();
+    return;
+  }
+  const Real eps = epsDx/norm;
+  xfd_ = x;
+  axpy(eps, dx, xfd_);
+  residual(xfd_, dG);
+  axpy(-1.0, Gx, dG);
+  dG *= 1.0/eps;
+}
+
+/**************************************************************************
+ * GMRES
+ **************************************************************************/
+
+GMRES::GMRES()
+  :
+  N_(0),
+  Kmax_(0),
+  tol_(0.0),
+  Nrecycle_(0),
+  n_(0),
+  k_(0),
+  applied_(0),
+  m_(0),
+  rows_(0),
+  beta_(0.0),
+  residual_(0.0)
+{}
+
+GMRES::GMRES(int N, int Kmax, Real tol, int Nrecycle)
+  :
+  N_(N),
+  Kmax_(Kmax),
+  tol_(tol),
+  Nrecycle_(Nrecycle),
+  n_(0),
+  k_(0),
+  applied_(0),
+  m_(0),
+  rows_(0),
+  beta_(0.0),
+  residual_(0.0),
+  V_(Kmax + 1),
+  H_((Kmax + 1)*Kmax)
+{
+  for (int j=0; j<=Kmax; ++j)
+    V_[j].resize(N);
+  if (Nrecycle > 0) {
+    U_.resize(Nrecycle + 1);
+    C_.resize(Nrecycle + 1);
+    for (int j=0; j<=Nrecycle; ++j) {
+      U_[j].resize(N);
+      C_[j].resize(N);
+    }
+    B_.resize((Nrecycle + 1)*Kmax);
+    c_.resize(Nrecycle + 1);
+  }
+}
+
+int GMRES::n() const {
+  return n_;
+}
+
+int GMRES::recycled() const {
+  return k_;
+}
+
+int GMRES::applications() const {
+  return n_ + applied_;
+}
+
+Real GMRES::beta() const {
+  return beta_;
+}
+
+Real GMRES::residual() const {
+  return residual_;
+}
+
+const Vector& GMRES::basis(int j) const {
+  return V_[j];
+}
+
+int GMRES::modelSize() const {
+  return m_;
+}
+
+int GMRES::modelRows() const {
+  return rows_;
+}
+
+Real GMRES::H(int i, int j) const {
+  return Hm_[j*rows_ + i];
+}
+
+Real GMRES::g(int i) const {
+  return gm_[i];
+}
+
+// x = W z for Rw z = y
+void GMRES::combine(const Real* y, Vector& x) const {
+  const int m = m_;
+  array<Real> z(m);
+  for (int q=m-1; q>=0; --q) {
+    Real s = y[q];
+    for (int l=q+1; l<m; ++l)
+      s -= Rw_[l*m + q]*z[l];
+    z[q] = s/Rw_[q*m + q];
+  }
+  array<const Real*> w(m);
+  for (int q=0; q<m; ++q)
+    w[q] = (cols_[q] < k_) ? U_[cols_[q]].pointer() : V_[cols_[q] - k_].pointer();
+  x.resize(N_);
+  x.setToZero();
+  blockCombine(w.pointer(), m, z.pointer(), x.pointer(), N_);
+}
+
+// C = A U, orthonormalized by CGS2 column by column, with U transformed so
+// that A U = C still holds; columns of U whose image is dependent on the
+// previous ones are dropped. U is orthonormalized first: the harmonic Ritz
+// vectors can be nearly parallel, and the transform of U then amplifies
+// their rounding errors into a mismatch of A U and C, and of the model's
+// residual and the true one, by up to cond(U) rather than cond(A).
+void GMRES::deflate(LinearOperator& A) {
+  array<Real> h(k_ + 1), h2(k_ + 1);
+  array<const Real*> c(k_ + 1), u(k_ + 1);
+  int ku = 0;
+  for (int j=0; j<k_; ++j) {
+    Vector& uj = U_[j];
+    const Real norm0 = sqrt(dot(uj, uj));
+    for (int pass=0; pass<2 && ku > 0; ++pass) {
+      blockDots(u.pointer(), ku, uj.pointer(), N_, h2.pointer());
+      for (int i=0; i<ku; ++i)
+	h2[i] = -h2[i];
+      blockCombine(u.pointer(), ku, h2.pointer(), uj.pointer(), N_);
+    }
+    const Real r = sqrt(dot(uj, uj));
+    if (r <= 1e-10*norm0)
+      continue;
+    uj *= 1.0/r;
+    if (ku != j)
+      U_[ku] = uj;
+    u[ku] = U_[ku].pointer();
+    ++ku;
+  }
+  k_ = ku;
+
+  applied_ = k_;
+  int kk = 0;
+  for (int j=0; j<k_; ++j) {
+    Vector& cj = C_[j];
+    A.apply(U_[j], cj);
+    const Real norm0 = sqrt(dot(cj, cj));
+    for (int i=0; i<kk; ++i)
+      h[i] = 0.0;
+    for (int pass=0; pass<2 && kk > 0; ++pass) {
+      blockDots(c.pointer(), kk, cj.pointer(), N_, h2.pointer());
+      for (int i=0; i<kk; ++i) {
+	h[i] += h2[i];
+	h2[i] = -h2[i];
+      }
+      blockCombine(c.pointer(), kk, h2.pointer(), cj.pointer(), N_);
+    }
+    const Real r = sqrt(dot(cj, cj));
+    if (r <= 1e-10*norm0)
+      continue;
+    for (int i=0; i<kk; ++i)
+      h[i] = -h[i];
+    blockCombine(u.pointer(), kk, h.pointer(), U_[j].pointer(), N_);
+    cj *= 1.0/r;
+    U_[j] *= 1.0/r;
+    if (kk != j) {
+      C_[kk] = cj;
+      U_[kk] = U_[j];
+    }
+    c[kk] = C_[kk].pointer();
+    u[kk] = U_[kk].pointer();
+    ++kk;
+  }
+  k_ = kk;
+}
+
+// The last solve searched W = [U V_n] with A W = [C V_{n+1}] G, for
+// G = [I B; 0 H]. Its harmonic Ritz pairs (theta, W z) solve
+// G^T G z = theta G^T [C V_{n+1}]^T W z, so 1/theta are the eigenvalues of
+// G^+ [C V_{n+1}]^T W, and the new U is W z for those of largest modulus
+// (real and imaginary parts of complex z).
+void GMRES::recycle() {
+  const int k = k_;
+  const int n = n_;
+  if (n == 0)
+    return;
+  const int cols = k + n;
+  const int rows = cols + 1;
+  const int ld = Kmax_ + 1;
+  const int ldb = Nrecycle_ + 1;
+
+  array<Real> G(rows*cols);
+  G.fill(0.0);
+  for (int j=0; j<k; ++j)
+    G[j*rows + j] = 1.0;
+  for (int l=0; l<n; ++l) {
+    for (int i=0; i<k; ++i)
+      G[(k+l)*rows + i] = B_[l*ldb + i];
+    for (int i=0; i<=n; ++i)
+      G[(k+l)*rows + k+i] = H_[l*ld + i];
+  }
+
+  // P = [C V_{n+1}]^T W, with C^T V = 0 and V^T V = I
+  array<Real> P(rows*cols);
+  P.fill(0.0);
+  array<const Real*> cv(rows);
+  for (int i=0; i<k; ++i)
+    cv[i] = C_[i].pointer();
+  for (int i=0; i<=n; ++i)
+    cv[k+i] = V_[i].pointer();
+  for (int j=0; j<k; ++j)
+    blockDots(cv.pointer(), rows, U_[j].pointer(), N_, P.pointer() + j*rows);
+  for (int l=0; l<n; ++l)
+    P[(k+l)*rows + k+l] = 1.0;
+
+  array<Real> M(cols*cols), A(rows*cols), b(rows);
+  for (int l=0; l<cols; ++l) {
+    for (int i=0; i<rows*cols; ++i)
+      A[i] = G[i];
+    for (int i=0; i<rows; ++i)
+      b[i] = P[l*rows + i];
+    leastSquares(A.pointer(), rows, cols, b.pointer(), M.pointer() + l*cols);
+  }
+  array<Real> wr(cols), wi(cols), Z(cols*cols);
+  eigenvalues(cols, M.pointer(), wr.pointer(), wi.pointer(), Z.pointer());
+
+  // Largest modulus first; a pair is taken whole, at its wi > 0 member
+  array<int> order(cols);
+  for (int j=0; j<cols; ++j)
+    order[j] = j;
+  for (int j=1; j<cols; ++j)
+    for (int l=j; l>0; --l) {
+      const Real a0 = wr[order[l-1]]*wr[order[l-1]] + wi[order[l-1]]*wi[order[l-1]];
+      const Real a1 = wr[order[l]]*wr[order[l]] + wi[order[l]]*wi[order[l]];
+      if (a1 <= a0)
+	break;
+      swap(order[l-1], order[l]);
+    }
+  array<int> pick(Nrecycle_ + 1);
+  int kn = 0;
+  for (int j=0; j<cols && kn < Nrecycle_; ++j) {
+    const int e = order[j];
+    if (wi[e] < 0.0)
+      continue;
+    pick[kn++] = e;
+    if (wi[e] > 0.0)
+      pick[kn++] = e + 1;
+  }
+
+  // New U into C, which the next solve recomputes anyway
+  array<const Real*> w(cols);
+  for (int i=0; i<k; ++i)
+    w[i] = U_[i].pointer();
+  for (int l=0; l<n; ++l)
+    w[k+l] = V_[l].pointer();
+  for (int s=0; s<kn; ++s) {
+    C_[s].setToZero();
+    blockCombine(w.pointer(), cols, Z.pointer() + pick[s]*cols, C_[s].pointer(), N_);
+  }
+  for (int s=0; s<kn; ++s) {
+    U_[s] = C_[s];
+    const Real norm = sqrt(dot(U_[s], U_[s]));
+    if (norm > 0.0)
+      U_[s] *= 1.0/norm;
+  }
+  k_ = kn;
+}
+
+// Model coordinates: an orthonormalization of W = [U V_n] by Cholesky
+// factorization of W^T W, taking V's columns (orthonormal) first and
+// dropping columns of U within the span of those before
+void GMRES::buildModel() {
+  const int k = k_;
+  const int n = n_;
+  const int ld = Kmax_ + 1;
+  const int ldb = Nrecycle_ + 1;
+  rows_ = k + n + 1;
+
+  // Gram matrix entries of the columns of U against [U V_n]
+  array<Real> UW(k*(k + n));
+  array<const Real*> w(k + n);
+  for (int i=0; i<k; ++i)
+    w[i] = U_[i].pointer();
+  for (int l=0; l<n; ++l)
+    w[k+l] = V_[l].pointer();
+  for (int i=0; i<k; ++i)
+    blockDots(w.pointer(), k + n, U_[i].pointer(), N_, UW.pointer() + i*(k + n));
+
+  cols_.resize(k + n);
+  Rw_.resize((k + n)*(k + n));
+  Rw_.fill(0.0);
+  m_ = 0;
+  for (int l=0; l<n; ++l) {
+    cols_[m_] = k + l;
+    Rw_[m_*(k + n) + m_] = 1.0;
+    ++m_;
+  }
+  const int ldr = k + n;
+  for (int j=0; j<k; ++j) {
+    Real* r = Rw_.pointer() + m_*ldr;
+    Real d = UW[j*(k + n) + j];
+    const Real d0 = d;
+    for (int q=0; q<m_; ++q) {
+      Real s = UW[j*(k + n) + cols_[q]];
+      for (int l=0; l<q; ++l)
+	s -= Rw_[q*ldr + l]*r[l];
+      r[q] = s/Rw_[q*ldr + q];
+      d -= r[q]*r[q];
+    }
+    if (d <= 1e-10*d0) {
+      for (int q=0; q<m_; ++q)
+	r[q] = 0.0;
+      continue;
+    }
+    r[m_] = sqrt(d);
+    cols_[m_++] = j;
+  }
+  // Compact Rw to m x m
+  const int m = m_;
+  array<Real> R(m*m);
+  for (int q=0; q<m; ++q)
+    for (int l=0; l<m; ++l)
+      R[q*m + l] = Rw_[q*ldr + l];
+  Rw_ = R;
+
+  // H = G Rw^{-1} column by column, G = [I B; 0 Hessenberg] on cols_
+  Hm_.resize(rows_*m);
+  array<Real> Gc(rows_);
+  for (int q=0; q<m; ++q) {
+    const int c = cols_[q];
+    Gc.fill(0.0);
+    if (c < k)
+      Gc[c] = 1.0;
+    else {
+      for (int i=0; i<k; ++i)
+	Gc[i] = B_[(c-k)*ldb + i];
+      for (int i=0; i<=n; ++i)
+	Gc[k+i] = H_[(c-k)*ld + i];
+    }
+    for (int l=0; l<q; ++l)
+      for (int i=0; i<rows_; ++i)
+	Gc[i] -= Hm_[l*rows_ + i]*Rw_[q*m + l];
+    for (int i=0; i<rows_; ++i)
+      Hm_[q*rows_ + i] = Gc[i]/Rw_[q*m + q];
+  }
+}
+
+int GMRES::solve(LinearOperator& A, const Vector& b, Vector& x) {
+  assert(b.length() == N_);
+  const int ld = Kmax_ + 1;
+  const int ldb = Nrecycle_ + 1;
+  if (Nrecycle_ > 0 && m_ > 0)
+    recycle();
+  n_ = 0;
+  applied_ = 0;
+  residual_ = 0.0;
+  H_.fill(0.0);
+  beta_ = sqrt(dot(b, b));
+  x.resize(N_);
+  x.setToZero();
+  if (beta_ == 0.0) {
+    m_ = 0;
+    rows_ = 1;
+    gm_.resize(1);
+    gm_[0] = 0.0;
+    return 0;
+  }
+  deflate(A);
+  const int k = k_;
+
+  // r0 = (I - C C^T) b
+  array<const Real*> cp(k);
+  for (int i=0; i<k; ++i)
+    cp[i] = C_[i].pointer();
+  V_[0] = b;
+  if (k > 0) {
+    blockDots(cp.pointer(), k, b.pointer(), N_, c_.pointer());
+    array<Real> mc(k);
+    for (int i=0; i<k; ++i)
+      mc[i] = -c_[i];
+    blockCombine(cp.pointer(), k, mc.pointer(), V_[0].pointer(), N_);
+  }
+  const Real beta0 = sqrt(dot(V_[0], V_[0]));
+
+  // Givens rotations of H, for the residual of the Krylov model
+  array<Real> cs(Kmax_), sn(Kmax_), g(Kmax_ + 1), h(k + Kmax_ + 1), h2(k + Kmax_ + 1);
+  array<Real*> v(k + Kmax_ + 1);
+  for (int i=0; i<k; ++i)
+    v[i] = C_[i].pointer();
+  g.fill(0.0);
+  g[0] = beta0;
+  residual_ = beta0/beta_;
+  if (residual_ >= tol_)
+    V_[0] *= 1.0/beta0;
+
+  for (int j=0; j<Kmax_ && residual_ >= tol_; ++j) {
+    Vector& w = V_[j+1];
+    A.apply(V_[j], w);
+    for (int i=0; i<=j; ++i)
+      v[k+i] = V_[i].pointer();
+    const int kj = k + j + 1;
+
+    // CGS2 against C and V: h = [C V]^T w, w -= [C V] h, twice
+    blockDots(v.pointer(), kj, w.pointer(), N_, h.pointer());
+    for (int i=0; i<kj; ++i)
+      h2[i] = -h[i];
+    blockCombine(v.pointer(), kj, h2.pointer(), w.pointer(), N_);
+    blockDots(v.pointer(), kj, w.pointer(), N_, h2.pointer());
+    for (int i=0; i<kj; ++i) {
+      h[i] += h2[i];
+      h2[i] = -h2[i];
+    }
+    blockCombine(v.pointer(), kj, h2.pointer(), w.pointer(), N_);
+    for (int i=0; i<k; ++i)
+      B_[j*ldb + i] = h[i];
+    Real* hv = h.pointer() + k;
+    const Real hn = sqrt(dot(w, w));
+    Real hnorm = hn*hn;
+    for (int i=0; i<=j; ++i)
+      hnorm += hv[i]*hv[i];
+    hnorm = sqrt(hnorm);
+
+    for (int i=0; i<=j; ++i)
+      H_[j*ld + i] = hv[i];
+    H_[j*ld + j+1] = hn;
+    n_ = j + 1;
+
+    // Rotate the new column and update the residual
+    Real r[2];
+    for (int i=0; i<j; ++i) {
+      const Real t = cs[i]*hv[i] + sn[i]*hv[i+1];
+      hv[i+1] = -sn[i]*hv[i] + cs[i]*hv[i+1];
+      hv[i] = t;
+    }
+    r[0] = hv[j];
+    r[1] = hn;
+    const Real d = sqrt(r[0]*r[0] + r[1]*r[1]);
+    cs[j] = (d > 0.0) ? r[0]/d : 1.0;
+    sn[j] = (d > 0.0) ? r[1]/d : 0.0;
+    g[j+1] = -sn[j]*g[j];
+    g[j] = cs[j]*g[j];
+    residual_ = fabs(g[j+1])/beta_;
+
+    // Stop on convergence or on breakdown, when A V_n is within V_n
+    if (hn > 0.0)
+      w *= 1.0/hn;
+    if (hn <= 1e-14*hnorm || residual_ < tol_)
+      break;
+  }
+
+  // y = argmin |H y - beta0 e1|, then z = C^T b - B y for U
+  const int n = n_;
+  array<Real> y(n), z(k);
+  if (n > 0) {
+    array<Real> Hc((n + 1)*n), e(n + 1);
+    for (int l=0; l<n; ++l)
+      for (int i=0; i<=n; ++i)
+	Hc[l*(n + 1) + i] = H_[l*ld + i];
+    e.fill(0.0);
+    e[0] = beta0;
+    residual_ = leastSquares(Hc.pointer(), n + 1, n, e.pointer(), y.pointer())/beta_;
+  }
+  for (int i=0; i<k; ++i) {
+    z[i] = c_[i];
+    for (int l=0; l<n; ++l)
+      z[i] -= B_[l*ldb + i]*y[l];
+  }
+  array<const Real*> uv(k + n);
+  array<Real> zy(k + n);
+  for (int i=0; i<k; ++i) {
+    uv[i] = U_[i].pointer();
+    zy[i] = z[i];
+  }
+  for (int l=0; l<n; ++l) {
+    uv[k+l] = V_[l].pointer();
+    zy[k+l] = y[l];
+  }
+  blockCombine(uv.pointer(), k + n, zy.pointer(), x.pointer(), N_);
+
+  buildModel();
+  gm_.resize(rows_);
+  gm_.fill(0.0);
+  for (int i=0; i<k; ++i)
+    gm_[i] = c_[i];
+  gm_[k] = beta0;
+  return n_;
+}
+
+/**************************************************************************
+ * NewtonKrylov
+ **************************************************************************/
+
+NewtonFlags::NewtonFlags()
+  :
+  Nnewton(20),
+  Ngmres(40),
+  epsSearch(1e-12),
+  epsKrylov(1e-3),
+  delta(0.0),
+  deltaMin(1e-12),
+  deltaMax(1.0),
+  improveMin(0.01),
+  improveOk(0.75),
+  Nrecycle(0),
+  verbose(true)
+{}
+
+// The Jacobian of a NewtonProblem at x
+class JacobianOperator : public LinearOperator {
+public:
+  JacobianOperator(NewtonProblem& p, const Vector& x, const Vector& Gx)
+    : p_(p), x_(x), Gx_(Gx) {}
+  void apply(const Vector& dx, Vector& dG) { p_.jacobian(x_, Gx_, dx, dG); }
+private:
+  NewtonProblem& p_;
+  const Vector& x_;
+  const Vector& Gx_;
+};
+
+NewtonKrylov::NewtonKrylov(const NewtonFlags& flags, int N)
+  :
+  flags_(flags),
+  gmres_(N, flags.Ngmres, flags.epsKrylov, flags.Nrecycle),
+  G_(N),
+  Gnew_(N),
+  dx_(N),
+  xnew_(N),
+  residual_(0.0),
+  iterations_(0),
+  applications_(0),
+  delta_(flags.delta)
+{}
+
+Real NewtonKrylov::residual() const {
+  return residual_;
+}
+
+int NewtonKrylov::iterations() const {
+  return iterations_;
+}
+
+int NewtonKrylov::applications() const {
+  return applications_;
+}
+
+Real NewtonKrylov::delta() const {
+  return delta_;
+}
+
+const NewtonFlags& NewtonKrylov::flags() const {
+  return flags_;
+}
+
+// min |[H; sqrt(mu) I] y - [g; 0]|, and |H y - g|
+static Real dampedStep(const GMRES& g, Real mu, array<Real>& y) {
+  const int n = g.modelSize();
+  const int rows = g.modelRows();
+  const int m = rows + n;
+  array<Real> A(m*n), b(m);
+  A.fill(0.0);
+  b.fill(0.0);
+  for (int l=0; l<n; ++l) {
+    for (int i=0; i<rows; ++i)
+      A[l*m + i] = g.H(i, l);
+    A[l*m + rows + l] = sqrt(mu);
+  }
+  for (int i=0; i<rows; ++i)
+    b[i] = g.g(i);
+  y.resize(n);
+  leastSquares(A.pointer(), m, n, b.pointer(), y.pointer());
+
+  Real r = 0.0;
+  for (int i=0; i<rows; ++i) {
+    Real s = -g.g(i);
+    for (int l=0; l<n; ++l)
+      s += g.H(i, l)*y[l];
+    r += s*s;
+  }
+  return sqrt(r);
+}
+
+static Real norm(const array<Real>& y) {
+  Real s = 0.0;
+  for (int i=0; i<y.length(); ++i)
+    s += y[i]*y[i];
+  return sqrt(s);
+}
+
+Real NewtonKrylov::hookstep(Real delta, array<Real>& y, bool& hook) const {
+  Real r = dampedStep(gmres_, 0.0, y);
+  hook = norm(y) > delta;
+  if (!hook)
+    return r;
+
+  // |y(mu)| decreases with mu; bracket delta, then bisect in log mu
+  Real scale = 0.0;
+  for (int l=0; l<gmres_.modelSize(); ++l)
+    for (int i=0; i<gmres_.modelRows(); ++i)
+      scale += gmres_.H(i, l)*gmres_.H(i, l);
+  Real mulo = 0.0;
+  Real muhi = 1e-12*scale;
+  array<Real> yhi;
+  Real rhi = dampedStep(gmres_, muhi, yhi);
+  while (norm(yhi) > delta) {
+    mulo = muhi;
+    muhi *= 10.0;
+    rhi = dampedStep(gmres_, muhi, yhi);
+  }
+  for (int k=0; k<100 && mulo > 0.0; ++k) {
+    const Real mu = sqrt(mulo*muhi);
+    array<Real> ym;
+    const Real rm = dampedStep(gmres_, mu, ym);
+    const Real nm = norm(ym);
+    if (nm > delta)
+      mulo = mu;
+    else {
+      muhi = mu;
+      yhi = ym;
+      rhi = rm;
+    }
+    if (fabs(nm - delta) < 1e-6*delta || muhi/mulo < 1.0 + 1e-12)
+      break;
+  }
+  y = yhi;
+  return rhi;
+}
+
+bool NewtonKrylov::solve(NewtonProblem& p, Vector& x) {
+  const int N = p.size();
+  assert(x.length() == N && G_.length() == N);
+  p.residual(x, G_);
+  residual_ = sqrt(dot(G_, G_));
+  delta_ = flags_.delta;
+  applications_ = 0;
+
+  for (iterations_=0; ; ++iterations_) {
+    if (flags_.verbose)
+      cout << "newton step " << iterations_ << ": |G| == " << residual_ << endl;
+    if (residual_ < flags_.epsSearch)
+      return true;
+    if (iterations_ == flags_.Nnewton)
+      return false;
+
+    // Krylov subspace of the Newton equation DG dx = -G
+    xnew_ = G_;
+    xnew_ *= -1.0;
+    JacobianOperator J(p, x, G_);
+    gmres_.solve(J, xnew_, dx_);
+    applications_ += gmres_.applications();
+    if (flags_.verbose) {
+      cout << "  GMRES: " << gmres_.n() << " iterations";
+      if (gmres_.recycled() > 0)
+	cout << " and " << gmres_.recycled() << " recycled vectors";
+      cout << ", residual " << gmres_.residual() << endl;
+    }
+
+    array<Real> y;
+    bool hook;
+    if (delta_ <= 0.0) {
+      hookstep(1e300, y, hook);
+      delta_ = norm(y);
+    }
+
+    // Hooksteps of decreasing radius until G falls as the model predicts
+    const Real r2 = residual_*residual_;
+    for (;;) {
+      const Real model = hookstep(delta_, y, hook);
+      const Real ynorm = norm(y);
+      gmres_.combine(y.pointer(), dx_);
+      xnew_ = x;
+      axpy(1.0, dx_, xnew_);
+      p.residual(xnew_, Gnew_);
+      const Real rnew = sqrt(dot(Gnew_, Gnew_));
+      const Real predicted = r2 - model*model;
+      const Real improvement = (predicted > 0.0) ? (r2 - rnew*rnew)/predicted
+	: (rnew < residual_ ? 1.0 : -1.0);
+      if (flags_.verbose)
+	cout << "  " << (hook ? "hookstep" : "newton step") << " |dx| == " << ynorm
+	     << ", |G| == " << rnew << ", improvement " << improvement << endl;
+
+      if (improvement < flags_.improveMin) {
+	if (0.5*ynorm >= flags_.deltaMin) {
+	  delta_ = 0.5*ynorm;
+	  continue;
+	}
+	if (rnew >= residual_) {
+	  if (flags_.verbose)
+	    cout << "newton: trust region below deltaMin, stopping" << endl;
+	  return false;
+	}
+      }
+      else if (improvement > flags_.improveOk && hook)
+	delta_ = (2.0*delta_ < flags_.deltaMax) ? 2.0*delta_ : flags_.deltaMax;
+
+      swap(x, xnew_);
+      swap(G_, Gnew_);
+      residual_ = rnew;
+      break;
+    }
+  }
+}
+
+} //namespace channelflow
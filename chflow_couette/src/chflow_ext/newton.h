@@ -0,0 +1,184 @@
+// newton.h: Newton-Krylov-hookstep solver over flat vectors
+
+#ifndef CHFLOW_EXT_NEWTON_H
+#define CHFLOW_EXT_NEWTON_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "channelflow/vector.h"
+
+namespace channelflow {
+
+// Inner product and y += a x of Vectors, in parallel over the elements
+Real dot(const Vector& x, const Vector& y);
+void axpy(Real a, const Vector& x, Vector& y);
+
+// h[j] = <V[j], w> for j < k, in one parallel pass over w
+void multiDot(const array<Vector>& V, int k, const Vector& w, Real* h);
+
+// Least-squares solution y (n) of A y = b for A m x n, m >= n, column-major,
+// by Householder QR; A and b are overwritten. Returns |A y - b|.
+Real leastSquares(Real* A, int m, int n, Real* b, Real* y);
+
+// y = A x for a linear operator on Vectors, such as a Jacobian
+class LinearOperator {
+public:
+  virtual ~LinearOperator();
+  virtual void apply(const Vector& x, Vector& y) = 0;
+};
+
+// NewtonProblem is a system G(x) = 0 of size() equations in as many
+// unknowns. The Jacobian-vector product defaults to the forward difference
+// (G(x + eps dx) - G(x))/eps with |eps dx| == epsDx; problems with a
+// cheaper or exact product override jacobian.
+class NewtonProblem {
+public:
+  NewtonProblem();
+  virtual ~NewtonProblem();
+
+  virtual int size() const = 0;
+  virtual void residual(const Vector& x, Vector& G) = 0;
+
+  // dG = DG(x) dx, with Gx == G(x)
+  virtual void jacobian(const Vector& x, const Vector& Gx, const Vector& dx, Vector& dG);
+
+  Real epsDx;  // size of the finite-difference perturbation
+
+private:
+  Vector xfd_;  // x + eps dx
+};
+
+// GMRES solves A x = b in the Krylov space K_n(A, b) of at most Kmax
+// vectors, which are allocated once for its lifetime and orthonormalized
+// by classical Gram-Schmidt with one reorthogonalization (CGS2): the inner
+// products against all previous vectors come from one parallel pass, and
+// the update from another.
+//
+// With Nrecycle > 0 it recycles, as GCRO-DR (Parks et al. 2006), a
+// subspace U of up to Nrecycle vectors from each solve into the next, for
+// sequences of nearby systems such as the Newton steps along a branch.
+// A solve first orthonormalizes U, applies A to it and orthonormalizes
+// C = A U, then searches span(U) + K_n((I - C C^T) A, (I - C C^T) b), so
+// that the directions of U, typically the slowest to converge, are
+// deflated from the Krylov iteration. The next U is spanned by the harmonic Ritz vectors of the
+// smallest harmonic Ritz values in the space searched.
+//
+// The least-squares model of the last solve stays available, in orthonormal
+// coordinates y with x = combine(y), |x| = |y| and |A x - b| = |H y - g|,
+// for a hookstep in the same subspace. Without recycling, H is the
+// Hessenberg matrix of the Arnoldi process and g = |b| e1.
+
+class GMRES {
+public:
+  GMRES();
+  GMRES(int N, int Kmax, Real tol, int Nrecycle=0);
+
+  // x minimizing |A x - b| over the space searched, and n, stopping when
+  // |A x - b| < tol |b| or at Kmax iterations
+  int solve(LinearOperator& A, const Vector& b, Vector& x);
+
+  int n() const;                 // iterations of the last solve
+  int recycled() const;          // recycled vectors searched in the last solve
+  int applications() const;      // of A in the last solve, n() + recycled()
+  Real beta() const;             // |b|
+  Real residual() const;         // |A x - b|/|b| of the Krylov model
+  const Vector& basis(int j) const;
+
+  // The model: H is modelRows() x modelSize(), n() + 1 rows and n()
+  // columns without recycling
+  int modelSize() const;
+  int modelRows() const;
+  Real H(int i, int j) const;
+  Real g(int i) const;
+
+  // x = combine(y) for a y of length modelSize()
+  void combine(const Real* y, Vector& x) const;
+
+private:
+  int N_;
+  int Kmax_;
+  Real tol_;
+  int Nrecycle_;
+  int n_;
+  int k_;               // recycled vectors held, A U = C after a solve's first pass
+  int applied_;         // of A to U in the last solve
+  int m_;               // model columns
+  int rows_;            // model rows, k + n + 1
+  Real beta_;
+  Real residual_;
+  array<Vector> V_;
+  array<Real> H_;       // Hessenberg matrix, column-major, Kmax+1 rows
+  array<Vector> U_;     // Nrecycle+1, room to complete a complex pair
+  array<Vector> C_;
+  array<Real> B_;       // C^T A V, column-major, Nrecycle+1 rows
+  array<Real> c_;       // C^T b
+  array<Real> Hm_;      // model, column-major, rows_ rows
+  array<Real> gm_;
+  array<int> cols_;     // columns of W = [U V_n] in the model, V's first
+  array<Real> Rw_;      // W^T W = Rw^T Rw over cols_, upper triangular, m_ x m_
+
+  void deflate(LinearOperator& A);  // C = A U, orthonormalized, and U to match
+  void buildModel();
+  void recycle();                   // U for the next solve
+};
+
+// NewtonFlags configures NewtonKrylov. The trust-region radius delta bounds
+// the step |dx|; delta <= 0 starts from the first Newton step's length.
+class NewtonFlags {
+public:
+  NewtonFlags();
+
+  int Nnewton;       // maximum Newton steps
+  int Ngmres;        // maximum GMRES iterations per step
+  Real epsSearch;    // converged when |G| < epsSearch
+  Real epsKrylov;    // relative GMRES tolerance
+  Real delta;        // initial trust-region radius
+  Real deltaMin;     // a step needing a smaller radius fails
+  Real deltaMax;
+  Real improveMin;   // reduction below this fraction of the prediction shrinks delta
+  Real improveOk;    // above this fraction, with a hookstep, grows delta
+  int Nrecycle;      // Krylov vectors recycled from each GMRES solve into the next
+  bool verbose;
+};
+
+// NewtonKrylov solves G(x) = 0 by Newton's method with GMRES for the linear
+// problems and the hookstep of Viswanath (2007) for globalization: when the
+// Newton step y_N in the Krylov basis exceeds the trust-region radius,
+// the step is y = argmin |H y - beta e1| subject to |y| = delta, found by
+// bisection on the Levenberg-Marquardt parameter mu of
+// (H^T H + mu I) y = H^T beta e1. If |G| falls by less than improveMin of
+// the model's prediction, delta is halved and the step recomputed in the
+// same Krylov subspace, at the cost of one residual evaluation and no
+// GMRES iterations. All vectors are allocated on construction.
+
+class NewtonKrylov {
+public:
+  NewtonKrylov(const NewtonFlags& flags, int N);
+
+  // Iterate from x; true if converged, with x the solution
+  bool solve(NewtonProblem& p, Vector& x);
+
+  Real residual() const;   // |G(x)| at the last iterate
+  int iterations() const;  // Newton steps taken
+  int applications() const;  // of the Jacobian, in all GMRES solves of the last solve
+  Real delta() const;      // current trust-region radius
+  const NewtonFlags& flags() const;
+
+private:
+  NewtonFlags flags_;
+  GMRES gmres_;
+  Vector G_;
+  Vector Gnew_;
+  Vector dx_;
+  Vector xnew_;
+  Real residual_;
+  int iterations_;
+  int applications_;
+  Real delta_;
+
+  // y of norm <= delta minimizing the Krylov model, and its residual
+  Real hookstep(Real delta, array<Real>& y, bool& hook) const;
+};
+
+} //namespace channelflow
+#endif
@@ -0,0 +1,419 @@
+// nonlinear.cpp: rotational nonlinear term with fused flow diagnostics
+
+#include <cstring>
+#include "nonlinear.h"
+#include "gridtables.h"
+#include "spectralops.h"
+
+using namespace std;
+
+namespace channelflow {
+
+FlowDiagnostics::FlowDiagnostics()
+  :
+  t(0.0),
+  cflfactor(0.0),
+  cflfactorFluct(0.0),
+  energy(0.0),
+  maxKE(0.0),
+  dissipation(0.0),
+  divNorm2(0.0),
+  valid(false)
+{
+  L2Norm2[0] = L2Norm2[1] = L2Norm2[2] = 0.0;
+}
+
+ostream& operator<<(ostream& os, const FlowDiagnostics& d) {
+  os << "t == " << d.t
+     << ", CFLfactor == " << d.cflfactor
+     << ", L2Norm(u,v,w) == " << sqrt(d.L2Norm2[0]) << ' '
+     << sqrt(d.L2Norm2[1]) << ' ' << sqrt(d.L2Norm2[2])
+     << ", energy == " << d.energy
+     << ", dissipation == " << d.dissipation
+     << ", divNorm == " << sqrt(d.divNorm2);
+  return os;
+}
+
+RotationalNL::RotationalNL()
+  :
+  trans_(0),
+  physical_(false)
+{}
+
+RotationalNL::RotationalNL(const FlowField& u)
+  :
+  trans_(0),
+  physical_(false)
+{
+  resize(u);
+}
+
+RotationalNL::RotationalNL(const RotationalNL& nl)
+  :
+  Ubase_(nl.Ubase_),
+  U_(nl.U_),
+  Uy_(nl.Uy_),
+  trans_(0),
+  physical_(false)
+{
+  if (nl.trans_)
+    resize(nl.utot_);
+}
+
+RotationalNL::~RotationalNL() {
+  delete trans_;
+  trans_ = 0;
+}
+
+RotationalNL& RotationalNL::operator=(const RotationalNL& nl) {
+  if (this != &nl && nl.trans_)
+    resize(nl.utot_);
+  Ubase_ = nl.Ubase_;
+  U_ = nl.U_;
+  Uy_ = nl.Uy_;
+  physical_ = false;
+  return *this;
+}
+
+void RotationalNL::resize(const FlowField& u) {
+  assert(u.Nd() == 3);
+  if (trans_ && sameGeometry(utot_, u))
+    return;
+  const int Nx = u.Nx();
+  const int Ny = u.Ny();
+  const int Nz = u.Nz();
+  dudy_.resize(Nx, Ny, Nz, 3, u.Lx(), u.Lz(), u.a(), u.b());
+  omega_.resize(Nx, Ny, Nz, 3, u.Lx(), u.Lz(), u.a(), u.b());
+  utot_.resize(Nx, Ny, Nz, 3, u.Lx(), u.Lz(), u.a(), u.b());
+  div_.resize(Nx, Ny, Nz, 1, u.Lx(), u.Lz(), u.a(), u.b());
+  delete trans_;
+  trans_ = new BatchedChebyTransform(u);
+  physical_ = false;
+}
+
+void RotationalNL::reserve(const FlowField& u, const ChebyCoeff& Ubase) {
+  resize(u);
+  profile(Ubase);
+  if (!sameGeometry(dup_, u)) {
+    dup_.resize(u.Nx(), u.Ny(), u.Nz(), 3, u.Lx(), u.Lz(), u.a(), u.b());
+    domega_.resize(u.Nx(), u.Ny(), u.Nz(), 3, u.Lx(), u.Lz(), u.a(), u.b());
+  }
+}
+
+void RotationalNL::operator()(const FlowField& u, const ChebyCoeff& Ubase,
+			      FlowField& f, FlowDiagnostics* diag) {
+  eval(u, Ubase, &f, diag);
+}
+
+void RotationalNL::diagnose(const FlowField& u, const ChebyCoeff& Ubase,
+			    FlowDiagnostics& d) {
+  eval(u, Ubase, 0, &d);
+}
+
+// Transforming Ubase would build an FFTW plan on every call, so the
+// spectral profile is kept until Ubase changes
+void RotationalNL::profile(const ChebyCoeff& Ubase) {
+  if (Ubase.N() == Ubase_.N() && Ubase.state() == Ubase_.state()
+      && Ubase.a() == Ubase_.a() && Ubase.b() == Ubase_.b()
+      && memcmp(Ubase.pointer(), Ubase_.pointer(), Ubase.N()*sizeof(Real)) == 0)
+    return;
+  Ubase_ = Ubase;
+  U_ = Ubase;
+  U_.makeSpectral();
+  Uy_ = ChebyCoeff(U_.N(), U_.a(), U_.b(), Spectral);
+  diff(U_, Uy_);
+}
+
+// Add profile U(y) to the kx=kz=0 mode of component i of spectral field v
+static void addProfile(FlowField& v, const ChebyCoeff& U, int i) {
+  const int Ny = v.Ny();
+  const int stride = 2*v.Mx()*v.Mz();
+  Real* data = v.rawData() + i*Ny*stride;
+  for (int ny=0; ny<Ny; ++ny)
+    data[ny*stride] += U[ny];
+}
+
+// omega = curl of a field with components u and y-derivatives dudy, and
+// div = its divergence if div != 0, in spectral space a row of Mz modes at
+// a time
+static void curl(const FlowField& u, const FlowField& dudy, FlowField& omega,
+		 FlowField* div) {
+  const GridTables& t = gridTables(u);
+  const int Ny = u.Ny();
+  const int Mx = u.Mx();
+  const int Mz = u.Mz();
+  const int Ncomp = Ny*u.Nx()*u.Nzpad();  // Reals per component
+
+  Vector gx(Mx);
+  Vector gz(Mz);
+  for (int mx=0; mx<Mx; ++mx)
+    gx[mx] = Im(t.Dx(mx));
+  for (int mz=0; mz<Mz; ++mz)
+    gz[mz] = Im(t.Dz(mz));
+
+  omega.setState(Spectral, Spectral);
+  if (div)
+    div->setState(Spectral, Spectral);
+  const Real* ud = u.rawData();
+  const Real* dy = dudy.rawData();
+  Real* om = omega.rawData();
+  Real* dv = div ? div->rawData() : 0;
+  const Real* gzp = gz.pointer();
+
+#pragma omp parallel for
+  for (int r=0; r<Ny*Mx; ++r) {
+    const Real ax = gx[r % Mx];
+    const int o = 2*Mz*r;
+    const Real* u0 = ud + o;
+    const Real* u1 = ud + Ncomp + o;
+    const Real* u2 = ud + 2*Ncomp + o;
+    const Real* d0 = dy + o;
+    const Real* d1 = dy + Ncomp + o;
+    const Real* d2 = dy + 2*Ncomp + o;
+    Real* w0 = om + o;
+    Real* w1 = om + Ncomp + o;
+    Real* w2 = om + 2*Ncomp + o;
+#pragma omp simd
+    for (int m=0; m<Mz; ++m) {
+      const Real az = gzp[m];
+      const int re = 2*m;
+      const int im = 2*m+1;
+      // w_x = dw/dy - Dz v,  w_y = Dz u - Dx w,  w_z = Dx v - du/dy
+      w0[re] = d2[re] + az*u1[im];
+      w0[im] = d2[im] - az*u1[re];
+      w1[re] = -az*u0[im] + ax*u2[im];
+      w1[im] =  az*u0[re] - ax*u2[re];
+      w2[re] = -ax*u1[im] - d0[re];
+      w2[im] =  ax*u1[re] - d0[im];
+    }
+    if (dv) {
+      Real* dr = dv + o;
+#pragma omp simd
+      for (int m=0; m<Mz; ++m) {
+	const Real az = gzp[m];
+	const int re = 2*m;
+	const int im = 2*m+1;
+	// div u = Dx u + dv/dy + Dz w
+	dr[re] = -ax*u0[im] + d1[re] - az*u2[im];
+	dr[im] =  ax*u0[re] + d1[im] + az*u2[re];
+      }
+    }
+  }
+}
+
+void RotationalNL::eval(const FlowField& u_, const ChebyCoeff& Ubase,
+			FlowField* f, FlowDiagnostics* diag) {
+  assert(u_.Nd() == 3);
+  FlowField& u = const_cast<FlowField&>(u_);
+  const fieldstate uxzstate = u.xzstate();
+  const fieldstate uystate = u.ystate();
+  u.makeSpectral();
+  resize(u);
+  physical_ = false;
+
+  const GridTables& t = gridTables(u);
+  const int Nx = u.Nx();
+  const int Ny = u.Ny();
+  const int Nz = u.Nz();
+  const int Nzpad = u.Nzpad();
+  const int Nplane = Nx*Nzpad;  // Reals per xz plane
+  const int Ncomp = Ny*Nplane;  // Reals per component
+
+  profile(Ubase);
+  const ChebyCoeff& U = U_;
+  const ChebyCoeff& Uy = Uy_;
+
+  // du/dy, and d(utot)/dy for the spectral curl
+  ydiffFast(u, dudy_);
+  addProfile(dudy_, Uy, 0);
+
+  // curl utot and div u
+  curl(u, dudy_, omega_, &div_);
+
+  if (diag) {
+    L2Norm2Fast(u, diag->L2Norm2);
+    diag->energy = 0.5*(diag->L2Norm2[0] + diag->L2Norm2[1] + diag->L2Norm2[2]);
+    diag->dissipation = L2Norm2Fast(omega_);
+    diag->divNorm2 = L2Norm2Fast(div_);
+  }
+
+  // utot = u + U ex in physical space
+  const Real* ud = u.rawData();
+  {
+    const int N = u.rawDataLength();
+    Real* ut = utot_.rawData();
+#pragma omp parallel for
+    for (int n=0; n<N; ++n)
+      ut[n] = ud[n];
+  }
+  utot_.setState(Spectral, Spectral);
+  addProfile(utot_, U, 0);
+  trans_->makePhysical(utot_);
+
+  if (f) {
+    trans_->makePhysical(omega_);
+    if (!sameGeometry(*f, u))
+      f->resize(Nx, Ny, Nz, 3, u.Lx(), u.Lz(), u.a(), u.b());
+    f->setState(Physical, Physical);
+  }
+
+  // One sweep over physical gridpoints: f = omega x utot, the CFL maxima of
+  // utot and of u = utot - U ex, and the maximum of u.u
+  array<Real> Upts(Ny);
+  if (diag)
+    for (int ny=0; ny<Ny; ++ny)
+      Upts[ny] = U.eval(t.y(ny));
+  const Real* ut = utot_.rawData();
+  const Real* wp = omega_.rawData();
+  Real* fp = f ? f->rawData() : 0;
+  const Real rdx = 1.0/t.dx();
+  const Real rdz = 1.0/t.dz();
+  Real cfl = 0.0;
+  Real cfl0 = 0.0;
+  Real ke = 0.0;
+
+#pragma omp parallel for reduction(max:cfl,cfl0,ke)
+  for (int ny=0; ny<Ny; ++ny) {
+    const Real Uny = diag ? Upts[ny] : 0.0;
+    Real cx = 0.0;
+    Real cx0 = 0.0;
+    Real cy = 0.0;
+    Real cz = 0.0;
+    Real k = 0.0;
+    for (int nx=0; nx<Nx; ++nx) {
+      const int o = ny*Nplane + nx*Nzpad;
+      const Real* v0 = ut + o;
+      const Real* v1 = ut + Ncomp + o;
+      const Real* v2 = ut + 2*Ncomp + o;
+      if (fp) {
+	const Real* w0 = wp + o;
+	const Real* w1 = wp + Ncomp + o;
+	const Real* w2 = wp + 2*Ncomp + o;
+	Real* f0 = fp + o;
+	Real* f1 = fp + Ncomp + o;
+	Real* f2 = fp + 2*Ncomp + o;
+#pragma omp simd
+	for (int nz=0; nz<Nz; ++nz) {
+	  f0[nz] = w1[nz]*v2[nz] - w2[nz]*v1[nz];
+	  f1[nz] = w2[nz]*v0[nz] - w0[nz]*v2[nz];
+	  f2[nz] = w0[nz]*v1[nz] - w1[nz]*v0[nz];
+	}
+	for (int nz=Nz; nz<Nzpad; ++nz)
+	  f0[nz] = f1[nz] = f2[nz] = 0.0;
+      }
+      if (diag) {
+#pragma omp simd reduction(max:cx,cx0,cy,cz,k)
+	for (int nz=0; nz<Nz; ++nz) {
+	  const Real u0 = v0[nz] - Uny;
+	  cx = Greater(cx, abs(v0[nz]));
+	  cx0 = Greater(cx0, abs(u0));
+	  cy = Greater(cy, abs(v1[nz]));
+	  cz = Greater(cz, abs(v2[nz]));
+	  k = Greater(k, u0*u0 + v1[nz]*v1[nz] + v2[nz]*v2[nz]);
+	}
+      }
+    }
+    cfl = Greater(cfl, Greater(cx*rdx, Greater(cy/t.dy(ny), cz*rdz)));
+    cfl0 = Greater(cfl0, Greater(cx0*rdx, Greater(cy/t.dy(ny), cz*rdz)));
+    ke = Greater(ke, k);
+  }
+
+  if (f) {
+    trans_->makeSpectral(*f);
+    physical_ = true;
+  }
+  if (diag) {
+    diag->cflfactor = cfl;
+    diag->cflfactorFluct = cfl0;
+    diag->maxKE = ke;
+    diag->valid = true;
+  }
+  u.makeState(uxzstate, uystate);
+}
+
+// The derivative of omega x utot in direction du, with the physical utot
+// and omega of the last evaluation; du' = d(du)/dy has no profile term
+void RotationalNL::linear(const FlowField& du_, FlowField& f) {
+  if (!physical_)
+    cferror("RotationalNL::linear : no nonlinear term evaluated to linearize about");
+  assert(du_.Nd() == 3 && sameGeometry(du_, utot_));
+  FlowField& du = const_cast<FlowField&>(du_);
+  const fieldstate xzstate = du.xzstate();
+  const fieldstate ystate = du.ystate();
+  du.makeSpectral();
+
+  const int Nx = du.Nx();
+  const int Ny = du.Ny();
+  const int Nz = du.Nz();
+  const int Nzpad = du.Nzpad();
+  const int Nplane = Nx*Nzpad;
+  const int Ncomp = Ny*Nplane;
+  if (!sameGeometry(dup_, du)) {
+    dup_.resize(Nx, Ny, Nz, 3, du.Lx(), du.Lz(), du.a(), du.b());
+    domega_.resize(Nx, Ny, Nz, 3, du.Lx(), du.Lz(), du.a(), du.b());
+  }
+
+  ydiffFast(du, dudy_);
+  curl(du, dudy_, domega_, 0);
+  {
+    const int N = du.rawDataLength();
+    const Real* ud = du.rawData();
+    Real* dp = dup_.rawData();
+#pragma omp parallel for
+    for (int n=0; n<N; ++n)
+      dp[n] = ud[n];
+  }
+  dup_.setState(Spectral, Spectral);
+  trans_->makePhysical(dup_);
+  trans_->makePhysical(domega_);
+
+  if (!sameGeometry(f, du))
+    f.resize(Nx, Ny, Nz, 3, du.Lx(), du.Lz(), du.a(), du.b());
+  f.setState(Physical, Physical);
+
+  const Real* ut = utot_.rawData();
+  const Real* wp = omega_.rawData();
+  const Real* vp = dup_.rawData();
+  const Real* dwp = domega_.rawData();
+  Real* fp = f.rawData();
+
+#pragma omp parallel for
+  for (int ny=0; ny<Ny; ++ny) {
+    for (int nx=0; nx<Nx; ++nx) {
+      const int o = ny*Nplane + nx*Nzpad;
+      const Real* U0 = ut + o;
+      const Real* U1 = ut + Ncomp + o;
+      const Real* U2 = ut + 2*Ncomp + o;
+      const Real* W0 = wp + o;
+      const Real* W1 = wp + Ncomp + o;
+      const Real* W2 = wp + 2*Ncomp + o;
+      const Real* v0 = vp + o;
+      const Real* v1 = vp + Ncomp + o;
+      const Real* v2 = vp + 2*Ncomp + o;
+      const Real* w0 = dwp + o;
+      const Real* w1 = dwp + Ncomp + o;
+      const Real* w2 = dwp + 2*Ncomp + o;
+      Real* f0 = fp + o;
+      Real* f1 = fp + Ncomp + o;
+      Real* f2 = fp + 2*Ncomp + o;
+#pragma omp simd
+      for (int nz=0; nz<Nz; ++nz) {
+	f0[nz] = w1[nz]*U2[nz] - w2[nz]*U1[nz] + W1[nz]*v2[nz] - W2[nz]*v1[nz];
+	f1[nz] = w2[nz]*U0[nz] - w0[nz]*U2[nz] + W2[nz]*v0[nz] - W0[nz]*v2[nz];
+	f2[nz] = w0[nz]*U1[nz] - w1[nz]*U0[nz] + W0[nz]*v1[nz] - W1[nz]*v0[nz];
+      }
+      for (int nz=Nz; nz<Nzpad; ++nz)
+	f0[nz] = f1[nz] = f2[nz] = 0.0;
+    }
+  }
+
+  trans_->makeSpectral(f);
+  du.makeState(xzstate, ystate);
+}
+
+void diagnose(const FlowField& u, const ChebyCoeff& Ubase, FlowDiagnostics& d) {
+  RotationalNL nl(u);
+  nl.diagnose(u, Ubase, d);
+}
+
+} //namespace channelflow
@@ -0,0 +1,97 @@
+// nonlinear.h: rotational nonlinear term with fused flow diagnostics
+
+#ifndef CHFLOW_EXT_NONLINEAR_H
+#define CHFLOW_EXT_NONLINEAR_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/chebyshev.h"
+#include "channelflow/flowfield.h"
+#include "ytransform.h"
+
+namespace channelflow {
+
+// Diagnostics of a velocity fluctuation u and total velocity utot = u + U(y) ex.
+// Norms are normalized as in diffops.h (divided by Lx Ly Lz).
+class FlowDiagnostics {
+public:
+  FlowDiagnostics();
+
+  Real t;            // time of the velocity field described
+  Real cflfactor;    // max |utot_i|/dx_i, same as CFLfactorFast(u,U)
+  Real cflfactorFluct;  // max |u_i|/dx_i, advection by u alone
+  Real L2Norm2[3];   // L2Norm2 of components u,v,w of u
+  Real energy;       // 1/2 L2Norm2(u)
+  Real maxKE;        // max of u.u over gridpoints, postproc's max_pointwise_ke
+  Real dissipation;  // L2Norm2(curl utot)
+  Real divNorm2;     // L2Norm2(div u)
+  bool valid;        // false until set
+};
+
+std::ostream& operator<<(std::ostream& os, const FlowDiagnostics& d);
+
+// RotationalNL evaluates the nonlinear term of navierstokesNL for the
+// Rotational method, f = (curl utot) x utot, and optionally the diagnostics
+// above on the way:
+//   * curl utot and div u are assembled in spectral space from u and du/dy,
+//     so their norms and the norms of u come from spectral sums
+//   * utot and curl utot are then transformed to physical space once, and
+//     the CFL maximum is taken in the same sweep that forms the product.
+// This replaces separate CFLfactor, L2Norm, divNorm and dissipation calls,
+// each of which would transform or differentiate u again.
+//
+// u must be a 3d field. f is returned in Spectral,Spectral. Equal to the
+// library's navierstokesNL to rounding error.
+//
+// After f is evaluated, utot and curl utot stay in physical space, and
+// linear() gives the tangent term about that u for any number of
+// perturbations du, at the cost of their own transforms only:
+//   f' = (curl du) x utot + (curl utot) x du.
+
+class RotationalNL {
+public:
+  RotationalNL();
+  RotationalNL(const FlowField& u);
+  RotationalNL(const RotationalNL& nl);
+  ~RotationalNL();
+
+  RotationalNL& operator=(const RotationalNL& nl);
+
+  // f = (curl utot) x utot; fill diag if it's nonzero. u in any state.
+  void operator()(const FlowField& u, const ChebyCoeff& Ubase, FlowField& f,
+		  FlowDiagnostics* diag=0);
+
+  // Diagnostics only, skipping the product
+  void diagnose(const FlowField& u, const ChebyCoeff& Ubase, FlowDiagnostics& d);
+
+  // f = derivative of the term at the u of the last operator() call, in
+  // direction du. du in any state.
+  void linear(const FlowField& du, FlowField& f);
+
+  // Allocate for u's grid and Ubase, linear() included, so that later calls
+  // on them build no FFTW plans
+  void reserve(const FlowField& u, const ChebyCoeff& Ubase);
+  void profile(const ChebyCoeff& Ubase);  // U_ and Uy_ of Ubase, ahead of a call
+
+private:
+  FlowField dudy_;   // du/dy, then du/dy + U'(y) ex
+  FlowField omega_;  // curl utot
+  FlowField utot_;   // u + U(y) ex
+  FlowField div_;    // div u
+  FlowField dup_;    // du of linear(), physical
+  FlowField domega_; // curl du, physical
+  ChebyCoeff Ubase_; // the Ubase of the last call, as given
+  ChebyCoeff U_;     // spectral Ubase_
+  ChebyCoeff Uy_;    // spectral Ubase_'
+  BatchedChebyTransform* trans_;
+  bool physical_;    // utot_ and omega_ physical, of the last u
+
+  void resize(const FlowField& u);
+  void eval(const FlowField& u, const ChebyCoeff& Ubase, FlowField* f,
+	    FlowDiagnostics* diag);
+};
+
+// The same diagnostics for a field on its own, e.g. an initial condition.
+void diagnose(const FlowField& u, const ChebyCoeff& Ubase, FlowDiagnostics& d);
+
+} //namespace channelflow
+#endif
@@ -0,0 +1,128 @@
+// packing.cpp: FlowFields as flat vectors of independent spectral coefficients
+
+#include "packing.h"
+#include "gridtables.h"
+
+using namespace std;
+
+namespace channelflow {
+
+static const Real sqrt2 = sqrt(2.0);
+
+SpectralPacking::SpectralPacking()
+  :
+  Nx_(0),
+  Ny_(0),
+  Nz_(0),
+  Nd_(0),
+  Mz_(0),
+  size_(0)
+{}
+
+SpectralPacking::SpectralPacking(const FlowField& u, bool dealias)
+  :
+  Nx_(u.Nx()),
+  Ny_(u.Ny()),
+  Nz_(u.Nz()),
+  Nd_(u.Nd()),
+  Mz_(u.Nz()/2 + 1),
+  size_(0)
+{
+  const GridTables& t = gridTables(u);
+  int Nmodes = 0, Nmirror = 0, Nzero = 0;
+  mode_.resize(Nx_*Mz_);
+  mirror_.resize(Nx_*Mz_);
+  zero_.resize(Nx_*Mz_);
+  for (int mx=0; mx<Nx_; ++mx) {
+    const int kx = t.kx(mx);
+    for (int mz=0; mz<Mz_; ++mz) {
+      const int m = mx*Mz_ + mz;
+      const bool free = abs(kx) < Nx_/2 && mz < Nz_/2 && !(dealias && t.isAliased(mx, mz));
+      if (free && mz == 0 && kx < 0)
+	mirror_[Nmirror++] = m;
+      else if (free)
+	mode_[Nmodes++] = m;
+      else
+	zero_[Nzero++] = m;
+    }
+  }
+  mode_.resize(Nmodes);
+  mirror_.resize(Nmirror);
+  zero_.resize(Nzero);
+  size_ = Nd_*Ny_*(2*Nmodes - 1);
+}
+
+int SpectralPacking::size() const {
+  return size_;
+}
+
+bool SpectralPacking::congruent(const FlowField& u) const {
+  return u.Nx() == Nx_ && u.Ny() == Ny_ && u.Nz() == Nz_ && u.Nd() == Nd_;
+}
+
+// Packed order: for each component and ny, Re u(0,0), then Re, Im of the
+// other modes
+void SpectralPacking::pack(const FlowField& u, Real* v) const {
+  assert(congruent(u));
+  assert(u.xzstate() == Spectral && u.ystate() == Spectral);
+  const Real* ud = u.rawData();
+  const int ystride = 2*Nx_*Mz_;
+  const int Nm = mode_.length();
+  const int line = 2*Nm - 1;
+
+#pragma omp parallel for schedule(static)
+  for (int l=0; l<Nd_*Ny_; ++l) {
+    const Real* ul = ud + l*ystride;
+    Real* vl = v + l*line;
+    vl[0] = ul[0];
+    for (int j=1; j<Nm; ++j) {
+      const int m = mode_[j];
+      const Real w = (m % Mz_ > 0) ? sqrt2 : 1.0;
+      vl[2*j-1] = w*ul[2*m];
+      vl[2*j]   = w*ul[2*m+1];
+    }
+  }
+}
+
+void SpectralPacking::unpack(const Real* v, FlowField& u) const {
+  assert(congruent(u));
+  u.setState(Spectral, Spectral);
+  Real* ud = u.rawData();
+  const int ystride = 2*Nx_*Mz_;
+  const int Nm = mode_.length();
+  const int line = 2*Nm - 1;
+
+#pragma omp parallel for schedule(static)
+  for (int l=0; l<Nd_*Ny_; ++l) {
+    Real* ul = ud + l*ystride;
+    const Real* vl = v + l*line;
+    ul[0] = vl[0];
+    ul[1] = 0.0;
+    for (int j=1; j<Nm; ++j) {
+      const int m = mode_[j];
+      const Real w = (m % Mz_ > 0) ? 1.0/sqrt2 : 1.0;
+      ul[2*m]   = w*vl[2*j-1];
+      ul[2*m+1] = w*vl[2*j];
+    }
+    for (int j=0; j<mirror_.length(); ++j) {
+      const int m = mirror_[j];
+      const int p = ((Nx_ - m/Mz_) % Nx_)*Mz_;
+      ul[2*m]   =  ul[2*p];
+      ul[2*m+1] = -ul[2*p+1];
+    }
+    for (int j=0; j<zero_.length(); ++j)
+      ul[2*zero_[j]] = ul[2*zero_[j]+1] = 0.0;
+  }
+}
+
+void SpectralPacking::pack(const FlowField& u, Vector& v, int offset) const {
+  assert(offset + size_ <= v.length());
+  pack(u, v.pointer() + offset);
+}
+
+void SpectralPacking::unpack(const Vector& v, FlowField& u, int offset) const {
+  assert(offset + size_ <= v.length());
+  unpack(v.pointer() + offset, u);
+}
+
+} //namespace channelflow
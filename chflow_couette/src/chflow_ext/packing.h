@@ -0,0 +1,53 @@
+// packing.h: FlowFields as flat vectors of independent spectral coefficients
+
+#ifndef CHFLOW_EXT_PACKING_H
+#define CHFLOW_EXT_PACKING_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "channelflow/vector.h"
+#include "channelflow/flowfield.h"
+
+namespace channelflow {
+
+// SpectralPacking maps the Spectral,Spectral coefficients of a real field
+// to a Real array and back, keeping only those a real field is free to
+// choose: modes with |kx| < Nx/2 and kz < Nz/2, for kz == 0 only kx >= 0,
+// and for kx == kz == 0 only the real parts. With dealias, aliased modes
+// (as GridTables::isAliased) are left out too. unpack fills the kz == 0,
+// kx < 0 modes by conjugation and zeroes the others left out.
+//
+// Coefficients of kz > 0 are scaled by sqrt(2), so that the Euclidean inner
+// product of packed vectors is the sum over the full spectrum, of both
+// halves, of the products of Chebyshev coefficients. Solvers working on the
+// vectors (GMRES, Arnoldi) then see the field's own geometry up to the
+// Chebyshev weights, without the redundancy of FlowField's storage.
+
+class SpectralPacking {
+public:
+  SpectralPacking();
+  SpectralPacking(const FlowField& u, bool dealias);
+
+  int size() const;  // length of a packed vector
+
+  void pack(const FlowField& u, Real* v) const;
+  void unpack(const Real* v, FlowField& u) const;
+  void pack(const FlowField& u, Vector& v, int offset=0) const;
+  void unpack(const Vector& v, FlowField& u, int offset=0) const;
+
+  bool congruent(const FlowField& u) const;
+
+private:
+  int Nx_;
+  int Ny_;
+  int Nz_;
+  int Nd_;
+  int Mz_;
+  int size_;
+  array<int> mode_;    // packed modes mx*Mz + mz, (0,0) first
+  array<int> mirror_;  // kz == 0, kx < 0 modes, filled from their kx > 0 partner
+  array<int> zero_;    // other modes left out
+};
+
+} //namespace channelflow
+#endif
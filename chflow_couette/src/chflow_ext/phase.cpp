@@ -0,0 +1,184 @@
+// phase.cpp: translations that optimize the symmetry of a field, by FFT
+
+#include <algorithm>
+#include "phase.h"
+#include "gridtables.h"
+
+using namespace std;
+
+namespace channelflow {
+
+// x - floor(x), into [0,1)
+static Real wrap(Real x) {
+  return x - floor(x);
+}
+
+PhaseOptimizer::PhaseOptimizer(const FieldSymmetry& s, const FlowField& u)
+  :
+  Nx_(u.Nx()),
+  Ny_(u.Ny()),
+  Nz_(u.Nz()),
+  Mz_(u.Nz()/2 + 1),
+  s_(s, u.Nx(), u.Nz()),
+  su_(u.Nx(), u.Ny(), u.Nz(), u.Nd(), u.Lx(), u.Lz(), u.a(), u.b()),
+  px_(u.Nx()*(u.Nz()/2 + 1)),
+  pz_(u.Nx()*(u.Nz()/2 + 1)),
+  D_(u.Nx()*(u.Nz()/2 + 1)),
+  residual_(0.0),
+  in_(0),
+  out_(0),
+  plan_(0)
+{
+  // Frequencies of C in (thx,thz); modes without a source and the Nyquist
+  // modes don't contribute
+  for (int mx=0; mx<Nx_; ++mx) {
+    const int kx = (mx <= Nx_/2) ? mx : mx - Nx_;
+    for (int mz=0; mz<Mz_; ++mz) {
+      const int m = mx*Mz_ + mz;
+      const bool used = s_.source(m) >= 0 && kx != Nx_/2 && mz != Nz_/2;
+      px_[m] = (used && s.sx() == -1) ? kx : 0;
+      pz_[m] = (used && s.sz() == -1) ? mz : 0;
+    }
+  }
+
+  in_ = (Complex*) fftw_malloc(Nx_*Mz_*sizeof(Complex));
+  out_ = (Real*) fftw_malloc(Nx_*Nz_*sizeof(Real));
+  plan_ = fftw_plan_dft_c2r_2d(Nx_, Nz_, (fftw_complex*) in_, out_, FFTW_ESTIMATE);
+}
+
+PhaseOptimizer::~PhaseOptimizer() {
+  fftw_destroy_plan(plan_);
+  fftw_free(in_);
+  fftw_free(out_);
+}
+
+Real PhaseOptimizer::residual() const {
+  return residual_;
+}
+
+Real PhaseOptimizer::correlation(Real thx, Real thz, Real* g, Real* H) const {
+  Real C = 0.0;
+  Real gx = 0.0, gz = 0.0, Hxx = 0.0, Hxz = 0.0, Hzz = 0.0;
+  for (int m=0; m<D_.length(); ++m) {
+    const Real phi = 2*pi*(px_[m]*thx + pz_[m]*thz);
+    const Complex e = D_[m]*Complex(cos(phi), sin(phi));
+    const Real qx = 2*pi*px_[m];
+    const Real qz = 2*pi*pz_[m];
+    C += e.real();
+    gx -= qx*e.imag();
+    gz -= qz*e.imag();
+    Hxx -= qx*qx*e.real();
+    Hxz -= qx*qz*e.real();
+    Hzz -= qz*qz*e.real();
+  }
+  if (g) {
+    g[0] = gx;
+    g[1] = gz;
+  }
+  if (H) {
+    H[0] = Hxx;
+    H[1] = Hxz;
+    H[2] = Hzz;
+  }
+  return C;
+}
+
+FieldSymmetry PhaseOptimizer::operator()(const FlowField& u, int Nsteps, Real residual) {
+  assert(u.xzstate() == Spectral && u.ystate() == Spectral);
+  assert(u.Nx() == Nx_ && u.Ny() == Ny_ && u.Nz() == Nz_);
+  const FieldSymmetry& s = s_.symmetry();
+  const int Nd = u.Nd();
+  const int Ny = Ny_;
+  const int ystride = 2*Nx_*Mz_;
+  const int istride = Ny*ystride;
+
+  su_ = u;
+  s_(su_);
+  const Real* ud = u.rawData();
+  const Real* sd = su_.rawData();
+  const Real* W = gridTables(u).chebyIP();
+
+  // D_k = <(s u)_k, u_k> and |u|^2, both over the full spectrum
+  Real norm2 = 0.0;
+#pragma omp parallel for schedule(static) reduction(+:norm2)
+  for (int m=0; m<Nx_*Mz_; ++m) {
+    const int mx = m / Mz_;
+    const int mz = m % Mz_;
+    const int kx = (mx <= Nx_/2) ? mx : mx - Nx_;
+    const Real w = (mz > 0) ? 2.0 : 1.0;
+    Complex D = 0.0;
+    Real n2 = 0.0;
+    for (int i=0; i<Nd; ++i)
+      for (int a=0; a<Ny; ++a) {
+	const Complex ua(ud[2*m + a*ystride + i*istride], ud[2*m + a*ystride + i*istride + 1]);
+	const Complex sa(sd[2*m + a*ystride + i*istride], sd[2*m + a*ystride + i*istride + 1]);
+	Complex Wu = 0.0;
+	for (int b=a%2; b<Ny; b+=2)
+	  Wu += W[a*Ny + b]*Complex(ud[2*m + b*ystride + i*istride],
+				    ud[2*m + b*ystride + i*istride + 1]);
+	D += conj(sa)*Wu;
+	n2 += (conj(ua)*Wu).real();
+      }
+    const bool used = s_.source(m) >= 0 && kx != Nx_/2 && mz != Nz_/2;
+    D_[m] = used ? w*D : Complex(0.0, 0.0);
+    norm2 += w*n2;
+  }
+
+  // C on the Nx x Nz grid of (thx,thz); the c2r transform doubles pz > 0
+  std::fill(in_, in_ + Nx_*Mz_, Complex(0.0, 0.0));
+  for (int m=0; m<D_.length(); ++m) {
+    const int jx = (px_[m] >= 0) ? px_[m] : px_[m] + Nx_;
+    in_[jx*Mz_ + pz_[m]] += (pz_[m] > 0) ? 0.5*D_[m] : D_[m];
+  }
+  fftw_execute(plan_);
+  int jmax = 0;
+  for (int j=1; j<Nx_*Nz_; ++j)
+    if (out_[j] > out_[jmax])
+      jmax = j;
+  Real thx = Real(jmax / Nz_)/Nx_;
+  Real thz = Real(jmax % Nz_)/Nz_;
+
+  // Newton steps in the reflected directions, while C is concave
+  const bool dx = s.sx() == -1;
+  const bool dz = s.sz() == -1;
+  Real C = correlation(thx, thz, 0, 0);
+  for (int n=0; n<Nsteps && (dx || dz); ++n) {
+    Real g[2], H[3];
+    correlation(thx, thz, g, H);
+    Real stepx = 0.0, stepz = 0.0;
+    if (dx && dz) {
+      const Real det = H[0]*H[2] - H[1]*H[1];
+      if (H[0] >= 0.0 || det <= 0.0)
+	break;
+      stepx = -( H[2]*g[0] - H[1]*g[1])/det;
+      stepz = -(-H[1]*g[0] + H[0]*g[1])/det;
+    }
+    else if (dx) {
+      if (H[0] >= 0.0)
+	break;
+      stepx = -g[0]/H[0];
+    }
+    else {
+      if (H[2] >= 0.0)
+	break;
+      stepz = -g[1]/H[2];
+    }
+    thx += stepx;
+    thz += stepz;
+    C = correlation(thx, thz, 0, 0);
+    if (fabs(stepx) + fabs(stepz) < residual)
+      break;
+  }
+
+  const Real r2 = (norm2 > 0.0) ? 2.0 - 2.0*C/norm2 : 0.0;
+  residual_ = sqrt(r2 > 0.0 ? r2 : 0.0);
+  return FieldSymmetry(dx ? 0.5*wrap(thx) : 0.0, dz ? 0.5*wrap(thz) : 0.0);
+}
+
+FieldSymmetry optimizePhaseFFT(const FlowField& u, const FieldSymmetry& s,
+			       int Nsteps, Real residual) {
+  PhaseOptimizer p(s, u);
+  return p(u, Nsteps, residual);
+}
+
+} //namespace channelflow
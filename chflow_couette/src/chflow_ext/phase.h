@@ -0,0 +1,74 @@
+// phase.h: translations that optimize the symmetry of a field, by FFT
+
+#ifndef CHFLOW_EXT_PHASE_H
+#define CHFLOW_EXT_PHASE_H
+
+#include <fftw3.h>
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "channelflow/flowfield.h"
+#include "channelflow/symmetry.h"
+#include "symmetry.h"
+
+namespace channelflow {
+
+// PhaseOptimizer finds the translation tau that minimizes
+// L2Norm(s(tau(u)) - tau(u)), as the library's optimizePhase does, without
+// probing the field. Since s and tau preserve norms, that is the maximum of
+// the correlation
+//
+//   C(tau) = Re <s(tau(u)), tau(u)> = Re sum_k D_k e^{2 pi i q_k . t}
+//
+// with D_k = <(s u)_k, u_k> the y inner product of mode k of s(u) and u, and
+// q_k = ((1 - sx) kx, (1 - sz) kz). So C over all shifts t = (ax,az) is one
+// inverse 2-D FFT of the D_k, binned at (kx,kz) in the reflected directions.
+// The largest sample is refined by Newton steps on the trigonometric sum
+// itself, which costs O(Mx Mz) per step.
+//
+// C has period 1/2 in ax if sx == -1 and does not depend on ax if sx == 1;
+// likewise in z. The translation returned has ax, az in [0, 1/2), or 0 in
+// a direction s does not reflect. One PhaseOptimizer per symmetry and grid
+// keeps its FFT plan and buffers for repeated calls, e.g. in tracking a
+// travelling wave; u must be Spectral,Spectral.
+
+class PhaseOptimizer {
+public:
+  PhaseOptimizer(const FieldSymmetry& s, const FlowField& u);
+  ~PhaseOptimizer();
+
+  // The optimal translation of u, after at most Nsteps Newton steps that
+  // stop when the step in ax, az is below residual
+  FieldSymmetry operator()(const FlowField& u, int Nsteps=10, Real residual=1e-13);
+
+  // L2Norm(s(tau(u)) - tau(u))/L2Norm(u) at the last optimum
+  Real residual() const;
+
+private:
+  PhaseOptimizer(const PhaseOptimizer& p);             // unimplemented
+  PhaseOptimizer& operator=(const PhaseOptimizer& p);  // unimplemented
+
+  int Nx_;
+  int Ny_;
+  int Nz_;
+  int Mz_;
+  SpectralSymmetry s_;
+  FlowField su_;         // s(u)
+  array<int> px_;        // frequency of D_k in thx (kx or 0)
+  array<int> pz_;        // frequency of D_k in thz (kz or 0)
+  array<Complex> D_;     // w_k D_k, w_k = 2 for kz > 0, 0 for unused modes
+  Real residual_;
+
+  Complex* in_;          // Nx x (Nz/2+1), binned D_k
+  Real* out_;            // Nx x Nz, samples of C
+  fftw_plan plan_;
+
+  // C at (thx,thz) = 2 (ax,az), with gradient and Hessian
+  Real correlation(Real thx, Real thz, Real* g, Real* H) const;
+};
+
+// optimizePhase by a PhaseOptimizer constructed for the call
+FieldSymmetry optimizePhaseFFT(const FlowField& u, const FieldSymmetry& s,
+			       int Nsteps=10, Real residual=1e-13);
+
+} //namespace channelflow
+#endif
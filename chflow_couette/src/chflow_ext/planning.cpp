@@ -0,0 +1,19 @@
+// planning.cpp: FFTW planning from concurrent threads
+
+#include <fftw3.h>
+#include "planning.h"
+
+namespace channelflow {
+
+namespace {
+struct PlannerLock {
+  PlannerLock() { fftw_make_planner_thread_safe(); }
+};
+}
+
+void threadSafePlanning() {
+  static PlannerLock lock;  // initialized once, even from concurrent callers
+  (void)lock;
+}
+
+} //namespace channelflow
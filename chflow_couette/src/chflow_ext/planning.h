@@ -0,0 +1,21 @@
+// planning.h: FFTW planning from concurrent threads
+
+#ifndef CHFLOW_EXT_PLANNING_H
+#define CHFLOW_EXT_PLANNING_H
+
+namespace channelflow {
+
+// FlowField and the DNS algorithms of the channelflow library make FFTW
+// plans as they are constructed and copied, and DNSExt builds algorithms on
+// every reset_dt. FFTW's planner is not thread-safe, but from FFTW 3.3.5 on,
+// libfftw3_threads can serialize it with a lock around every plan creation
+// and destruction, so that integrators may step on concurrent threads
+// whatever their algorithm. Executing plans needs no lock.
+//
+// threadSafePlanning() installs that lock. It must be called before the
+// first concurrent region; further calls do nothing.
+
+void threadSafePlanning();
+
+} //namespace channelflow
+#endif
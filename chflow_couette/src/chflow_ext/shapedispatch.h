@@ -0,0 +1,62 @@
+// shapedispatch.h: run kernels specialised for common (Nd, Ny) field shapes
+
+#ifndef CHFLOW_EXT_SHAPEDISPATCH_H
+#define CHFLOW_EXT_SHAPEDISPATCH_H
+
+namespace channelflow {
+
+// Nearly all fields we integrate have Nd = 1 (pressure, scalars), 3
+// (velocity) or 9 (velocity gradients) and Ny = 33, with Ny = 17 and 65 for
+// resolution checks. A kernel written as
+//
+//   template <int ND, int NY> struct MyKernel {
+//     static void run(MyArgs& a) {
+//       const int Nd = ND ? ND : a.Nd;   // compile-time unless ND == 0
+//       const int Ny = NY ? NY : a.Ny;
+//       ...
+//     }
+//   };
+//
+// and called through dispatchShape<MyKernel>(Nd, Ny, args) gets constant
+// trip counts for component loops and Chebyshev recurrences in those
+// shapes, so the compiler unrolls them. Any other shape runs the generic
+// instantiation MyKernel<0,0>, which reads the bounds from its arguments.
+
+template <template <int, int> class Kernel, int NY, class Args>
+inline void dispatchNd(int Nd, Args& args) {
+  switch (Nd) {
+  case 1:
+    Kernel<1,NY>::run(args);
+    return;
+  case 3:
+    Kernel<3,NY>::run(args);
+    return;
+  case 9:
+    Kernel<9,NY>::run(args);
+    return;
+  default:
+    Kernel<0,0>::run(args);
+    return;
+  }
+}
+
+template <template <int, int> class Kernel, class Args>
+inline void dispatchShape(int Nd, int Ny, Args& args) {
+  switch (Ny) {
+  case 17:
+    dispatchNd<Kernel,17>(Nd, args);
+    return;
+  case 33:
+    dispatchNd<Kernel,33>(Nd, args);
+    return;
+  case 65:
+    dispatchNd<Kernel,65>(Nd, args);
+    return;
+  default:
+    Kernel<0,0>::run(args);
+    return;
+  }
+}
+
+} //namespace channelflow
+#endif
@@ -0,0 +1,576 @@
+// solutions.cpp: invariant solutions of the DNS as Newton problems
+
+#include <cstring>
+#include <omp.h>
+#include "channelflow/diffops.h"
+#include "solutions.h"
+#include "planning.h"
+
+using namespace std;
+
+namespace channelflow {
+
+/**************************************************************************
+ * EquilibriumProblem
+ **************************************************************************/
+
+EquilibriumProblem::EquilibriumProblem(const FlowField& u, Real nu, Real T, Real dt,
+				       const DNSExtFlags& flags, bool xrel, bool zrel)
+  :
+  dns_(0),
+  tangent_(0),
+  dt_(T/iround(T/dt)),
+  Nsteps_(iround(T/dt)),
+  xrel_(xrel),
+  zrel_(zrel),
+  evaluations_(0),
+  packing_(u, flags.dealias_xz()),
+  projector_(flags.symmetries, u.Nx(), u.Nz()),
+  u_(u),
+  q_(u.Nx(), u.Ny(), u.Nz(), 1, u.Lx(), u.Lz(), u.a(), u.b())
+{
+  if (Nsteps_ < 1 || fabs(Nsteps_*dt - T) > 1e-6*T)
+    cferror("EquilibriumProblem: T must be a positive multiple of dt");
+  u_.makeSpectral();
+  if (flags.lowStorageRK && flags.etdOrder == 0) {
+    const ChebyCoeff Ubase = baseflowProfile(flags.baseflow, u.Ny(), u.a(), u.b());
+    tangent_ = new TangentDNS(u_, Ubase, nu, dt_, flags);
+    dut_.resize(1);
+  }
+  else
+    dns_ = new DNSExt(u_, nu, dt_, flags);
+}
+
+EquilibriumProblem::~EquilibriumProblem() {
+  delete dns_;
+  delete tangent_;
+}
+
+int EquilibriumProblem::size() const {
+  return packing_.size() + xrel_ + zrel_;
+}
+
+int EquilibriumProblem::evaluations() const {
+  return evaluations_;
+}
+
+const SpectralPacking& EquilibriumProblem::packing() const {
+  return packing_;
+}
+
+void EquilibriumProblem::toVector(const FlowField& u, Real ax, Real az, Vector& x) const {
+  x.resize(size());
+  FlowField v(u);
+  v.makeSpectral();
+  projector_(v);
+  packing_.pack(v, x);
+  int n = packing_.size();
+  if (xrel_)
+    x[n++] = ax;
+  if (zrel_)
+    x[n++] = az;
+}
+
+void EquilibriumProblem::toField(const Vector& x, FlowField& u, Real& ax, Real& az) const {
+  u = u_;
+  packing_.unpack(x, u);
+  projector_(u);
+  int n = packing_.size();
+  ax = xrel_ ? x[n++] : 0.0;
+  az = zrel_ ? x[n++] : 0.0;
+}
+
+// Restarting at t = 0 with the same dt makes f^T the same map on every call
+void EquilibriumProblem::flow(FlowField& u) {
+  if (tangent_) {
+    tangent_->reset_time(0.0);
+    tangent_->advance(u, q_, Nsteps_);
+  }
+  else {
+    dns_->reset_dt(dt_);
+    dns_->reset_time(0.0);
+    dns_->advance(u, q_, Nsteps_);
+  }
+  u.makeSpectral();
+  ++evaluations_;
+}
+
+void EquilibriumProblem::residual(const Vector& x, Vector& G) {
+  Real ax, az;
+  toField(x, u_, ax, az);
+  flow(u_);
+  if (xrel_ || zrel_)
+    u_ *= FieldSymmetry(ax, az);
+
+  G.resize(size());
+  packing_.pack(u_, G);
+  const int Nu = packing_.size();
+  Real* g = G.pointer();
+  const Real* xu = x.pointer();
+#pragma omp parallel for schedule(static)
+  for (int n=0; n<Nu; ++n)
+    g[n] -= xu[n];
+  for (int n=Nu; n<size(); ++n)
+    g[n] = 0.0;
+}
+
+void EquilibriumProblem::jacobian(const Vector& x, const Vector& Gx, const Vector& dx,
+				  Vector& dG) {
+  if (!tangent_) {
+    NewtonProblem::jacobian(x, Gx, dx, dG);
+    if (xrel_ || zrel_) {
+      Real ax, az;
+      toField(x, u_, ax, az);
+      phaseConditions(dx, dG);
+    }
+    return;
+  }
+
+  // D(tau f^T)(u) du - du + dax d/dax (tau f^T(u)) + daz d/daz (tau f^T(u))
+  Real ax, az, dax, daz;
+  if (dut_.length() != 1)
+    dut_.resize(1);
+  toField(x, u_, ax, az);
+  toField(dx, dut_[0], dax, daz);
+  dG.resize(size());
+  phaseConditions(dx, dG);
+
+  tangent_->reset_time(0.0);
+  tangent_->advance(u_, q_, dut_, Nsteps_);
+  ++evaluations_;
+  FlowField& du = dut_[0];
+  du.makeSpectral();
+  u_.makeSpectral();
+  if (xrel_ || zrel_) {
+    const FieldSymmetry tau(ax, az);
+    u_ *= tau;
+    du *= tau;
+  }
+  packing_.pack(du, dG);
+
+  // tau(ax,az) u(x,z) = u(x + ax Lx, z + az Lz)
+  const int Nu = packing_.size();
+  const Real shift[2] = {dax*u_.Lx(), daz*u_.Lz()};
+  for (int d=0; d<2; ++d) {
+    if ((d == 0 && !xrel_) || (d == 1 && !zrel_))
+      continue;
+    if (d == 0)
+      xdiff(u_, du_);
+    else
+      zdiff(u_, du_);
+    ud_.resize(size());
+    packing_.pack(du_, ud_);
+    Real* g = dG.pointer();
+    const Real* p = ud_.pointer();
+    const Real c = shift[d];
+#pragma omp parallel for schedule(static)
+    for (int n=0; n<Nu; ++n)
+      g[n] += c*p[n];
+  }
+
+  Real* g = dG.pointer();
+  const Real* dxu = dx.pointer();
+#pragma omp parallel for schedule(static)
+  for (int n=0; n<Nu; ++n)
+    g[n] -= dxu[n];
+}
+
+void EquilibriumProblem::tangentMap(const Vector& x, int n, const Vector* const* du,
+				    Vector* const* dy) {
+  Real ax, az;
+  toField(x, u_, ax, az);
+  const FieldSymmetry tau(ax, az);
+  const int Nu = packing_.size();
+  if (dut_.length() != n)
+    dut_.resize(n);
+  for (int j=0; j<n; ++j) {
+    dut_[j] = u_;
+    packing_.unpack(*du[j], dut_[j]);
+    projector_(dut_[j]);
+  }
+
+  if (tangent_) {
+    tangent_->reset_time(0.0);
+    tangent_->advance(u_, q_, dut_, Nsteps_);
+    ++evaluations_;
+  }
+  else {
+    // (f^T(u + eps du) - f^T(u))/eps with |eps du| == epsDx
+    FlowField u0(u_);
+    for (int j=0; j<n; ++j) {
+      const Real eps = epsDx/sqrt(dot(*du[j], *du[j]));
+      FlowField& v = dut_[j];
+      v *= eps;
+      v += u0;
+      flow(v);
+    }
+    flow(u_);
+    for (int j=0; j<n; ++j) {
+      dut_[j] -= u_;
+      dut_[j] *= sqrt(dot(*du[j], *du[j]))/epsDx;
+    }
+  }
+
+  for (int j=0; j<n; ++j) {
+    FlowField& v = dut_[j];
+    v.makeSpectral();
+    if (xrel_ || zrel_)
+      v *= tau;
+    dy[j]->resize(Nu);
+    packing_.pack(v, *dy[j]);
+  }
+}
+
+// Phase conditions <du, d/dx u> and <du, d/dz u> at the current u
+void EquilibriumProblem::phaseConditions(const Vector& dx, Vector& dG) {
+  const int Nu = packing_.size();
+  int n = Nu;
+  for (int d=0; d<2; ++d) {
+    if ((d == 0 && !xrel_) || (d == 1 && !zrel_))
+      continue;
+    if (d == 0)
+      xdiff(u_, du_);
+    else
+      zdiff(u_, du_);
+    ud_.resize(size());
+    ud_.setToZero();
+    packing_.pack(du_, ud_);
+    dG[n++] = dot(ud_, dx);
+  }
+}
+
+/**************************************************************************
+ * PeriodicOrbitProblem
+ **************************************************************************/
+
+// <a, b> over N elements
+static Real innerProduct(const Real* a, const Real* b, int N) {
+  Real s = 0.0;
+#pragma omp parallel for schedule(static) reduction(+:s)
+  for (int n=0; n<N; ++n)
+    s += a[n]*b[n];
+  return s;
+}
+
+PeriodicOrbitProblem::PeriodicOrbitProblem(const FlowField& u, Real nu, Real T, Real dt,
+					   int M, const DNSExtFlags& flags, bool xrel,
+					   bool zrel)
+  :
+  M_(M),
+  Nsteps_(M > 0 ? iround(T/(M*dt)) : 0),
+  T_(T),
+  xrel_(xrel),
+  zrel_(zrel),
+  evaluations_(0),
+  packing_(u, flags.dealias_xz()),
+  projector_(flags.symmetries, u.Nx(), u.Nz()),
+  dns_(M),
+  tangent_(M),
+  u_(M),
+  q_(M),
+  du_(M)
+{
+  if (M < 1 || T <= 0.0)
+    cferror("PeriodicOrbitProblem: needs T > 0 and at least one segment");
+  if (Nsteps_ < 1)
+    Nsteps_ = 1;
+  threadSafePlanning();
+  FlowField v(u);
+  v.makeSpectral();
+  projector_(v);
+  const bool exact = flags.lowStorageRK && flags.etdOrder == 0;
+  ChebyCoeff Ubase;
+  if (exact)
+    Ubase = baseflowProfile(flags.baseflow, u.Ny(), u.a(), u.b());
+
+  // Everything a segment allocates is allocated here, before any threads
+  for (int m=0; m<M_; ++m) {
+    dns_[m] = 0;
+    tangent_[m] = 0;
+    u_[m] = v;
+    q_[m] = FlowField(u.Nx(), u.Ny(), u.Nz(), 1, u.Lx(), u.Lz(), u.a(), u.b());
+    if (exact) {
+      tangent_[m] = new TangentDNS(v, Ubase, nu, this->dt(T), flags);
+      tangent_[m]->reserve(v, 1);
+      du_[m].resize(1);
+      du_[m][0] = v;
+    }
+    else
+      dns_[m] = new DNSExt(v, nu, this->dt(T), flags);
+  }
+  du0_ = v;
+  pd_.resize(packing_.size());
+}
+
+PeriodicOrbitProblem::~PeriodicOrbitProblem() {
+  for (int m=0; m<M_; ++m) {
+    delete dns_[m];
+    delete tangent_[m];
+  }
+}
+
+int PeriodicOrbitProblem::size() const {
+  return M_*packing_.size() + 1 + xrel_ + zrel_;
+}
+
+int PeriodicOrbitProblem::segments() const {
+  return M_;
+}
+
+Real PeriodicOrbitProblem::dt(Real T) const {
+  return T/(M_*Nsteps_);
+}
+
+int PeriodicOrbitProblem::evaluations() const {
+  return evaluations_;
+}
+
+const SpectralPacking& PeriodicOrbitProblem::packing() const {
+  return packing_;
+}
+
+void PeriodicOrbitProblem::toVector(const FlowField& u, Real T, Real ax, Real az,
+				    Vector& x) {
+  const int Nu = packing_.size();
+  x.resize(size());
+  setPeriod(T);
+  FlowField v(u);
+  v.makeSpectral();
+  projector_(v);
+  for (int m=0; m<M_; ++m) {
+    packing_.pack(v, x, m*Nu);
+    if (m < M_-1)
+      segment(0, v, 0);
+  }
+  int n = M_*Nu;
+  x[n++] = T;
+  if (xrel_)
+    x[n++] = ax;
+  if (zrel_)
+    x[n++] = az;
+}
+
+void PeriodicOrbitProblem::toField(const Vector& x, int m, FlowField& u) const {
+  u = u_[m];
+  unpack(x, m, u);
+}
+
+void PeriodicOrbitProblem::parameters(const Vector& x, Real& T, Real& ax, Real& az) const {
+  int n = M_*packing_.size();
+  T = x[n++];
+  ax = xrel_ ? x[n++] : 0.0;
+  az = zrel_ ? x[n++] : 0.0;
+}
+
+void PeriodicOrbitProblem::unpack(const Vector& x, int m, FlowField& u) const {
+  packing_.unpack(x, u, m*packing_.size());
+  projector_(u);
+}
+
+// The step count is fixed, so dt follows T; refactoring the TangentDNS
+// solvers builds no plans but is serial, and skipped while T is unchanged
+void PeriodicOrbitProblem::setPeriod(Real T) {
+  if (T <= 0.0)
+    cferror("PeriodicOrbitProblem: period T <= 0");
+  if (T == T_)
+    return;
+  T_ = T;
+  for (int m=0; m<M_; ++m)
+    if (tangent_[m])
+      tangent_[m]->reset_dt(dt(T));
+}
+
+// Restarting at t = 0 makes f^{T/M} the same map on every call
+void PeriodicOrbitProblem::segment(int m, FlowField& u, array<FlowField>* du) {
+  if (tangent_[m]) {
+    tangent_[m]->reset_time(0.0);
+    if (du)
+      tangent_[m]->advance(u, q_[m], *du, Nsteps_);
+    else
+      tangent_[m]->advance(u, q_[m], Nsteps_);
+  }
+  else {
+    dns_[m]->reset_dt(dt(T_));
+    dns_[m]->reset_time(0.0);
+    dns_[m]->advance(u, q_[m], Nsteps_);
+  }
+  u.makeSpectral();
+}
+
+// Segments run on their own threads, each with an equal share of the rest
+// for its inner loops. Reserved TangentDNS step without building FFTW plans;
+// DNSExt builds them on every reset_dt, under the lock of
+// threadSafePlanning.
+void PeriodicOrbitProblem::flow(bool tangents) {
+  const int inner = max(1, omp_get_max_threads()/M_);
+  const int levels = omp_get_max_active_levels();
+  if (inner > 1)
+    omp_set_max_active_levels(2);
+#pragma omp parallel for schedule(static,1) num_threads(M_)
+  for (int m=0; m<M_; ++m) {
+    omp_set_num_threads(inner);
+    segment(m, u_[m], tangents ? &du_[m] : 0);
+  }
+  omp_set_max_active_levels(levels);
+  ++evaluations_;
+}
+
+void PeriodicOrbitProblem::residual(const Vector& x, Vector& G) {
+  Real T, ax, az;
+  parameters(x, T, ax, az);
+  setPeriod(T);
+  for (int m=0; m<M_; ++m)
+    unpack(x, m, u_[m]);
+  flow(false);
+  if (xrel_ || zrel_)
+    u_[M_-1] *= FieldSymmetry(ax, az);
+
+  // G_m = f(u_m) - u_{m+1}, cyclically
+  const int Nu = packing_.size();
+  const int N = M_*Nu;
+  G.resize(size());
+  for (int m=0; m<M_; ++m)
+    packing_.pack(u_[m], G, m*Nu);
+  Real* g = G.pointer();
+  const Real* xu = x.pointer();
+#pragma omp parallel for schedule(static)
+  for (int n=0; n<N; ++n)
+    g[n] -= xu[(n + Nu) % N];
+  for (int n=N; n<size(); ++n)
+    g[n] = 0.0;
+}
+
+// GT_ = (G(x + dT eT) - Gx)/dT in the u rows, for the T column and the time
+// phase condition; kept for the Newton step's GMRES iterations at this x
+void PeriodicOrbitProblem::periodColumn(const Vector& x, const Vector& Gx) {
+  if (xT_.length() == x.length()
+      && memcmp(xT_.pointer(), x.pointer(), x.length()*sizeof(Real)) == 0)
+    return;
+  Real T, ax, az;
+  parameters(x, T, ax, az);
+  const Real dT = epsDx*T;
+  setPeriod(T + dT);
+  for (int m=0; m<M_; ++m)
+    unpack(x, m, u_[m]);
+  flow(false);
+  setPeriod(T);
+  if (xrel_ || zrel_)
+    u_[M_-1] *= FieldSymmetry(ax, az);
+
+  const int Nu = packing_.size();
+  const int N = M_*Nu;
+  GT_.resize(size());
+  for (int m=0; m<M_; ++m)
+    packing_.pack(u_[m], GT_, m*Nu);
+  Real* g = GT_.pointer();
+  const Real* gx = Gx.pointer();
+  const Real* xu = x.pointer();
+#pragma omp parallel for schedule(static)
+  for (int n=0; n<N; ++n)
+    g[n] = (g[n] - xu[(n + Nu) % N] - gx[n])/dT;
+  for (int n=N; n<size(); ++n)
+    g[n] = 0.0;
+  xT_ = x;
+}
+
+void PeriodicOrbitProblem::jacobian(const Vector& x, const Vector& Gx, const Vector& dx,
+				    Vector& dG) {
+  periodColumn(x, Gx);
+  if (!tangent_[0]) {
+    NewtonProblem::jacobian(x, Gx, dx, dG);
+    phaseConditions(x, dx, dG);
+    return;
+  }
+
+  // D f(u_m) du_m - du_{m+1} + dT d/dT G_m, and for the last segment the
+  // derivatives of tau(ax,az) as in EquilibriumProblem
+  Real T, ax, az, dT, dax, daz;
+  parameters(x, T, ax, az);
+  parameters(dx, dT, dax, daz);
+  setPeriod(T);
+  for (int m=0; m<M_; ++m) {
+    unpack(x, m, u_[m]);
+    unpack(dx, m, du_[m][0]);
+  }
+  flow(true);
+  FlowField& u = u_[M_-1];
+  FlowField& du = du_[M_-1][0];
+  if (xrel_ || zrel_) {
+    const FieldSymmetry tau(ax, az);
+    u *= tau;
+    du *= tau;
+  }
+
+  const int Nu = packing_.size();
+  const int N = M_*Nu;
+  dG.resize(size());
+  for (int m=0; m<M_; ++m)
+    packing_.pack(du_[m][0], dG, m*Nu);
+
+  // tau(ax,az) u(x,z) = u(x + ax Lx, z + az Lz)
+  const Real shift[2] = {dax*u.Lx(), daz*u.Lz()};
+  for (int d=0; d<2; ++d) {
+    if ((d == 0 && !xrel_) || (d == 1 && !zrel_))
+      continue;
+    if (d == 0)
+      xdiff(u, du0_);
+    else
+      zdiff(u, du0_);
+    packing_.pack(du0_, pd_);
+    Real* g = dG.pointer() + (M_-1)*Nu;
+    const Real* p = pd_.pointer();
+    const Real c = shift[d];
+#pragma omp parallel for schedule(static)
+    for (int n=0; n<Nu; ++n)
+      g[n] += c*p[n];
+  }
+
+  Real* g = dG.pointer();
+  const Real* gT = GT_.pointer();
+  const Real* dxu = dx.pointer();
+#pragma omp parallel for schedule(static)
+  for (int n=0; n<N; ++n)
+    g[n] += dT*gT[n] - dxu[(n + Nu) % N];
+  phaseConditions(x, dx, dG);
+}
+
+// <du_0, d/dT G_{M-1}>, near <du_0, du_0/dt>/M, and <du_0, d/dx u_0>,
+// <du_0, d/dz u_0>
+void PeriodicOrbitProblem::phaseConditions(const Vector& x, const Vector& dx, Vector& dG) {
+  const int Nu = packing_.size();
+  int n = M_*Nu;
+  dG[n++] = innerProduct(dx.pointer(), GT_.pointer() + (M_-1)*Nu, Nu);
+  if (!xrel_ && !zrel_)
+    return;
+  unpack(x, 0, u_[0]);
+  for (int d=0; d<2; ++d) {
+    if ((d == 0 && !xrel_) || (d == 1 && !zrel_))
+      continue;
+    if (d == 0)
+      xdiff(u_[0], du0_);
+    else
+      zdiff(u_[0], du0_);
+    packing_.pack(du0_, pd_);
+    dG[n++] = innerProduct(dx.pointer(), pd_.pointer(), Nu);
+  }
+}
+
+/**************************************************************************
+ * LinearizedMap
+ **************************************************************************/
+
+LinearizedMap::LinearizedMap(EquilibriumProblem& p, const Vector& x)
+  :
+  p_(p),
+  x_(x)
+{}
+
+int LinearizedMap::size() const {
+  return p_.packing().size();
+}
+
+void LinearizedMap::apply(int n, const Vector* const* du, Vector* const* dy) {
+  p_.tangentMap(x_, n, du, dy);
+}
+
+} //namespace channelflow
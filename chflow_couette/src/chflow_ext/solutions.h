@@ -0,0 +1,176 @@
+// solutions.h: invariant solutions of the DNS as Newton problems
+
+#ifndef CHFLOW_EXT_SOLUTIONS_H
+#define CHFLOW_EXT_SOLUTIONS_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/vector.h"
+#include "channelflow/flowfield.h"
+#include "channelflow/symmetry.h"
+#include "dnsext.h"
+#include "tangent.h"
+#include "symmetry.h"
+#include "packing.h"
+#include "newton.h"
+#include "eigen.h"
+
+namespace channelflow {
+
+// EquilibriumProblem is G(u) = f^T(u) - u = 0 for the time-T map f^T of a
+// DNSExt, so that its solutions are equilibria, or with xrel or zrel
+//
+//   G(u, ax, az) = tau(ax,az) f^T(u) - u = 0,
+//
+// travelling waves, which f^T translates by (-ax Lx, -az Lz). The unknowns
+// are the SpectralPacking of u followed by ax and/or az, whose equations
+// are the phase conditions <du, du/dx> = 0 and <du, du/dz> = 0 on the
+// Newton step, fixing the wave's position; they have residual 0.
+//
+// u is kept in the subspace of flags.symmetries: it is projected when
+// unpacked, and the DNS projects after each step. One DNSExt integrates
+// every evaluation of f^T, restarted at t = 0 with the fixed dt, so that
+// its solvers are built once. T must be a multiple of dt, to within
+// rounding, and dt is adjusted to T/round(T/dt).
+//
+// With flags.lowStorageRK (and no etdOrder), f^T is integrated by a
+// TangentDNS instead, the same scheme as in DNSExt, and the Jacobian is
+// exact: DG dx comes from one integration of u with the tangent du in
+// lockstep, in place of the finite difference, and the ax, az columns
+// from the x and z derivatives of tau f^T(u).
+
+class EquilibriumProblem : public NewtonProblem {
+public:
+  EquilibriumProblem(const FlowField& u, Real nu, Real T, Real dt,
+		     const DNSExtFlags& flags, bool xrel=false, bool zrel=false);
+  ~EquilibriumProblem();
+
+  int size() const;
+  void residual(const Vector& x, Vector& G);
+  void jacobian(const Vector& x, const Vector& Gx, const Vector& dx, Vector& dG);
+
+  void toVector(const FlowField& u, Real ax, Real az, Vector& x) const;
+  void toField(const Vector& x, FlowField& u, Real& ax, Real& az) const;
+
+  // dy[j] = D(tau f^T)(u) du[j] for j < n at the u, ax, az of x, on packed
+  // fields: one lockstep integration with TangentDNS, or else the forward
+  // difference of f^T in each direction
+  void tangentMap(const Vector& x, int n, const Vector* const* du, Vector* const* dy);
+
+  int evaluations() const;  // integrations of f^T so far
+  const SpectralPacking& packing() const;
+
+private:
+  EquilibriumProblem(const EquilibriumProblem& p);             // unimplemented
+  EquilibriumProblem& operator=(const EquilibriumProblem& p);  // unimplemented
+
+  DNSExt* dns_;
+  TangentDNS* tangent_;  // in place of dns_, for the exact Jacobian
+  Real dt_;
+  int Nsteps_;
+  bool xrel_;
+  bool zrel_;
+  int evaluations_;
+  SpectralPacking packing_;
+  SymmetryProjector projector_;
+  FlowField u_;
+  FlowField q_;
+  FlowField du_;   // d/dx or d/dz of u, for the phase conditions
+  Vector ud_;      // packed du_
+  array<FlowField> dut_;  // the tangent of TangentDNS
+
+  void flow(FlowField& u);  // u = f^T(u)
+  void phaseConditions(const Vector& dx, Vector& dG);  // rows of dG, with u_ at x
+};
+
+// PeriodicOrbitProblem is the multiple-shooting form of
+//
+//   G(u, T, ax, az) = tau(ax,az) f^T(u) - u = 0
+//
+// for periodic orbits, or with xrel or zrel relative periodic orbits, of
+// unknown period T. The orbit is split into M segments of duration T/M with
+// states u_0 ... u_{M-1}, and the equations are
+//
+//   G_m     = f^{T/M}(u_m) - u_{m+1},                 m < M-1,
+//   G_{M-1} = tau(ax,az) f^{T/M}(u_{M-1}) - u_0,
+//
+// with phase conditions on the Newton step du_0 fixing the orbit in time,
+// <du_0, d/dT tau f^{T/M}(u_{M-1})> = 0, and as for EquilibriumProblem in x
+// and z. The unknowns are the SpectralPackings of u_0 ... u_{M-1}, then T,
+// ax, az. Shorter segments keep the Jacobian well conditioned over long
+// periods, and as each segment has its own DNS, the segments are integrated
+// on concurrent threads (nested OpenMP divides the remaining threads among
+// them), so an evaluation of G costs the wall-clock time of one segment.
+//
+// Every segment takes the same number of steps, fixed on construction, so dt
+// follows T. With flags.lowStorageRK (and no etdOrder) the DNS are
+// TangentDNS and the Jacobian is exact in the u_m, by lockstep tangents on
+// all segments at once; the T column is the forward difference in T, once
+// per x. Otherwise the segments are DNSExt, which build FFTW plans as they
+// step, under the lock the constructor installs by threadSafePlanning, and
+// the Jacobian is the default finite difference.
+
+class PeriodicOrbitProblem : public NewtonProblem {
+public:
+  PeriodicOrbitProblem(const FlowField& u, Real nu, Real T, Real dt, int M,
+		       const DNSExtFlags& flags, bool xrel=false, bool zrel=false);
+  ~PeriodicOrbitProblem();
+
+  int size() const;
+  void residual(const Vector& x, Vector& G);
+  void jacobian(const Vector& x, const Vector& Gx, const Vector& dx, Vector& dG);
+
+  // x for the orbit through u: u_m = f^{mT/M}(u), integrated serially
+  void toVector(const FlowField& u, Real T, Real ax, Real az, Vector& x);
+  void toField(const Vector& x, int m, FlowField& u) const;  // u_m
+  void parameters(const Vector& x, Real& T, Real& ax, Real& az) const;
+
+  int segments() const;
+  Real dt(Real T) const;    // of period T
+  int evaluations() const;  // integrations of all segments so far
+  const SpectralPacking& packing() const;
+
+private:
+  PeriodicOrbitProblem(const PeriodicOrbitProblem& p);             // unimplemented
+  PeriodicOrbitProblem& operator=(const PeriodicOrbitProblem& p);  // unimplemented
+
+  int M_;
+  int Nsteps_;     // per segment
+  Real T_;         // the period the DNS are set to
+  bool xrel_;
+  bool zrel_;
+  int evaluations_;
+  SpectralPacking packing_;
+  SymmetryProjector projector_;
+  array<DNSExt*> dns_;
+  array<TangentDNS*> tangent_;  // in place of dns_, for the exact Jacobian
+  array<FlowField> u_;          // segment states
+  array<FlowField> q_;
+  array<array<FlowField> > du_; // tangent of segment m
+  FlowField du0_;               // d/dx or d/dz of a segment state
+  Vector pd_;                   // packed du0_
+  Vector xT_;                   // x of the T column
+  Vector GT_;                   // d/dT G at xT_
+
+  void setPeriod(Real T);
+  void unpack(const Vector& x, int m, FlowField& u) const;  // projected
+  void segment(int m, FlowField& u, array<FlowField>* du);  // u = f^{T/M}(u)
+  void flow(bool tangents);                                 // all u_ at once
+  void periodColumn(const Vector& x, const Vector& Gx);      // GT_ at x
+  void phaseConditions(const Vector& x, const Vector& dx, Vector& dG);
+};
+
+// The linearized time-T map of an EquilibriumProblem at x, du -> D(tau
+// f^T)(u) du on packed fields, whose eigenvalues are the multipliers
+// exp(sigma T) of the equilibrium's or travelling wave's eigenmodes
+class LinearizedMap : public BlockOperator {
+public:
+  LinearizedMap(EquilibriumProblem& p, const Vector& x);
+  void apply(int n, const Vector* const* du, Vector* const* dy);
+  int size() const;
+private:
+  EquilibriumProblem& p_;
+  const Vector& x_;
+};
+
+} //namespace channelflow
+#endif
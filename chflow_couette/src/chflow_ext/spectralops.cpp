@@ -0,0 +1,247 @@
+// spectralops.cpp: vectorized spectral-space operators for FlowFields
+
+#include "spectralops.h"
+#include "gridtables.h"
+#include "shapedispatch.h"
+
+#include "channelflow/vector.h"
+
+using namespace std;
+
+namespace channelflow {
+
+// I^n for integer n >= 0
+static Complex ipow(int n) {
+  switch (n % 4) {
+  case 0:
+    return Complex(1.0, 0.0);
+  case 1:
+    return Complex(0.0, 1.0);
+  case 2:
+    return Complex(-1.0, 0.0);
+  default:
+    return Complex(0.0, -1.0);
+  }
+}
+
+void cmulRow(Real* out, const Real* in, Complex c, int M) {
+  const Real a = Re(c);
+  const Real b = Im(c);
+#pragma omp simd
+  for (int m=0; m<M; ++m) {
+    const Real x = in[2*m];
+    const Real y = in[2*m+1];
+    out[2*m]   = a*x - b*y;
+    out[2*m+1] = a*y + b*x;
+  }
+}
+
+void cmulRow(Real* out, const Real* in, const Real* k, Complex c, int M) {
+  const Real a = Re(c);
+  const Real b = Im(c);
+#pragma omp simd
+  for (int m=0; m<M; ++m) {
+    const Real x = k[m]*in[2*m];
+    const Real y = k[m]*in[2*m+1];
+    out[2*m]   = a*x - b*y;
+    out[2*m+1] = a*y + b*x;
+  }
+}
+
+void axpyRow(Real* y, Real a, const Real* x, int N) {
+#pragma omp simd
+  for (int n=0; n<N; ++n)
+    y[n] += a*x[n];
+}
+
+// Shared setup for xdiffFast and zdiffFast: get f into xz-Spectral and
+// make df congruent, in f's y state. Returns false if df aliases f.
+static bool prepareDiff(FlowField& f, FlowField& df) {
+  f.makeSpectral_xz();
+  if (&df == &f)
+    return false;
+  if (!sameGeometry(df, f))
+    df.resize(f.Nx(), f.Ny(), f.Nz(), f.Nd(), f.Lx(), f.Lz(), f.a(), f.b());
+  df.setState(Spectral, f.ystate());
+  return true;
+}
+
+void xdiffFast(const FlowField& f_, FlowField& dfdx, int n) {
+  assert(n >= 0);
+  FlowField& f = const_cast<FlowField&>(f_);
+  const fieldstate fxzstate = f.xzstate();
+  const fieldstate fystate = f.ystate();
+  const bool distinct = prepareDiff(f, dfdx);
+
+  const int Nd = f.Nd();
+  const int Ny = f.Ny();
+  const int Mx = f.Mx();
+  const int Mz = f.Mz();
+  const int kxmax = f.kxmax();
+  const GridTables& t = gridTables(f);
+  const Complex rot = ipow(n);
+  const Real* in = f.rawData();
+  Real* out = dfdx.rawData();
+
+  Vector cx(Mx);
+  for (int mx=0; mx<Mx; ++mx)
+    cx[mx] = pow(t.alpha(mx), n) * zero_last_mode(t.kx(mx), kxmax, n);
+
+  // One row of Mz coeffs per (i,ny,mx), all scaled by (2 pi i kx/Lx)^n
+#pragma omp parallel for
+  for (int r=0; r<Nd*Ny*Mx; ++r)
+    cmulRow(out + 2*Mz*r, in + 2*Mz*r, rot*cx[r % Mx], Mz);
+
+  if (distinct)
+    f.makeState(fxzstate, fystate);
+  dfdx.makeSpectral();
+}
+
+struct YDiffArgs {
+  const Real* in;
+  Real* out;
+  int Nd;
+  int Ny;
+  int Nlines;  // Reals per xz plane, 2*Mx*Mz
+  Real c;      // 2/(b-a)
+};
+
+// One pass of out = d/dy in on Chebyshev coeffs, for all xz lines at once:
+// d_{Ny-1} = 0, d_n = d_{n+2} + 2(n+1) c u_{n+1}, then d_0 /= 2.
+template <int ND, int NY> struct YDiffKernel {
+  static void run(YDiffArgs& a) {
+    const int Nd = ND ? ND : a.Nd;
+    const int Ny = NY ? NY : a.Ny;
+    const int N = a.Nlines;
+    const int Nchunk = 512;
+    const int Nchunks = (N + Nchunk - 1)/Nchunk;
+    const Real c = a.c;
+
+#pragma omp parallel for
+    for (int r=0; r<Nd*Nchunks; ++r) {
+      const int i = r / Nchunks;
+      const int l0 = (r % Nchunks)*Nchunk;
+      const int L = lesser(Nchunk, N-l0);
+      const Real* u = a.in + Ny*N*i + l0;
+      Real* d = a.out + Ny*N*i + l0;
+
+      Real* dlast = d + (Ny-1)*N;
+#pragma omp simd
+      for (int l=0; l<L; ++l)
+	dlast[l] = 0.0;
+      if (Ny < 2)
+	continue;
+
+      const Real* ulast = u + (Ny-1)*N;
+      Real* dnext = d + (Ny-2)*N;
+      const Real cNy = 2*(Ny-1)*c;
+#pragma omp simd
+      for (int l=0; l<L; ++l)
+	dnext[l] = cNy*ulast[l];
+
+      for (int n=Ny-3; n>=0; --n) {
+	const Real cn = 2*(n+1)*c;
+	const Real* un1 = u + (n+1)*N;
+	const Real* dn2 = d + (n+2)*N;
+	Real* dn = d + n*N;
+#pragma omp simd
+	for (int l=0; l<L; ++l)
+	  dn[l] = dn2[l] + cn*un1[l];
+      }
+#pragma omp simd
+      for (int l=0; l<L; ++l)
+	d[l] *= 0.5;
+    }
+  }
+};
+
+void ydiffFast(const FlowField& f_, FlowField& dfdy, int n) {
+  assert(n >= 0);
+  FlowField& f = const_cast<FlowField&>(f_);
+  const fieldstate fxzstate = f.xzstate();
+  const fieldstate fystate = f.ystate();
+  f.makeSpectral();
+  const bool distinct = prepareDiff(f, dfdy);
+
+  const int Ndata = f.Nd()*f.Ny()*f.Nx()*2*f.Mz();
+  const Real* in = f.rawData();
+  Real* out = dfdy.rawData();
+
+  YDiffArgs args;
+  args.Nd = f.Nd();
+  args.Ny = f.Ny();
+  args.Nlines = f.Nx()*2*f.Mz();
+  args.c = 2.0/(f.b() - f.a());
+
+  // Ping-pong through scratch arrays, so that no pass reads and writes the
+  // same data. Only the last pass of a distinct-output call writes to out.
+  Vector s0;
+  Vector s1;
+  const Real* src = in;
+  for (int k=0; k<n; ++k) {
+    Real* dst = out;
+    if (k < n-1 || !distinct) {
+      Vector& s = (k % 2 == 0) ? s0 : s1;
+      if (s.length() != Ndata)
+	s.resize(Ndata);
+      dst = s.pointer();
+    }
+    args.in = src;
+    args.out = dst;
+    dispatchShape<YDiffKernel>(args.Nd, args.Ny, args);
+    src = dst;
+  }
+  if (src != out)
+    for (int l=0; l<Ndata; ++l)
+      out[l] = src[l];
+
+  if (distinct)
+    f.makeState(fxzstate, fystate);
+  dfdy.makeSpectral();
+}
+
+void zdiffFast(const FlowField& f_, FlowField& dfdz, int n) {
+  assert(n >= 0);
+  FlowField& f = const_cast<FlowField&>(f_);
+  const fieldstate fxzstate = f.xzstate();
+  const fieldstate fystate = f.ystate();
+  const bool distinct = prepareDiff(f, dfdz);
+
+  const int Nd = f.Nd();
+  const int Ny = f.Ny();
+  const int Mx = f.Mx();
+  const int Mz = f.Mz();
+  const int kzmax = f.kzmax();
+  const GridTables& t = gridTables(f);
+  const Complex rot = ipow(n);
+  const Real* in = f.rawData();
+  Real* out = dfdz.rawData();
+
+  Vector cz(Mz);
+  for (int mz=0; mz<Mz; ++mz)
+    cz[mz] = pow(t.gamma(mz), n) * zero_last_mode(t.kz(mz), kzmax, n);
+  const Real* czp = cz.pointer();
+
+#pragma omp parallel for
+  for (int r=0; r<Nd*Ny*Mx; ++r)
+    cmulRow(out + 2*Mz*r, in + 2*Mz*r, czp, rot, Mz);
+
+  if (distinct)
+    f.makeState(fxzstate, fystate);
+  dfdz.makeSpectral();
+}
+
+void axpy(FlowField& y, Real a, const FlowField& x) {
+  assert(y.congruent(x));
+  assert(y.xzstate() == x.xzstate() && y.ystate() == x.ystate());
+  const int N = y.rawDataLength();
+  const int Nchunk = 4096;
+  Real* yp = y.rawData();
+  const Real* xp = x.rawData();
+
+#pragma omp parallel for
+  for (int n=0; n<N; n += Nchunk)
+    axpyRow(yp + n, a, xp + n, lesser(Nchunk, N-n));
+}
+
+} //namespace channelflow
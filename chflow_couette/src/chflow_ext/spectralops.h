@@ -0,0 +1,39 @@
+// spectralops.h: vectorized spectral-space operators for FlowFields
+
+#ifndef CHFLOW_EXT_SPECTRALOPS_H
+#define CHFLOW_EXT_SPECTRALOPS_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/flowfield.h"
+
+namespace channelflow {
+
+// FlowField stores xz-spectral coefficients as interleaved Complex, i.e.
+// rows of Reals (re,im,re,im,...) of Mz = Nz/2+1 modes for each (i,ny,mx).
+// The kernels below work on such rows as plain Real arrays and spell out the
+// real and imaginary lanes, so that compilers vectorize them at full SIMD
+// width (configure with -DNATIVE_ARCH=ON for AVX2/AVX-512 builds). The
+// diffops.h versions go through cmplx() and a libgcc complex multiply for
+// every coefficient.
+//
+// Row kernels: M is the number of Complex elements, out may equal in.
+void cmulRow(Real* out, const Real* in, Complex c, int M);       // out = c in
+void cmulRow(Real* out, const Real* in, const Real* k, Complex c, int M);
+                                                       // out[m] = c k[m] in[m]
+void axpyRow(Real* y, Real a, const Real* x, int N);   // y += a x, N Reals
+
+// Drop-in replacements for xdiff, ydiff, zdiff of diffops.h. Same semantics:
+// input in any state, output in Spectral,Spectral, highest xz mode zeroed for
+// odd n. Computing in place (&dfdx == &f) is allowed. ydiffFast runs the
+// Chebyshev recurrence across whole xz planes, with the Ny loop unrolled for
+// the shapes in shapedispatch.h.
+void xdiffFast(const FlowField& f, FlowField& dfdx, int n=1);  // d^nf/dx^n
+void ydiffFast(const FlowField& f, FlowField& dfdy, int n=1);  // d^nf/dy^n
+void zdiffFast(const FlowField& f, FlowField& dfdz, int n=1);  // d^nf/dz^n
+
+// Whole-field y += a x for congruent fields in the same state. This is the
+// building block of multistep right-hand sides sum_j (a_j u_j + b_j f_j).
+void axpy(FlowField& y, Real a, const FlowField& x);
+
+} //namespace channelflow
+#endif
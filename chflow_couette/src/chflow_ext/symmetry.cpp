@@ -0,0 +1,259 @@
+// symmetry.cpp: field symmetries acting on spectral coefficients mode by mode
+
+#include <cstring>
+#include "symmetry.h"
+
+using namespace std;
+
+namespace channelflow {
+
+SpectralSymmetry::SpectralSymmetry()
+  :
+  Mx_(0),
+  Mz_(0)
+{}
+
+SpectralSymmetry::SpectralSymmetry(const FieldSymmetry& s, int Nx, int Nz)
+  :
+  s_(s),
+  Mx_(Nx),
+  Mz_(Nz/2 + 1),
+  source_(Mx_*Mz_),
+  conj_(Mx_*Mz_),
+  phase_(Mx_*Mz_)
+{
+  for (int mx=0; mx<Mx_; ++mx) {
+    const int kx = (mx <= Nx/2) ? mx : mx - Nx;
+    for (int mz=0; mz<Mz_; ++mz) {
+      const int m = mx*Mz_ + mz;
+      const int kxs = s.sx()*kx;
+      const int kzs = s.sz()*mz;
+      phase_[m] = exp(Complex(0.0, 2*pi*(kxs*s.ax() + kzs*s.az())));
+
+      // Stored partner of a negative kz
+      const bool c = kzs < 0;
+      const int kxp = c ? -kxs : kxs;
+      const int kzp = c ? -kzs : kzs;
+      conj_[m] = c;
+      if (kxp <= -Nx/2 || kxp > Nx/2 || kzp > Nz/2)
+	source_[m] = -1;
+      else
+	source_[m] = (kxp >= 0 ? kxp : kxp + Nx)*Mz_ + kzp;
+    }
+  }
+}
+
+const FieldSymmetry& SpectralSymmetry::symmetry() const {
+  return s_;
+}
+
+int SpectralSymmetry::Mx() const {
+  return Mx_;
+}
+
+int SpectralSymmetry::Mz() const {
+  return Mz_;
+}
+
+int SpectralSymmetry::source(int m) const {
+  return source_[m];
+}
+
+void SpectralSymmetry::apply(int m, const Real* u, Real* v, int Nd, int Ny) const {
+  const int ystride = 2*Mx_*Mz_;
+  const int istride = Ny*ystride;
+  const int o = 2*m;
+  const int src = source_[m];
+  for (int i=0; i<Nd; ++i)
+    for (int ny=0; ny<Ny; ++ny)
+      v[o + ny*ystride + i*istride] = v[o + ny*ystride + i*istride + 1] = 0.0;
+  if (src >= 0)
+    add(m, 1.0, u + 2*src, ystride, istride, v, Nd, Ny);
+}
+
+void SpectralSymmetry::add(int m, Real c, const Real* us, int ys, int is,
+			   Real* v, int Nd, int Ny) const {
+  const int ystride = 2*Mx_*Mz_;
+  const int istride = Ny*ystride;
+  const int o = 2*m;
+  if (source_[m] < 0)
+    return;
+  const Real pr = c*phase_[m].real();
+  const Real pim = c*phase_[m].imag();
+  const Real cs = conj_[m] ? -1.0 : 1.0;
+  for (int i=0; i<Nd; ++i) {
+    const int ci = (i == 0) ? s_.sx() : (i == 1) ? s_.sy() : s_.sz();
+    const Real si = (Nd == 1) ? 1.0 : Real(s_.s()*ci);
+    for (int ny=0; ny<Ny; ++ny) {
+      const Real sy = (s_.sy() == -1 && ny % 2) ? -si : si;
+      const Real ur = us[ny*ys + i*is];
+      const Real ui = cs*us[ny*ys + i*is + 1];
+      v[o + ny*ystride + i*istride]     += sy*(pr*ur - pim*ui);
+      v[o + ny*ystride + i*istride + 1] += sy*(pr*ui + pim*ur);
+    }
+  }
+}
+
+// Pairs m < source(m) are done together from a copy of mode m; a mode
+// that is its own source is copied too
+void SpectralSymmetry::operator()(FlowField& u) const {
+  assert(u.xzstate() == Spectral && u.ystate() == Spectral);
+  const int Nd = u.Nd();
+  const int Ny = u.Ny();
+  const int ystride = 2*Mx_*Mz_;
+  const int istride = Ny*ystride;
+  Real* ud = u.rawData();
+
+#pragma omp parallel
+  {
+    array<Real> buf(2*Ny*Nd);
+    Real* b = buf.pointer();
+
+#pragma omp for schedule(static)
+    for (int m=0; m<Mx_*Mz_; ++m) {
+      const int src = source_[m];
+      if (src >= 0 && src < m)
+	continue;
+      for (int i=0; i<Nd; ++i)
+	for (int ny=0; ny<Ny; ++ny) {
+	  b[2*(i*Ny + ny)]     = ud[2*m + ny*ystride + i*istride];
+	  b[2*(i*Ny + ny) + 1] = ud[2*m + ny*ystride + i*istride + 1];
+	}
+      if (src == m || src < 0) {
+	for (int i=0; i<Nd; ++i)
+	  for (int ny=0; ny<Ny; ++ny)
+	    ud[2*m + ny*ystride + i*istride] = ud[2*m + ny*ystride + i*istride + 1] = 0.0;
+	if (src == m)
+	  add(m, 1.0, b, 2, 2*Ny, ud, Nd, Ny);
+	continue;
+      }
+      // m <- s(u) from src, then src <- s(u) from the copy of m
+      apply(m, ud, ud, Nd, Ny);
+      for (int i=0; i<Nd; ++i)
+	for (int ny=0; ny<Ny; ++ny)
+	  ud[2*src + ny*ystride + i*istride] = ud[2*src + ny*ystride + i*istride + 1] = 0.0;
+      if (source_[src] == m)
+	add(src, 1.0, b, 2, 2*Ny, ud, Nd, Ny);
+    }
+  }
+}
+
+/**************************************************************************
+ * SymmetryProjector
+ **************************************************************************/
+
+SymmetryProjector::SymmetryProjector()
+  :
+  n_(0),
+  Mx_(0),
+  Mz_(0),
+  maxOrbit_(0)
+{}
+
+SymmetryProjector::SymmetryProjector(const array<FieldSymmetry>& symmetries,
+				     int Nx, int Nz)
+  :
+  n_(symmetries.length()),
+  Mx_(Nx),
+  Mz_(Nz/2 + 1),
+  terms_(1 << symmetries.length()),
+  maxOrbit_(0)
+{
+  // Subset bits b, lowest symmetry outermost: s[i1] s[i2] ... for i1 < i2
+  for (int b=0; b<terms_.length(); ++b) {
+    FieldSymmetry g;
+    for (int i=n_-1; i>=0; --i)
+      if (b & (1 << i))
+	g = symmetries[i]*g;
+    terms_[b] = SpectralSymmetry(g, Nx, Nz);
+  }
+
+  // Orbits: closure of each unvisited mode under the sources of all terms
+  const int M = Mx_*Mz_;
+  array<char> seen(M);
+  seen.fill(0);
+  orbit_.resize(M);
+  orbitStart_.resize(M + 1);
+  int n = 0;
+  int Norbits = 0;
+  for (int m=0; m<M; ++m) {
+    if (seen[m])
+      continue;
+    const int start = n;
+    orbitStart_[Norbits++] = start;
+    orbit_[n++] = m;
+    seen[m] = 1;
+    for (int k=start; k<n; ++k)
+      for (int t=0; t<terms_.length(); ++t) {
+	const int src = terms_[t].source(orbit_[k]);
+	if (src >= 0 && !seen[src]) {
+	  seen[src] = 1;
+	  orbit_[n++] = src;
+	}
+      }
+    maxOrbit_ = (n - start > maxOrbit_) ? n - start : maxOrbit_;
+  }
+  orbitStart_[Norbits] = n;
+  orbitStart_.resize(Norbits + 1);
+}
+
+int SymmetryProjector::length() const {
+  return n_;
+}
+
+void SymmetryProjector::operator()(FlowField& u) const {
+  if (n_ == 0)
+    return;
+  assert(u.xzstate() == Spectral && u.ystate() == Spectral);
+  const int Nd = u.Nd();
+  const int Ny = u.Ny();
+  const int ystride = 2*Mx_*Mz_;
+  const int istride = Ny*ystride;
+  const int T = terms_.length();
+  const Real c = 1.0/T;
+  const int Norbits = orbitStart_.length() - 1;
+  Real* ud = u.rawData();
+
+#pragma omp parallel
+  {
+    // Orbit members' coefficients, member k at k*modesize
+    const int modesize = 2*Ny*Nd;
+    array<Real> buf(maxOrbit_*modesize);
+    Real* b = buf.pointer();
+
+#pragma omp for schedule(dynamic, 16)
+    for (int k=0; k<Norbits; ++k) {
+      const int* orbit = orbit_.pointer() + orbitStart_[k];
+      const int K = orbitStart_[k+1] - orbitStart_[k];
+      for (int j=0; j<K; ++j) {
+	const int o = 2*orbit[j];
+	Real* bj = b + j*modesize;
+	for (int i=0; i<Nd; ++i)
+	  for (int ny=0; ny<Ny; ++ny) {
+	    bj[2*(i*Ny + ny)]     = ud[o + ny*ystride + i*istride];
+	    bj[2*(i*Ny + ny) + 1] = ud[o + ny*ystride + i*istride + 1];
+	    ud[o + ny*ystride + i*istride] = ud[o + ny*ystride + i*istride + 1] = 0.0;
+	  }
+      }
+      for (int j=0; j<K; ++j)
+	for (int t=0; t<T; ++t) {
+	  const int src = terms_[t].source(orbit[j]);
+	  if (src < 0)
+	    continue;
+	  int js = 0;
+	  while (orbit[js] != src)
+	    ++js;
+	  terms_[t].add(orbit[j], c, b + js*modesize, 2, 2*Ny, ud, Nd, Ny);
+	}
+    }
+  }
+}
+
+const FieldSymmetry* halvingSymmetry(const array<FieldSymmetry>& symmetries) {
+  for (int n=0; n<symmetries.length(); ++n)
+    if (symmetries[n].sx()*symmetries[n].sz() == -1)
+      return &symmetries[n];
+  return 0;
+}
+
+} //namespace channelflow
@@ -0,0 +1,96 @@
+// symmetry.h: field symmetries acting on spectral coefficients mode by mode
+
+#ifndef CHFLOW_EXT_SYMMETRY_H
+#define CHFLOW_EXT_SYMMETRY_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "channelflow/flowfield.h"
+#include "channelflow/symmetry.h"
+
+namespace channelflow {
+
+// SpectralSymmetry is a FieldSymmetry s, (u,v,w)(x,y,z) ->
+// s (sx u, sy v, sz w)(sx x + ax Lx, sy y, sz z + az Lz), as it acts on the
+// Spectral,Spectral coefficients of a FlowField:
+//
+//   (s u)_i at (kx,kz) = s c_i e^{2 pi i (kx' ax + kz' az)} R u_i at (kx',kz')
+//
+// with (kx',kz') = (sx kx, sz kz), c = (sx,sy,sz), R the y reflection
+// T_n -> (-1)^n T_n if sy == -1, and a source mode of negative kz' read as
+// the conjugate of its stored partner. Sources, conjugation and phase
+// factors are tabulated per mode m = mx*Mz + mz when constructed. A scalar
+// field (Nd == 1, e.g. pressure) transforms without the signs s c_i.
+//
+// Every source map of a FieldSymmetry is an involution (sx, sz = +-1), so
+// modes pair up or map to themselves, and s(u) can be formed in place, a
+// pair at a time, without a temporary field.
+
+class SpectralSymmetry {
+public:
+  SpectralSymmetry();
+  SpectralSymmetry(const FieldSymmetry& s, int Nx, int Nz);
+
+  // Mode m of s(u) into v from the source mode of u, for a field of Nd
+  // components and Ny Chebyshev coefficients, laid out as FlowField
+  void apply(int m, const Real* u, Real* v, int Nd, int Ny) const;
+
+  // v += c s(u) at mode m, from the coefficients of u's source mode at us,
+  // with strides ys between ny and is between components, into v laid out
+  // as FlowField
+  void add(int m, Real c, const Real* us, int ys, int is, Real* v, int Nd, int Ny) const;
+
+  // u = s(u) in place; u Spectral,Spectral on the grid given on construction
+  void operator()(FlowField& u) const;
+
+  int source(int m) const;   // mx*Mz + mz of the source mode, -1 if none
+  const FieldSymmetry& symmetry() const;
+  int Mx() const;
+  int Mz() const;
+
+private:
+  FieldSymmetry s_;
+  int Mx_;
+  int Mz_;
+  array<int> source_;     // source mode of each mode
+  array<char> conj_;      // source is read conjugated
+  array<Complex> phase_;  // e^{2 pi i (kx' ax + kz' az)}
+};
+
+// SymmetryProjector is the projection 1/2^n (1 + s[0]) (1 + s[1]) ...
+// (1 + s[n-1]) of FlowField::project(array<FieldSymmetry>), expanded into
+// the 2^n products of symmetries and applied in one spectral-space pass.
+// The modes fall into orbits, the sets of modes the products map into each
+// other (at most 2^n modes, mostly 2 or 4). Each orbit is read into a small
+// per-thread buffer and its projected coefficients written back, so there
+// is one sweep over u instead of a copy and a sweep per symmetry, and no
+// field-sized temporaries. Phases and sources are tabulated per mode on
+// construction.
+
+class SymmetryProjector {
+public:
+  SymmetryProjector();
+  SymmetryProjector(const array<FieldSymmetry>& symmetries, int Nx, int Nz);
+
+  // u = P u in place; u Spectral,Spectral, any number of components
+  void operator()(FlowField& u) const;
+
+  int length() const;  // number of symmetries, 0 if P is the identity
+
+private:
+  int n_;
+  int Mx_;
+  int Mz_;
+  array<SpectralSymmetry> terms_;  // the 2^n products
+  array<int> orbit_;               // modes grouped by orbit
+  array<int> orbitStart_;          // orbit k is orbit_[orbitStart_[k]...]
+  int maxOrbit_;
+};
+
+// The symmetry of a list by which half of the modes determine the others:
+// one with sx sz == -1, such as shift-reflect or shift-rotate, maps
+// (kx,kz) to (-kx,kz). Null if there is none.
+const FieldSymmetry* halvingSymmetry(const array<FieldSymmetry>& symmetries);
+
+} //namespace channelflow
+#endif
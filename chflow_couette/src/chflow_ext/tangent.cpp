@@ -0,0 +1,127 @@
+// tangent.cpp: tangent-linear DNS advancing perturbations with the base flow
+
+#include "tangent.h"
+#include "gridtables.h"
+
+using namespace std;
+
+namespace channelflow {
+
+TangentDNS::TangentDNS()
+  :
+  IMEXRK3DNS()
+{}
+
+TangentDNS::TangentDNS(const TangentDNS& dns)
+  :
+  IMEXRK3DNS(dns),
+  projector_(dns.projector_),
+  df_(dns.df_)
+{}
+
+TangentDNS::TangentDNS(const FlowField& u, const ChebyCoeff& Ubase, Real nu,
+		       Real dt, const DNSExtFlags& flags, Real t)
+  :
+  IMEXRK3DNS(u, Ubase, nu, dt, flags, t),
+  projector_(flags.symmetries, u.Nx(), u.Nz())
+{}
+
+TangentDNS::~TangentDNS() {}
+
+TangentDNS& TangentDNS::operator=(const TangentDNS& dns) {
+  IMEXRK3DNS::operator=(dns);
+  projector_ = dns.projector_;
+  df_ = dns.df_;
+  return *this;
+}
+
+DNSAlgorithm* TangentDNS::clone() const {
+  return new TangentDNS(*this);
+}
+
+void TangentDNS::advance(FlowField& u, FlowField& q, int nSteps) {
+  array<FlowField> du;
+  advance(u, q, du, nSteps);
+}
+
+// The first substep reads N_{i-2} at weight zero, so it must exist
+void TangentDNS::reserve(const FlowField& u, int K) {
+  nl_.reserve(u, Ubase_);
+  if (df_.length() < 2*K)
+    df_.resize(2*K);
+  for (int k=0; k<2*K; ++k)
+    if (!sameGeometry(df_[k], u)) {
+      df_[k] = f_[1];
+      df_[k].setToZero();
+    }
+}
+
+void TangentDNS::advance(FlowField& u, FlowField& q, array<FlowField>& du, int nSteps) {
+  const int K = du.length();
+  reserve(u, K);
+  u.makeSpectral();
+  q.makeSpectral();
+  for (int k=0; k<K; ++k) {
+    if (!sameGeometry(du[k], u) || du[k].Nd() != 3)
+      cferror("TangentDNS::advance : tangents must be 3d fields on u's grid");
+    du[k].makeSpectral();
+  }
+
+  // Member 0 is u, member 1+k tangent k
+  array<FlowField*> up(K+1);
+  array<const FlowField*> fa(K+1);
+  array<const FlowField*> fb(K+1);
+  up[0] = &u;
+  for (int k=0; k<K; ++k)
+    up[k+1] = &du[k];
+
+  for (int n=0; n<nSteps; ++n) {
+    // N(u) and its physical fields for the tangent terms, as IMEXRK3DNS
+    if (!current(u)) {
+      copyFast(u, u0_);
+      nl_(u0_, Ubase_, f_[0]);
+    }
+    for (int k=0; k<K; ++k)
+      nl_.linear(du[k], df_[2*k]);
+
+    for (int i=0; i<3; ++i) {
+      fa[0] = &f_[0];
+      fb[0] = &f_[1];
+      for (int k=0; k<K; ++k) {
+	fa[k+1] = &df_[2*k];
+	fb[k+1] = &df_[2*k+1];
+      }
+      substep(i, K+1, up.pointer(), fa.pointer(), fb.pointer(), i == 2 ? &q : 0);
+      swap(f_[0], f_[1]);
+      for (int k=0; k<K; ++k)
+	swap(df_[2*k], df_[2*k+1]);
+      if (i < 2) {
+	nl_(u, Ubase_, f_[0]);
+	for (int k=0; k<K; ++k)
+	  nl_.linear(du[k], df_[2*k]);
+      }
+    }
+    t_ += dt_;
+
+    copyFast(u, u0_);
+    nl_(u0_, Ubase_, f_[0], &diag_);
+    diag_.t = t_;
+    f0valid_ = true;
+  }
+
+  if (projector_.length() > 0) {
+    projector_(u);
+    projector_(q);
+    for (int k=0; k<K; ++k)
+      projector_(du[k]);
+    f0valid_ = false;
+  }
+  if (flags_.dealias_xz()) {
+    u.setPadded(true);
+    for (int k=0; k<K; ++k)
+      du[k].setPadded(true);
+  }
+  cfl_ = cflNumber(diag_.cflfactor, dt_, flags_);
+}
+
+} //namespace channelflow
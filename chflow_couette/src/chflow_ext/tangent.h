@@ -0,0 +1,56 @@
+// tangent.h: tangent-linear DNS advancing perturbations with the base flow
+
+#ifndef CHFLOW_EXT_TANGENT_H
+#define CHFLOW_EXT_TANGENT_H
+
+#include "channelflow/mathdefs.h"
+#include "channelflow/array.h"
+#include "channelflow/chebyshev.h"
+#include "channelflow/flowfield.h"
+#include "channelflow/dns.h"
+#include "imexrk.h"
+#include "symmetry.h"
+
+namespace channelflow {
+
+// TangentDNS advances a velocity field u by IMEXRK3DNS and, in lockstep,
+// any number of tangent fields du[k] by the derivative of the same discrete
+// scheme, so that du(T) = Df^T(u) du(0) exactly, to rounding, for the
+// time-T map f^T of IMEXRK3DNS. Each substep evaluates N(u) once and keeps
+// its physical utot and curl utot in the RotationalNL, which supplies the
+// tangent terms (curl du) x utot + (curl utot) x du at the cost of the
+// tangents' own transforms; the implicit solve loads each mode's TauSolver
+// once for u and all tangents. The tangents carry no mean forcing, and
+// under a bulk velocity constraint have zero bulk velocity.
+//
+// u alone (advance without tangents) steps exactly as IMEXRK3DNS within
+// DNSExt: at the end of each advance, u, q and the tangents are projected
+// onto the subspace of flags.symmetries.
+
+class TangentDNS : public IMEXRK3DNS {
+public:
+  TangentDNS();
+  TangentDNS(const TangentDNS& dns);
+  TangentDNS(const FlowField& u, const ChebyCoeff& Ubase, Real nu, Real dt,
+	     const DNSExtFlags& flags, Real t=0);
+  ~TangentDNS();
+
+  TangentDNS& operator=(const TangentDNS& dns);
+
+  // Advance u and the tangents du[k] about it nSteps; q receives u's pressure
+  void advance(FlowField& u, FlowField& q, array<FlowField>& du, int nSteps=1);
+
+  virtual void advance(FlowField& u, FlowField& q, int nSteps=1);
+  virtual DNSAlgorithm* clone() const;
+
+  // Allocate for up to K tangents on u's grid. Advancing then builds no
+  // FFTW plans, so that instances may advance on concurrent threads.
+  void reserve(const FlowField& u, int K);
+
+protected:
+  SymmetryProjector projector_;  // of flags.symmetries
+  array<FlowField> df_;          // tangent k's explicit terms at 2k, 2k+1, as f_
+};
+
+} //namespace channelflow
+#endif
@@ -0,0 +1,179 @@
+// ytransform.cpp: batched Chebyshev transforms in y for whole FlowFields
+
+#include "ytransform.h"
+
+#include <omp.h>
+
+using namespace std;
+
+namespace channelflow {
+
+// Number of y-lines transformed per FFTW call. Ny*Nblock Reals should sit
+// comfortably in L2 cache (33*256*8 bytes = 66kB for production grids).
+const int Nblock = 256;
+
+BatchedChebyTransform::BatchedChebyTransform()
+  :
+  Nx_(0),
+  Ny_(0),
+  Nz_(0),
+  Nlines_(0),
+  blocksize_(0),
+  Nblocks_(0),
+  remainder_(0),
+  plan_(0),
+  remainder_plan_(0)
+{}
+
+BatchedChebyTransform::BatchedChebyTransform(const FlowField& u, uint flags)
+  :
+  BatchedChebyTransform(u.Nx(), u.Ny(), u.Nz(), flags)
+{}
+
+BatchedChebyTransform::BatchedChebyTransform(int Nx, int Ny, int Nz, uint flags)
+  :
+  Nx_(Nx),
+  Ny_(Ny),
+  Nz_(Nz),
+  Nlines_(Nx*2*(Nz/2+1)),
+  blocksize_(lesser(Nlines_, Nblock)),
+  Nblocks_(blocksize_ > 0 ? Nlines_/blocksize_ : 0),
+  remainder_(blocksize_ > 0 ? Nlines_ % blocksize_ : 0),
+  specscale_(Ny),
+  physscale_(Ny),
+  plan_(0),
+  remainder_plan_(0)
+{
+  assert(Nx_ >= 0 && Ny_ >= 0 && Nz_ >= 0);
+  if (Ny_ < 2 || Nlines_ == 0)
+    return;
+
+  // Same normalization as FlowField::makeSpectral_y and makePhysical_y:
+  // u_n = c_n/(Ny-1) REDFT00(u)_n, with c_n = 1/2 for n=0,Ny-1, else 1.
+  const int Nb = Ny_-1;
+  for (int ny=0; ny<Ny_; ++ny) {
+    const bool end = (ny == 0 || ny == Nb);
+    specscale_[ny] = (end ? 0.5 : 1.0)/Nb;
+    physscale_[ny] = (end ? 1.0 : 0.5);
+  }
+
+  // Plans are executed on fields' own data with fftw_execute_r2r, at offsets
+  // that aren't necessarily SIMD-aligned. REDFT00 has no SIMD codelets, so
+  // FFTW_UNALIGNED costs nothing and frees us from alignment bookkeeping.
+  // Plan on a scratch array so FFTW_MEASURE etc. don't clobber user data.
+  const int Ndata = Ny_*Nlines_;
+  Real* scratch = (Real*) fftw_malloc(Ndata*sizeof(Real));
+  fftw_r2r_kind kind = FFTW_REDFT00;
+  fftw_iodim ydim;
+  ydim.n  = Ny_;
+  ydim.is = Nlines_;
+  ydim.os = Nlines_;
+
+  fftw_iodim linedim;
+  linedim.n  = blocksize_;
+  linedim.is = 1;
+  linedim.os = 1;
+  plan_ = fftw_plan_guru_r2r(1, &ydim, 1, &linedim, scratch, scratch, &kind,
+			     flags | FFTW_UNALIGNED);
+  if (remainder_ > 0) {
+    linedim.n = remainder_;
+    remainder_plan_ = fftw_plan_guru_r2r(1, &ydim, 1, &linedim, scratch, scratch,
+					 &kind, flags | FFTW_UNALIGNED);
+  }
+  fftw_free(scratch);
+
+  if (plan_ == 0 || (remainder_ > 0 && remainder_plan_ == 0))
+    cferror("BatchedChebyTransform: FFTW failed to create y-transform plans");
+}
+
+BatchedChebyTransform::~BatchedChebyTransform() {
+  if (plan_)
+    fftw_destroy_plan(plan_);
+  if (remainder_plan_)
+    fftw_destroy_plan(remainder_plan_);
+  plan_ = 0;
+  remainder_plan_ = 0;
+}
+
+bool BatchedChebyTransform::congruent(const FlowField& u) const {
+  return (u.Nx() == Nx_ && u.Ny() == Ny_ && u.Nz() == Nz_);
+}
+
+void BatchedChebyTransform::transform(FlowField& u, const Real* prescale,
+				      const Real* postscale) const {
+  assert(congruent(u));
+  Real* data = u.rawData();
+  const int Nd = u.Nd();
+  const int Nlines = Nlines_;
+  const int Ny = Ny_;
+  const int Nchunks = Nblocks_ + (remainder_ > 0 ? 1 : 0);
+
+#pragma omp parallel for
+  for (int n=0; n<Nd*Nchunks; ++n) {
+    const int i = n / Nchunks;
+    const int b = n % Nchunks;
+    const int L = (b < Nblocks_) ? blocksize_ : remainder_;
+    Real* block = data + i*Ny*Nlines + b*blocksize_;
+
+    if (prescale)
+      for (int ny=0; ny<Ny; ++ny) {
+	const Real c = prescale[ny];
+	if (c != 1.0) {
+	  Real* plane = block + ny*Nlines;
+	  for (int l=0; l<L; ++l)
+	    plane[l] *= c;
+	}
+      }
+
+    fftw_execute_r2r((b < Nblocks_) ? plan_ : remainder_plan_, block, block);
+
+    if (postscale)
+      for (int ny=0; ny<Ny; ++ny) {
+	const Real c = postscale[ny];
+	Real* plane = block + ny*Nlines;
+	for (int l=0; l<L; ++l)
+	  plane[l] *= c;
+      }
+  }
+}
+
+void BatchedChebyTransform::makeSpectral_y(FlowField& u) const {
+  if (u.ystate() == Spectral)
+    return;
+  if (Ny_ >= 2)
+    transform(u, 0, specscale_.pointer());
+  u.setState(u.xzstate(), Spectral);
+}
+
+void BatchedChebyTransform::makePhysical_y(FlowField& u) const {
+  if (u.ystate() == Physical)
+    return;
+  if (Ny_ >= 2)
+    transform(u, physscale_.pointer(), 0);
+  u.setState(u.xzstate(), Physical);
+}
+
+void BatchedChebyTransform::makeSpectral(FlowField& u) const {
+  u.makeSpectral_xz();
+  makeSpectral_y(u);
+}
+
+void BatchedChebyTransform::makePhysical(FlowField& u) const {
+  makePhysical_y(u);
+  u.makePhysical_xz();
+}
+
+void BatchedChebyTransform::makeState(FlowField& u, fieldstate xzstate,
+				      fieldstate ystate) const {
+  if (ystate == Physical)
+    makePhysical_y(u);
+  else
+    makeSpectral_y(u);
+
+  if (xzstate == Physical)
+    u.makePhysical_xz();
+  else
+    u.makeSpectral_xz();
+}
+
+} //namespace channelflow
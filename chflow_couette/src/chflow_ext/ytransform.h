@@ -0,0 +1,73 @@
+// ytransform.h: batched Chebyshev transforms in y for whole FlowFields
+
+#ifndef CHFLOW_EXT_YTRANSFORM_H
+#define CHFLOW_EXT_YTRANSFORM_H
+
+#include <fftw3.h>
+#include "channelflow/mathdefs.h"
+#include "channelflow/vector.h"
+#include "channelflow/flowfield.h"
+
+namespace channelflow {
+
+// BatchedChebyTransform does the work of FlowField::makeSpectral_y and
+// makePhysical_y without copying each (x,z) line into a scratch buffer.
+//
+// FlowField data is ordered d, Ny, Nx, Nz. For a fixed component the
+// Nx*Nzpad lines are contiguous within a y-plane and each line has stride
+// Nx*Nzpad in y. So one strided REDFT00 plan transforms a whole block of
+// adjacent lines in place, and the Chebyshev normalization is a scaling of
+// contiguous y-planes. Blocks of lines are distributed over OpenMP threads.
+//
+// The plans depend on Nx,Ny,Nz only, so one BatchedChebyTransform serves
+// fields of any vector dimension Nd on the same grid. Results are identical
+// to FlowField's own y transforms (same normalization of modes 0 and Ny-1).
+
+class BatchedChebyTransform {
+public:
+  BatchedChebyTransform();
+  BatchedChebyTransform(int Nx, int Ny, int Nz, uint fftw_flags = FFTW_ESTIMATE);
+  BatchedChebyTransform(const FlowField& u, uint fftw_flags = FFTW_ESTIMATE);
+  ~BatchedChebyTransform();
+
+  void makeSpectral_y(FlowField& u) const;
+  void makePhysical_y(FlowField& u) const;
+  void makeSpectral(FlowField& u) const;   // xz by FlowField, y batched
+  void makePhysical(FlowField& u) const;
+  void makeState(FlowField& u, fieldstate xzstate, fieldstate ystate) const;
+
+  bool congruent(const FlowField& u) const;
+
+  inline int Nx() const;
+  inline int Ny() const;
+  inline int Nz() const;
+
+private:
+  BatchedChebyTransform(const BatchedChebyTransform& t);            // unimplemented
+  BatchedChebyTransform& operator=(const BatchedChebyTransform& t); // unimplemented
+
+  int Nx_;
+  int Ny_;
+  int Nz_;
+  int Nlines_;     // Nx*Nzpad, number of y-lines per component
+  int blocksize_;  // lines per call of plan_
+  int Nblocks_;    // number of full blocks per component
+  int remainder_;  // lines in the last, partial block (0 if none)
+
+  Vector specscale_; // y-plane scaling after  REDFT00 in makeSpectral_y
+  Vector physscale_; // y-plane scaling before REDFT00 in makePhysical_y
+
+  fftw_plan plan_;           // unnormalized REDFT00 over blocksize_ lines
+  fftw_plan remainder_plan_; // same over remainder_ lines
+
+  // Apply REDFT00 to every y-line, scaling y-planes by prescale before or
+  // postscale after the transform (either can be null).
+  void transform(FlowField& u, const Real* prescale, const Real* postscale) const;
+};
+
+inline int BatchedChebyTransform::Nx() const {return Nx_;}
+inline int BatchedChebyTransform::Ny() const {return Ny_;}
+inline int BatchedChebyTransform::Nz() const {return Nz_;}
+
+} //namespace channelflow
+#endif
@@ -4,17 +4,149 @@
 #include "channelflow/flowfield.h"
 #include "channelflow/utilfuncs.h"
 #include "thequick_light/iniparser_light.h"
+#include "chflow_ext/dnsext.h"
+#include "chflow_ext/dualstate.h"
+#include "chflow_ext/ensemble.h"
+#include "chflow_ext/gridtables.h"
+#include "chflow_ext/events.h"
+#include "chflow_ext/symmetry.h"
+#include "chflow_ext/solutions.h"
+#include "chflow_ext/continuation.h"
+#include "chflow_ext/planning.h"
 
 #include <fstream>
+#include <sstream>
+#include <vector>
+#include <omp.h>
 
 using namespace std;
 using namespace channelflow;
 using namespace thequicklight;
 
-int main()
+// Value of an optional parameter, or defaultValue if it is not in the file
+template <typename T>
+T getOptionalValue(const IniParser& parser, const string& section,
+                   const string& paramName, T defaultValue)
+{
+    IniParser::ErrorCode err;
+    T value = parser.getValue<T>(section, paramName, &err);
+    return (err == IniParser::ErrorCode::Success) ? value : defaultValue;
+}
+
+// Value following option name on the command line, or defaultValue
+string commandLineValue(int argc, char* argv[], const string& name, const string& defaultValue)
+{
+    for (int i = 1; i < argc - 1; ++i)
+        if (name == argv[i])
+            return argv[i+1];
+    return defaultValue;
+}
+
+// Symmetries "s sx sy sz ax az", as FieldSymmetry reads them, separated by ';'
+channelflow::array<FieldSymmetry> parseSymmetries(const string& list)
+{
+    vector<FieldSymmetry> symms;
+    istringstream groups(list);
+    for (string group; getline(groups, group, ';'); )
+    {
+        if (group.find_first_not_of(" \t") == string::npos)
+            continue;
+        istringstream is(group);
+        FieldSymmetry symm;
+        is >> symm;
+        symms.push_back(symm);
+    }
+    channelflow::array<FieldSymmetry> result(symms.size());
+    for (size_t i = 0; i < symms.size(); ++i)
+        result[i] = symms[i];
+    return result;
+}
+
+// Append the xz-mean and rms profiles of the fluctuation up (physical) at t
+// to file, one line per gridpoint
+void appendProfiles(const FlowField& up, int t, const string& file)
+{
+    const int M = up.Ny();
+    Vector mean(3*M);
+    Vector meanSquare(3*M);
+    xzProfilesFast(up, mean.pointer(), meanSquare.pointer());
+    ofstream os(file.c_str(), ios_base::app);
+    os << setprecision(17) << "# t == " << t << ": y <u> <v> <w> urms vrms wrms" << endl;
+    for (int ny = 0; ny < M; ++ny)
+    {
+        os << up.y(ny);
+        for (int i = 0; i < 3; ++i)
+            os << ' ' << mean[ny + M*i];
+        for (int i = 0; i < 3; ++i)
+            os << ' ' << sqrt(std::max(0.0, meanSquare[ny + M*i] - square(mean[ny + M*i])));
+        os << endl;
+    }
+    os << endl;
+}
+
+// Evaluate the events on diag, appending new crossings to
+// savingDir/crossings.txt. On an event, report it, prefixed by who, and
+// record it in savingDir/event.txt with the name of the final state saved.
+bool checkEvents(FlowEvents& events, const FlowDiagnostics& diag, const string& savingDir,
+                 const string& state, const string& who)
+{
+    const int crossings = events.crossings();
+    const bool fired = events(diag);
+    if (events.crossings() != crossings)
+    {
+        ofstream os((savingDir + "/crossings.txt").c_str(), ios_base::app);
+        os << setprecision(17);
+        for (int i = crossings; i < events.crossings(); ++i)
+            os << events.crossingTimes()[i] << endl;
+    }
+    if (fired)
+    {
+        cout << who << "event " << FlowEvents::name(events.fired()) << " at t == " << events.time()
+             << ", stopping" << endl;
+        ofstream os((savingDir + "/event.txt").c_str());
+        os << setprecision(17)
+           << "event " << FlowEvents::name(events.fired()) << endl
+           << "t " << events.time() << endl
+           << "value " << events.value() << endl
+           << "state " << state << endl;
+    }
+    return fired;
+}
+
+// Integration at one Reynolds number. A sweep keeps one per Re and
+// advances them one dT interval each, concurrently. FFTW reuses the plans of
+// the first run's transforms for the others.
+struct Run
+{
+    Run() : nu(0), dns(0), ustates(0), T0(0), t(0), active(true) {}
+    ~Run() { delete ustates; delete dns; }
+
+    string Re;                // as given, names the output directory of a sweep
+    Real nu;
+    string savingDir;
+    FlowField u;
+    FlowField q;
+    DNSExt* dns;
+    DualStateField* ustates;  // physical-space copy of u for saving
+    TimeStep dt;
+    FlowEvents events;
+    int T0;
+    int t;
+    bool active;
+
+private:
+    Run(const Run&);
+    Run& operator=(const Run&);
+};
+
+int main(int argc, char* argv[])
 {
     IniParser parser("settings.ini");
 
+    // The runs of a sweep and the segments of an orbit plan their transforms
+    // on concurrent threads
+    threadSafePlanning();
+
     // Define gridsize
     IniParser::ErrorCode err;
     const int Nx = parser.getValue<int>("Definitions", "Nx", &err);
@@ -30,25 +162,72 @@ int main()
     const Real Lx=LxPrefactor*pi;
     const Real Lz=LzPrefactor*pi;
 
+    // Symmetries imposed on u, e.g. to stay in the subspace of a solution
+    const channelflow::array<FieldSymmetry> symmetries =
+        parseSymmetries(getOptionalValue<string>(parser, "Definitions", "symmetries", ""));
+
     // Define saving properties
     string savingDir = parser.getValue<string>("Saving settings", "ChannelFlowFilesDirectory");
+    // Interval, in units of dT, between checkpoints of the full DNS state in
+    // savingDir/state; 0 disables them
+    const int stateInterval = getOptionalValue<int>(parser, "Saving settings", "state_interval", 0);
+    // Append the xz-mean and rms profiles of the fluctuation u,v,w at every
+    // dT to savingDir/profiles.txt
+    const bool profiles = getOptionalValue<int>(parser, "Saving settings", "profiles", 0) != 0;
 
     cout << "Nx = " << Nx << ", Ny = " << Ny << ", Nz = " << Nz << endl << endl;
     cout << "Lx = " << LxPrefactor << "*pi, Ly = " << b - a << ", Lz = " << LzPrefactor << "*pi" << endl << endl;
 
-    // Define flow parameters
-    const Real Reynolds = parser.getValue<float>("Definitions", "Re");
-    const Real nu = 1.0/Reynolds;
+    // Define flow parameters. A [Sweep] Re_list integrates each of its
+    // Reynolds numbers in this process, saving into data-<Re> directories.
+    vector<string> ReList;
+    vector<Real> ReValues;
+    istringstream ReTokens(getOptionalValue<string>(parser, "Sweep", "Re_list", ""));
+    for (string Re; ReTokens >> Re; )
+    {
+        ReList.push_back(Re);
+        ReValues.push_back(atof(Re.c_str()));
+    }
+    const bool sweep = !ReList.empty();
+    if (!sweep)
+    {
+        ReValues.push_back(parser.getValue<float>("Definitions", "Re"));
+        ReList.push_back(r2s(ReValues[0]));
+    }
     const Real dPdx  = 0.0;
     
-    // Define integration parameters
-    //const int   n = 400;    // take n steps between printouts
-    const int   n = ::floor(Reynolds);    // take n steps between printouts
-    const Real dt = 1.0/n; // integration timestep
-    //const Real T  = 100.0; // integrate from t=0 to t=T
+    // Define integration parameters. dt varies within [dtmin, dtmax] to keep
+    // the CFL number within [CFLmin, CFLmax], with n = dT/dt steps between
+    // printouts. Without a [Time stepping] section dt is fixed to 1/floor(Re).
+    IniParser::ErrorCode dtErr;
+    const Real dtGiven = parser.getValue<float>("Time stepping", "dt", &dtErr);
+    const Real CFLmin = getOptionalValue<float>(parser, "Time stepping", "CFLmin", 0.4);
+    const Real CFLmax = getOptionalValue<float>(parser, "Time stepping", "CFLmax", 0.6);
+    const int dT = getOptionalValue<int>(parser, "Time stepping", "dT", 1); // save interval
+    // Base-flow advection in the implicit solve: the CFL number is then that
+    // of the perturbation alone, permitting larger dt
+    const bool implicitBaseflow = getOptionalValue<int>(parser, "Time stepping", "implicit_baseflow", 0) != 0;
+    // Velocity of the frame of reference, e.g. a travelling wave's phase speed
+    const Real cx = getOptionalValue<float>(parser, "Time stepping", "cx", 0.0);
+    const Real cz = getOptionalValue<float>(parser, "Time stepping", "cz", 0.0);
+    // 2 or 4: exponential Runge-Kutta (ETDRKn) in place of SBDF3
+    const int etdOrder = getOptionalValue<int>(parser, "Time stepping", "etd_order", 0);
+    // Self-starting low-storage IMEX RK3 in place of SBDF3
+    const bool lowStorageRK = getOptionalValue<int>(parser, "Time stepping", "low_storage_rk", 0) != 0;
+    // Blow-up guard: a dT interval whose result exceeds a bound is repeated
+    // from an in-memory snapshot with dt reduced, up to guard_snapshots
+    // intervals back; 0 disables it, as does a bound <= 0 for that bound
+    DNSGuard guard;
+    guard.snapshots  = getOptionalValue<int>(parser, "Time stepping", "guard_snapshots", 0);
+    guard.CFLmax     = getOptionalValue<float>(parser, "Time stepping", "guard_CFL", 2.0);
+    guard.divNormMax = getOptionalValue<float>(parser, "Time stepping", "guard_divnorm", 1e-4);
+    guard.energyMax  = getOptionalValue<float>(parser, "Time stepping", "guard_energy", 0.0);
+    guard.dtFactor   = getOptionalValue<float>(parser, "Time stepping", "guard_dt_factor", 0.5);
+    // 0: 1e-2*dtmin
+    const Real guardDtmin = getOptionalValue<float>(parser, "Time stepping", "guard_dtmin", 0.0);
     
     // Define DNS parameters
-    DNSFlags flags;
+    DNSExtFlags flags;
     flags.baseflow     = PlaneCouette;
     flags.timestepping = SBDF3;
     flags.initstepping = SMRK2;
@@ -59,15 +238,82 @@ int main()
     flags.taucorrection = true;
     flags.constraint  = PressureGradient; // enforce constant pressure gradient
     flags.dPdx  = dPdx;
+    flags.implicitBaseflow = implicitBaseflow;
+    flags.cx = cx;
+    flags.cz = cz;
+    flags.etdOrder = etdOrder;
+    flags.lowStorageRK = lowStorageRK;
+    flags.symmetries = symmetries;
 
-    const Real T0 = 0;
-    const Real T1 = parser.getValue<int>("Definitions", "T");
+    // Newton search: converge an equilibrium, or with xrel/zrel a travelling
+    // wave, from the initial field instead of integrating it; with orbit, a
+    // (relative) periodic orbit of period near T
+    const bool newtonSearch = getOptionalValue<int>(parser, "Newton", "search", 0) != 0;
+    const Real newtonT  = getOptionalValue<float>(parser, "Newton", "T", 10.0);
+    const Real newtonDt = getOptionalValue<float>(parser, "Newton", "dt", 0.02);
+    const bool xrel = getOptionalValue<int>(parser, "Newton", "xrel", 0) != 0;
+    const bool zrel = getOptionalValue<int>(parser, "Newton", "zrel", 0) != 0;
+    const bool orbit = getOptionalValue<int>(parser, "Newton", "orbit", 0) != 0;
+    const int segments = getOptionalValue<int>(parser, "Newton", "segments", 4);
+    NewtonFlags newtonFlags;
+    newtonFlags.Nnewton   = getOptionalValue<int>(parser, "Newton", "Nnewton", newtonFlags.Nnewton);
+    newtonFlags.Ngmres    = getOptionalValue<int>(parser, "Newton", "Ngmres", newtonFlags.Ngmres);
+    newtonFlags.epsSearch = getOptionalValue<float>(parser, "Newton", "eps_search", newtonFlags.epsSearch);
+    newtonFlags.epsKrylov = getOptionalValue<float>(parser, "Newton", "eps_krylov", newtonFlags.epsKrylov);
+    newtonFlags.delta     = getOptionalValue<float>(parser, "Newton", "delta", newtonFlags.delta);
+    newtonFlags.deltaMax  = getOptionalValue<float>(parser, "Newton", "delta_max", newtonFlags.deltaMax);
+    ArnoldiFlags arnoldiFlags;
+    arnoldiFlags.Neig      = getOptionalValue<int>(parser, "Newton", "eigenvalues", 0);
+    arnoldiFlags.blockSize = getOptionalValue<int>(parser, "Newton", "eig_block", arnoldiFlags.blockSize);
+    arnoldiFlags.Kmax      = getOptionalValue<int>(parser, "Newton", "eig_krylov", arnoldiFlags.Kmax);
+    arnoldiFlags.tol       = getOptionalValue<float>(parser, "Newton", "eig_tol", arnoldiFlags.tol);
+    newtonFlags.Nrecycle   = getOptionalValue<int>(parser, "Newton", "recycle", newtonFlags.Nrecycle);
+
+    // Continuation of the converged solution's branch in Re, Lx or Lz
+    const int continuationSteps = getOptionalValue<int>(parser, "Continuation", "steps", 0);
+    const SolutionFamily::Parameter continuationParameter = SolutionFamily::parseParameter(
+        getOptionalValue<string>(parser, "Continuation", "parameter", "Re"));
+    ContinuationFlags continuationFlags;
+    continuationFlags.ds      = getOptionalValue<float>(parser, "Continuation", "ds", continuationFlags.ds);
+    continuationFlags.dsMin   = getOptionalValue<float>(parser, "Continuation", "ds_min", continuationFlags.dsMin);
+    continuationFlags.dsMax   = getOptionalValue<float>(parser, "Continuation", "ds_max", continuationFlags.dsMax);
+    continuationFlags.history = getOptionalValue<int>(parser, "Continuation", "history", continuationFlags.history);
+    continuationFlags.order   = getOptionalValue<int>(parser, "Continuation", "order", continuationFlags.order);
+    continuationFlags.Ntarget = getOptionalValue<int>(parser, "Continuation", "Ntarget", continuationFlags.Ntarget);
+    const Real muMin = getOptionalValue<float>(parser, "Continuation", "mu_min", -1e30);
+    const Real muMax = getOptionalValue<float>(parser, "Continuation", "mu_max", 1e30);
+
+    // Events, checked every dT, on which the run stops early with a final
+    // checkpoint. -ke on the command line sets the laminarization threshold
+    // on the maximum pointwise u.u, timeintegration.py's max_ke_threshold.
+    FlowEvents events;
+    events.energyBelow = getOptionalValue<float>(parser, "Events", "energy_below", 0.0);
+    events.energyAbove = getOptionalValue<float>(parser, "Events", "energy_above", 0.0);
+    events.maxKEBelow  = getOptionalValue<float>(parser, "Events", "max_ke_below", 0.0);
+    const string ke = commandLineValue(argc, argv, "-ke", "");
+    if (!ke.empty())
+        events.maxKEBelow = atof(ke.c_str());
+    events.stallTol    = getOptionalValue<float>(parser, "Events", "stall_tol", 0.0);
+    events.stallWindow = getOptionalValue<int>(parser, "Events", "stall_window", 10);
+    events.crossing    = getOptionalValue<int>(parser, "Events", "crossing", 0) != 0;
+    events.crossingObservable = FlowEvents::parseObservable(
+        getOptionalValue<string>(parser, "Events", "crossing_observable", "dissipation"));
+    events.crossingLevel     = getOptionalValue<float>(parser, "Events", "crossing_level", 0.0);
+    events.crossingDirection = getOptionalValue<int>(parser, "Events", "crossing_direction", 0);
+    events.crossingCount     = getOptionalValue<int>(parser, "Events", "crossing_count", 0);
+
+    int T0 = 0;
+    const int T1 = parser.getValue<int>("Definitions", "T");
     //flags.t0    = T0;
 
     cout << "================================================================\n";
     cout << "This program integrates a plane Couette flow from a random\n";
-    cout << "initial condition at Re = " << Reynolds << " and for " << T1 << " time units.\n";
-    cout << "Velocity fields are saved at intervals dT=1.0 in a " << savingDir << "/ directory.\n";
+    cout << "initial condition at Re =";
+    for (size_t i = 0; i < ReList.size(); ++i)
+        cout << " " << ReList[i];
+    cout << " and for " << T1 << " time units.\n";
+    cout << "Velocity fields are saved at intervals dT=" << dT << " in a "
+         << (sweep ? string("data-<Re>") : savingDir) << "/ directory.\n";
     cout << "Domain size: " << LxPrefactor << "*pi X " << b - a << " X " << LzPrefactor << "*pi" << endl << endl;
 
     // Define size and smoothness of initial disturbance
@@ -83,66 +329,456 @@ int main()
         startFromState = true;
     }
 
-    // Construct data fields: 3d velocity and 1d pressure
-    cout << "building velocity and pressure fields..." << flush;
-    FlowField u;
-    FlowField q;
-    if (startFromState)
+    // A checkpoint written with state_interval continues the run exactly,
+    // multistep history and the events' state included
+    bool restart = false;
+    string stateFile = parser.getValue<string>("Initial conditions", "state_file", &err);
+    if (err == IniParser::ErrorCode::Success)
     {
-        u = FlowField(savingDir + "/" + uFile);
-        q = FlowField(u.Nx(), u.Ny(), u.Nz(), 1, u.Lx(), u.Lz(), u.a(), u.b());
+        restart = true;
+        startFromState = false;
     }
-    else
+
+    // An ensemble of members, from random initial fields or from U_file
+    // perturbed by a random field of relative size perturbation, integrated
+    // at Re together by EnsembleDNS on shared solvers, each member's output
+    // and events in savingDir/member<m>. dt follows the largest CFL number.
+    const int members = getOptionalValue<int>(parser, "Ensemble", "members", 0);
+    if (members > 0)
     {
-        u = FlowField(Nx,Ny,Nz,3,Lx,Lz,a,b);
-        q = FlowField(Nx,Ny,Nz,1,Lx,Lz,a,b);
+        if (sweep || restart || newtonSearch || implicitBaseflow || flags.movingFrame() || etdOrder != 0
+            || lowStorageRK || guard.snapshots > 0 || stateInterval > 0)
+            cferror("couette: an ensemble is SBDF3 at one Re, without Re_list, state_file, Newton search, "
+                    "implicit_baseflow, cx, cz, etd_order, low_storage_rk, guard_snapshots or state_interval");
+        const Real perturbation = getOptionalValue<float>(parser, "Ensemble", "perturbation", 1e-3);
+        const Real nu = 1.0/ReValues[0];
+        const Real dt0   = (dtErr == IniParser::ErrorCode::Success) ? dtGiven : 1.0/::floor(ReValues[0]);
+        const Real dtmin = getOptionalValue<float>(parser, "Time stepping", "dtmin", dt0);
+        const Real dtmax = getOptionalValue<float>(parser, "Time stepping", "dtmax", dt0);
+        TimeStep dt(dt0, dtmin, dtmax, dT, CFLmin, CFLmax, dtmin < dtmax);
+
+        cout << "building " << members << " ensemble members..." << flush;
+        channelflow::array<FlowField> u(members);
+        channelflow::array<FlowField> q(members);
+        vector<FlowEvents> memberEvents(members, events);
+        vector<string> memberDirs(members);
+        vector<bool> running(members, true);
+        mkdir(savingDir);
+        for (int m = 0; m < members; ++m)
+        {
+            if (startFromState)
+            {
+                u[m] = FlowField(savingDir + "/" + uFile);
+                FlowField du(u[m].Nx(), u[m].Ny(), u[m].Nz(), 3, u[m].Lx(), u[m].Lz(), u[m].a(), u[m].b());
+                du.addPerturbations(kxmax,kzmax,1.0,spectralDecay);
+                du *= perturbation*L2Norm(u[m])/L2Norm(du);
+                u[m].makeSpectral();
+                du.makeSpectral();
+                u[m] += du;
+            }
+            else
+            {
+                u[m] = FlowField(Nx,Ny,Nz,3,Lx,Lz,a,b);
+                u[m].addPerturbations(kxmax,kzmax,1.0,spectralDecay);
+                u[m] *= magnitude/L2Norm(u[m]);
+            }
+            u[m].makeSpectral();
+            if (symmetries.length() > 0)
+                SymmetryProjector(symmetries, u[m].Nx(), u[m].Nz())(u[m]);
+            q[m] = FlowField(u[m].Nx(), u[m].Ny(), u[m].Nz(), 1, u[m].Lx(), u[m].Lz(), u[m].a(), u[m].b());
+            memberDirs[m] = savingDir + "/member" + i2s(m);
+            mkdir(memberDirs[m]);
+        }
+        EnsembleDNS ensemble(u, baseflowProfile(flags.baseflow, u[0].Ny(), u[0].a(), u[0].b()),
+                             nu, dt, flags, T0);
+        cout << "done" << endl;
+
+        FlowField up;  // physical copy of a member for saving
+        for (int t = T0; t <= T1; t += dT)
+        {
+            if (dt.adjust(ensemble.CFL()))
+                ensemble.reset_dt(dt);
+            cout << "         t == " << t << endl;
+            cout << "   max CFL == " << ensemble.CFL() << endl;
+
+            bool anyRunning = false;
+            for (int m = 0; m < members; ++m)
+            {
+                if (!running[m])
+                    continue;
+                const FlowDiagnostics& diag = ensemble.diagnostics(m);
+                const string who = "member " + i2s(m) + ": ";
+                cout << who << "energy == " << diag.energy << ", dissip == " << diag.dissipation << endl;
+                up = u[m];
+                up.makePhysical();
+                if (!startFromState)
+                {
+                    up.save(memberDirs[m] + "/u" + i2s(t));
+                    q[m].save(memberDirs[m] + "/q" + i2s(t));
+                }
+                if (profiles)
+                    appendProfiles(up, t, memberDirs[m] + "/profiles.txt");
+                if (checkEvents(memberEvents[m], diag, memberDirs[m], "final_u", who))
+                {
+                    up.save(memberDirs[m] + "/final_u");
+                    running[m] = false;
+                    continue;
+                }
+                anyRunning = true;
+            }
+            cout << endl;
+            if (!anyRunning)
+                break;
+
+            // Stopped members are carried along, their output done
+            ensemble.advance(u, q, dt.n());
+        }
+        return 0;
     }
 
-    cout << "done" << endl;
-    
-    // Perturb velocity field
-    if (!startFromState)
+    // Construct data fields: 3d velocity and 1d pressure, one pair per Re
+    vector<Run*> runs;
+    for (size_t i = 0; i < ReList.size(); ++i)
     {
-        u.addPerturbations(kxmax,kzmax,1.0,spectralDecay);
-        u *= magnitude/L2Norm(u);
+        Run* r = new Run;
+        runs.push_back(r);
+        r->Re = ReList[i];
+        r->nu = 1.0/ReValues[i];
+        r->savingDir = sweep ? "data-" + r->Re : savingDir;
+        r->events = events;
+
+        const Real dt0   = (dtErr == IniParser::ErrorCode::Success) ? dtGiven : 1.0/::floor(ReValues[i]);
+        const Real dtmin = getOptionalValue<float>(parser, "Time stepping", "dtmin", dt0);
+        const Real dtmax = getOptionalValue<float>(parser, "Time stepping", "dtmax", dt0);
+        r->dt = TimeStep(dt0, dtmin, dtmax, dT, CFLmin, CFLmax, dtmin < dtmax);
+
+        cout << "building velocity and pressure fields";
+        if (sweep)
+            cout << " for Re = " << r->Re;
+        cout << "..." << flush;
+        FlowField& u = r->u;
+        if (restart)
+            u = FlowField(r->savingDir + "/" + stateFile + "_u.ff");
+        else if (startFromState)
+            u = FlowField(savingDir + "/" + uFile);
+        else
+            u = FlowField(Nx,Ny,Nz,3,Lx,Lz,a,b);
+        r->q = FlowField(u.Nx(), u.Ny(), u.Nz(), 1, u.Lx(), u.Lz(), u.a(), u.b());
+        cout << "done" << endl;
+
+        // Perturb velocity field
+        if (!startFromState && !restart)
+        {
+            u.addPerturbations(kxmax,kzmax,1.0,spectralDecay);
+            u *= magnitude/L2Norm(u);
+        }
+        if (symmetries.length() > 0)
+        {
+            u.makeSpectral();
+            SymmetryProjector(symmetries, u.Nx(), u.Nz())(u);
+        }
+
+        // Construct Navier-Stoke integrator, set integration method
+        cout << "building DNS..." << flush;
+        r->dns = new DNSExt(u, r->nu, r->dt.dt(), flags);
+        DNSExt& dns = *r->dns;
+        guard.dtmin = (guardDtmin > 0) ? guardDtmin : 1e-2*dtmin;
+        dns.setGuard(guard);
+        r->T0 = T0;
+        if (restart)
+        {
+            dns.loadState(r->savingDir + "/" + stateFile, u);
+            r->events.load(r->savingDir + "/" + stateFile);
+            r->T0 = iround(dns.time());
+            r->dt = TimeStep(dns.dt(), dtmin, dtmax, dT, CFLmin, CFLmax, dtmin < dtmax);
+            if (r->dt.dt() != dns.dt())
+                dns.reset_dt(r->dt);
+        }
+        r->t = r->T0;
+        r->active = r->T0 <= T1;
+        cout << "done" << endl;
+
+        r->ustates = new DualStateField(u);
+        mkdir(r->savingDir);
+    }
+
+    // Newton search from each run's initial field, saving the solution as
+    // ueqb (uorbit) and the search's outcome in newton.txt
+    for (size_t i = 0; newtonSearch && i < runs.size(); ++i)
+    {
+        Run& r = *runs[i];
+        cout << "Newton search";
+        if (sweep)
+            cout << " at Re = " << r.Re;
+        cout << ", T = " << newtonT << ", dt = " << newtonDt;
+        if (orbit)
+            cout << ", periodic orbit in " << segments << " segments";
+        cout << endl;
+
+        // A periodic orbit is converged by multiple shooting, and its
+        // multipliers are those of the time-T map through its first state
+        Real T = newtonT;
+        Real ax, az;
+        bool converged;
+        Real residual;
+        int iterations;
+        int evaluations;
+        Real dt = newtonDt;
+        Vector x;
+        const string solution = r.savingDir + (orbit ? "/uorbit" : "/ueqb");
+        if (orbit)
+        {
+            PeriodicOrbitProblem problem(r.u, r.nu, newtonT, newtonDt, segments, flags, xrel, zrel);
+            NewtonKrylov newton(newtonFlags, problem.size());
+            problem.toVector(r.u, newtonT, 0.0, 0.0, x);
+            converged = newton.solve(problem, x);
+            residual = newton.residual();
+            iterations = newton.iterations();
+            evaluations = problem.evaluations();
+            problem.toField(x, 0, r.u);
+            problem.parameters(x, T, ax, az);
+            dt = problem.dt(T);
+            r.u.save(solution);
+        }
+        else
+        {
+            EquilibriumProblem problem(r.u, r.nu, newtonT, newtonDt, flags, xrel, zrel);
+            NewtonKrylov newton(newtonFlags, problem.size());
+            problem.toVector(r.u, 0.0, 0.0, x);
+            converged = newton.solve(problem, x);
+            residual = newton.residual();
+            iterations = newton.iterations();
+            evaluations = problem.evaluations();
+            problem.toField(x, r.u, ax, az);
+            r.u.save(solution);
+        }
+        ofstream os((r.savingDir + "/newton.txt").c_str());
+        os << setprecision(17)
+           << "converged " << converged << endl
+           << "residual " << residual << endl
+           << "iterations " << iterations << endl
+           << "evaluations " << evaluations << endl
+           << "T " << T << endl
+           << "ax " << ax << endl
+           << "az " << az << endl
+           << "cx " << -ax*Lx/T << endl
+           << "cz " << -az*Lz/T << endl;
+        if (orbit)
+            os << "segments " << segments << endl;
+        cout << (converged ? "converged" : "not converged") << ", |G| == " << residual;
+        if (orbit)
+            cout << ", T == " << T;
+        cout << ", saved " << solution << endl;
+
+        // Leading multipliers lambda = exp((sigma + i omega) T) of the
+        // solution, in eigenvalues.txt, and their eigenfunctions as ef1, ef2,
+        // ..., the real and imaginary parts of a complex pair's in turn
+        if (arnoldiFlags.Neig > 0)
+        {
+            EquilibriumProblem problem(r.u, r.nu, T, dt, flags, xrel, zrel);
+            Vector xT;
+            problem.toVector(r.u, ax, az, xT);
+            LinearizedMap map(problem, xT);
+            BlockArnoldi arnoldi(arnoldiFlags, map.size());
+            arnoldi.solve(map);
+            ofstream es((r.savingDir + "/eigenvalues.txt").c_str());
+            es << setprecision(17) << "# j Re(lambda) Im(lambda) |lambda| sigma omega residual" << endl;
+            FlowField ef(r.u);
+            for (int j = 0; j < arnoldi.number(); ++j)
+            {
+                const Complex lambda = arnoldi.eigenvalue(j);
+                es << j+1 << ' ' << Re(lambda) << ' ' << Im(lambda) << ' ' << abs(lambda) << ' '
+                   << log(abs(lambda))/T << ' ' << arg(lambda)/T << ' '
+                   << arnoldi.residual(j) << endl;
+                problem.packing().unpack(arnoldi.eigenvector(j), ef);
+                ef.save(r.savingDir + "/ef" + i2s(j+1));
+            }
+            cout << "saved " << arnoldi.number() << " eigenvalues to " << r.savingDir
+                 << "/eigenvalues.txt" << endl;
+        }
+
+        // The solution's branch, one line per point in branch.txt, with the
+        // last point saved as ubranch. The family has the search's grid,
+        // T and dt, so that x is already its first point.
+        if (converged && continuationSteps > 0)
+        {
+            SolutionFamily family(r.u, 1.0/r.nu, newtonT, newtonDt, flags, continuationParameter,
+                                  xrel, zrel, orbit ? segments : 0);
+            Continuation continuation(family, continuationFlags, newtonFlags);
+            continuation.start(x, family.parameter());
+            const ChebyCoeff Ubase = baseflowProfile(flags.baseflow, r.u.Ny(), r.u.a(), r.u.b());
+            ofstream bs((r.savingDir + "/branch.txt").c_str());
+            bs << setprecision(17)
+               << "# n mu arclength L2Norm dissipation T ax az residual iterations applications" << endl;
+            FlowField u;
+            for (int n = 0; n <= continuationSteps; ++n)
+            {
+                if (n > 0 && !continuation.step())
+                    break;
+                family.toField(continuation.x(), continuation.mu(), u);
+                family.parameters(continuation.x(), T, ax, az);
+                FlowDiagnostics d;
+                diagnose(u, Ubase, d);
+                bs << n << ' ' << continuation.mu() << ' ' << continuation.arclength() << ' '
+                   << sqrt(d.L2Norm2[0] + d.L2Norm2[1] + d.L2Norm2[2]) << ' ' << d.dissipation << ' '
+                   << T << ' ' << ax << ' ' << az << ' ' << continuation.residual() << ' '
+                   << continuation.iterations() << ' ' << continuation.applications() << endl;
+                if (continuation.mu() < muMin || continuation.mu() > muMax)
+                    break;
+            }
+            u.save(r.savingDir + "/ubranch");
+            cout << "continued " << continuation.points() << " points to mu == "
+                 << continuation.mu() << ", saved " << r.savingDir << "/branch.txt" << endl;
+        }
+        r.active = false;
     }
 
-    // Construct Navier-Stoke integrator, set integration method
-    cout << "building DNS..." << flush;
-    DNS dns(u, nu, dt, flags);
-    cout << "done" << endl;
-    
-    mkdir(savingDir);
     //fstream u_file("u_norms", ios_base::out);
     //fstream v_file("v_norms", ios_base::out);
     //fstream w_file("w_norms", ios_base::out);
     //fstream ke_file("ke", ios_base::out);
-    for (Real t = T0; t <= T1; t += n*dt)
+    // Each pass takes every active run one dT interval: its output and
+    // events at t in turn, then the advance of all runs at once, then their
+    // rollback records and checkpoints in turn. The runs of a sweep advance
+    // concurrently, the threads divided among them (nested OpenMP), whatever
+    // their algorithm, as FFTW planning is serialized by threadSafePlanning.
+    for (bool active = !newtonSearch; active; )
     {
-        cout << "         t == " << t << endl;
-        cout << "       CFL == " << dns.CFL() << endl;
-        cout << " L2Norm(u) == " << L2Norm(u[0]) << endl;
-        cout << " L2Norm(v) == " << L2Norm(u[1]) << endl;
-        cout << " L2Norm(w) == " << L2Norm(u[2]) << endl;
-        cout << "divNorm(u) == " << divNorm(u) << endl;
-        cout << "      dPdx == " << dns.dPdx() << endl;
-        cout << "     Ubulk == " << dns.Ubulk() << endl;
-        
-        //u_file << L2Norm(u[0]) << ",";
-        //v_file << L2Norm(u[1]) << ",";
-        //w_file << L2Norm(u[2]) << ",";
-        //ke_file << L2Norm(u[0])*L2Norm(u[0]) + L2Norm(u[1])*L2Norm(u[1]) + L2Norm(u[2])*L2Norm(u[2]) << ",";
-        // Write velocity and modified pressure fields to disk
-        if (!startFromState)
+        active = false;
+        vector<Run*> stepping;
+        for (size_t i = 0; i < runs.size(); ++i)
         {
-            u.makePhysical();
-            u.save(savingDir + "/u"+i2s(int(t)));
-            q.save(savingDir + "/q"+i2s(int(t)));
-            u.makeSpectral();
+            Run& r = *runs[i];
+            if (!r.active)
+                continue;
+            const int t = r.t;
+            const string& savingDir = r.savingDir;
+            DNSExt& dns = *r.dns;
+            DualStateField& ustates = *r.ustates;
+            TimeStep& dt = r.dt;
+            FlowEvents& events = r.events;
+            FlowField& q = r.q;
+
+            // Keep the CFL number in range, as measured on the current u
+            if (dt.adjust(dns.CFL()))
+                dns.reset_dt(dt);
+
+            // Diagnostics of u, computed along with the last nonlinear term
+            const FlowDiagnostics& diag = dns.diagnostics();
+            if (sweep)
+                cout << "        Re == " << r.Re << endl;
+            cout << "         t == " << t << endl;
+            cout << "       CFL == " << dns.CFL() << endl;
+            cout << " L2Norm(u) == " << sqrt(diag.L2Norm2[0]) << endl;
+            cout << " L2Norm(v) == " << sqrt(diag.L2Norm2[1]) << endl;
+            cout << " L2Norm(w) == " << sqrt(diag.L2Norm2[2]) << endl;
+            cout << "divNorm(u) == " << sqrt(diag.divNorm2) << endl;
+            cout << "    energy == " << diag.energy << endl;
+            cout << "    dissip == " << diag.dissipation << endl;
+            cout << "      dPdx == " << dns.dPdx() << endl;
+            cout << "     Ubulk == " << dns.Ubulk() << endl;
+            
+            //u_file << L2Norm(u[0]) << ",";
+            //v_file << L2Norm(u[1]) << ",";
+            //w_file << L2Norm(u[2]) << ",";
+            //ke_file << L2Norm(u[0])*L2Norm(u[0]) + L2Norm(u[1])*L2Norm(u[1]) + L2Norm(u[2])*L2Norm(u[2]) << ",";
+            // Write velocity and modified pressure fields to disk
+            if (!startFromState)
+            {
+                ustates.physical().save(savingDir + "/u"+i2s(t));
+                q.save(savingDir + "/q"+i2s(t));
+            }
+            if (profiles)
+                appendProfiles(ustates.physical(), t, savingDir + "/profiles.txt");
+            
+            // Stop on an event, leaving the final state and a record of it
+            if (checkEvents(events, diag, savingDir, "final", ""))
+            {
+                dns.saveState(savingDir + "/final", ustates.field());
+                events.save(savingDir + "/final");
+                r.active = false;
+                continue;
+            }
+
+            cout << endl;
+            stepping.push_back(&r);
         }
-        
+
         // Take n steps of length dt
-        dns.advance(u, q, n);
-        cout << endl;
+        const int R = stepping.size();
+        vector<int> rollbacks(R);
+        for (int k = 0; k < R; ++k)
+            rollbacks[k] = stepping[k]->dns->rollbacks();
+        const int outer = std::min(R, omp_get_max_threads());
+        if (outer > 1)
+        {
+            const int inner = std::max(1, omp_get_max_threads()/outer);
+            const int levels = omp_get_max_active_levels();
+            if (inner > 1)
+                omp_set_max_active_levels(2);
+#pragma omp parallel for schedule(dynamic,1) num_threads(outer)
+            for (int k = 0; k < R; ++k)
+            {
+                omp_set_num_threads(inner);
+                Run& r = *stepping[k];
+                r.dns->advance(r.ustates->modify(), r.q, r.dt.n());
+            }
+            omp_set_max_active_levels(levels);
+        }
+        else
+            for (int k = 0; k < R; ++k)
+            {
+                Run& r = *stepping[k];
+                r.dns->advance(r.ustates->modify(), r.q, r.dt.n());
+            }
+
+        for (int k = 0; k < R; ++k)
+        {
+            Run& r = *stepping[k];
+            const int t = r.t;
+            const string& savingDir = r.savingDir;
+            DNSExt& dns = *r.dns;
+            DualStateField& ustates = *r.ustates;
+            TimeStep& dt = r.dt;
+            if (dns.rollbacks() != rollbacks[k])
+            {
+                if (sweep)
+                    cout << "        Re == " << r.Re << endl;
+
+                // Continue from the dt the guard fell back to, within the
+                // configured dtmax, so that the CFL control can grow it again
+                cout << "blow-up guard: rolled back " << dns.rollbacks() - rollbacks[k]
+                     << " time(s) to t == " << dns.restartTime() << ", dt == " << dns.dt() << endl;
+                dt = TimeStep(dns.dt(), std::min(dt.dtmin(), dns.dt()), dt.dtmax(), dT, CFLmin, CFLmax, dt.variable());
+                if (dt.dt() != dns.dt())
+                    dns.reset_dt(dt);
+
+                // A rollback into earlier intervals discards the trajectory
+                // their u, q, crossings and events came from; rollbacks.txt
+                // marks the range of those outputs, t0 < t <= t1
+                const bool stale = dns.restartTime() < t - 0.5*dns.dt();
+                ofstream os((savingDir + "/rollbacks.txt").c_str(), ios_base::app);
+                os << setprecision(17) << dns.restartTime() << ' ' << t + dT << ' ' << dns.dt();
+                if (stale)
+                    os << " stale " << dns.restartTime() << ' ' << t;
+                os << endl;
+                if (stale)
+                    cout << "blow-up guard: outputs after t == " << dns.restartTime() << " up to t == " << t
+                         << " are from the discarded trajectory, see rollbacks.txt" << endl;
+                cout << endl;
+            }
+            if (stateInterval > 0 && ((t - r.T0)/dT + 1) % stateInterval == 0)
+            {
+                dns.saveState(savingDir + "/state", ustates.field());
+                r.events.save(savingDir + "/state");
+            }
+
+            r.t += dT;
+            r.active = r.t <= T1;
+            active = active || r.active;
+        }
     }
+
+    for (size_t i = 0; i < runs.size(); ++i)
+        delete runs[i];
 }